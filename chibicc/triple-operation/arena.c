@@ -0,0 +1,118 @@
+// This file implements region-based memory allocation.
+//
+// Objects that die together are allocated from the same arena by
+// bumping a pointer through large chunks, and the whole arena is
+// released at once by arena_reset(). There is no way to free a single
+// object, which matches how a compiler uses its data structures: they
+// are built up during one phase and dropped when the phase is done.
+//
+// Chunks are zero-filled when they are obtained, so arena_alloc()
+// returns zeroed memory like calloc().
+
+#include "chibicc.h"
+
+#define CHUNK_SIZE (64 * 1024)
+
+// Nothing the compiler allocates needs more than pointer alignment.
+#define ALIGN 8
+
+struct ArenaChunk {
+  ArenaChunk *next;
+  size_t size;
+  char data[];
+};
+
+Arena lex_arena = {"lex"};
+Arena scope_arena = {"scope"};
+Arena ast_arena = {"ast"};
+Arena fn_arena = {"fn"};
+
+static Arena *arenas[] = {&lex_arena, &scope_arena, &ast_arena, &fn_arena};
+
+static ArenaChunk *new_chunk(Arena *a, size_t size) {
+  ArenaChunk *c = calloc(1, sizeof(ArenaChunk) + size);
+  if (!c)
+    error("out of memory");
+  c->size = size;
+
+  a->reserved += size;
+  if (a->reserved > a->peak)
+    a->peak = a->reserved;
+  return c;
+}
+
+void *arena_alloc(Arena *a, size_t size) {
+  size = (size + ALIGN - 1) & ~(size_t)(ALIGN - 1);
+  a->nallocs++;
+  a->used += size;
+
+  if (size <= a->end - a->cur) {
+    void *p = a->cur;
+    a->cur += size;
+    return p;
+  }
+
+  // A large object gets a chunk of its own, which is put behind the
+  // current chunk so that the rest of the current chunk is not wasted.
+  if (size > CHUNK_SIZE / 4) {
+    ArenaChunk *c = new_chunk(a, size);
+    if (a->chunks) {
+      c->next = a->chunks->next;
+      a->chunks->next = c;
+    } else {
+      a->chunks = c;
+    }
+    return c->data;
+  }
+
+  ArenaChunk *c = new_chunk(a, CHUNK_SIZE);
+  c->next = a->chunks;
+  a->chunks = c;
+  a->cur = c->data + size;
+  a->end = c->data + CHUNK_SIZE;
+  return c->data;
+}
+
+// Frees everything allocated from `a`. The arena can be used again.
+void arena_reset(Arena *a) {
+  for (ArenaChunk *c = a->chunks, *next; c; c = next) {
+    next = c->next;
+    free(c);
+  }
+  a->chunks = NULL;
+  a->cur = a->end = NULL;
+  a->reserved = 0;
+  a->nresets++;
+}
+
+// Like arena_reset(), but keeps the current chunk for the allocations
+// that follow, which saves going back to malloc() for an arena that is
+// reset over and over. Only the part of the chunk that was handed out
+// needs to be zeroed again.
+void arena_rewind(Arena *a) {
+  ArenaChunk *c = a->chunks;
+  if (!c || a->end != c->data + c->size) {
+    arena_reset(a);
+    return;
+  }
+
+  for (ArenaChunk *d = c->next, *next; d; d = next) {
+    next = d->next;
+    free(d);
+  }
+  memset(c->data, 0, a->cur - c->data);
+  c->next = NULL;
+  a->cur = c->data;
+  a->reserved = c->size;
+  a->nresets++;
+}
+
+void print_arena_stats(FILE *out) {
+  fprintf(out, "%-8s %10s %12s %12s %12s %7s\n",
+          "arena", "allocs", "bytes", "reserved", "peak", "resets");
+  for (int i = 0; i < sizeof(arenas) / sizeof(*arenas); i++) {
+    Arena *a = arenas[i];
+    fprintf(out, "%-8s %10zu %12zu %12zu %12zu %7d\n",
+            a->name, a->nallocs, a->used, a->reserved, a->peak, a->nresets);
+  }
+}
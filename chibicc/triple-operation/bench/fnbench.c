@@ -0,0 +1,100 @@
+// Measures how peak memory grows with the number of functions.
+//
+//   bench/fnbench [ <functions> ]
+//
+// For N functions (20000 by default) and N/8, N/4 and N/2, a program is
+// generated whose functions all have the same body: locals, loops, a
+// switch, string literals and calls. Each function is compiled as soon
+// as it is parsed, and its nodes and locals are freed before the next
+// one, so the peak of the function arena should not depend on N. The
+// process's peak RSS still grows with the size of the file, whose
+// tokens stay in memory, but by much less than the ASTs of all the
+// functions would take. Every run happens in a fresh child process.
+
+#include "../chibicc.h"
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+
+typedef struct {
+  double time;
+  size_t fn_peak;
+  size_t ast_peak;
+} Result;
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char *generate(int n) {
+  static char path[] = "/tmp/chibicc-fnbench-XXXXXX";
+  strcpy(path + strlen(path) - 6, "XXXXXX");
+  int fd = mkstemp(path);
+  if (fd < 0)
+    error("mkstemp: %s", strerror(errno));
+
+  FILE *out = fdopen(fd, "w");
+  fprintf(out, "int printf();\nint g;\n");
+  for (int i = 0; i < n; i++) {
+    fprintf(out,
+            "int f%d(int x, int y) {\n"
+            "  int a[8]; int s = 0;\n"
+            "  for (int i = 0; i < 8; i++) a[i] = x * i + y;\n"
+            "  while (s < 100) { s = s + a[s %% 8]; if (s > 50) break; }\n"
+            "  switch (x) { case 0: s++; break; case 1: s--; default: s = s * 2; }\n"
+            "  char *p = \"f%d\"; g = g + p[0];\n"
+            "  return s + ({ int t = x << 2; t ^ y; }) + %d;\n"
+            "}\n",
+            i, i, i);
+  }
+  fclose(out);
+  return path;
+}
+
+// Compiles `path` in a child process and reports its peak RSS in kB.
+static Result run_once(char *path, long *maxrss) {
+  int fds[2];
+  if (pipe(fds) < 0)
+    error("pipe: %s", strerror(errno));
+
+  pid_t pid = fork();
+  if (pid == 0) {
+    FILE *out = fopen("/dev/null", "w");
+    double start = now();
+    Token *tok = tokenize_file(path);
+    Var *prog = parse(tok, out);
+    codegen_data(prog, out);
+    Result r = {now() - start, fn_arena.peak, ast_arena.peak};
+    write(fds[1], &r, sizeof(r));
+    _exit(0);
+  }
+
+  Result r;
+  if (read(fds[0], &r, sizeof(r)) != sizeof(r))
+    error("benchmark child failed");
+
+  int status;
+  struct rusage ru;
+  wait4(pid, &status, 0, &ru);
+  *maxrss = ru.ru_maxrss;
+  close(fds[0]);
+  close(fds[1]);
+  return r;
+}
+
+int main(int argc, char **argv) {
+  int max = argc > 1 ? atoi(argv[1]) : 20000;
+
+  printf("%10s %10s %10s %10s %10s\n", "functions", "time", "fn peak", "ast peak", "max rss");
+  for (int n = max / 8; n <= max; n *= 2) {
+    char *path = generate(n);
+    long maxrss;
+    Result r = run_once(path, &maxrss);
+    unlink(path);
+    printf("%10d %9.3fs %7zu kB %7zu kB %7ld kB\n",
+           n, r.time, r.fn_peak / 1024, r.ast_peak / 1024, maxrss);
+  }
+  return 0;
+}
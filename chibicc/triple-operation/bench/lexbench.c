@@ -0,0 +1,106 @@
+// Measures tokenizer throughput.
+//
+//   bench/lexbench [ <file> | -s <megabytes> ]
+//
+// Without a file, a synthetic program of the given size (8 MB by
+// default) is generated first. The input is tokenized a few times and
+// the best run is reported in MB/s. Every run happens in a fresh child
+// process, since the tokenizer never frees its memory and a growing heap
+// would penalize the later runs.
+
+#include "../chibicc.h"
+#include <sys/wait.h>
+#include <time.h>
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char *generate(size_t size) {
+  static char path[] = "/tmp/chibicc-lexbench-XXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0)
+    error("mkstemp: %s", strerror(errno));
+
+  FILE *out = fdopen(fd, "w");
+  for (int i = 0; ftell(out) < size; i++) {
+    fprintf(out,
+            "/* generated function number %d, with a comment long enough\n"
+            " * to matter for the comment scanner */\n"
+            "int compute_something_%d(int first_argument, int second_argument) {\n"
+            "  int intermediate_value = first_argument + second_argument + %d;\n"
+            "  printf(\"value of intermediate_value at step %d: %%d\\n\", intermediate_value);\n"
+            "  // subtract one from large values\n"
+            "  if (intermediate_value > 100)\n"
+            "    return intermediate_value - 1;\n"
+            "  return intermediate_value;\n"
+            "}\n\n",
+            i, i, i, i);
+  }
+  fclose(out);
+  return path;
+}
+
+// Tokenizes `path` in a child process and returns the elapsed time.
+static double run_once(char *path) {
+  int fds[2];
+  if (pipe(fds) < 0)
+    error("pipe: %s", strerror(errno));
+
+  pid_t pid = fork();
+  if (pid == 0) {
+    double start = now();
+    tokenize_file(path);
+    double t = now() - start;
+    write(fds[1], &t, sizeof(t));
+    _exit(0);
+  }
+
+  double t;
+  if (read(fds[0], &t, sizeof(t)) != sizeof(t))
+    error("benchmark child failed");
+  waitpid(pid, NULL, 0);
+  close(fds[0]);
+  close(fds[1]);
+  return t;
+}
+
+static double run(char *path, size_t size) {
+  double best = 0;
+  for (int i = 0; i < 3; i++) {
+    double mbs = size / run_once(path) / 1e6;
+    if (mbs > best)
+      best = mbs;
+  }
+  return best;
+}
+
+int main(int argc, char **argv) {
+  size_t size = 8 << 20;
+  char *path = NULL;
+
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-s") && argv[i + 1])
+      size = (size_t)atoi(argv[++i]) << 20;
+    else
+      path = argv[i];
+  }
+
+  bool generated = !path;
+  if (generated)
+    path = generate(size);
+
+  struct stat st;
+  if (stat(path, &st) < 0)
+    error("cannot stat %s: %s", path, strerror(errno));
+  size = st.st_size;
+
+  printf("input: %s (%.1f MB)\n", path, size / 1e6);
+  printf("%8.1f MB/s\n", run(path, size));
+
+  if (generated)
+    unlink(path);
+  return 0;
+}
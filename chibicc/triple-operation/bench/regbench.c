@@ -0,0 +1,162 @@
+// Compares the code generated at -O0 and -O1.
+//
+//   bench/regbench
+//
+// Each program below is compiled at both levels, assembled and linked
+// with cc, and run. The table shows how many instructions were emitted,
+// how many of them access the stack frame, and how long the program
+// took. The programs are dominated by loops over local variables, which
+// -O0 loads and stores on every use and -O1 keeps in registers. Both
+// builds must exit with the same status.
+
+#include "../chibicc.h"
+#include <sys/wait.h>
+#include <time.h>
+
+static char *programs[][2] = {
+  {"loops",
+   "int main() {\n"
+   "  int s = 0;\n"
+   "  for (int i = 0; i < 30000; i++)\n"
+   "    for (int j = 0; j < 1000; j++)\n"
+   "      s = s + (i ^ j) * 3 - (j >> 2);\n"
+   "  return s & 127;\n"
+   "}\n"},
+  {"sieve",
+   "char flags[100000];\n"
+   "int main() {\n"
+   "  int count = 0;\n"
+   "  for (int k = 0; k < 200; k++) {\n"
+   "    count = 0;\n"
+   "    for (int i = 2; i < 100000; i++) flags[i] = 1;\n"
+   "    for (int i = 2; i < 100000; i++) {\n"
+   "      if (!flags[i]) continue;\n"
+   "      count++;\n"
+   "      for (int j = i + i; j < 100000; j = j + i) flags[j] = 0;\n"
+   "    }\n"
+   "  }\n"
+   "  return count & 127;\n"
+   "}\n"},
+  {"fib",
+   "int fib(int n) { if (n < 2) return n; return fib(n - 1) + fib(n - 2); }\n"
+   "int main() { return fib(32) & 127; }\n"},
+  {"collatz",
+   "long steps(long n) {\n"
+   "  long k = 0;\n"
+   "  while (n != 1) { if (n % 2) n = 3 * n + 1; else n = n / 2; k++; }\n"
+   "  return k;\n"
+   "}\n"
+   "int main() {\n"
+   "  long best = 0;\n"
+   "  for (long i = 1; i < 1000000; i++) { long s = steps(i); if (s > best) best = s; }\n"
+   "  return best & 127;\n"
+   "}\n"},
+};
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int wait_for(pid_t pid) {
+  int status;
+  waitpid(pid, &status, 0);
+  return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+// Compiles `src` at `level` in a child process and counts what it emitted.
+static void compile(char *src, int level, char *asm_path, int *insns, int *frame_refs) {
+  char c_path[] = "/tmp/chibicc-regbench-XXXXXX";
+  int fd = mkstemp(c_path);
+  if (fd < 0)
+    error("mkstemp: %s", strerror(errno));
+  write(fd, src, strlen(src));
+  close(fd);
+
+  pid_t pid = fork();
+  if (pid == 0) {
+    opt_level = level;
+    FILE *out = fopen(asm_path, "w");
+    fprintf(out, ".file 1 \"%s\"\n", c_path);
+    Token *tok = tokenize_file(c_path);
+    Var *prog = parse(tok, out);
+    codegen_data(prog, out);
+    fclose(out);
+    _exit(0);
+  }
+  if (wait_for(pid) != 0)
+    error("cannot compile the benchmark");
+  unlink(c_path);
+
+  *insns = *frame_refs = 0;
+  FILE *in = fopen(asm_path, "r");
+  char line[256];
+  while (fgets(line, sizeof(line), in)) {
+    if (line[0] != ' ' || line[2] == '.')
+      continue;
+    (*insns)++;
+    if (strstr(line, "(%rbp)") || strstr(line, "push %rax") || strstr(line, "pop %r"))
+      (*frame_refs)++;
+  }
+  fclose(in);
+}
+
+// Assembles `asm_path`, runs it and returns its exit status.
+static int run(char *asm_path, double *time) {
+  char exe_path[] = "/tmp/chibicc-regbench-XXXXXX";
+  int fd = mkstemp(exe_path);
+  if (fd < 0)
+    error("mkstemp: %s", strerror(errno));
+  close(fd);
+
+  pid_t pid = fork();
+  if (pid == 0) {
+    execlp("cc", "cc", "-o", exe_path, asm_path, NULL);
+    _exit(127);
+  }
+  if (wait_for(pid) != 0)
+    error("cannot assemble the benchmark");
+
+  double start = now();
+  pid = fork();
+  if (pid == 0) {
+    execl(exe_path, exe_path, NULL);
+    _exit(127);
+  }
+  int status = wait_for(pid);
+  *time = now() - start;
+  unlink(exe_path);
+  return status;
+}
+
+int main(int argc, char **argv) {
+
+  printf("%-8s %9s %9s %9s %9s %8s %8s %7s\n", "program", "insns O0", "insns O1",
+         "frame O0", "frame O1", "time O0", "time O1", "speedup");
+
+  for (int i = 0; i < sizeof(programs) / sizeof(*programs); i++) {
+    int insns[2], frame_refs[2], status[2];
+    double time[2];
+
+    for (int level = 0; level < 2; level++) {
+      char asm_path[] = "/tmp/chibicc-regbench-XXXXXX.s";
+      int fd = mkstemps(asm_path, 2);
+      if (fd < 0)
+        error("mkstemp: %s", strerror(errno));
+      close(fd);
+
+      compile(programs[i][1], level, asm_path, &insns[level], &frame_refs[level]);
+      status[level] = run(asm_path, &time[level]);
+      unlink(asm_path);
+    }
+
+    if (status[0] != status[1])
+      error("%s: exit status %d at -O0 but %d at -O1", programs[i][0], status[0], status[1]);
+
+    printf("%-8s %9d %9d %9d %9d %7.3fs %7.3fs %6.2fx\n", programs[i][0],
+           insns[0], insns[1], frame_refs[0], frame_refs[1],
+           time[0], time[1], time[0] / time[1]);
+  }
+  return 0;
+}
@@ -0,0 +1,84 @@
+// Measures how parsing time grows with the number of file-scope names.
+//
+//   bench/scopebench [ <globals> ]
+//
+// For N globals (100000 by default) and N/8, N/4 and N/2, a program is
+// generated that declares N global variables, enum constants, typedefs
+// and functions, where every function refers to names declared before
+// it. Only parse() is timed. If name lookup is constant time, the time
+// per global stays flat as N grows; if lookups walk every earlier
+// declaration, it grows with N. Every run happens in a fresh child
+// process.
+
+#include "../chibicc.h"
+#include <sys/wait.h>
+#include <time.h>
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char *generate(int n) {
+  static char path[] = "/tmp/chibicc-scopebench-XXXXXX";
+  strcpy(path + strlen(path) - 6, "XXXXXX");
+  int fd = mkstemp(path);
+  if (fd < 0)
+    error("mkstemp: %s", strerror(errno));
+
+  FILE *out = fdopen(fd, "w");
+  for (int i = 0; i < n; i++) {
+    fprintf(out,
+            "int g%d;\n"
+            "enum e%d { c%d = %d };\n"
+            "typedef int t%d;\n"
+            "t%d f%d() { t%d x = g%d + c%d; return x + g%d; }\n",
+            i, i, i, i, i, i, i, i, i, i, i / 2);
+  }
+  fclose(out);
+  return path;
+}
+
+// Parses `path` in a child process and returns the elapsed time.
+static double run_once(char *path) {
+  int fds[2];
+  if (pipe(fds) < 0)
+    error("pipe: %s", strerror(errno));
+
+  pid_t pid = fork();
+  if (pid == 0) {
+    Token *tok = tokenize_file(path);
+    double start = now();
+    parse(tok, NULL);
+    double t = now() - start;
+    write(fds[1], &t, sizeof(t));
+    _exit(0);
+  }
+
+  double t;
+  if (read(fds[0], &t, sizeof(t)) != sizeof(t))
+    error("benchmark child failed");
+  waitpid(pid, NULL, 0);
+  close(fds[0]);
+  close(fds[1]);
+  return t;
+}
+
+int main(int argc, char **argv) {
+  int max = argc > 1 ? atoi(argv[1]) : 100000;
+
+  printf("%10s %10s %14s\n", "globals", "parse", "per global");
+  for (int n = max / 8; n <= max; n *= 2) {
+    char *path = generate(n);
+    double best = 1e9;
+    for (int i = 0; i < 3; i++) {
+      double t = run_once(path);
+      if (t < best)
+        best = t;
+    }
+    unlink(path);
+    printf("%10d %9.3fs %11.2f us\n", n, best, best / n * 1e6);
+  }
+  return 0;
+}
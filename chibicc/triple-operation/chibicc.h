@@ -1,14 +1,20 @@
 #define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE // MAP_ANONYMOUS
 #include <assert.h>
 #include <ctype.h>
 #include <errno.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 typedef struct Type Type;
 typedef struct Node Node;
@@ -27,11 +33,35 @@ typedef enum {
   TK_EOF,      // End-of-file markers
 } TokenKind;
 
+// Keywords. The tokenizer classifies every identifier once, so the
+// parser can switch on `tok->kw` instead of comparing strings.
+typedef enum {
+  KW_NONE,
+  KW_RETURN, KW_IF, KW_ELSE, KW_FOR, KW_WHILE, KW_INT, KW_SIZEOF, KW_CHAR,
+  KW_STRUCT, KW_UNION, KW_SHORT, KW_LONG, KW_VOID, KW_TYPEDEF, KW_BOOL,
+  KW_ENUM, KW_STATIC, KW_GOTO, KW_BREAK, KW_CONTINUE, KW_SWITCH, KW_CASE,
+  KW_DEFAULT,
+} Keyword;
+
+// Interned identifier. There is one Symbol per distinct spelling, see
+// symbol.c.
+typedef struct Symbol Symbol;
+struct Symbol {
+  char *name;     // NUL-terminated spelling
+  int len;
+  uint32_t hash;
+  Keyword kw;     // Keyword id, KW_NONE otherwise
+};
+
 // Token type
+//
+// A file's tokens are stored contiguously and end with TK_EOF, so the
+// token after `tok` is `tok + 1`.
 typedef struct Token Token;
 struct Token {
   TokenKind kind; // Token kind
-  Token *next;    // Next token
+  Keyword kw;     // Keyword id if kind is TK_RESERVED
+  Symbol *sym;    // Identifiers and keywords only
   int64_t val;    // If kind is TK_NUM, its value
   char *loc;      // Token location
   int len;        // Token length
@@ -43,8 +73,10 @@ struct Token {
 
 void error(char *fmt, ...);
 void error_at(char *loc, char *fmt, ...);
+void get_line_col(char *loc, int *line_no, int *col_no);
 void error_tok(Token *tok, char *fmt, ...);
 void warn_tok(Token *tok, char *fmt, ...);
+Keyword find_keyword(char *p, int len);
 bool equal(Token *tok, char *op);
 Token *skip(Token *tok, char *op);
 bool consume(Token **rest, Token *tok, char *str);
@@ -53,6 +85,75 @@ Token *tokenize_file(char *filename);
 #define unreachable() \
   error("internal error at %s:%d", __FILE__, __LINE__)
 
+//
+// arena.c
+//
+
+typedef struct ArenaChunk ArenaChunk;
+
+// A region of memory that is freed all at once.
+typedef struct {
+  char *name;
+  ArenaChunk *chunks;
+  char *cur;
+  char *end;
+
+  // Statistics
+  size_t nallocs;
+  size_t used;
+  size_t reserved;
+  size_t peak;
+  int nresets;
+} Arena;
+
+extern Arena lex_arena;   // Symbols and string literals
+extern Arena scope_arena; // File scope, freed when parsing is done
+extern Arena ast_arena;   // Globals, types and members
+extern Arena fn_arena;    // Nodes, locals and block scopes of the
+                          // function being compiled
+
+void *arena_alloc(Arena *a, size_t size);
+void arena_reset(Arena *a);
+void arena_rewind(Arena *a);
+void print_arena_stats(FILE *out);
+
+//
+// scan.c
+//
+
+bool is_ident1(char c);
+bool is_ident2(char c);
+char *skip_space(char *p);
+char *skip_ident(char *p);
+char *skip_line(char *p);
+char *skip_comment(char *p);
+char *skip_str(char *p);
+
+//
+// symbol.c
+//
+
+Symbol *intern(char *s, int len);
+
+//
+// hashmap.c
+//
+
+typedef struct {
+  void *key;
+  void *val;
+} HashEntry;
+
+typedef struct {
+  HashEntry *buckets;
+  int capacity;
+  int used;
+  Arena *arena; // Where the buckets come from
+} HashMap;
+
+void *hashmap_get(HashMap *map, void *key);
+void hashmap_put(HashMap *map, void *key, void *val);
+
 //
 // parse.c
 //
@@ -67,6 +168,7 @@ struct Var {
 
   // Local variable
   int offset;
+  int vreg;      // Virtual register at -O1, or -1 if it lives in memory
 
   // Global variable or function
   bool is_function;
@@ -126,55 +228,75 @@ typedef enum {
 } NodeKind;
 
 // AST node type
+//
+// The fields after the header depend on the node kind and share
+// storage. A node is allocated only as large as its kind needs, so it
+// must be accessed only through the fields of its own kind.
 struct Node {
   NodeKind kind; // Node kind
   Node *next;    // Next node
   Type *ty;      // Type, e.g. int or pointer to int
   Token *tok;    // Representative token
 
-  Node *lhs;     // Left-hand side
-  Node *rhs;     // Right-hand side
-
-  // "if" or "for" statement
-  Node *cond;
-  Node *then;
-  Node *els;
-  Node *init;
-  Node *inc;
-
-  // "break" and "continue" labels
-  char *brk_label;
-  char *cont_label;
-
-  // Block or statement expression
-  Node *body;
-
-  // Struct member access
-  Member *member;
-
-  // Function call
-  char *funcname;
-  Type *func_ty;
-  Node *args;
-
-  // Goto or labeled statement
-  char *label;
-  char *unique_label;
-  Node *goto_next;
-
-  // Switch-cases
-  Node *case_next;
-  Node *default_case;
-
-  // Variable
-  Var *var;
-
-  // Numeric literal
-  int64_t val;
+  union {
+    // Variable
+    Var *var;
+
+    // Block or statement expression
+    Node *body;
+
+    // Operators, "return" and expression statements, and the
+    // statement after a label or case
+    struct {
+      Node *lhs;         // Left-hand side
+      union {
+        Node *rhs;       // Right-hand side
+        Member *member;  // Struct member access
+        int64_t val;     // Numeric literal or case value
+      };
+
+      // Goto, labeled statement or case
+      char *label;
+      char *unique_label;
+      union {
+        Node *goto_next;
+        Node *case_next;
+      };
+    };
+
+    // "if", "for", "while" or "switch" statement, or ?:
+    struct {
+      Node *cond;
+      Node *then;
+      union {
+        Node *els;
+        Node *init;        // "for"
+      };
+      union {
+        Node *inc;         // "for"
+        Node *cases;       // "switch"
+      };
+      char *brk_label;
+      union {
+        char *cont_label;  // "for"
+        Node *default_case; // "switch"
+      };
+    };
+
+    // Function call
+    struct {
+      char *funcname;
+      Type *func_ty;
+      Node *args;
+    };
+  };
 };
 
+Node *new_node(NodeKind kind, Token *tok);
+Node *new_binary(NodeKind kind, Node *lhs, Node *rhs, Token *tok);
+Node *new_num(int64_t val, Token *tok);
 Node *new_cast(Node *expr, Type *ty);
-Var *parse(Token *tok);
+Var *parse(Token *tok, FILE *out);
 
 //
 // type.c
@@ -199,6 +321,7 @@ struct Type {
   TypeKind kind;
   int size;           // sizeof() value
   int align;          // alignment
+  bool is_probe;      // Only parsed through, never hash-consed
 
   // Pointer-to or array-of type. We intentionally use the same member
   // to represent pointer/array duality in C.
@@ -210,7 +333,7 @@ struct Type {
   // the C spec.
   Type *base;
 
-  // Declaration
+  // Function parameter
   Token *name;
 
   // Array
@@ -218,6 +341,8 @@ struct Type {
 
   // Struct
   Member *members;
+  Member **member_index; // Hash index of a wide struct, see find_member()
+  int member_mask;
 
   // Function type
   Type *return_ty;
@@ -247,13 +372,52 @@ Type *copy_type(Type *ty);
 Type *pointer_to(Type *base);
 Type *func_type(Type *return_ty);
 Type *array_of(Type *base, int size);
+void index_members(Type *ty);
+Member *find_member(Type *ty, Symbol *name);
 Type *enum_type(void);
 Type *struct_type(void);
 void add_type(Node *node);
 
+//
+// fold.c
+//
+
+extern bool opt_fold;
+
+void fold_function(Var *fn);
+
 //
 // codegen.c
 //
 
-void codegen(Var *prog, FILE *out);
+extern int opt_level;
+
+void println(char *fmt, ...);
+void codegen_function(Var *fn, FILE *out);
+void codegen_data(Var *prog, FILE *out);
 int align_to(int n, int align);
+
+//
+// strength.c
+//
+
+bool can_reduce(Node *node);
+void gen_mul_imm(int64_t c, int width, char *reg);
+void gen_div_imm(int64_t d, int width, bool is_mod);
+
+//
+// regalloc.c
+//
+
+void codegen_function_o1(Var *fn);
+
+//
+// peephole.c
+//
+
+extern bool opt_peephole;
+
+void start_buffering(void);
+bool buffer_line(char *fmt, va_list ap);
+void flush_lines(FILE *out);
+void print_peephole_stats(FILE *out);
@@ -1,5 +1,8 @@
 #include "chibicc.h"
 
+// Optimization level, 0 or 1. See regalloc.c for -O1.
+int opt_level;
+
 static FILE *output_file;
 static int depth;
 static char *argreg8[] = {"%dil", "%sil", "%dl", "%cl", "%r8b", "%r9b"};
@@ -11,11 +14,16 @@ static Var *current_fn;
 static void gen_expr(Node *node);
 static void gen_stmt(Node *node);
 
-static void println(char *fmt, ...) {
+// Prints a line of assembly. The lines of a function are held back
+// for the peephole optimizer, see peephole.c.
+void println(char *fmt, ...) {
   va_list ap;
   va_start(ap, fmt);
-  vfprintf(output_file, fmt, ap);
-  fprintf(output_file, "\n");
+  if (!buffer_line(fmt, ap)) {
+    vfprintf(output_file, fmt, ap);
+    fprintf(output_file, "\n");
+  }
+  va_end(ap);
 }
 
 static int count(void) {
@@ -167,9 +175,96 @@ static void cast(Type *from, Type *to) {
     println("  %s", cast_table[t1][t2]);
 }
 
+// Emits a .loc directive for `tok`.
+static void emit_loc(Token *tok) {
+  int line_no, col_no;
+  get_line_col(tok->loc, &line_no, &col_no);
+  println("  .loc 1 %d %d", line_no, col_no);
+}
+
+// Returns a new label .L.<name>.<n>.
+static char *new_label(char *name) {
+  int c = count();
+  int len = snprintf(NULL, 0, ".L.%s.%d", name, c) + 1;
+  char *buf = arena_alloc(&fn_arena, len);
+  sprintf(buf, ".L.%s.%d", name, c);
+  return buf;
+}
+
+static char *negate_cc(char *cc) {
+  if (!strcmp(cc, "e"))
+    return "ne";
+  if (!strcmp(cc, "ne"))
+    return "e";
+  if (!strcmp(cc, "l"))
+    return "ge";
+  return "g";
+}
+
+// Jumps on the flags to `t` if `cc` holds and to `f` if not, where
+// either label may be NULL to fall through instead.
+static void branch(char *cc, char *t, char *f) {
+  if (!t) {
+    println("  j%s %s", negate_cc(cc), f);
+    return;
+  }
+  println("  j%s %s", cc, t);
+  if (f)
+    println("  jmp %s", f);
+}
+
+// Jumps to `t` if `node` is true and to `f` if it is false, either of
+// which may be NULL to fall through. A comparison jumps on the flags
+// of its cmp, and !, && and || become jumps, so a condition never
+// computes the 0 or 1 that gen_expr() would.
+static void gen_cond(Node *node, char *t, char *f) {
+  switch (node->kind) {
+  case ND_NOT:
+    gen_cond(node->lhs, f, t);
+    return;
+  case ND_LOGAND: {
+    char *end = f ? f : new_label("false");
+    gen_cond(node->lhs, NULL, end);
+    gen_cond(node->rhs, t, f);
+    if (!f)
+      println("%s:", end);
+    return;
+  }
+  case ND_LOGOR: {
+    char *end = t ? t : new_label("true");
+    gen_cond(node->lhs, end, NULL);
+    gen_cond(node->rhs, t, f);
+    if (!t)
+      println("%s:", end);
+    return;
+  }
+  case ND_EQ:
+  case ND_NE:
+  case ND_LT:
+  case ND_LE: {
+    emit_loc(node->tok);
+    gen_expr(node->rhs);
+    push();
+    gen_expr(node->lhs);
+    pop("%rdi");
+    if (node->lhs->ty->kind == TY_LONG || node->lhs->ty->base)
+      println("  cmp %%rdi, %%rax");
+    else
+      println("  cmp %%edi, %%eax");
+    branch((node->kind == ND_EQ) ? "e" : (node->kind == ND_NE) ? "ne" :
+           (node->kind == ND_LT) ? "l" : "le", t, f);
+    return;
+  }
+  }
+
+  gen_expr(node);
+  println("  cmp $0, %%rax");
+  branch("ne", t, f);
+}
+
 // Generate code for a given node.
 static void gen_expr(Node *node) {
-  println("  .loc 1 %d", node->tok->line_no);
+  emit_loc(node->tok);
 
   switch (node->kind) {
   case ND_NUM:
@@ -206,15 +301,14 @@ static void gen_expr(Node *node) {
     cast(node->lhs->ty, node->ty);
     return;
   case ND_COND: {
-    int c = count();
-    gen_expr(node->cond);
-    println("  cmp $0, %%rax");
-    println("  je .L.else.%d", c);
+    char *els = new_label("else");
+    char *end = new_label("end");
+    gen_cond(node->cond, NULL, els);
     gen_expr(node->then);
-    println("  jmp .L.end.%d", c);
-    println(".L.else.%d:", c);
+    println("  jmp %s", end);
+    println("%s:", els);
     gen_expr(node->els);
-    println(".L.end.%d:", c);
+    println("%s:", end);
     return;
   }
   case ND_NOT:
@@ -227,34 +321,16 @@ static void gen_expr(Node *node) {
     gen_expr(node->lhs);
     println("  not %%rax");
     return;
-  case ND_LOGAND: {
-    int c = count();
-    gen_expr(node->lhs);
-    println("  cmp $0, %%rax");
-    println("  je .L.false.%d", c);
-    gen_expr(node->rhs);
-    println("  cmp $0, %%rax");
-    println("  je .L.false.%d", c);
-    println("  mov $1, %%rax");
-    println("  jmp .L.end.%d", c);
-    println(".L.false.%d:", c);
-    println("  mov $0, %%rax");
-    println(".L.end.%d:", c);
-    return;
-  }
+  case ND_LOGAND:
   case ND_LOGOR: {
-    int c = count();
-    gen_expr(node->lhs);
-    println("  cmp $0, %%rax");
-    println("  jne .L.true.%d", c);
-    gen_expr(node->rhs);
-    println("  cmp $0, %%rax");
-    println("  jne .L.true.%d", c);
-    println("  mov $0, %%rax");
-    println("  jmp .L.end.%d", c);
-    println(".L.true.%d:", c);
+    char *f = new_label("false");
+    char *end = new_label("end");
+    gen_cond(node, NULL, f);
     println("  mov $1, %%rax");
-    println(".L.end.%d:", c);
+    println("  jmp %s", end);
+    println("%s:", f);
+    println("  mov $0, %%rax");
+    println("%s:", end);
     return;
   }
   case ND_FUNCALL: {
@@ -274,6 +350,17 @@ static void gen_expr(Node *node) {
   }
   }
 
+  // Multiplication or division by a constant. See strength.c.
+  if (can_reduce(node)) {
+    gen_expr(node->lhs);
+    bool wide = node->lhs->ty->kind == TY_LONG || node->lhs->ty->base;
+    if (node->kind == ND_MUL)
+      gen_mul_imm(node->rhs->val, wide ? 8 : 4, "%rax");
+    else
+      gen_div_imm(node->rhs->val, wide ? 8 : 4, node->kind == ND_MOD);
+    return;
+  }
+
   gen_expr(node->rhs);
   push();
   gen_expr(node->lhs);
@@ -353,20 +440,19 @@ static void gen_expr(Node *node) {
 }
 
 static void gen_stmt(Node *node) {
-  println("  .loc 1 %d", node->tok->line_no);
+  emit_loc(node->tok);
 
   switch (node->kind) {
   case ND_IF: {
-    int c = count();
-    gen_expr(node->cond);
-    println("  cmp $0, %%rax");
-    println("  je  .L.else.%d", c);
+    char *els = new_label("else");
+    char *end = new_label("end");
+    gen_cond(node->cond, NULL, els);
     gen_stmt(node->then);
-    println("  jmp .L.end.%d", c);
-    println(".L.else.%d:", c);
+    println("  jmp %s", end);
+    println("%s:", els);
     if (node->els)
       gen_stmt(node->els);
-    println(".L.end.%d:", c);
+    println("%s:", end);
     return;
   }
   case ND_FOR: {
@@ -374,11 +460,8 @@ static void gen_stmt(Node *node) {
     if (node->init)
       gen_stmt(node->init);
     println(".L.begin.%d:", c);
-    if (node->cond) {
-      gen_expr(node->cond);
-      println("  cmp $0, %%rax");
-      println("  je %s", node->brk_label);
-    }
+    if (node->cond)
+      gen_cond(node->cond, NULL, node->brk_label);
     gen_stmt(node->then);
     println("%s:", node->cont_label);
     if (node->inc)
@@ -390,7 +473,7 @@ static void gen_stmt(Node *node) {
   case ND_SWITCH:
     gen_expr(node->cond);
 
-    for (Node *n = node->case_next; n; n = n->case_next) {
+    for (Node *n = node->cases; n; n = n->case_next) {
       char *reg = (node->cond->ty->size == 8) ? "%rax" : "%eax";
       println("  cmp $%ld, %s", n->val, reg);
       println("  je %s", n->label);
@@ -431,19 +514,14 @@ static void gen_stmt(Node *node) {
 }
 
 // Assign offsets to local variables.
-static void assign_lvar_offsets(Var *prog) {
-  for (Var *fn = prog; fn; fn = fn->next) {
-    if (!fn->is_function)
-      continue;
-
-    int offset = 0;
-    for (Var *var = fn->locals; var; var = var->next) {
-      offset += var->ty->size;
-      offset = align_to(offset, var->ty->align);
-      var->offset = -offset;
-    }
-    fn->stack_size = align_to(offset, 16);
+static void assign_lvar_offsets(Var *fn) {
+  int offset = 0;
+  for (Var *var = fn->locals; var; var = var->next) {
+    offset += var->ty->size;
+    offset = align_to(offset, var->ty->align);
+    var->offset = -offset;
   }
+  fn->stack_size = align_to(offset, 16);
 }
 
 static void emit_data(Var *prog) {
@@ -482,46 +560,55 @@ static void store_gp(int r, int offset, int sz) {
   unreachable();
 }
 
-static void emit_text(Var *prog) {
-  for (Var *fn = prog; fn; fn = fn->next) {
-    if (!fn->is_function || !fn->is_definition)
-      continue;
+static void emit_text(Var *fn) {
+  if (fn->is_static)
+    println("  .local %s", fn->name);
+  else
+    println("  .globl %s", fn->name);
+
+  println("  .text");
+  println("%s:", fn->name);
+  current_fn = fn;
+
+  // Prologue
+  println("  push %%rbp");
+  println("  mov %%rsp, %%rbp");
+  println("  sub $%d, %%rsp", fn->stack_size);
+
+  // Save passed-by-register arguments to the stack
+  int i = 0;
+  for (Var *var = fn->params; var; var = var->next)
+    store_gp(i++, var->offset, var->ty->size);
+
+  // Emit code
+  gen_stmt(fn->body);
+  assert(depth == 0);
+
+  // Epilogue
+  println(".L.return.%s:", fn->name);
+  println("  mov %%rbp, %%rsp");
+  println("  pop %%rbp");
+  println("  ret");
+}
 
-    if (fn->is_static)
-      println("  .local %s", fn->name);
-    else
-      println("  .globl %s", fn->name);
-
-    println("  .text");
-    println("%s:", fn->name);
-    current_fn = fn;
-
-    // Prologue
-    println("  push %%rbp");
-    println("  mov %%rsp, %%rbp");
-    println("  sub $%d, %%rsp", fn->stack_size);
-
-    // Save passed-by-register arguments to the stack
-    int i = 0;
-    for (Var *var = fn->params; var; var = var->next)
-      store_gp(i++, var->offset, var->ty->size);
-
-    // Emit code
-    gen_stmt(fn->body);
-    assert(depth == 0);
-
-    // Epilogue
-    println(".L.return.%s:", fn->name);
-    println("  mov %%rbp, %%rsp");
-    println("  pop %%rbp");
-    println("  ret");
+// Emits a function definition. The parser calls this as soon as it has
+// read the function, before the rest of the file.
+void codegen_function(Var *fn, FILE *out) {
+  output_file = out;
+  start_buffering();
+
+  if (opt_level > 0) {
+    codegen_function_o1(fn);
+  } else {
+    assign_lvar_offsets(fn);
+    emit_text(fn);
   }
+
+  flush_lines(out);
 }
 
-void codegen(Var *prog, FILE *out) {
+// Emits the global variables once the whole file has been parsed.
+void codegen_data(Var *prog, FILE *out) {
   output_file = out;
-
-  assign_lvar_offsets(prog);
   emit_data(prog);
-  emit_text(prog);
 }
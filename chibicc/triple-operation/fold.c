@@ -0,0 +1,476 @@
+// This file folds the constant expressions of a function once it has
+// been parsed and typed.
+//
+// An operation whose operands are numbers is replaced by a number, so
+// that `3*4+x` adds 12 to x and the scaled index of `a[2][3]` is a
+// single offset. x+0, x*1, x&-1 and the like become x, the constants of
+// (x+1)+2 are combined, and an if, a loop or a ?: whose condition is a
+// number keeps only the code that can run.
+//
+// Folding never changes what the generated code computes, down to the
+// bits of %rax that C does not look at: an int is added in 32 bits and
+// zero-extended, & is done in 64 bits, a load sign-extends, and so on.
+// Since an int expression may be passed as is to a long parameter,
+// x+0 on an int x only becomes x if x is zero-extended already. A node
+// that replaces another takes its type, as the code generators take the
+// width of an operation from the type of its left operand.
+//
+// --no-fold turns the pass off.
+
+#include "chibicc.h"
+
+bool opt_fold = true;
+
+static Node *fold(Node *node);
+
+static bool is_num(Node *node) {
+  return node && node->kind == ND_NUM;
+}
+
+static bool is_wide(Type *ty) {
+  return ty->kind == TY_LONG || ty->base;
+}
+
+// &, | and ^ are always done in 64 bits, anything else in the width of
+// its left operand.
+static bool is_wide_op(Node *node) {
+  switch (node->kind) {
+  case ND_BITAND:
+  case ND_BITOR:
+  case ND_BITXOR:
+    return true;
+  }
+  return is_wide(node->lhs->ty);
+}
+
+static Node *new_value(Node *node, uint64_t val) {
+  Node *num = new_num(val, node->tok);
+  num->ty = node->ty;
+  return num;
+}
+
+//
+// Values
+//
+
+// Computes what the code of the binary operator `node` leaves in %rax
+// given the values `a` and `b` of its operands. Returns false if the
+// value is only known at run time, as on a division by zero.
+static bool eval_binary(Node *node, uint64_t a, uint64_t b, uint64_t *v) {
+  bool wide = is_wide(node->lhs->ty);
+
+  switch (node->kind) {
+  case ND_ADD:
+    *v = wide ? a + b : (uint32_t)(a + b);
+    return true;
+  case ND_SUB:
+    *v = wide ? a - b : (uint32_t)(a - b);
+    return true;
+  case ND_MUL:
+    *v = wide ? a * b : (uint32_t)(a * b);
+    return true;
+  case ND_DIV:
+  case ND_MOD:
+    if (wide != (node->lhs->ty->size == 8))
+      return false;
+    if (wide) {
+      if (b == 0 || ((int64_t)a == INT64_MIN && (int64_t)b == -1))
+        return false;
+      *v = node->kind == ND_DIV ? (int64_t)a / (int64_t)b : (int64_t)a % (int64_t)b;
+      return true;
+    }
+    if ((uint32_t)b == 0 || ((int32_t)a == INT32_MIN && (int32_t)b == -1))
+      return false;
+    *v = (uint32_t)(node->kind == ND_DIV ? (int32_t)a / (int32_t)b : (int32_t)a % (int32_t)b);
+    return true;
+  case ND_BITAND:
+    *v = a & b;
+    return true;
+  case ND_BITOR:
+    *v = a | b;
+    return true;
+  case ND_BITXOR:
+    *v = a ^ b;
+    return true;
+  case ND_SHL:
+    *v = wide ? a << (b & 63) : (uint32_t)((uint32_t)a << (b & 31));
+    return true;
+  case ND_SHR:
+    *v = wide ? (int64_t)a >> (b & 63) : (uint32_t)((int32_t)a >> (b & 31));
+    return true;
+  }
+
+  int64_t x = wide ? (int64_t)a : (int32_t)a;
+  int64_t y = wide ? (int64_t)b : (int32_t)b;
+  switch (node->kind) {
+  case ND_EQ: *v = x == y; return true;
+  case ND_NE: *v = x != y; return true;
+  case ND_LT: *v = x < y; return true;
+  case ND_LE: *v = x <= y; return true;
+  }
+  unreachable();
+}
+
+enum { I8, I16, I32, I64 };
+
+static int type_id(Type *ty) {
+  switch (ty->kind) {
+  case TY_CHAR:
+    return I8;
+  case TY_SHORT:
+    return I16;
+  case TY_INT:
+    return I32;
+  }
+  return I64;
+}
+
+// Mirrors cast() in codegen.c.
+static uint64_t eval_cast(Type *from, Type *to, uint64_t v) {
+  if (to->kind == TY_VOID)
+    return v;
+
+  if (to->kind == TY_BOOL) {
+    if (is_integer(from) && from->size <= 4)
+      return (uint32_t)v != 0;
+    return v != 0;
+  }
+
+  int t1 = type_id(from);
+  int t2 = type_id(to);
+  if (t2 == I8 && t1 > I8)
+    return (uint32_t)(int8_t)v;
+  if (t2 == I16 && t1 > I16)
+    return (uint32_t)(int16_t)v;
+  if (t2 == I64 && t1 < I64)
+    return (int64_t)(int32_t)v;
+  return v;
+}
+
+// Returns true if a cast from `from` to `to` leaves %rax as it is.
+static bool is_nop_cast(Type *from, Type *to) {
+  if (to->kind == TY_VOID)
+    return true;
+  if (to->kind == TY_BOOL)
+    return false;
+  int t1 = type_id(from);
+  int t2 = type_id(to);
+  return !(t2 == I8 && t1 > I8) && !(t2 == I16 && t1 > I16) && !(t2 == I64 && t1 < I64);
+}
+
+// Returns true if the upper half of %rax is zero after `node`.
+static bool is_zero_extended(Node *node) {
+  switch (node->kind) {
+  case ND_NUM:
+    return node->val == (uint32_t)node->val;
+  case ND_ADD:
+  case ND_SUB:
+  case ND_MUL:
+  case ND_DIV:
+  case ND_MOD:
+  case ND_SHL:
+  case ND_SHR:
+    return !is_wide(node->lhs->ty);
+  case ND_EQ:
+  case ND_NE:
+  case ND_LT:
+  case ND_LE:
+  case ND_NOT:
+  case ND_LOGAND:
+  case ND_LOGOR:
+    return true;
+  case ND_CAST:
+    return node->ty->kind == TY_BOOL;
+  }
+  return false;
+}
+
+//
+// Expressions
+//
+
+static bool is_commutative(NodeKind kind) {
+  return kind == ND_ADD || kind == ND_MUL || kind == ND_BITAND || kind == ND_BITOR ||
+         kind == ND_BITXOR;
+}
+
+// Returns true if `node`, whose right operand is a number, gives the
+// low 64 or 32 bits of its left operand.
+static bool is_identity(Node *node) {
+  bool wide = is_wide_op(node);
+  uint64_t c = wide ? node->rhs->val : (uint32_t)node->rhs->val;
+
+  switch (node->kind) {
+  case ND_ADD:
+  case ND_SUB:
+  case ND_BITOR:
+  case ND_BITXOR:
+    return c == 0;
+  case ND_MUL:
+    return c == 1;
+  case ND_BITAND:
+    return c == UINT64_MAX;
+  case ND_SHL:
+  case ND_SHR:
+    return (c & (wide ? 63 : 31)) == 0;
+  }
+  return false;
+}
+
+// Returns the constant of x+c or x-c as an addend.
+static uint64_t addend(Node *node) {
+  return node->kind == ND_SUB ? -(uint64_t)node->rhs->val : node->rhs->val;
+}
+
+// Combines the constants of (x op c1) op c2 into x op c, which is the
+// same as long as both operations are done in the same width.
+static Node *reassociate(Node *node) {
+  Node *x = node->lhs;
+  bool sums = (node->kind == ND_ADD || node->kind == ND_SUB) &&
+              (x->kind == ND_ADD || x->kind == ND_SUB);
+  if (!sums && (x->kind != node->kind || !is_commutative(node->kind)))
+    return node;
+  if (!is_num(x->rhs) || is_wide_op(x) != is_wide_op(node))
+    return node;
+
+  uint64_t c1 = x->rhs->val;
+  uint64_t c2 = node->rhs->val;
+  uint64_t c;
+  switch (node->kind) {
+  case ND_MUL:    c = c1 * c2; break;
+  case ND_BITAND: c = c1 & c2; break;
+  case ND_BITOR:  c = c1 | c2; break;
+  case ND_BITXOR: c = c1 ^ c2; break;
+  default:        c = addend(x) + addend(node);
+  }
+
+  Node *num = new_num(is_wide_op(node) ? c : (int32_t)c, node->rhs->tok);
+  num->ty = node->rhs->ty;
+  Node *n = new_binary(sums ? ND_ADD : node->kind, x->lhs, num, node->tok);
+  n->ty = node->ty;
+  return n;
+}
+
+static Node *fold_binary(Node *node) {
+  if (is_num(node->lhs) && is_num(node->rhs)) {
+    uint64_t v;
+    if (eval_binary(node, node->lhs->val, node->rhs->val, &v))
+      return new_value(node, v);
+    return node;
+  }
+
+  // The constant of a commutative operation goes on the right, where
+  // it can be combined with others and used as an immediate.
+  if (is_num(node->lhs) && is_commutative(node->kind) &&
+      is_wide(node->lhs->ty) == is_wide(node->rhs->ty)) {
+    Node *n = new_binary(node->kind, node->rhs, node->lhs, node->tok);
+    n->ty = node->ty;
+    node = n;
+  }
+  if (!is_num(node->rhs))
+    return node;
+
+  if (node->kind != ND_SHL && node->kind != ND_SHR)
+    node = reassociate(node);
+
+  Node *x = node->lhs;
+  if (is_identity(node) && x->ty == node->ty && (is_wide_op(node) || is_zero_extended(x)))
+    return x;
+  return node;
+}
+
+// Folds the operands of an lvalue without replacing it.
+static void fold_lvalue(Node *node) {
+  switch (node->kind) {
+  case ND_DEREF:
+    node->lhs = fold(node->lhs);
+    return;
+  case ND_MEMBER:
+    fold_lvalue(node->lhs);
+    return;
+  case ND_COMMA:
+    node->lhs = fold(node->lhs);
+    fold_lvalue(node->rhs);
+    return;
+  }
+}
+
+static void fold_list(Node **list) {
+  for (Node **p = list; *p; p = &(*p)->next) {
+    Node *n = fold(*p);
+    if (n != *p) {
+      n->next = (*p)->next;
+      *p = n;
+    }
+  }
+}
+
+//
+// Statements
+//
+
+// Returns true if `node` has a label or a case, which code outside of
+// it may jump to.
+static bool has_label(Node *node) {
+  if (!node)
+    return false;
+
+  switch (node->kind) {
+  case ND_LABEL:
+  case ND_CASE:
+    return true;
+  case ND_NUM:
+  case ND_VAR:
+  case ND_GOTO:
+    return false;
+  case ND_IF:
+  case ND_COND:
+  case ND_FOR:
+  case ND_SWITCH:
+    if (has_label(node->cond) || has_label(node->then))
+      return true;
+    if (node->kind == ND_FOR)
+      return has_label(node->init) || has_label(node->inc);
+    return node->kind != ND_SWITCH && has_label(node->els);
+  case ND_BLOCK:
+  case ND_STMT_EXPR:
+    for (Node *n = node->body; n; n = n->next)
+      if (has_label(n))
+        return true;
+    return false;
+  case ND_FUNCALL:
+    for (Node *n = node->args; n; n = n->next)
+      if (has_label(n))
+        return true;
+    return false;
+  case ND_ADDR:
+  case ND_DEREF:
+  case ND_NOT:
+  case ND_BITNOT:
+  case ND_CAST:
+  case ND_RETURN:
+  case ND_EXPR_STMT:
+  case ND_MEMBER:
+    return has_label(node->lhs);
+  }
+  return has_label(node->lhs) || has_label(node->rhs);
+}
+
+static Node *new_empty_stmt(Token *tok) {
+  return new_node(ND_BLOCK, tok);
+}
+
+// Returns what `node` folds to. Only the fields of the node's own kind
+// may be touched.
+static Node *fold(Node *node) {
+  if (!node)
+    return NULL;
+
+  switch (node->kind) {
+  case ND_NUM:
+  case ND_VAR:
+  case ND_GOTO:
+    return node;
+  case ND_ASSIGN:
+    fold_lvalue(node->lhs);
+    node->rhs = fold(node->rhs);
+    return node;
+  case ND_MEMBER:
+  case ND_ADDR:
+    fold_lvalue(node->lhs);
+    return node;
+  case ND_DEREF:
+  case ND_RETURN:
+  case ND_EXPR_STMT:
+  case ND_LABEL:
+  case ND_CASE:
+    node->lhs = fold(node->lhs);
+    return node;
+  case ND_CAST:
+    node->lhs = fold(node->lhs);
+    if (is_num(node->lhs))
+      return new_value(node, eval_cast(node->lhs->ty, node->ty, node->lhs->val));
+    if (node->lhs->ty == node->ty && is_nop_cast(node->lhs->ty, node->ty))
+      return node->lhs;
+    return node;
+  case ND_NOT:
+    node->lhs = fold(node->lhs);
+    return is_num(node->lhs) ? new_value(node, node->lhs->val == 0) : node;
+  case ND_BITNOT:
+    node->lhs = fold(node->lhs);
+    return is_num(node->lhs) ? new_value(node, ~node->lhs->val) : node;
+  case ND_LOGAND:
+  case ND_LOGOR: {
+    node->lhs = fold(node->lhs);
+    node->rhs = fold(node->rhs);
+    if (!is_num(node->lhs))
+      return node;
+    // 0 && y is 0, and 1 || y is 1.
+    bool lhs = node->lhs->val != 0;
+    if (lhs == (node->kind == ND_LOGOR))
+      return new_value(node, lhs);
+    return is_num(node->rhs) ? new_value(node, node->rhs->val != 0) : node;
+  }
+  case ND_COMMA:
+    node->lhs = fold(node->lhs);
+    node->rhs = fold(node->rhs);
+    return is_num(node->lhs) ? node->rhs : node;
+  case ND_COND: {
+    node->cond = fold(node->cond);
+    node->then = fold(node->then);
+    node->els = fold(node->els);
+    if (!is_num(node->cond))
+      return node;
+    Node *branch = node->cond->val ? node->then : node->els;
+    if (branch->ty == node->ty || node->ty->kind == TY_VOID)
+      return branch;
+    return node;
+  }
+  case ND_FUNCALL:
+    fold_list(&node->args);
+    return node;
+  case ND_BLOCK:
+  case ND_STMT_EXPR:
+    fold_list(&node->body);
+    return node;
+  case ND_IF: {
+    node->cond = fold(node->cond);
+    node->then = fold(node->then);
+    node->els = fold(node->els);
+    if (!is_num(node->cond))
+      return node;
+    Node *taken = node->cond->val ? node->then : node->els;
+    Node *dead = node->cond->val ? node->els : node->then;
+    if (has_label(dead))
+      return node;
+    return taken ? taken : new_empty_stmt(node->tok);
+  }
+  case ND_FOR:
+    node->init = fold(node->init);
+    node->cond = fold(node->cond);
+    node->inc = fold(node->inc);
+    node->then = fold(node->then);
+    if (!is_num(node->cond))
+      return node;
+    if (node->cond->val) {
+      node->cond = NULL;
+      return node;
+    }
+    if (has_label(node->then) || has_label(node->inc))
+      return node;
+    return node->init ? node->init : new_empty_stmt(node->tok);
+  case ND_SWITCH:
+    node->cond = fold(node->cond);
+    node->then = fold(node->then);
+    return node;
+  }
+
+  node->lhs = fold(node->lhs);
+  node->rhs = fold(node->rhs);
+  return fold_binary(node);
+}
+
+void fold_function(Var *fn) {
+  if (opt_fold)
+    fn->body = fold(fn->body);
+}
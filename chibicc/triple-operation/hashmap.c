@@ -0,0 +1,78 @@
+// This is an implementation of an open-addressing hash map with
+// linear probing. Keys are pointers compared by address, which is
+// enough for interned names.
+//
+// Entries are never removed. An empty map owns no memory, so creating
+// one is free; the bucket array is allocated by the first insertion,
+// from the map's arena. Hash maps only back scopes, so their buckets
+// are freed together with the scopes.
+
+#include "chibicc.h"
+
+// Initial hash bucket size
+#define INIT_SIZE 16
+
+// Rehash if the usage exceeds 70%.
+#define HIGH_WATERMARK 70
+
+static uint64_t hash(void *key) {
+  uint64_t h = (uintptr_t)key * 0x9e3779b97f4a7c15;
+  return h ^ (h >> 32);
+}
+
+static HashEntry *get_entry(HashMap *map, void *key) {
+  if (!map->buckets)
+    return NULL;
+
+  uint64_t h = hash(key);
+  for (int i = 0; i < map->capacity; i++) {
+    HashEntry *ent = &map->buckets[(h + i) & (map->capacity - 1)];
+    if (ent->key == key)
+      return ent;
+    if (ent->key == NULL)
+      return NULL;
+  }
+  unreachable();
+}
+
+static void rehash(HashMap *map) {
+  HashMap map2 = {};
+  map2.arena = map->arena;
+  map2.capacity = map->capacity ? map->capacity * 2 : INIT_SIZE;
+  map2.buckets = arena_alloc(map->arena, sizeof(HashEntry) * map2.capacity);
+
+  for (int i = 0; i < map->capacity; i++) {
+    HashEntry *ent = &map->buckets[i];
+    if (ent->key)
+      hashmap_put(&map2, ent->key, ent->val);
+  }
+
+  *map = map2;
+}
+
+void *hashmap_get(HashMap *map, void *key) {
+  HashEntry *ent = get_entry(map, key);
+  return ent ? ent->val : NULL;
+}
+
+// Inserts `key`, or replaces its value if it is already present.
+void hashmap_put(HashMap *map, void *key, void *val) {
+  if ((map->used + 1) * 100 > map->capacity * HIGH_WATERMARK)
+    rehash(map);
+
+  uint64_t h = hash(key);
+  for (int i = 0; i < map->capacity; i++) {
+    HashEntry *ent = &map->buckets[(h + i) & (map->capacity - 1)];
+    if (ent->key == key) {
+      ent->val = val;
+      return;
+    }
+    if (ent->key == NULL) {
+      ent->key = key;
+      ent->val = val;
+      map->used++;
+      return;
+    }
+  }
+  unreachable();
+}
@@ -22,8 +22,7 @@
 // or enum constants
 typedef struct VarScope VarScope;
 struct VarScope {
-  VarScope *next;
-  char *name;
+  char *name; // Interned, so it is compared by address
   int depth;
 
   Var *var;
@@ -35,8 +34,7 @@ struct VarScope {
 // Scope for struct, union or enum tags
 typedef struct TagScope TagScope;
 struct TagScope {
-  TagScope *next;
-  char *name;
+  char *name; // Interned, so it is compared by address
   int depth;
   Type *ty;
 };
@@ -46,9 +44,10 @@ struct Scope {
   Scope *next;
 
   // C has two block scopes; one is for variables/typedefs and
-  // the other is for struct/union/enum tags.
-  VarScope *vars;
-  TagScope *tags;
+  // the other is for struct/union/enum tags. Both map a name to
+  // its VarScope or TagScope.
+  HashMap vars;
+  HashMap tags;
 };
 
 // Variable attributes such as typedef or extern.
@@ -64,7 +63,10 @@ static Var *locals;
 // Likewise, global variables are accumulated to this list.
 static Var *globals;
 
-static Scope *scope = &(Scope){};
+static Scope *scope = &(Scope){
+  .vars.arena = &scope_arena,
+  .tags.arena = &scope_arena,
+};
 
 // scope_depth is incremented by one at the beginning of a block
 // scope and decremented by one at the end of a block scope.
@@ -89,7 +91,7 @@ static bool is_typename(Token *tok);
 static Type *typespec(Token **rest, Token *tok, VarAttr *attr);
 static Type *enum_specifier(Token **rest, Token *tok);
 static Type *type_suffix(Token **rest, Token *tok, Type *ty);
-static Type *declarator(Token **rest, Token *tok, Type *ty);
+static Type *declarator(Token **rest, Token *tok, Type *ty, Token **name);
 static Node *declaration(Token **rest, Token *tok, Type *basety);
 static Node *compound_stmt(Token **rest, Token *tok);
 static Node *stmt(Token **rest, Token *tok);
@@ -117,8 +119,15 @@ static Node *unary(Token **rest, Token *tok);
 static Node *primary(Token **rest, Token *tok);
 static Token *parse_typedef(Token *tok, Type *basety);
 
+// Block scopes only exist inside a function, so they are freed along
+// with the function's nodes. The file scope outlives every function.
+static Arena *scope_mem(void) {
+  return scope_depth ? &fn_arena : &scope_arena;
+}
+
 static void enter_scope(void) {
-  Scope *sc = calloc(1, sizeof(Scope));
+  Scope *sc = arena_alloc(&fn_arena, sizeof(Scope));
+  sc->vars.arena = sc->tags.arena = &fn_arena;
   sc->next = scope;
   scope = sc;
   scope_depth++;
@@ -131,29 +140,66 @@ static void leave_scope(void) {
 
 // Find a variable by name.
 static VarScope *find_var(Token *tok) {
-  for (Scope *sc = scope; sc; sc = sc->next)
-    for (VarScope *sc2 = sc->vars; sc2; sc2 = sc2->next)
-      if (equal(tok, sc2->name))
-        return sc2;
+  for (Scope *sc = scope; sc; sc = sc->next) {
+    VarScope *sc2 = hashmap_get(&sc->vars, tok->sym->name);
+    if (sc2)
+      return sc2;
+  }
   return NULL;
 }
 
 static TagScope *find_tag(Token *tok) {
-  for (Scope *sc = scope; sc; sc = sc->next)
-    for (TagScope *sc2 = sc->tags; sc2; sc2 = sc2->next)
-      if (equal(tok, sc2->name))
-        return sc2;
+  for (Scope *sc = scope; sc; sc = sc->next) {
+    TagScope *sc2 = hashmap_get(&sc->tags, tok->sym->name);
+    if (sc2)
+      return sc2;
+  }
   return NULL;
 }
 
-static Node *new_node(NodeKind kind, Token *tok) {
-  Node *node = calloc(1, sizeof(Node));
+#define SIZE_UPTO(field) (offsetof(Node, field) + sizeof(((Node *)0)->field))
+
+// Returns the number of bytes a node of `kind` occupies.
+static size_t node_size(NodeKind kind) {
+  switch (kind) {
+  case ND_VAR:
+    return SIZE_UPTO(var);
+  case ND_BLOCK:
+  case ND_STMT_EXPR:
+    return SIZE_UPTO(body);
+  case ND_ADDR:
+  case ND_DEREF:
+  case ND_NOT:
+  case ND_BITNOT:
+  case ND_CAST:
+  case ND_RETURN:
+  case ND_EXPR_STMT:
+    return SIZE_UPTO(lhs);
+  case ND_GOTO:
+  case ND_LABEL:
+  case ND_CASE:
+    return SIZE_UPTO(goto_next);
+  case ND_IF:
+  case ND_COND:
+    return SIZE_UPTO(els);
+  case ND_FOR:
+  case ND_SWITCH:
+    return SIZE_UPTO(cont_label);
+  case ND_FUNCALL:
+    return SIZE_UPTO(args);
+  }
+  // Binary operators, member accesses and numbers.
+  return SIZE_UPTO(rhs);
+}
+
+Node *new_node(NodeKind kind, Token *tok) {
+  Node *node = arena_alloc(&fn_arena, node_size(kind));
   node->kind = kind;
   node->tok = tok;
   return node;
 }
 
-static Node *new_binary(NodeKind kind, Node *lhs, Node *rhs, Token *tok) {
+Node *new_binary(NodeKind kind, Node *lhs, Node *rhs, Token *tok) {
   Node *node = new_node(kind, tok);
   node->lhs = lhs;
   node->rhs = rhs;
@@ -166,7 +212,7 @@ static Node *new_unary(NodeKind kind, Node *expr, Token *tok) {
   return node;
 }
 
-static Node *new_num(int64_t val, Token *tok) {
+Node *new_num(int64_t val, Token *tok) {
   Node *node = new_node(ND_NUM, tok);
   node->val = val;
   return node;
@@ -181,26 +227,22 @@ static Node *new_var_node(Var *var, Token *tok) {
 Node *new_cast(Node *expr, Type *ty) {
   add_type(expr);
 
-  Node *node = calloc(1, sizeof(Node));
-  node->kind = ND_CAST;
-  node->tok = expr->tok;
+  Node *node = new_node(ND_CAST, expr->tok);
   node->lhs = expr;
-  node->ty = copy_type(ty);
+  node->ty = ty;
   return node;
 }
 
 static VarScope *push_scope(char *name) {
-  VarScope *sc = calloc(1, sizeof(VarScope));
+  VarScope *sc = arena_alloc(scope_mem(), sizeof(VarScope));
   sc->name = name;
   sc->depth = scope_depth;
-
-  sc->next = scope->vars;
-  scope->vars = sc;
+  hashmap_put(&scope->vars, name, sc);
   return sc;
 }
 
-static Var *new_var(char *name, Type *ty) {
-  Var *var = calloc(1, sizeof(Var));
+static Var *new_var(Arena *arena, char *name, Type *ty) {
+  Var *var = arena_alloc(arena, sizeof(Var));
   var->name = name;
   var->ty = ty;
   push_scope(name)->var = var;
@@ -208,7 +250,7 @@ static Var *new_var(char *name, Type *ty) {
 }
 
 static Var *new_lvar(char *name, Type *ty) {
-  Var *var = new_var(name, ty);
+  Var *var = new_var(&fn_arena, name, ty);
   var->is_local = true;
   var->next = locals;
   locals = var;
@@ -216,21 +258,21 @@ static Var *new_lvar(char *name, Type *ty) {
 }
 
 static Var *new_gvar(char *name, Type *ty) {
-  Var *var = new_var(name, ty);
+  Var *var = new_var(&ast_arena, name, ty);
   var->next = globals;
   globals = var;
   return var;
 }
 
-static char *new_unique_name(void) {
+static char *new_unique_name(Arena *arena) {
   static int id = 0;
-  char *buf = calloc(1, 20);
+  char *buf = arena_alloc(arena, 20);
   sprintf(buf, ".L..%d", id++);
   return buf;
 }
 
 static Var *new_anon_gvar(Type *ty) {
-  return new_gvar(new_unique_name(), ty);
+  return new_gvar(new_unique_name(&ast_arena), ty);
 }
 
 static Var *new_string_literal(char *p, Type *ty) {
@@ -242,7 +284,7 @@ static Var *new_string_literal(char *p, Type *ty) {
 static char *get_ident(Token *tok) {
   if (tok->kind != TK_IDENT)
     error_tok(tok, "expected an identifier");
-  return strndup(tok->loc, tok->len);
+  return tok->sym->name;
 }
 
 static Type *find_typedef(Token *tok) {
@@ -261,13 +303,11 @@ static long get_number(Token *tok) {
 }
 
 static void push_tag_scope(Token *tok, Type *ty) {
-  TagScope *sc = calloc(1, sizeof(TagScope));
-  sc->name = strndup(tok->loc, tok->len);
+  TagScope *sc = arena_alloc(scope_mem(), sizeof(TagScope));
+  sc->name = tok->sym->name;
   sc->depth = scope_depth;
   sc->ty = ty;
-
-  sc->next = scope->tags;
-  scope->tags = sc;
+  hashmap_put(&scope->tags, sc->name, sc);
 }
 
 // typespec = typename typename*
@@ -305,36 +345,36 @@ static Type *typespec(Token **rest, Token *tok, VarAttr *attr) {
 
   while (is_typename(tok)) {
     // Handle storage class specifiers.
-    if (equal(tok, "typedef") || equal(tok, "static")) {
+    if (tok->kw == KW_TYPEDEF || tok->kw == KW_STATIC) {
       if (!attr)
         error_tok(tok, "storage class specifier is not allowed in this context");
 
-      if (equal(tok, "typedef"))
+      if (tok->kw == KW_TYPEDEF)
         attr->is_typedef = true;
       else
         attr->is_static = true;
 
       if (attr->is_typedef + attr->is_static > 1)
         error_tok(tok, "typedef and static may not be used together");
-      tok = tok->next;
+      tok++;
       continue;
     }
 
     // Handle user-defined types.
     Type *ty2 = find_typedef(tok);
-    if (equal(tok, "struct") || equal(tok, "union") || equal(tok, "enum") || ty2) {
+    if (tok->kw == KW_STRUCT || tok->kw == KW_UNION || tok->kw == KW_ENUM || ty2) {
       if (counter)
         break;
 
-      if (equal(tok, "struct")) {
-        ty = struct_decl(&tok, tok->next);
-      } else if (equal(tok, "union")) {
-        ty = union_decl(&tok, tok->next);
-      } else if (equal(tok, "enum")) {
-        ty = enum_specifier(&tok, tok->next);
+      if (tok->kw == KW_STRUCT) {
+        ty = struct_decl(&tok, tok + 1);
+      } else if (tok->kw == KW_UNION) {
+        ty = union_decl(&tok, tok + 1);
+      } else if (tok->kw == KW_ENUM) {
+        ty = enum_specifier(&tok, tok + 1);
       } else {
         ty = ty2;
-        tok = tok->next;
+        tok++;
       }
 
       counter += OTHER;
@@ -342,20 +382,16 @@ static Type *typespec(Token **rest, Token *tok, VarAttr *attr) {
     }
 
     // Handle built-in types.
-    if (equal(tok, "void"))
-      counter += VOID;
-    else if (equal(tok, "_Bool"))
-      counter += BOOL;
-    else if (equal(tok, "char"))
-      counter += CHAR;
-    else if (equal(tok, "short"))
-      counter += SHORT;
-    else if (equal(tok, "int"))
-      counter += INT;
-    else if (equal(tok, "long"))
-      counter += LONG;
-    else
+    switch (tok->kw) {
+    case KW_VOID:  counter += VOID;  break;
+    case KW_BOOL:  counter += BOOL;  break;
+    case KW_CHAR:  counter += CHAR;  break;
+    case KW_SHORT: counter += SHORT; break;
+    case KW_INT:   counter += INT;   break;
+    case KW_LONG:  counter += LONG;  break;
+    default:
       unreachable();
+    }
 
     switch (counter) {
     case VOID:
@@ -384,7 +420,7 @@ static Type *typespec(Token **rest, Token *tok, VarAttr *attr) {
       error_tok(tok, "invalid type");
     }
 
-    tok = tok->next;
+    tok++;
   }
 
   *rest = tok;
@@ -401,35 +437,34 @@ static Type *func_params(Token **rest, Token *tok, Type *ty) {
     if (cur != &head)
       tok = skip(tok, ",");
 
+    Token *name;
     Type *ty2 = typespec(&tok, tok, NULL);
-    ty2 = declarator(&tok, tok, ty2);
+    ty2 = declarator(&tok, tok, ty2, &name);
 
     // "array of T" is converted to "pointer to T" only in the parameter
     // context. For example, *argv[] is converted to **argv by this.
-    if (ty2->kind == TY_ARRAY) {
-      Token *name = ty2->name;
+    if (ty2->kind == TY_ARRAY)
       ty2 = pointer_to(ty2->base);
-      ty2->name = name;
-    }
 
     cur = cur->next = copy_type(ty2);
+    cur->name = name;
   }
 
   ty = func_type(ty);
   ty->params = head.next;
-  *rest = tok->next;
+  *rest = tok + 1;
   return ty;
 }
 
 // array-dimensions = num? "]" type-suffix
 static Type *array_dimensions(Token **rest, Token *tok, Type *ty) {
   if (equal(tok, "]")) {
-    ty = type_suffix(rest, tok->next, ty);
+    ty = type_suffix(rest, tok + 1, ty);
     return array_of(ty, -1);
   }
 
   int sz = get_number(tok);
-  tok = skip(tok->next, "]");
+  tok = skip(tok + 1, "]");
   ty = type_suffix(rest, tok, ty);
   return array_of(ty, sz);
 }
@@ -439,50 +474,53 @@ static Type *array_dimensions(Token **rest, Token *tok, Type *ty) {
 //             | ε
 static Type *type_suffix(Token **rest, Token *tok, Type *ty) {
   if (equal(tok, "("))
-    return func_params(rest, tok->next, ty);
+    return func_params(rest, tok + 1, ty);
 
   if (equal(tok, "["))
-    return array_dimensions(rest, tok->next, ty);
+    return array_dimensions(rest, tok + 1, ty);
 
   *rest = tok;
   return ty;
 }
 
 // declarator = "*"* ("(" ident ")" | "(" declarator ")" | ident) type-suffix
-static Type *declarator(Token **rest, Token *tok, Type *ty) {
+//
+// The declared identifier is stored to `*name` unless `name` is NULL.
+// It is not kept in the type, which may be shared.
+static Type *declarator(Token **rest, Token *tok, Type *ty, Token **name) {
   while (consume(&tok, tok, "*"))
     ty = pointer_to(ty);
 
   if (equal(tok, "(")) {
     Token *start = tok;
-    Type ignore;
-    declarator(&tok, tok->next, &ignore);
+    Type ignore = {.is_probe = true};
+    declarator(&tok, tok + 1, &ignore, NULL);
     tok = skip(tok, ")");
     ty = type_suffix(rest, tok, ty);
-    return declarator(&tok, start->next, ty);
+    return declarator(&tok, start + 1, ty, name);
   }
 
   if (tok->kind != TK_IDENT)
     error_tok(tok, "expected a variable name");
-  ty = type_suffix(rest, tok->next, ty);
-  ty->name = tok;
-  return ty;
+  if (name)
+    *name = tok;
+  return type_suffix(rest, tok + 1, ty);
 }
 
 // abstract-declarator = "*"* ("(" abstract-declarator ")")? type-suffix
 static Type *abstract_declarator(Token **rest, Token *tok, Type *ty) {
   while (equal(tok, "*")) {
     ty = pointer_to(ty);
-    tok = tok->next;
+    tok++;
   }
 
   if (equal(tok, "(")) {
     Token *start = tok;
-    Type ignore;
-    abstract_declarator(&tok, tok->next, &ignore);
+    Type ignore = {.is_probe = true};
+    abstract_declarator(&tok, tok + 1, &ignore);
     tok = skip(tok, ")");
     ty = type_suffix(rest, tok, ty);
-    return abstract_declarator(&tok, start->next, ty);
+    return abstract_declarator(&tok, start + 1, ty);
   }
 
   return type_suffix(rest, tok, ty);
@@ -505,7 +543,7 @@ static Type *enum_specifier(Token **rest, Token *tok) {
   Token *tag = NULL;
   if (tok->kind == TK_IDENT) {
     tag = tok;
-    tok = tok->next;
+    tok++;
   }
 
   if (tag && !equal(tok, "{")) {
@@ -528,11 +566,11 @@ static Type *enum_specifier(Token **rest, Token *tok) {
       tok = skip(tok, ",");
 
     char *name = get_ident(tok);
-    tok = tok->next;
+    tok++;
 
     if (equal(tok, "=")) {
-      val = get_number(tok->next);
-      tok = tok->next->next;
+      val = get_number(tok + 1);
+      tok += 2;
     }
 
     VarScope *sc = push_scope(name);
@@ -540,7 +578,7 @@ static Type *enum_specifier(Token **rest, Token *tok) {
     sc->enum_val = val++;
   }
 
-  *rest = tok->next;
+  *rest = tok + 1;
 
   if (tag)
     push_tag_scope(tag, ty);
@@ -557,39 +595,46 @@ static Node *declaration(Token **rest, Token *tok, Type *basety) {
     if (i++ > 0)
       tok = skip(tok, ",");
 
-    Type *ty = declarator(&tok, tok, basety);
+    Token *name;
+    Type *ty = declarator(&tok, tok, basety, &name);
     if (ty->size < 0)
       error_tok(tok, "variable has incomplete type");
     if (ty->kind == TY_VOID)
       error_tok(tok, "variable declared void");
 
-    Var *var = new_lvar(get_ident(ty->name), ty);
+    Var *var = new_lvar(get_ident(name), ty);
 
     if (!equal(tok, "="))
       continue;
 
-    Node *lhs = new_var_node(var, ty->name);
-    Node *rhs = assign(&tok, tok->next);
+    Node *lhs = new_var_node(var, name);
+    Node *rhs = assign(&tok, tok + 1);
     Node *node = new_binary(ND_ASSIGN, lhs, rhs, tok);
     cur = cur->next = new_unary(ND_EXPR_STMT, node, tok);
   }
 
   Node *node = new_node(ND_BLOCK, tok);
   node->body = head.next;
-  *rest = tok->next;
+  *rest = tok + 1;
   return node;
 }
 
 // Returns true if a given token represents a type.
 static bool is_typename(Token *tok) {
-  static char *kw[] = {
-    "void", "_Bool", "char", "short", "int", "long", "struct", "union",
-    "typedef", "enum", "static",
-  };
-
-  for (int i = 0; i < sizeof(kw) / sizeof(*kw); i++)
-    if (equal(tok, kw[i]))
-      return true;
+  switch (tok->kw) {
+  case KW_VOID:
+  case KW_BOOL:
+  case KW_CHAR:
+  case KW_SHORT:
+  case KW_INT:
+  case KW_LONG:
+  case KW_STRUCT:
+  case KW_UNION:
+  case KW_TYPEDEF:
+  case KW_ENUM:
+  case KW_STATIC:
+    return true;
+  }
   return find_typedef(tok);
 }
 
@@ -607,9 +652,9 @@ static bool is_typename(Token *tok) {
 //      | "{" compound-stmt
 //      | expr-stmt
 static Node *stmt(Token **rest, Token *tok) {
-  if (equal(tok, "return")) {
+  if (tok->kw == KW_RETURN) {
     Node *node = new_node(ND_RETURN, tok);
-    Node *exp = expr(&tok, tok->next);
+    Node *exp = expr(&tok, tok + 1);
     *rest = skip(tok, ";");
 
     add_type(exp);
@@ -617,21 +662,21 @@ static Node *stmt(Token **rest, Token *tok) {
     return node;
   }
 
-  if (equal(tok, "if")) {
+  if (tok->kw == KW_IF) {
     Node *node = new_node(ND_IF, tok);
-    tok = skip(tok->next, "(");
+    tok = skip(tok + 1, "(");
     node->cond = expr(&tok, tok);
     tok = skip(tok, ")");
     node->then = stmt(&tok, tok);
-    if (equal(tok, "else"))
-      node->els = stmt(&tok, tok->next);
+    if (tok->kw == KW_ELSE)
+      node->els = stmt(&tok, tok + 1);
     *rest = tok;
     return node;
   }
 
-  if (equal(tok, "switch")) {
+  if (tok->kw == KW_SWITCH) {
     Node *node = new_node(ND_SWITCH, tok);
-    tok = skip(tok->next, "(");
+    tok = skip(tok + 1, "(");
     node->cond = expr(&tok, tok);
     tok = skip(tok, ")");
 
@@ -639,7 +684,7 @@ static Node *stmt(Token **rest, Token *tok) {
     current_switch = node;
 
     char *brk = brk_label;
-    brk_label = node->brk_label = new_unique_name();
+    brk_label = node->brk_label = new_unique_name(&fn_arena);
 
     node->then = stmt(rest, tok);
 
@@ -648,43 +693,43 @@ static Node *stmt(Token **rest, Token *tok) {
     return node;
   }
 
-  if (equal(tok, "case")) {
+  if (tok->kw == KW_CASE) {
     if (!current_switch)
       error_tok(tok, "stray case");
-    int val = get_number(tok->next);
+    int val = get_number(tok + 1);
 
     Node *node = new_node(ND_CASE, tok);
-    tok = skip(tok->next->next, ":");
-    node->label = new_unique_name();
+    tok = skip(tok + 2, ":");
+    node->label = new_unique_name(&fn_arena);
     node->lhs = stmt(rest, tok);
     node->val = val;
-    node->case_next = current_switch->case_next;
-    current_switch->case_next = node;
+    node->case_next = current_switch->cases;
+    current_switch->cases = node;
     return node;
   }
 
-  if (equal(tok, "default")) {
+  if (tok->kw == KW_DEFAULT) {
     if (!current_switch)
       error_tok(tok, "stray default");
 
     Node *node = new_node(ND_CASE, tok);
-    tok = skip(tok->next, ":");
-    node->label = new_unique_name();
+    tok = skip(tok + 1, ":");
+    node->label = new_unique_name(&fn_arena);
     node->lhs = stmt(rest, tok);
     current_switch->default_case = node;
     return node;
   }
 
-  if (equal(tok, "for")) {
+  if (tok->kw == KW_FOR) {
     Node *node = new_node(ND_FOR, tok);
-    tok = skip(tok->next, "(");
+    tok = skip(tok + 1, "(");
 
     enter_scope();
 
     char *brk = brk_label;
     char *cont = cont_label;
-    brk_label = node->brk_label = new_unique_name();
-    cont_label = node->cont_label = new_unique_name();
+    brk_label = node->brk_label = new_unique_name(&fn_arena);
+    cont_label = node->cont_label = new_unique_name(&fn_arena);
 
     if (is_typename(tok)) {
       Type *basety = typespec(&tok, tok, NULL);
@@ -709,16 +754,16 @@ static Node *stmt(Token **rest, Token *tok) {
     return node;
   }
 
-  if (equal(tok, "while")) {
+  if (tok->kw == KW_WHILE) {
     Node *node = new_node(ND_FOR, tok);
-    tok = skip(tok->next, "(");
+    tok = skip(tok + 1, "(");
     node->cond = expr(&tok, tok);
     tok = skip(tok, ")");
 
     char *brk = brk_label;
     char *cont = cont_label;
-    brk_label = node->brk_label = new_unique_name();
-    cont_label = node->cont_label = new_unique_name();
+    brk_label = node->brk_label = new_unique_name(&fn_arena);
+    cont_label = node->cont_label = new_unique_name(&fn_arena);
 
     node->then = stmt(rest, tok);
 
@@ -727,45 +772,45 @@ static Node *stmt(Token **rest, Token *tok) {
     return node;
   }
 
-  if (equal(tok, "goto")) {
+  if (tok->kw == KW_GOTO) {
     Node *node = new_node(ND_GOTO, tok);
-    node->label = get_ident(tok->next);
+    node->label = get_ident(tok + 1);
     node->goto_next = gotos;
     gotos = node;
-    *rest = skip(tok->next->next, ";");
+    *rest = skip(tok + 2, ";");
     return node;
   }
 
-  if (equal(tok, "break")) {
+  if (tok->kw == KW_BREAK) {
     if (!brk_label)
       error_tok(tok, "stray break");
     Node *node = new_node(ND_GOTO, tok);
     node->unique_label = brk_label;
-    *rest = skip(tok->next, ";");
+    *rest = skip(tok + 1, ";");
     return node;
   }
 
-  if (equal(tok, "continue")) {
+  if (tok->kw == KW_CONTINUE) {
     if (!cont_label)
       error_tok(tok, "stray continue");
     Node *node = new_node(ND_GOTO, tok);
     node->unique_label = cont_label;
-    *rest = skip(tok->next, ";");
+    *rest = skip(tok + 1, ";");
     return node;
   }
 
-  if (tok->kind == TK_IDENT && equal(tok->next, ":")) {
+  if (tok->kind == TK_IDENT && equal(tok + 1, ":")) {
     Node *node = new_node(ND_LABEL, tok);
-    node->label = strndup(tok->loc, tok->len);
-    node->unique_label = new_unique_name();
-    node->lhs = stmt(rest, tok->next->next);
+    node->label = tok->sym->name;
+    node->unique_label = new_unique_name(&fn_arena);
+    node->lhs = stmt(rest, tok + 2);
     node->goto_next = labels;
     labels = node;
     return node;
   }
 
   if (equal(tok, "{"))
-    return compound_stmt(rest, tok->next);
+    return compound_stmt(rest, tok + 1);
 
   return expr_stmt(rest, tok);
 }
@@ -779,7 +824,7 @@ static Node *compound_stmt(Token **rest, Token *tok) {
   enter_scope();
 
   while (!equal(tok, "}")) {
-    if (is_typename(tok) && !equal(tok->next, ":")) {
+    if (is_typename(tok) && !equal(tok + 1, ":")) {
       VarAttr attr = {};
       Type *basety = typespec(&tok, tok, &attr);
 
@@ -798,14 +843,14 @@ static Node *compound_stmt(Token **rest, Token *tok) {
   leave_scope();
 
   node->body = head.next;
-  *rest = tok->next;
+  *rest = tok + 1;
   return node;
 }
 
 // expr-stmt = expr? ";"
 static Node *expr_stmt(Token **rest, Token *tok) {
   if (equal(tok, ";")) {
-    *rest = tok->next;
+    *rest = tok + 1;
     return new_node(ND_BLOCK, tok);
   }
 
@@ -820,19 +865,24 @@ static Node *expr(Token **rest, Token *tok) {
   Node *node = assign(&tok, tok);
 
   if (equal(tok, ","))
-    return new_binary(ND_COMMA, node, expr(rest, tok->next), tok);
+    return new_binary(ND_COMMA, node, expr(rest, tok + 1), tok);
 
   *rest = tok;
   return node;
 }
 
 // Convert `A op= B` to `tmp = &A, *tmp = *tmp op B`
-// where tmp is a fresh pointer variable.
+// where tmp is a fresh pointer variable. A variable is evaluated
+// without side effects, so `x op= B` simply becomes `x = x op B`,
+// which keeps x's address from being taken.
 static Node *to_assign(Node *binary) {
   add_type(binary->lhs);
   add_type(binary->rhs);
   Token *tok = binary->tok;
 
+  if (binary->lhs->kind == ND_VAR)
+    return new_binary(ND_ASSIGN, new_var_node(binary->lhs->var, tok), binary, tok);
+
   Var *var = new_lvar("", pointer_to(binary->lhs->ty));
 
   Node *expr1 = new_binary(ND_ASSIGN, new_var_node(var, tok),
@@ -857,37 +907,37 @@ static Node *assign(Token **rest, Token *tok) {
   Node *node = conditional(&tok, tok);
 
   if (equal(tok, "="))
-    return new_binary(ND_ASSIGN, node, assign(rest, tok->next), tok);
+    return new_binary(ND_ASSIGN, node, assign(rest, tok + 1), tok);
 
   if (equal(tok, "+="))
-    return to_assign(new_add(node, assign(rest, tok->next), tok));
+    return to_assign(new_add(node, assign(rest, tok + 1), tok));
 
   if (equal(tok, "-="))
-    return to_assign(new_sub(node, assign(rest, tok->next), tok));
+    return to_assign(new_sub(node, assign(rest, tok + 1), tok));
 
   if (equal(tok, "*="))
-    return to_assign(new_binary(ND_MUL, node, assign(rest, tok->next), tok));
+    return to_assign(new_binary(ND_MUL, node, assign(rest, tok + 1), tok));
 
   if (equal(tok, "/="))
-    return to_assign(new_binary(ND_DIV, node, assign(rest, tok->next), tok));
+    return to_assign(new_binary(ND_DIV, node, assign(rest, tok + 1), tok));
 
   if (equal(tok, "%="))
-    return to_assign(new_binary(ND_MOD, node, assign(rest, tok->next), tok));
+    return to_assign(new_binary(ND_MOD, node, assign(rest, tok + 1), tok));
 
   if (equal(tok, "&="))
-    return to_assign(new_binary(ND_BITAND, node, assign(rest, tok->next), tok));
+    return to_assign(new_binary(ND_BITAND, node, assign(rest, tok + 1), tok));
 
   if (equal(tok, "|="))
-    return to_assign(new_binary(ND_BITOR, node, assign(rest, tok->next), tok));
+    return to_assign(new_binary(ND_BITOR, node, assign(rest, tok + 1), tok));
 
   if (equal(tok, "^="))
-    return to_assign(new_binary(ND_BITXOR, node, assign(rest, tok->next), tok));
+    return to_assign(new_binary(ND_BITXOR, node, assign(rest, tok + 1), tok));
 
   if (equal(tok, "<<="))
-    return to_assign(new_binary(ND_SHL, node, assign(rest, tok->next), tok));
+    return to_assign(new_binary(ND_SHL, node, assign(rest, tok + 1), tok));
 
   if (equal(tok, ">>="))
-    return to_assign(new_binary(ND_SHR, node, assign(rest, tok->next), tok));
+    return to_assign(new_binary(ND_SHR, node, assign(rest, tok + 1), tok));
 
   *rest = tok;
   return node;
@@ -904,7 +954,7 @@ static Node *conditional(Token **rest, Token *tok) {
 
   Node *node = new_node(ND_COND, tok);
   node->cond = cond;
-  node->then = expr(&tok, tok->next);
+  node->then = expr(&tok, tok + 1);
   tok = skip(tok, ":");
   node->els = conditional(rest, tok);
   return node;
@@ -915,7 +965,7 @@ static Node *logor(Token **rest, Token *tok) {
   Node *node = logand(&tok, tok);
   while (equal(tok, "||")) {
     Token *start = tok;
-    node = new_binary(ND_LOGOR, node, logand(&tok, tok->next), start);
+    node = new_binary(ND_LOGOR, node, logand(&tok, tok + 1), start);
   }
   *rest = tok;
   return node;
@@ -926,7 +976,7 @@ static Node *logand(Token **rest, Token *tok) {
   Node *node = bitor(&tok, tok);
   while (equal(tok, "&&")) {
     Token *start = tok;
-    node = new_binary(ND_LOGAND, node, bitor(&tok, tok->next), start);
+    node = new_binary(ND_LOGAND, node, bitor(&tok, tok + 1), start);
   }
   *rest = tok;
   return node;
@@ -937,7 +987,7 @@ static Node *bitor(Token **rest, Token *tok) {
   Node *node = bitxor(&tok, tok);
   while (equal(tok, "|")) {
     Token *start = tok;
-    node = new_binary(ND_BITOR, node, bitxor(&tok, tok->next), start);
+    node = new_binary(ND_BITOR, node, bitxor(&tok, tok + 1), start);
   }
   *rest = tok;
   return node;
@@ -948,7 +998,7 @@ static Node *bitxor(Token **rest, Token *tok) {
   Node *node = bitand(&tok, tok);
   while (equal(tok, "^")) {
     Token *start = tok;
-    node = new_binary(ND_BITXOR, node, bitand(&tok, tok->next), start);
+    node = new_binary(ND_BITXOR, node, bitand(&tok, tok + 1), start);
   }
   *rest = tok;
   return node;
@@ -959,7 +1009,7 @@ static Node *bitand(Token **rest, Token *tok) {
   Node *node = equality(&tok, tok);
   while (equal(tok, "&")) {
     Token *start = tok;
-    node = new_binary(ND_BITAND, node, equality(&tok, tok->next), start);
+    node = new_binary(ND_BITAND, node, equality(&tok, tok + 1), start);
   }
   *rest = tok;
   return node;
@@ -973,12 +1023,12 @@ static Node *equality(Token **rest, Token *tok) {
     Token *start = tok;
 
     if (equal(tok, "==")) {
-      node = new_binary(ND_EQ, node, relational(&tok, tok->next), start);
+      node = new_binary(ND_EQ, node, relational(&tok, tok + 1), start);
       continue;
     }
 
     if (equal(tok, "!=")) {
-      node = new_binary(ND_NE, node, relational(&tok, tok->next), start);
+      node = new_binary(ND_NE, node, relational(&tok, tok + 1), start);
       continue;
     }
 
@@ -995,22 +1045,22 @@ static Node *relational(Token **rest, Token *tok) {
     Token *start = tok;
 
     if (equal(tok, "<")) {
-      node = new_binary(ND_LT, node, shift(&tok, tok->next), start);
+      node = new_binary(ND_LT, node, shift(&tok, tok + 1), start);
       continue;
     }
 
     if (equal(tok, "<=")) {
-      node = new_binary(ND_LE, node, shift(&tok, tok->next), start);
+      node = new_binary(ND_LE, node, shift(&tok, tok + 1), start);
       continue;
     }
 
     if (equal(tok, ">")) {
-      node = new_binary(ND_LT, shift(&tok, tok->next), node, start);
+      node = new_binary(ND_LT, shift(&tok, tok + 1), node, start);
       continue;
     }
 
     if (equal(tok, ">=")) {
-      node = new_binary(ND_LE, shift(&tok, tok->next), node, start);
+      node = new_binary(ND_LE, shift(&tok, tok + 1), node, start);
       continue;
     }
 
@@ -1027,12 +1077,12 @@ static Node *shift(Token **rest, Token *tok) {
     Token *start = tok;
 
     if (equal(tok, "<<")) {
-      node = new_binary(ND_SHL, node, add(&tok, tok->next), start);
+      node = new_binary(ND_SHL, node, add(&tok, tok + 1), start);
       continue;
     }
 
     if (equal(tok, ">>")) {
-      node = new_binary(ND_SHR, node, add(&tok, tok->next), start);
+      node = new_binary(ND_SHR, node, add(&tok, tok + 1), start);
       continue;
     }
 
@@ -1105,12 +1155,12 @@ static Node *add(Token **rest, Token *tok) {
     Token *start = tok;
 
     if (equal(tok, "+")) {
-      node = new_add(node, mul(&tok, tok->next), start);
+      node = new_add(node, mul(&tok, tok + 1), start);
       continue;
     }
 
     if (equal(tok, "-")) {
-      node = new_sub(node, mul(&tok, tok->next), start);
+      node = new_sub(node, mul(&tok, tok + 1), start);
       continue;
     }
 
@@ -1127,17 +1177,17 @@ static Node *mul(Token **rest, Token *tok) {
     Token *start = tok;
 
     if (equal(tok, "*")) {
-      node = new_binary(ND_MUL, node, cast(&tok, tok->next), start);
+      node = new_binary(ND_MUL, node, cast(&tok, tok + 1), start);
       continue;
     }
 
     if (equal(tok, "/")) {
-      node = new_binary(ND_DIV, node, cast(&tok, tok->next), start);
+      node = new_binary(ND_DIV, node, cast(&tok, tok + 1), start);
       continue;
     }
 
     if (equal(tok, "%")) {
-      node = new_binary(ND_MOD, node, cast(&tok, tok->next), start);
+      node = new_binary(ND_MOD, node, cast(&tok, tok + 1), start);
       continue;
     }
 
@@ -1148,9 +1198,9 @@ static Node *mul(Token **rest, Token *tok) {
 
 // cast = "(" type-name ")" cast | unary
 static Node *cast(Token **rest, Token *tok) {
-  if (equal(tok, "(") && is_typename(tok->next)) {
+  if (equal(tok, "(") && is_typename(tok + 1)) {
     Token *start = tok;
-    Type *ty = typename(&tok, tok->next);
+    Type *ty = typename(&tok, tok + 1);
     tok = skip(tok, ")");
     Node *node = new_cast(cast(rest, tok), ty);
     node->tok = start;
@@ -1165,30 +1215,30 @@ static Node *cast(Token **rest, Token *tok) {
 //       | postfix
 static Node *unary(Token **rest, Token *tok) {
   if (equal(tok, "+"))
-    return cast(rest, tok->next);
+    return cast(rest, tok + 1);
 
   if (equal(tok, "-"))
-    return new_binary(ND_SUB, new_num(0, tok), cast(rest, tok->next), tok);
+    return new_binary(ND_SUB, new_num(0, tok), cast(rest, tok + 1), tok);
 
   if (equal(tok, "&"))
-    return new_unary(ND_ADDR, cast(rest, tok->next), tok);
+    return new_unary(ND_ADDR, cast(rest, tok + 1), tok);
 
   if (equal(tok, "*"))
-    return new_unary(ND_DEREF, cast(rest, tok->next), tok);
+    return new_unary(ND_DEREF, cast(rest, tok + 1), tok);
 
   if (equal(tok, "!"))
-    return new_unary(ND_NOT, cast(rest, tok->next), tok);
+    return new_unary(ND_NOT, cast(rest, tok + 1), tok);
 
   if (equal(tok, "~"))
-    return new_unary(ND_BITNOT, cast(rest, tok->next), tok);
+    return new_unary(ND_BITNOT, cast(rest, tok + 1), tok);
 
   // Read ++i as i+=1
   if (equal(tok, "++"))
-    return to_assign(new_add(unary(rest, tok->next), new_num(1, tok), tok));
+    return to_assign(new_add(unary(rest, tok + 1), new_num(1, tok), tok));
 
   // Read --i as i-=1
   if (equal(tok, "--"))
-    return to_assign(new_sub(unary(rest, tok->next), new_num(1, tok), tok));
+    return to_assign(new_sub(unary(rest, tok + 1), new_num(1, tok), tok));
 
   return postfix(rest, tok);
 }
@@ -1206,15 +1256,15 @@ static void struct_members(Token **rest, Token *tok, Type *ty) {
       if (i++)
         tok = skip(tok, ",");
 
-      Member *mem = calloc(1, sizeof(Member));
-      mem->ty = declarator(&tok, tok, basety);
-      mem->name = mem->ty->name;
+      Member *mem = arena_alloc(&ast_arena, sizeof(Member));
+      mem->ty = declarator(&tok, tok, basety, &mem->name);
       cur = cur->next = mem;
     }
   }
 
-  *rest = tok->next;
+  *rest = tok + 1;
   ty->members = head.next;
+  index_members(ty);
 }
 
 // struct-union-decl = ident? ("{" struct-members)?
@@ -1223,7 +1273,7 @@ static Type *struct_union_decl(Token **rest, Token *tok) {
   Token *tag = NULL;
   if (tok->kind == TK_IDENT) {
     tag = tok;
-    tok = tok->next;
+    tok++;
   }
 
   if (tag && !equal(tok, "{")) {
@@ -1304,11 +1354,10 @@ static Type *union_decl(Token **rest, Token *tok) {
 }
 
 static Member *get_struct_member(Type *ty, Token *tok) {
-  for (Member *mem = ty->members; mem; mem = mem->next)
-    if (mem->name->len == tok->len &&
-        !strncmp(mem->name->loc, tok->loc, tok->len))
-      return mem;
-  error_tok(tok, "no such member");
+  Member *mem = tok->sym ? find_member(ty, tok->sym) : NULL;
+  if (!mem)
+    error_tok(tok, "no such member");
+  return mem;
 }
 
 static Node *struct_ref(Node *lhs, Token *tok) {
@@ -1337,35 +1386,35 @@ static Node *postfix(Token **rest, Token *tok) {
     if (equal(tok, "[")) {
       // x[y] is short for *(x+y)
       Token *start = tok;
-      Node *idx = expr(&tok, tok->next);
+      Node *idx = expr(&tok, tok + 1);
       tok = skip(tok, "]");
       node = new_unary(ND_DEREF, new_add(node, idx, start), start);
       continue;
     }
 
     if (equal(tok, ".")) {
-      node = struct_ref(node, tok->next);
-      tok = tok->next->next;
+      node = struct_ref(node, tok + 1);
+      tok += 2;
       continue;
     }
 
     if (equal(tok, "->")) {
       // x->y is short for (*x).y
       node = new_unary(ND_DEREF, node, tok);
-      node = struct_ref(node, tok->next);
-      tok = tok->next->next;
+      node = struct_ref(node, tok + 1);
+      tok += 2;
       continue;
     }
 
     if (equal(tok, "++")) {
       node = new_inc_dec(node, tok, 1);
-      tok = tok->next;
+      tok++;
       continue;
     }
 
     if (equal(tok, "--")) {
       node = new_inc_dec(node, tok, -1);
-      tok = tok->next;
+      tok++;
       continue;
     }
 
@@ -1377,7 +1426,7 @@ static Node *postfix(Token **rest, Token *tok) {
 // funcall = ident "(" (assign ("," assign)*)? ")"
 static Node *funcall(Token **rest, Token *tok) {
   Token *start = tok;
-  tok = tok->next->next;
+  tok += 2;
 
   VarScope *sc = find_var(start);
   if (!sc)
@@ -1411,7 +1460,7 @@ static Node *funcall(Token **rest, Token *tok) {
   *rest = skip(tok, ")");
 
   Node *node = new_node(ND_FUNCALL, start);
-  node->funcname = strndup(start->loc, start->len);
+  node->funcname = start->sym->name;
   node->func_ty = ty;
   node->ty = ty->return_ty;
   node->args = head.next;
@@ -1428,35 +1477,35 @@ static Node *funcall(Token **rest, Token *tok) {
 static Node *primary(Token **rest, Token *tok) {
   Token *start = tok;
 
-  if (equal(tok, "(") && equal(tok->next, "{")) {
+  if (equal(tok, "(") && equal(tok + 1, "{")) {
     // This is a GNU statement expresssion.
     Node *node = new_node(ND_STMT_EXPR, tok);
-    node->body = compound_stmt(&tok, tok->next->next)->body;
+    node->body = compound_stmt(&tok, tok + 2)->body;
     *rest = skip(tok, ")");
     return node;
   }
 
   if (equal(tok, "(")) {
-    Node *node = expr(&tok, tok->next);
+    Node *node = expr(&tok, tok + 1);
     *rest = skip(tok, ")");
     return node;
   }
 
-  if (equal(tok, "sizeof") && equal(tok->next, "(") && is_typename(tok->next->next)) {
-    Type *ty = typename(&tok, tok->next->next);
+  if (tok->kw == KW_SIZEOF && equal(tok + 1, "(") && is_typename(tok + 2)) {
+    Type *ty = typename(&tok, tok + 2);
     *rest = skip(tok, ")");
     return new_num(ty->size, start);
   }
 
-  if (equal(tok, "sizeof")) {
-    Node *node = unary(rest, tok->next);
+  if (tok->kw == KW_SIZEOF) {
+    Node *node = unary(rest, tok + 1);
     add_type(node);
     return new_num(node->ty->size, tok);
   }
 
   if (tok->kind == TK_IDENT) {
     // Function call
-    if (equal(tok->next, "("))
+    if (equal(tok + 1, "("))
       return funcall(rest, tok);
 
     // Variable or enum constant
@@ -1470,19 +1519,19 @@ static Node *primary(Token **rest, Token *tok) {
     else
       node = new_num(sc->enum_val, tok);
 
-    *rest = tok->next;
+    *rest = tok + 1;
     return node;
   }
 
   if (tok->kind == TK_STR) {
     Var *var = new_string_literal(tok->str, tok->ty);
-    *rest = tok->next;
+    *rest = tok + 1;
     return new_var_node(var, tok);
   }
 
   if (tok->kind == TK_NUM) {
     Node *node = new_num(tok->val, tok);
-    *rest = tok->next;
+    *rest = tok + 1;
     return node;
   }
 
@@ -1497,8 +1546,9 @@ static Token *parse_typedef(Token *tok, Type *basety) {
       tok = skip(tok, ",");
     first = false;
 
-    Type *ty = declarator(&tok, tok, basety);
-    push_scope(get_ident(ty->name))->type_def = ty;
+    Token *name;
+    Type *ty = declarator(&tok, tok, basety, &name);
+    push_scope(get_ident(name))->type_def = ty;
   }
   return tok;
 }
@@ -1518,29 +1568,32 @@ static void create_param_lvars(Type *param) {
 static void resolve_goto_labels(void) {
   for (Node *x = gotos; x; x = x->goto_next) {
     for (Node *y = labels; y; y = y->goto_next) {
-      if (!strcmp(x->label, y->label)) {
+      if (x->label == y->label) {
         x->unique_label = y->unique_label;
         break;
       }
     }
 
     if (x->unique_label == NULL)
-      error_tok(x->tok->next, "use of undeclared label");
+      error_tok(x->tok + 1, "use of undeclared label");
   }
 
   gotos = labels = NULL;
 }
 
-static Token *function(Token *tok, Type *basety, VarAttr *attr) {
-  Type *ty = declarator(&tok, tok, basety);
+static Var *function(Token **rest, Token *tok, Type *basety, VarAttr *attr) {
+  Token *name;
+  Type *ty = declarator(&tok, tok, basety, &name);
 
-  Var *fn = new_gvar(get_ident(ty->name), ty);
+  Var *fn = new_gvar(get_ident(name), ty);
   fn->is_function = true;
   fn->is_definition = !consume(&tok, tok, ";");
   fn->is_static = attr->is_static;
 
-  if (!fn->is_definition)
-    return tok;
+  if (!fn->is_definition) {
+    *rest = tok;
+    return fn;
+  }
 
   current_fn = fn;
   locals = NULL;
@@ -1553,7 +1606,23 @@ static Token *function(Token *tok, Type *basety, VarAttr *attr) {
   fn->locals = locals;
   leave_scope();
   resolve_goto_labels();
-  return tok;
+  fold_function(fn);
+  *rest = tok;
+  return fn;
+}
+
+// Emits a function definition as soon as it has been parsed and frees
+// its nodes and locals, so that only one function's AST is in memory
+// at a time. The function itself stays among the globals.
+static void emit_function(Var *fn, FILE *out) {
+  if (out)
+    codegen_function(fn, out);
+
+  fn->params = fn->locals = NULL;
+  fn->body = NULL;
+  current_fn = NULL;
+  locals = NULL;
+  arena_rewind(&fn_arena);
 }
 
 static Token *global_variable(Token *tok, Type *basety) {
@@ -1564,8 +1633,9 @@ static Token *global_variable(Token *tok, Type *basety) {
       tok = skip(tok, ",");
     first = false;
 
-    Type *ty = declarator(&tok, tok, basety);
-    new_gvar(get_ident(ty->name), ty);
+    Token *name;
+    Type *ty = declarator(&tok, tok, basety, &name);
+    new_gvar(get_ident(name), ty);
   }
   return tok;
 }
@@ -1576,13 +1646,17 @@ static bool is_function(Token *tok) {
   if (equal(tok, ";"))
     return false;
 
-  Type dummy = {};
-  Type *ty = declarator(&tok, tok, &dummy);
+  Type dummy = {.is_probe = true};
+  Type *ty = declarator(&tok, tok, &dummy, NULL);
   return ty->kind == TY_FUNC;
 }
 
 // program = (typedef | function-definition | global-variable)*
-Var *parse(Token *tok) {
+//
+// Each function definition is compiled to `out` right after it is
+// parsed, or only checked if `out` is NULL. The globals are returned
+// for codegen_data().
+Var *parse(Token *tok, FILE *out) {
   globals = NULL;
 
   while (tok->kind != TK_EOF) {
@@ -1597,7 +1671,9 @@ Var *parse(Token *tok) {
 
     // Function
     if (is_function(tok)) {
-      tok = function(tok, basety, &attr);
+      Var *fn = function(&tok, tok, basety, &attr);
+      if (fn->is_definition)
+        emit_function(fn, out);
       continue;
     }
 
@@ -1605,5 +1681,9 @@ Var *parse(Token *tok) {
     tok = global_variable(tok, basety);
 
   }
+
+  // Nothing refers to the scopes once the whole file is parsed.
+  *scope = (Scope){.vars.arena = &scope_arena, .tags.arena = &scope_arena};
+  arena_reset(&scope_arena);
   return globals;
 }
@@ -0,0 +1,852 @@
+// This file cleans up the instructions of a function before they are
+// written out.
+//
+// Both code generators print assembly a line at a time and never look
+// back, so their output is full of waste that is obvious from a few
+// lines away: a value pushed only to be popped into another register,
+// an address computed into %rax only to be dereferenced, a boolean
+// materialized only to be compared with zero. While a function is being
+// generated, println() therefore appends its lines to a buffer here.
+// When the function is done, flush_lines() runs the rules below over
+// the buffer until none of them applies, then writes out what is left.
+//
+// Each rule matches a short window of instructions and replaces it with
+// fewer or cheaper ones. Rules that need a register or the flags to be
+// dead afterwards scan forward, following jumps, for an instruction
+// that reads or overwrites them, and assume the value is live if the
+// scan runs out of lines. Rules that move code never look past a label,
+// since another path may join there.
+//
+// Every rule counts how often it fires; --peephole-stats prints them.
+
+#include "chibicc.h"
+
+bool opt_peephole = true;
+
+// Registers, in the order of their encoding, and the flags.
+enum {
+  RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+  R8, R9, R10, R11, R12, R13, R14, R15,
+  FLAGS,
+};
+
+#define BIT(r) (1u << (r))
+#define ALL_REGS (BIT(FLAGS + 1) - 1)
+#define ARG_REGS (BIT(RDI) | BIT(RSI) | BIT(RDX) | BIT(RCX) | BIT(R8) | BIT(R9))
+#define CALLER_SAVED (ARG_REGS | BIT(RAX) | BIT(R10) | BIT(R11) | BIT(FLAGS))
+#define CALLEE_SAVED (BIT(RBX) | BIT(RSP) | BIT(RBP) | BIT(R12) | BIT(R13) | BIT(R14) | BIT(R15))
+
+// How far liveness scans look before they give up
+#define SCAN_LIMIT 64
+
+static char *reg_names[][4] = {
+  {"%rax", "%eax", "%ax", "%al"},     {"%rcx", "%ecx", "%cx", "%cl"},
+  {"%rdx", "%edx", "%dx", "%dl"},     {"%rbx", "%ebx", "%bx", "%bl"},
+  {"%rsp", "%esp", "%sp", "%spl"},    {"%rbp", "%ebp", "%bp", "%bpl"},
+  {"%rsi", "%esi", "%si", "%sil"},    {"%rdi", "%edi", "%di", "%dil"},
+  {"%r8", "%r8d", "%r8w", "%r8b"},    {"%r9", "%r9d", "%r9w", "%r9b"},
+  {"%r10", "%r10d", "%r10w", "%r10b"}, {"%r11", "%r11d", "%r11w", "%r11b"},
+  {"%r12", "%r12d", "%r12w", "%r12b"}, {"%r13", "%r13d", "%r13w", "%r13b"},
+  {"%r14", "%r14d", "%r14w", "%r14b"}, {"%r15", "%r15d", "%r15w", "%r15b"},
+};
+
+static int reg_sizes[] = {8, 4, 2, 1};
+
+typedef enum {
+  OPND_REG, // %rax
+  OPND_IMM, // $42
+  OPND_MEM, // -8(%rbp)
+  OPND_SYM, // Jump and call targets
+} OperandKind;
+
+typedef struct {
+  OperandKind kind;
+  char *text;
+  int reg;       // Register, and its size in bytes
+  int size;
+  long imm;      // Immediate
+  unsigned regs; // Registers read to compute the operand
+} Operand;
+
+typedef enum {
+  LN_INSN,
+  LN_LABEL,
+  LN_DIRECTIVE,
+  LN_DELETED,
+} LineKind;
+
+typedef struct {
+  LineKind kind;
+  char *text;       // As printed, without the newline
+  char *op;         // Mnemonic, or the name of a label
+  Operand opnds[3];
+  int nopnds;
+  unsigned use;     // Registers read
+  unsigned def;     // Registers overwritten without being read
+} Line;
+
+static Line *lines;
+static int nlines;
+static int lines_capacity;
+
+// Indices of the labels, sorted by name
+static int *labels;
+static int nlabels;
+
+// Lines kept in the buffer while a function is generated
+static bool buffering;
+
+typedef struct {
+  char *name;
+  bool (*apply)(int i);
+  long hits;
+} Rule;
+
+static long lines_in;
+static long lines_out;
+
+//
+// Parsing
+//
+
+static char *copy(char *s, int len) {
+  char *p = arena_alloc(&fn_arena, len + 1);
+  memcpy(p, s, len);
+  return p;
+}
+
+static bool find_reg(char *s, int len, int *reg, int *size) {
+  for (int i = 0; i < sizeof(reg_names) / sizeof(*reg_names); i++) {
+    for (int j = 0; j < 4; j++) {
+      char *name = reg_names[i][j];
+      if (name[1] == s[1] && !strncmp(name, s, len) && name[len] == '\0') {
+        *reg = i;
+        *size = reg_sizes[j];
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+static int reg_len(char *s) {
+  int len = 1;
+  while (isalnum(s[len]))
+    len++;
+  return len;
+}
+
+static Operand parse_operand(char *s, int len) {
+  Operand o = {OPND_SYM, copy(s, len)};
+  char *end;
+
+  if (s[0] == '$') {
+    o.imm = strtol(s + 1, &end, 10);
+    if (end == s + len)
+      o.kind = OPND_IMM;
+    return o;
+  }
+
+  if (s[0] == '%') {
+    if (find_reg(s, len, &o.reg, &o.size)) {
+      o.kind = OPND_REG;
+      o.regs = BIT(o.reg);
+    }
+    return o;
+  }
+
+  if (memchr(s, '(', len)) {
+    o.kind = OPND_MEM;
+    for (char *p = s; p < s + len; p++) {
+      int reg, size;
+      if (*p == '%' && find_reg(p, reg_len(p), &reg, &size))
+        o.regs |= BIT(reg);
+    }
+  }
+  return o;
+}
+
+static bool is_mov(char *op) {
+  return !strcmp(op, "mov") || !strcmp(op, "lea") ||
+         !strncmp(op, "movs", 4) || !strncmp(op, "movz", 4);
+}
+
+static bool is_alu(char *op) {
+  static char *ops[] = {"add", "sub", "and", "or", "xor", "imul", "adc", "sbb"};
+  for (int i = 0; i < sizeof(ops) / sizeof(*ops); i++)
+    if (!strcmp(op, ops[i]))
+      return true;
+  return false;
+}
+
+static bool is_jump(Line *l) {
+  return l->kind == LN_INSN && l->op[0] == 'j';
+}
+
+// Computes which registers an instruction reads and which it
+// overwrites. Writing a 32-bit register clears the upper half, so it
+// counts as overwriting the whole register, but writing a byte or a
+// word does not.
+static void set_effects(Line *l) {
+  Operand *src = &l->opnds[0];
+  Operand *dst = &l->opnds[l->nopnds ? l->nopnds - 1 : 0];
+  char *op = l->op;
+  unsigned dst_reg = (l->nopnds && dst->kind == OPND_REG) ? BIT(dst->reg) : 0;
+  bool full = dst->kind == OPND_REG && dst->size >= 4;
+
+  l->use = 0;
+  l->def = 0;
+  for (int i = 0; i < l->nopnds; i++)
+    if (l->opnds[i].kind == OPND_MEM)
+      l->use |= l->opnds[i].regs;
+
+  if (is_mov(op) && l->nopnds == 2) {
+    l->use |= src->regs;
+    if (full)
+      l->def |= dst_reg;
+    else
+      l->use |= dst_reg;
+  } else if (is_alu(op) && l->nopnds == 2) {
+    l->use |= src->regs | dst->regs;
+    if (!strcmp(op, "adc") || !strcmp(op, "sbb"))
+      l->use |= BIT(FLAGS);
+    else
+      l->def |= BIT(FLAGS);
+  } else if (!strcmp(op, "imul") && l->nopnds == 3) {
+    l->use |= src->regs | l->opnds[1].regs;
+    l->def |= BIT(FLAGS) | (full ? dst_reg : 0);
+    if (!full)
+      l->use |= dst_reg;
+  } else if ((!strcmp(op, "cmp") || !strcmp(op, "test")) && l->nopnds == 2) {
+    l->use |= src->regs | dst->regs;
+    l->def |= BIT(FLAGS);
+  } else if (!strcmp(op, "push") && l->nopnds == 1) {
+    l->use |= src->regs | BIT(RSP);
+  } else if (!strcmp(op, "pop") && l->nopnds == 1) {
+    l->use |= BIT(RSP);
+    l->def |= dst_reg;
+  } else if (!strncmp(op, "set", 3) && l->nopnds == 1) {
+    l->use |= BIT(FLAGS) | dst_reg;
+  } else if (!strncmp(op, "cmov", 4) && l->nopnds == 2) {
+    l->use |= BIT(FLAGS) | src->regs | dst_reg;
+  } else if ((!strcmp(op, "cqo") || !strcmp(op, "cdq")) && l->nopnds == 0) {
+    l->use |= BIT(RAX);
+    l->def |= BIT(RDX);
+  } else if ((!strcmp(op, "imul") || !strcmp(op, "mul")) && l->nopnds == 1) {
+    // %rdx:%rax = %rax * operand
+    l->use |= BIT(RAX) | src->regs;
+    l->def |= BIT(RDX) | BIT(FLAGS);
+  } else if ((!strcmp(op, "idiv") || !strcmp(op, "div")) && l->nopnds == 1) {
+    l->use |= BIT(RAX) | BIT(RDX) | src->regs;
+    l->def |= BIT(FLAGS);
+  } else if (!strcmp(op, "shl") || !strcmp(op, "sal") || !strcmp(op, "sar") || !strcmp(op, "shr")) {
+    // A shift by zero leaves the flags alone, so they are read too.
+    for (int i = 0; i < l->nopnds; i++)
+      l->use |= l->opnds[i].regs;
+    l->use |= BIT(FLAGS);
+  } else if ((!strcmp(op, "not") || !strcmp(op, "neg")) && l->nopnds == 1) {
+    l->use |= dst_reg;
+    if (!strcmp(op, "neg"))
+      l->def |= BIT(FLAGS);
+  } else if (!strcmp(op, "call")) {
+    l->use |= ARG_REGS | BIT(RAX) | BIT(RSP);
+    l->def |= CALLER_SAVED;
+  } else if (!strcmp(op, "ret")) {
+    l->use |= BIT(RAX) | CALLEE_SAVED;
+  } else if (op[0] == 'j') {
+    if (strcmp(op, "jmp"))
+      l->use |= BIT(FLAGS);
+  } else {
+    // Anything else might read anything.
+    l->use = ALL_REGS;
+  }
+}
+
+static void parse_line(Line *l, char *text) {
+  *l = (Line){LN_INSN, text};
+
+  if (text[0] != ' ') {
+    l->kind = LN_LABEL;
+    l->op = copy(text, strlen(text) - 1);
+    return;
+  }
+
+  char *p = text;
+  while (*p == ' ')
+    p++;
+  if (*p == '.') {
+    l->kind = LN_DIRECTIVE;
+    return;
+  }
+
+  char *start = p;
+  while (*p && *p != ' ')
+    p++;
+  l->op = copy(start, p - start);
+
+  // Operands are separated by commas outside parentheses.
+  while (*p) {
+    while (*p == ' ')
+      p++;
+    if (!*p || l->nopnds == 3)
+      break;
+    start = p;
+    int depth = 0;
+    while (*p && (depth || *p != ',')) {
+      if (*p == '(')
+        depth++;
+      else if (*p == ')')
+        depth--;
+      p++;
+    }
+    char *end = p;
+    while (end > start && end[-1] == ' ')
+      end--;
+    l->opnds[l->nopnds++] = parse_operand(start, end - start);
+    if (*p == ',')
+      p++;
+  }
+
+  set_effects(l);
+}
+
+//
+// Buffering
+//
+
+// Appends a line of output while a function is being generated, or
+// returns false if lines go straight to the file.
+bool buffer_line(char *fmt, va_list ap) {
+  if (!buffering)
+    return false;
+
+  va_list ap2;
+  va_copy(ap2, ap);
+  int len = vsnprintf(NULL, 0, fmt, ap2);
+  va_end(ap2);
+  char *text = arena_alloc(&fn_arena, len + 1);
+  vsnprintf(text, len + 1, fmt, ap);
+
+  if (nlines == lines_capacity) {
+    lines_capacity = lines_capacity ? lines_capacity * 2 : 256;
+    lines = realloc(lines, sizeof(Line) * lines_capacity);
+    if (!lines)
+      error("out of memory");
+  }
+  parse_line(&lines[nlines], text);
+  if (lines[nlines++].kind == LN_INSN)
+    lines_in++;
+  return true;
+}
+
+static void rewrite(int i, char *fmt, ...) {
+  va_list ap, ap2;
+  va_start(ap, fmt);
+  va_copy(ap2, ap);
+  int len = vsnprintf(NULL, 0, fmt, ap2);
+  va_end(ap2);
+  char *text = arena_alloc(&fn_arena, len + 1);
+  vsnprintf(text, len + 1, fmt, ap);
+  va_end(ap);
+  parse_line(&lines[i], text);
+}
+
+static void delete_line(int i) {
+  lines[i].kind = LN_DELETED;
+}
+
+// Returns the instruction or label after line `i`, or -1.
+static int next_line(int i) {
+  for (i++; i < nlines; i++)
+    if (lines[i].kind == LN_INSN || lines[i].kind == LN_LABEL)
+      return i;
+  return -1;
+}
+
+// Returns the instruction or label before line `i`, or -1.
+static int prev_line(int i) {
+  for (i--; i >= 0; i--)
+    if (lines[i].kind == LN_INSN || lines[i].kind == LN_LABEL)
+      return i;
+  return -1;
+}
+
+static bool insn_at(int i, char *op) {
+  return i >= 0 && lines[i].kind == LN_INSN && !strcmp(lines[i].op, op);
+}
+
+//
+// Liveness
+//
+
+static int compare_labels(const void *a, const void *b) {
+  return strcmp(lines[*(int *)a].op, lines[*(int *)b].op);
+}
+
+static void index_labels(void) {
+  labels = arena_alloc(&fn_arena, sizeof(int) * (nlines + 1));
+  nlabels = 0;
+  for (int i = 0; i < nlines; i++)
+    if (lines[i].kind == LN_LABEL)
+      labels[nlabels++] = i;
+  qsort(labels, nlabels, sizeof(int), compare_labels);
+}
+
+static int find_label(char *name) {
+  int lo = 0, hi = nlabels;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    int c = strcmp(lines[labels[mid]].op, name);
+    if (c == 0)
+      return labels[mid];
+    if (c < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return -1;
+}
+
+static bool dead_after(int i, unsigned regs, int *budget) {
+  for (int j = i + 1; j < nlines; j++) {
+    Line *l = &lines[j];
+    if (l->kind != LN_INSN)
+      continue;
+    if (--*budget < 0 || (l->use & regs))
+      return false;
+
+    regs &= ~l->def;
+    if (!regs || !strcmp(l->op, "ret"))
+      return true;
+
+    if (is_jump(l)) {
+      int k = find_label(l->opnds[0].text);
+      if (k < 0)
+        return false;
+      if (!strcmp(l->op, "jmp"))
+        j = k;
+      else if (!dead_after(k, regs, budget))
+        return false;
+    }
+  }
+  return false;
+}
+
+// Returns true if no path from after line `i` reads `regs` before
+// overwriting them.
+static bool is_dead(int i, unsigned regs) {
+  int budget = SCAN_LIMIT;
+  return dead_after(i, regs, &budget);
+}
+
+//
+// Rules
+//
+
+// push %rax; ...; pop %rdi  =>  mov %rax, %rdi; ...
+//
+// The lines in between must leave the stack and %rdi alone.
+static bool push_pop(int i) {
+  Line *push = &lines[i];
+  if (strcmp(push->op, "push") || push->opnds[0].kind != OPND_REG)
+    return false;
+
+  unsigned touched = 0;
+  for (int j = next_line(i); j >= 0; j = next_line(j)) {
+    Line *l = &lines[j];
+    if (l->kind == LN_LABEL || is_jump(l))
+      return false;
+
+    if (!strcmp(l->op, "pop")) {
+      Operand *dst = &l->opnds[0];
+      if (dst->kind != OPND_REG || (touched & dst->regs))
+        return false;
+      if (dst->reg == push->opnds[0].reg)
+        delete_line(i);
+      else
+        rewrite(i, "  mov %s, %s", push->opnds[0].text, dst->text);
+      delete_line(j);
+      return true;
+    }
+
+    if (l->use & BIT(RSP))
+      return false;
+    touched |= l->use | l->def;
+    for (int k = 0; k < l->nopnds; k++)
+      if (l->opnds[k].kind == OPND_REG)
+        touched |= l->opnds[k].regs;
+  }
+  return false;
+}
+
+// lea -8(%rbp), %rax; movsxd (%rax), %rax  =>  movsxd -8(%rbp), %rax
+//
+// The instruction that dereferences the address may come later, as
+// long as nothing in between uses the register.
+static bool fold_lea(int i) {
+  Line *lea = &lines[i];
+  if (strcmp(lea->op, "lea") || lea->opnds[1].kind != OPND_REG || lea->opnds[1].size != 8)
+    return false;
+  int reg = lea->opnds[1].reg;
+  unsigned addr = lea->opnds[0].regs;
+  if (addr & BIT(reg))
+    return false;
+
+  char deref[8];
+  snprintf(deref, sizeof(deref), "(%s)", reg_names[reg][0]);
+
+  for (int j = next_line(i); j >= 0; j = next_line(j)) {
+    Line *l = &lines[j];
+    if (l->kind == LN_LABEL || is_jump(l))
+      return false;
+
+    if (!((l->use | l->def) & BIT(reg))) {
+      if (l->def & addr)
+        return false;
+      continue;
+    }
+
+    // This is the first use. The register must appear only as the
+    // address, or as the destination that overwrites it.
+    if (!(is_mov(l->op) || is_alu(l->op) || !strcmp(l->op, "cmp")) || l->nopnds != 2)
+      return false;
+
+    int k = -1;
+    for (int n = 0; n < 2; n++) {
+      Operand *o = &l->opnds[n];
+      if (o->kind == OPND_MEM && !strcmp(o->text, deref))
+        k = n;
+      else if (o->regs & BIT(reg) && !(n == 1 && (l->def & BIT(reg))))
+        return false;
+    }
+    if (k < 0 || (!(l->def & BIT(reg)) && !is_dead(j, BIT(reg))))
+      return false;
+
+    char *src = (k == 0) ? lea->opnds[0].text : l->opnds[0].text;
+    char *dst = (k == 1) ? lea->opnds[0].text : l->opnds[1].text;
+    rewrite(j, "  %s %s, %s", l->op, src, dst);
+    delete_line(i);
+    return true;
+  }
+  return false;
+}
+
+// mov $2, %rax; mov %rax, %rdi  =>  mov $2, %rdi
+//
+// Moves a value straight into the register it is copied to, if the
+// first register is not needed afterwards.
+static bool retarget(int i) {
+  Line *l = &lines[i];
+  if (!is_mov(l->op) || l->nopnds != 2 || l->opnds[1].kind != OPND_REG ||
+      !(l->def & l->opnds[1].regs))
+    return false;
+
+  int j = next_line(i);
+  if (!insn_at(j, "mov"))
+    return false;
+  Operand *from = &lines[j].opnds[0];
+  Operand *to = &lines[j].opnds[1];
+  if (from->kind != OPND_REG || to->kind != OPND_REG || from->size != 8 || to->size != 8 ||
+      from->reg != l->opnds[1].reg || to->reg == from->reg || (l->opnds[0].regs & to->regs))
+    return false;
+  if (!is_dead(j, from->regs))
+    return false;
+
+  int size = l->opnds[1].size;
+  rewrite(i, "  %s %s, %s", l->op, l->opnds[0].text, reg_names[to->reg][size == 8 ? 0 : 1]);
+  delete_line(j);
+  return true;
+}
+
+static bool takes_imm(char *op) {
+  static char *ops[] = {"mov", "add", "sub", "and", "or", "xor", "imul", "cmp"};
+  for (int i = 0; i < sizeof(ops) / sizeof(*ops); i++)
+    if (!strcmp(op, ops[i]))
+      return true;
+  return false;
+}
+
+// mov $2, %rdi; ...; sub %edi, %eax  =>  ...; sub $2, %eax
+static bool fold_imm(int i) {
+  Line *mov = &lines[i];
+  if (strcmp(mov->op, "mov") || mov->opnds[0].kind != OPND_IMM ||
+      mov->opnds[1].kind != OPND_REG || mov->opnds[1].size < 4)
+    return false;
+  int reg = mov->opnds[1].reg;
+
+  // A 32-bit move clears the upper half.
+  long val = mov->opnds[0].imm;
+  if (mov->opnds[1].size == 4)
+    val = (uint32_t)val;
+
+  for (int j = next_line(i); j >= 0; j = next_line(j)) {
+    Line *l = &lines[j];
+    if (l->kind == LN_LABEL || is_jump(l))
+      return false;
+    if (!((l->use | l->def) & BIT(reg)))
+      continue;
+
+    Operand *src = &l->opnds[0];
+    Operand *dst = &l->opnds[1];
+    if (!takes_imm(l->op) || l->nopnds != 2 || src->kind != OPND_REG || src->reg != reg ||
+        src->size < 4 || dst->kind != OPND_REG || dst->reg == reg)
+      return false;
+
+    long v = (src->size == 4) ? (int32_t)val : val;
+    if (v != (int32_t)v && strcmp(l->op, "mov"))
+      return false;
+    if (!is_dead(j, BIT(reg)))
+      return false;
+
+    rewrite(j, "  %s $%ld, %s", l->op, v, dst->text);
+    delete_line(i);
+    return true;
+  }
+  return false;
+}
+
+static bool is_test_zero(Line *l) {
+  return l->kind == LN_INSN && !strcmp(l->op, "cmp") && l->nopnds == 2 &&
+         l->opnds[0].kind == OPND_IMM && l->opnds[0].imm == 0 &&
+         l->opnds[1].kind == OPND_REG && l->opnds[1].size >= 4;
+}
+
+static bool is_branch_on_zero(int i) {
+  return insn_at(i, "je") || insn_at(i, "jne");
+}
+
+// mov $0, %rax; cmp $0, %rax; je L  =>  mov $0, %rax; jmp L
+static bool const_branch(int i) {
+  if (!is_test_zero(&lines[i]))
+    return false;
+
+  int p = prev_line(i);
+  int j = next_line(i);
+  if (!insn_at(p, "mov") || !is_branch_on_zero(j))
+    return false;
+
+  Operand *src = &lines[p].opnds[0];
+  Operand *dst = &lines[p].opnds[1];
+  if (src->kind != OPND_IMM || dst->kind != OPND_REG || dst->reg != lines[i].opnds[1].reg)
+    return false;
+  if (!is_dead(j, BIT(FLAGS)))
+    return false;
+
+  bool narrow = dst->size == 4 || lines[i].opnds[1].size == 4;
+  bool zero = narrow ? (int32_t)src->imm == 0 : src->imm == 0;
+  bool taken = (lines[j].op[1] == 'e') == zero;
+
+  if (taken)
+    rewrite(j, "  jmp %s", lines[j].opnds[0].text);
+  else
+    delete_line(j);
+  delete_line(i);
+  return true;
+}
+
+static char *invert_cc(char *cc) {
+  static char *pairs[][2] = {
+    {"e", "ne"}, {"z", "nz"}, {"l", "ge"}, {"le", "g"},
+    {"b", "ae"}, {"be", "a"}, {"s", "ns"}, {"o", "no"},
+  };
+  for (int i = 0; i < sizeof(pairs) / sizeof(*pairs); i++) {
+    if (!strcmp(cc, pairs[i][0]))
+      return pairs[i][1];
+    if (!strcmp(cc, pairs[i][1]))
+      return pairs[i][0];
+  }
+  return NULL;
+}
+
+// setl %al; movzb %al, %rax; cmp $0, %rax; je L  =>  setl %al; movzb %al, %rax; jge L
+//
+// movzb leaves the flags alone, so the branch can test the comparison
+// that set %al directly.
+static bool setcc_branch(int i) {
+  if (!is_test_zero(&lines[i]))
+    return false;
+
+  int p = prev_line(i);
+  int q = prev_line(p);
+  int j = next_line(i);
+  if (p < 0 || q < 0 || lines[p].kind != LN_INSN || lines[q].kind != LN_INSN ||
+      !is_branch_on_zero(j))
+    return false;
+
+  Line *ext = &lines[p];
+  Line *set = &lines[q];
+  if (strncmp(ext->op, "movz", 4) || ext->opnds[0].kind != OPND_REG || ext->opnds[0].size != 1 ||
+      ext->opnds[1].kind != OPND_REG || ext->opnds[1].reg != lines[i].opnds[1].reg)
+    return false;
+  if (strncmp(set->op, "set", 3) || set->opnds[0].kind != OPND_REG ||
+      set->opnds[0].reg != ext->opnds[0].reg || set->opnds[0].size != 1)
+    return false;
+
+  char *cc = set->op + 3;
+  if (!strcmp(lines[j].op, "je"))
+    cc = invert_cc(cc);
+  if (!cc || !is_dead(j, BIT(FLAGS)))
+    return false;
+
+  rewrite(j, "  j%s %s", cc, lines[j].opnds[0].text);
+  delete_line(i);
+  return true;
+}
+
+// Returns the number of bytes a move reads from memory.
+static int load_size(Line *l) {
+  char *op = l->op;
+  if (!strcmp(op, "mov"))
+    return l->opnds[1].size;
+  if (!strcmp(op, "movsxd") || !strcmp(op, "movslq"))
+    return 4;
+  if (!strncmp(op, "movsb", 5) || !strncmp(op, "movzb", 5))
+    return 1;
+  if (!strncmp(op, "movsw", 5) || !strncmp(op, "movzw", 5))
+    return 2;
+  return 0;
+}
+
+// mov %eax, -4(%rbp); movsxd -4(%rbp), %rax  =>  mov %eax, -4(%rbp); movslq %eax, %rax
+static bool store_reload(int i) {
+  Line *store = &lines[i];
+  if (strcmp(store->op, "mov") || store->opnds[0].kind != OPND_REG ||
+      store->opnds[1].kind != OPND_MEM)
+    return false;
+
+  int j = next_line(i);
+  if (j < 0 || lines[j].kind != LN_INSN)
+    return false;
+  Line *load = &lines[j];
+  if (!is_mov(load->op) || !strcmp(load->op, "lea") || load->opnds[0].kind != OPND_MEM ||
+      load->opnds[1].kind != OPND_REG || strcmp(load->opnds[0].text, store->opnds[1].text) ||
+      load_size(load) != store->opnds[0].size)
+    return false;
+
+  if (!strcmp(load->op, "mov") && load->opnds[1].reg == store->opnds[0].reg) {
+    delete_line(j);
+    return true;
+  }
+
+  char *op = !strcmp(load->op, "movsxd") ? "movslq" : load->op;
+  rewrite(j, "  %s %s, %s", op, store->opnds[0].text, load->opnds[1].text);
+  return true;
+}
+
+// Deletes a move or an arithmetic instruction whose result is
+// overwritten before it is read.
+static bool dead_move(int i) {
+  Line *l = &lines[i];
+  bool alu = is_alu(l->op) && strcmp(l->op, "adc") && strcmp(l->op, "sbb") && l->nopnds >= 2;
+  if ((!is_mov(l->op) && strncmp(l->op, "set", 3) && !alu) || l->nopnds == 0)
+    return false;
+
+  Operand *dst = &l->opnds[l->nopnds - 1];
+  if (dst->kind != OPND_REG || dst->reg == RSP || dst->reg == RBP)
+    return false;
+  if (!is_dead(i, dst->regs | (alu ? BIT(FLAGS) : 0)))
+    return false;
+  delete_line(i);
+  return true;
+}
+
+// add $0, %rax  =>  (nothing), if the flags are not needed
+static bool add_zero(int i) {
+  Line *l = &lines[i];
+  if ((strcmp(l->op, "add") && strcmp(l->op, "sub")) || l->nopnds != 2 ||
+      l->opnds[0].kind != OPND_IMM || l->opnds[0].imm != 0 || l->opnds[1].kind != OPND_REG)
+    return false;
+  if (l->opnds[1].size == 4 || !is_dead(i, BIT(FLAGS)))
+    return false;
+  delete_line(i);
+  return true;
+}
+
+// jmp L; L:  =>  L:
+static bool jump_to_next(int i) {
+  if (!is_jump(&lines[i]))
+    return false;
+  for (int j = next_line(i); j >= 0 && lines[j].kind == LN_LABEL; j = next_line(j)) {
+    if (!strcmp(lines[j].op, lines[i].opnds[0].text)) {
+      delete_line(i);
+      return true;
+    }
+  }
+  return false;
+}
+
+// Deletes the instructions between a jump or a return and the next
+// label, which nothing can reach.
+static bool dead_code(int i) {
+  if (strcmp(lines[i].op, "jmp") && strcmp(lines[i].op, "ret"))
+    return false;
+
+  bool found = false;
+  for (int j = next_line(i); j >= 0 && lines[j].kind == LN_INSN; j = next_line(j)) {
+    delete_line(j);
+    found = true;
+  }
+  return found;
+}
+
+static Rule rules[] = {
+  {"push-pop", push_pop},
+  {"fold-lea", fold_lea},
+  {"retarget", retarget},
+  {"fold-imm", fold_imm},
+  {"const-branch", const_branch},
+  {"setcc-branch", setcc_branch},
+  {"store-reload", store_reload},
+  {"dead-move", dead_move},
+  {"add-zero", add_zero},
+  {"jump-to-next", jump_to_next},
+  {"dead-code", dead_code},
+};
+
+// Applies the rules until none of them matches. Every rule deletes an
+// instruction or replaces a memory operand with a register or an
+// immediate, so this terminates.
+static void optimize(void) {
+  index_labels();
+
+  for (bool changed = true; changed;) {
+    changed = false;
+    for (int i = 0; i < nlines; i++) {
+      for (int r = 0; r < sizeof(rules) / sizeof(*rules) && lines[i].kind == LN_INSN; r++) {
+        if (rules[r].apply(i)) {
+          rules[r].hits++;
+          changed = true;
+          break;
+        }
+      }
+    }
+  }
+}
+
+void start_buffering(void) {
+  buffering = true;
+  nlines = 0;
+}
+
+// Optimizes the buffered lines and writes them to `out`.
+void flush_lines(FILE *out) {
+  buffering = false;
+  if (opt_peephole)
+    optimize();
+
+  for (int i = 0; i < nlines; i++) {
+    if (lines[i].kind != LN_DELETED)
+      fprintf(out, "%s\n", lines[i].text);
+    if (lines[i].kind == LN_INSN)
+      lines_out++;
+  }
+  nlines = 0;
+}
+
+void print_peephole_stats(FILE *out) {
+  fprintf(out, "%-14s %10s\n", "rule", "hits");
+  for (int i = 0; i < sizeof(rules) / sizeof(*rules); i++)
+    fprintf(out, "%-14s %10ld\n", rules[i].name, rules[i].hits);
+  fprintf(out, "%-14s %10ld\n", "insns before", lines_in);
+  fprintf(out, "%-14s %10ld\n", "insns after", lines_out);
+}
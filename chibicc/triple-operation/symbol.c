@@ -0,0 +1,82 @@
+// This file interns identifiers. Every distinct spelling gets exactly
+// one Symbol, so once a name has been interned it can be compared by
+// address instead of by contents.
+//
+// Symbols live in an open-addressing hash table with linear probing.
+// They are never removed.
+
+#include "chibicc.h"
+
+static Symbol **table;
+static int capacity;
+static int used;
+
+// Mixes the name in 8-byte words, which matters because the tokenizer
+// hashes every identifier it reads.
+static uint32_t hash_name(char *s, int len) {
+  uint64_t hash = len;
+  uint64_t w;
+  for (; len >= 8; s += 8, len -= 8) {
+    memcpy(&w, s, 8);
+    hash = (hash ^ w) * 0x9e3779b97f4a7c15;
+  }
+  if (len > 0) {
+    w = 0;
+    memcpy(&w, s, len);
+    hash = (hash ^ w) * 0x9e3779b97f4a7c15;
+  }
+  // Multiplication only carries bits upward, so fold the high half
+  // back down once more and take the top bits, which depend on all
+  // of the input.
+  hash ^= hash >> 32;
+  hash *= 0x9e3779b97f4a7c15;
+  return hash >> 32;
+}
+
+static void rehash(void) {
+  Symbol **old = table;
+  int old_capacity = capacity;
+
+  capacity = capacity ? capacity * 2 : 1024;
+  table = calloc(capacity, sizeof(Symbol *));
+
+  for (int i = 0; i < old_capacity; i++) {
+    Symbol *sym = old[i];
+    if (!sym)
+      continue;
+    int j = sym->hash & (capacity - 1);
+    while (table[j])
+      j = (j + 1) & (capacity - 1);
+    table[j] = sym;
+  }
+  free(old);
+}
+
+static Symbol *new_symbol(char *s, int len, uint32_t hash) {
+  // The name is stored right after the Symbol itself.
+  Symbol *sym = arena_alloc(&lex_arena, sizeof(Symbol) + len + 1);
+  sym->name = (char *)(sym + 1);
+  memcpy(sym->name, s, len);
+  sym->len = len;
+  sym->hash = hash;
+  sym->kw = find_keyword(s, len);
+  return sym;
+}
+
+// Returns the unique Symbol spelled by the `len` bytes at `s`.
+Symbol *intern(char *s, int len) {
+  // Keep the load factor under 3/4.
+  if ((used + 1) * 4 > capacity * 3)
+    rehash();
+
+  uint32_t hash = hash_name(s, len);
+  for (int i = hash & (capacity - 1);; i = (i + 1) & (capacity - 1)) {
+    Symbol *sym = table[i];
+    if (!sym) {
+      used++;
+      return table[i] = new_symbol(s, len, hash);
+    }
+    if (sym->hash == hash && sym->len == len && !memcmp(sym->name, s, len))
+      return sym;
+  }
+}
@@ -65,6 +65,18 @@ int main() {
 
   ASSERT(3, ({ int i=0; switch(-1) { case 0xffffffff: i=3; break; } i; }));
 
+  ASSERT(3, ({ int a=1; int b=0; int r=0; if (a && !b) r=3; r; }));
+  ASSERT(4, ({ int a=1; int b=0; int r=4; if (!a || b) r=5; r; }));
+  ASSERT(5, ({ int a=2; int b=3; a<b && b<=3 ? 5 : 6; }));
+  ASSERT(6, ({ int a=2; int b=3; !(a<b) || b==3 ? 6 : 7; }));
+  ASSERT(15, ({ int i=0; int s=0; for (; i<10 && !(s>=12); i++) s+=i; s; }));
+  ASSERT(5, ({ int n=0; while (n<5 || n==7) n++; n; }));
+  ASSERT(1, ({ long x=4294967296; x ? 1 : 2; }));
+  ASSERT(2, ({ long x=4294967296; !x ? 1 : 2; }));
+  ASSERT(1, ({ long x=-1; long y=0; x<y && y<=0; }));
+  ASSERT(12, ({ int n=0; if (n++ || n++) n+=10; n; }));
+  ASSERT(1, ({ int n=0; if (n++ && n++) n+=10; n; }));
+
   printf("OK\n");
   return 0;
 }
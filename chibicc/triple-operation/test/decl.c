@@ -17,6 +17,11 @@ int main() {
   ASSERT(1, (_Bool)2);
   ASSERT(0, (_Bool)(char)256);
 
+  ASSERT(7, ({ int x=3, y=4; int *a=&x, *b=&y; *a + *b; }));
+  ASSERT(4, ({ struct { int *p, *q; } s; int x=3, y=4; s.p=&x; s.q=&y; *s.q; }));
+  ASSERT(36, ({ int (*p)[3], (*q)[2]; sizeof(*p) + 3 * sizeof(*q); }));
+  ASSERT(5, ({ int y[2][3]; int (*x)[3] = y; y[1][2] = 5; x[1][2]; }));
+
   printf("OK\n");
   return 0;
 }
@@ -22,4 +22,74 @@ check -o
 ./chibicc --help 2>&1 | grep -q chibicc
 check --help
 
+# functions are emitted as they are parsed, but not left behind on error
+echo 'int f() { return 0; } int g() { return x; }' > $tmp/fail.c
+rm -f $tmp/out
+! ./chibicc -o $tmp/out $tmp/fail.c 2>/dev/null && [ ! -e $tmp/out ]
+check 'no output on error'
+
+# -O1 keeps locals and temporaries in registers
+echo 'int f(int n) { int s = 0; for (int i = 0; i < n; i++) s = s + i * n; return s; }' > $tmp/loop.c
+./chibicc -O1 -o $tmp/out $tmp/loop.c && ! grep -q 'push %rax\|(%rbp)' $tmp/out
+check -O1
+
+# the peephole optimizer cleans up the stack machine's output
+echo 'int f(int x) { return x + 2; }' > $tmp/peep.c
+./chibicc -o $tmp/out $tmp/peep.c && ! grep -q 'push %rax\|pop %rdi' $tmp/out && grep -q 'add $2, %eax' $tmp/out
+check peephole
+
+./chibicc --no-peephole -o $tmp/out $tmp/peep.c && grep -q 'push %rax' $tmp/out
+check --no-peephole
+
+./chibicc --peephole-stats -o $tmp/out $tmp/peep.c 2>&1 | grep -q 'push-pop *1$'
+check --peephole-stats
+
+# constant folding
+echo 'int f(int x) { return 3*7+x; }' > $tmp/const.c
+./chibicc -o $tmp/out $tmp/const.c && grep -q 'add $21, %eax' $tmp/out && ! grep -q imul $tmp/out
+check 'constant folding'
+
+./chibicc --no-fold -o $tmp/out $tmp/const.c && grep -q imul $tmp/out
+check --no-fold
+
+# conditions jump on the flags of their comparisons
+echo 'int f(int n) { int s = 0; for (int i = 0; i < n && !(s == 7); i++) if (s <= i || i == 3) s = s + i; return s; }' > $tmp/cond.c
+./chibicc --no-peephole -o $tmp/out $tmp/cond.c && ! grep -q ' set\| sete\|movz' $tmp/out && grep -q 'jge' $tmp/out
+check 'compare and branch'
+
+./chibicc -O1 -o $tmp/out $tmp/cond.c && ! grep -q ' set\|movz' $tmp/out && grep -q 'jge' $tmp/out
+check 'compare and branch -O1'
+
+# multiplication and division by constants compute what cc does
+int_consts='0 1 -1 2 -2 3 -3 5 6 7 -7 8 9 10 12 -12 24 25 36 -40 100 641 1000 -1000 4096 65536 -65536 1000000007 1073741824 2147483647 -2147483647 (-2147483647-1)'
+long_consts="$int_consts 2147483648 -2147483648 4294967296 4294967297 1099511627777 -1099511627777 6148914691236517205 4611686018427387904 9223372036854775807 (-9223372036854775807-1)"
+n=0
+for ty in int long; do
+    [ $ty = int ] && consts=$int_consts || consts=$long_consts
+    for c in $consts; do
+        n=$((n+1))
+        echo "$ty NAME_mul$n($ty x) { return x * $c; }"
+        case $c in 0|-1) continue;; esac
+        echo "$ty NAME_div$n($ty x) { return x / $c; }"
+        echo "$ty NAME_mod$n($ty x) { return x % $c; }"
+    done
+done > $tmp/ops
+sed 's/NAME_//' $tmp/ops > $tmp/arith.c
+(echo '#include <stdio.h>'
+ sed 's/NAME_//; s/ {.*/;/' $tmp/ops
+ sed 's/NAME_/ref_/' $tmp/ops
+ echo 'int main() {'
+ echo '  long xs[] = {0, 1, -1, 2, -2, 3, 7, -7, 100, -100, 2147483647, -2147483647-1, 4294967295, 1L<<40, -(1L<<40), 9223372036854775807, -9223372036854775807-1};'
+ echo '  unsigned long r = 1;'
+ echo '  for (int i = 0; i < 2000; i++) {'
+ echo '    long x = i < sizeof(xs) / sizeof(*xs) ? xs[i] : (long)(r = r * 6364136223846793005 + 1442695040888963407) >> (i % 64);'
+ sed 's/^\([a-z]*\) NAME_\([a-z0-9]*\).*/    if (\2(x) != ref_\2(x)) { printf("\2(%ld) is %ld, not %ld\\n", x, (long)\2(x), (long)ref_\2(x)); return 1; }/' $tmp/ops
+ echo '  }'
+ echo '  return 0;'
+ echo '}') > $tmp/ref.c
+for opt in -O0 -O1; do
+    ./chibicc $opt -o $tmp/arith.s $tmp/arith.c && cc -fwrapv -o $tmp/arith $tmp/arith.s $tmp/ref.c 2>/dev/null && $tmp/arith
+    check "constant operands $opt"
+done
+
 echo OK
@@ -0,0 +1,50 @@
+#include "test.h"
+
+// Declared without parameters, so that an int argument is passed with
+// all 64 bits of %rax as they are.
+long id();
+
+int main() {
+  int x = -1;
+
+  ASSERT(42, 6*7);
+  ASSERT(15, 3*4+3);
+  ASSERT(32, sizeof(long) * 4);
+  ASSERT(13, ({ int z = 10; 1 + z + 2; }));
+  ASSERT(7, ({ int z = 10; (z + 5) - 8; }));
+  ASSERT(12, ({ int a[4][5]; a[2][3] = 12; a[2][3]; }));
+  ASSERT(-2147483648, 2147483647 + 1);
+  ASSERT(0, id(2147483647 + 1) >> 32);
+  ASSERT(3, -7 / 2 * -1);
+  ASSERT(-1, -7 >> 3);
+  ASSERT(1, -1 < 0);
+  ASSERT(0, 4294967295 == -1);
+  ASSERT(1, (int)4294967295 == -1);
+  ASSERT(44, (char)300);
+  ASSERT(-56, (char)200);
+  ASSERT(1, (_Bool)256);
+  ASSERT(1, (_Bool)4294967296);
+
+  ASSERT(-1, id(x) >> 32);
+  ASSERT(0, id(x + 0) >> 32);
+  ASSERT(0, id(x * 1) >> 32);
+  ASSERT(0, id(x << 0) >> 32);
+  ASSERT(-1, id(x | 0) >> 32);
+  ASSERT(-1, id(x & ~0) >> 32);
+
+  ASSERT(0, 0 && 1/0);
+  ASSERT(1, 1 || 1/0);
+  ASSERT(3, 1 ? 3 : 1/0);
+  ASSERT(4, 0 ? 1/0 : 4);
+  ASSERT(7, ({ int r = 7; if (0) r = 1/0; r; }));
+  ASSERT(5, ({ int n = 0; while (1) { if (++n == 5) break; } n; }));
+  ASSERT(0, ({ int n = 0; while (0) n++; n; }));
+  ASSERT(2, ({ int n = 0; for (; 0;) n++; n + 2; }));
+  ASSERT(3, ({ int n = 0; goto in; if (0) { in: n = 3; } n; }));
+  ASSERT(9, ({ int n = 0; switch (1) { case 0: if (0) { case 1: n = 9; } } n; }));
+
+  printf("OK\n");
+  return 0;
+}
+
+long id(long x) { return x; }
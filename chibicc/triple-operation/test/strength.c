@@ -0,0 +1,59 @@
+#include "test.h"
+
+// Declared without parameters, so that an int argument is passed with
+// all 64 bits of %rax as they are.
+long id();
+
+struct S3 { char c[3]; };
+struct S12 { int i[3]; };
+struct S24 { long l[3]; };
+
+int main() {
+  int x = -7;
+  long y = -7;
+
+  ASSERT(-28, x * 4);
+  ASSERT(-63, x * 9);
+  ASSERT(-280, x * 40);
+  ASSERT(49, x * -7);
+  ASSERT(7, x * -1);
+  ASSERT(0, x * 0);
+  ASSERT(-3, x / 2);
+  ASSERT(3, x / -2);
+  ASSERT(-1, x % 2);
+  ASSERT(-1, x / 7);
+  ASSERT(0, x / 8);
+  ASSERT(-7, x % 10);
+  ASSERT(-2, x / 3);
+  ASSERT(-1, x % -3);
+  ASSERT(-7, x / 1);
+  ASSERT(0, x % 1);
+  ASSERT(1, ({ int m = -2147483647-1; m / (-2147483647-1); }));
+  ASSERT(-1, (x - 2147483640) / 2147483647);
+
+  ASSERT(-4, y / 2 * 2 + y % 2 + 3);
+  ASSERT(-8, y * 1099511627777 >> 40);
+  ASSERT(-3, y * 3 / 7);
+  ASSERT(2, y / -3);
+  ASSERT(-1, y % 6);
+
+  ASSERT(0, id(x * 4) >> 32);
+  ASSERT(0, id(x * -1) >> 32);
+  ASSERT(0, id(x * 1) >> 32);
+  ASSERT(0, id(x / 1) >> 32);
+  ASSERT(0, id(x / 4) >> 32);
+  ASSERT(0, id(x / 7) >> 32);
+  ASSERT(0, id(x % 4) >> 32);
+  ASSERT(0, id(x % 7) >> 32);
+
+  ASSERT(5, ({ struct S3 a[8]; &a[5] - a; }));
+  ASSERT(6, ({ struct S12 a[8]; &a[7] - &a[1]; }));
+  ASSERT(-3, ({ struct S24 a[8]; &a[1] - &a[4]; }));
+  ASSERT(60, ({ struct S12 a[8]; (char *)(a + 5) - (char *)a; }));
+  ASSERT(7, ({ struct S3 a[8]; int i = 7; a[i].c[1] = 7; a[7].c[1]; }));
+
+  printf("OK\n");
+  return 0;
+}
+
+long id(long x) { return x; }
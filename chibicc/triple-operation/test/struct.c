@@ -57,6 +57,10 @@ int main() {
   ASSERT(1, ({ struct T { struct T *next; int x; } a; struct T b; b.x=1; a.next=&b; a.next->x; }));
   ASSERT(4, ({ typedef struct T T; struct T { int x; }; sizeof(T); }));
 
+  ASSERT(40, ({ struct {int a,b,c,d,e,f,g,h,i,j;} x; sizeof(x); }));
+  ASSERT(7, ({ struct {int a,b,c,d,e,f,g,h,i,j;} x; x.a=1; x.j=3; x.e=4; x.j+x.e; }));
+  ASSERT(1, ({ struct {int a,b,c,d,e,f,g,h,i,j;} x, *p=&x; p->a=1; p->i=9; p->a; }));
+
   printf("OK\n");
   return 0;
 }
@@ -15,18 +15,75 @@ void error(char *fmt, ...) {
   exit(1);
 }
 
+// Start of every line of the input, in order. The tokenizer records
+// them as it goes; the table is complete up to `scanned`.
+static char **line_starts;
+static int nlines;
+static int line_capacity;
+static char *scanned;
+
+// End of the input, once it has been tokenized.
+static char *input_end;
+
+static void add_line(char *p) {
+  if (nlines == line_capacity) {
+    line_capacity = line_capacity ? line_capacity * 2 : 1024;
+    line_starts = realloc(line_starts, sizeof(char *) * line_capacity);
+  }
+  line_starts[nlines++] = p;
+}
+
+static void init_lines(char *p) {
+  line_starts = NULL;
+  nlines = line_capacity = 0;
+  scanned = p;
+  input_end = NULL;
+  add_line(p);
+}
+
+// Records the lines that start before `end`.
+static void scan_lines(char *end) {
+  if (end <= scanned)
+    return;
+  for (char *p = scanned; (p = memchr(p, '\n', end - p)); p++)
+    add_line(p + 1);
+  scanned = end;
+}
+
+// Returns the 1-based line and column of `loc`, or 0 for both if `loc`
+// does not point into the input.
+void get_line_col(char *loc, int *line_no, int *col_no) {
+  if (loc < current_input || (input_end && loc > input_end)) {
+    *line_no = *col_no = 0;
+    return;
+  }
+  scan_lines(loc + 1);
+
+  // Find the last line that starts at or before `loc`.
+  int lo = 0, hi = nlines - 1;
+  while (lo < hi) {
+    int mid = (lo + hi + 1) / 2;
+    if (line_starts[mid] <= loc)
+      lo = mid;
+    else
+      hi = mid - 1;
+  }
+  *line_no = lo + 1;
+  *col_no = loc - line_starts[lo] + 1;
+}
+
 // Reports an error message in the following format.
 //
 // foo.c:10: x = y + 1;
 //               ^ <error message here>
-static void verror_at(int line_no, char *loc, char *fmt, va_list ap) {
-  // Find a line containing `loc`.
-  char *line = loc;
-  while (current_input < line && line[-1] != '\n')
-    line--;
+static void verror_at(char *loc, char *fmt, va_list ap) {
+  int line_no, col_no;
+  get_line_col(loc, &line_no, &col_no);
 
+  // Find a line containing `loc`.
+  char *line = loc - col_no + 1;
   char *end = loc;
-  while (*end != '\n')
+  while (*end && *end != '\n')
     end++;
 
   // Print out the line.
@@ -43,59 +100,67 @@ static void verror_at(int line_no, char *loc, char *fmt, va_list ap) {
 }
 
 void error_at(char *loc, char *fmt, ...) {
-  int line_no = 1;
-  for (char *p = current_input; p < loc; p++)
-    if (*p == '\n')
-      line_no++;
-
   va_list ap;
   va_start(ap, fmt);
-  verror_at(line_no, loc, fmt, ap);
+  verror_at(loc, fmt, ap);
   exit(1);
 }
 
 void error_tok(Token *tok, char *fmt, ...) {
   va_list ap;
   va_start(ap, fmt);
-  verror_at(tok->line_no, tok->loc, fmt, ap);
+  verror_at(tok->loc, fmt, ap);
   exit(1);
 }
 
 void warn_tok(Token *tok, char *fmt, ...) {
   va_list ap;
   va_start(ap, fmt);
-  verror_at(tok->line_no, tok->loc, fmt, ap);
+  verror_at(tok->loc, fmt, ap);
 }
 
 // Consumes the current token if it matches `op`.
 bool equal(Token *tok, char *op) {
-  return strlen(op) == tok->len &&
-         !strncmp(tok->loc, op, tok->len);
+  return strlen(op) == tok->len && !memcmp(tok->loc, op, tok->len);
 }
 
 // Ensure that the current token is `op`.
 Token *skip(Token *tok, char *op) {
   if (!equal(tok, op))
     error_tok(tok, "expected '%s'", op);
-  return tok->next;
+  return tok + 1;
 }
 
 bool consume(Token **rest, Token *tok, char *str) {
   if (equal(tok, str)) {
-    *rest = tok->next;
+    *rest = tok + 1;
     return true;
   }
   *rest = tok;
   return false;
 }
 
-// Create a new token and add it as the next token of `cur`.
-static Token *new_token(TokenKind kind, Token *cur, char *str, int len) {
-  Token *tok = calloc(1, sizeof(Token));
+// Tokens of the file being tokenized. They are kept in one array, so
+// the token after `tok` is `tok + 1`.
+static Token *tokens;
+static int ntokens;
+static int capacity;
+
+// Appends a new token to `tokens`. The returned pointer is only valid
+// until the next call, since growing the array may move it.
+// The line table is brought up to `str` to get the token's line.
+static Token *new_token(TokenKind kind, char *str, int len) {
+  if (ntokens == capacity) {
+    capacity = capacity ? capacity * 2 : 1024;
+    tokens = realloc(tokens, sizeof(Token) * capacity);
+  }
+  Token *tok = &tokens[ntokens++];
+  *tok = (Token){0};
+  scan_lines(str);
   tok->kind = kind;
+  tok->line_no = nlines;
   tok->loc = str;
   tok->len = len;
-  cur->next = tok;
   return tok;
 }
 
@@ -103,16 +168,6 @@ static bool startswith(char *p, char *q) {
   return strncmp(p, q, strlen(q)) == 0;
 }
 
-// Returns true if c is valid as the first character of an identifier.
-static bool is_ident1(char c) {
-  return ('a' <= c && c <= 'z') || ('A' <= c && c <= 'Z') || c == '_';
-}
-
-// Returns true if c is valid as a non-first character of an identifier.
-static bool is_ident2(char c) {
-  return is_ident1(c) || ('0' <= c && c <= '9');
-}
-
 static int from_hex(char c) {
   if ('0' <= c && c <= '9')
     return c - '0';
@@ -121,18 +176,41 @@ static int from_hex(char c) {
   return c - 'A' + 10;
 }
 
-static bool is_keyword(Token *tok) {
-  static char *kw[] = {
-    "return", "if", "else", "for", "while", "int", "sizeof", "char",
-    "struct", "union", "short", "long", "void", "typedef", "_Bool",
-    "enum", "static", "goto", "break", "continue", "switch", "case",
-    "default",
-  };
-
-  for (int i = 0; i < sizeof(kw) / sizeof(*kw); i++)
-    if (equal(tok, kw[i]))
-      return true;
-  return false;
+// Returns the keyword spelled by `p`, or KW_NONE.
+//
+// This is a perfect hash done by hand: the length and the first
+// character of a word select at most two candidates, so an identifier
+// is classified with one jump and one or two memcmp calls.
+Keyword find_keyword(char *p, int len) {
+#define KEY(n, c) ((n) << 8 | (unsigned char)(c))
+#define K(s, kw) if (!memcmp(p, s, len)) return kw;
+
+  if (len > 8)
+    return KW_NONE;
+
+  switch (KEY(len, *p)) {
+  case KEY(2, 'i'): K("if", KW_IF) break;
+  case KEY(3, 'f'): K("for", KW_FOR) break;
+  case KEY(3, 'i'): K("int", KW_INT) break;
+  case KEY(4, 'c'): K("char", KW_CHAR) K("case", KW_CASE) break;
+  case KEY(4, 'e'): K("else", KW_ELSE) K("enum", KW_ENUM) break;
+  case KEY(4, 'g'): K("goto", KW_GOTO) break;
+  case KEY(4, 'l'): K("long", KW_LONG) break;
+  case KEY(4, 'v'): K("void", KW_VOID) break;
+  case KEY(5, '_'): K("_Bool", KW_BOOL) break;
+  case KEY(5, 'b'): K("break", KW_BREAK) break;
+  case KEY(5, 's'): K("short", KW_SHORT) break;
+  case KEY(5, 'u'): K("union", KW_UNION) break;
+  case KEY(5, 'w'): K("while", KW_WHILE) break;
+  case KEY(6, 'r'): K("return", KW_RETURN) break;
+  case KEY(6, 's'): K("sizeof", KW_SIZEOF) K("struct", KW_STRUCT) K("static", KW_STATIC) K("switch", KW_SWITCH) break;
+  case KEY(7, 'd'): K("default", KW_DEFAULT) break;
+  case KEY(7, 't'): K("typedef", KW_TYPEDEF) break;
+  case KEY(8, 'c'): K("continue", KW_CONTINUE) break;
+  }
+  return KW_NONE;
+#undef K
+#undef KEY
 }
 
 static int read_escaped_char(char **new_pos, char *p) {
@@ -180,34 +258,39 @@ static int read_escaped_char(char **new_pos, char *p) {
 // Find a closing double-quote.
 static char *string_literal_end(char *p) {
   char *start = p;
-  for (; *p != '"'; p++) {
-    if (*p == '\0')
+  for (;;) {
+    p = skip_str(p);
+    if (*p == '"')
+      return p;
+    if (*p == '\0' || *++p == '\0')
       error_at(start, "unclosed string literal");
-    if (*p == '\\')
-      p++;
+    p++;
   }
-  return p;
 }
 
-static Token *read_string_literal(Token *cur, char *start) {
+static Token *read_string_literal(char *start) {
   char *end = string_literal_end(start + 1);
-  char *buf = calloc(1, end - start);
+  char *buf = arena_alloc(&lex_arena, end - start);
   int len = 0;
 
   for (char *p = start + 1; p < end;) {
-    if (*p == '\\')
+    if (*p == '\\') {
       buf[len++] = read_escaped_char(&p, p + 1);
-    else
-      buf[len++] = *p++;
+    } else {
+      char *q = skip_str(p);
+      memcpy(buf + len, p, q - p);
+      len += q - p;
+      p = q;
+    }
   }
 
-  Token *tok = new_token(TK_STR, cur, start, end - start + 1);
+  Token *tok = new_token(TK_STR, start, end - start + 1);
   tok->ty = array_of(ty_char, len + 1);
   tok->str = buf;
   return tok;
 }
 
-static Token *read_char_literal(Token *cur, char *start) {
+static Token *read_char_literal(char *start) {
   char *p = start + 1;
   if (*p == '\0')
     error_at(start, "unclosed char literal");
@@ -222,12 +305,12 @@ static Token *read_char_literal(Token *cur, char *start) {
   if (!end)
     error_at(p, "unclosed char literal");
 
-  Token *tok = new_token(TK_NUM, cur, start, end - start + 1);
+  Token *tok = new_token(TK_NUM, start, end - start + 1);
   tok->val = c;
   return tok;
 }
 
-static Token *read_int_literal(Token *cur, char *start) {
+static Token *read_int_literal(char *start) {
   char *p = start;
 
   int base = 10;
@@ -245,80 +328,64 @@ static Token *read_int_literal(Token *cur, char *start) {
   if (isalnum(*p))
     error_at(p, "invalid digit");
 
-  Token *tok = new_token(TK_NUM, cur, start, p - start);
+  Token *tok = new_token(TK_NUM, start, p - start);
   tok->val = val;
   return tok;
 }
 
-static void convert_keywords(Token *tok) {
-  for (Token *t = tok; t->kind != TK_EOF; t = t->next)
-    if (is_keyword(t))
-      t->kind = TK_RESERVED;
-}
-
-// Initialize line info for all tokens.
-static void add_line_numbers(Token *tok) {
-  char *p = current_input;
-  int n = 1;
-
-  do {
-    if (p == tok->loc) {
-      tok->line_no = n;
-      tok = tok->next;
-    }
-    if (*p == '\n')
-      n++;
-  } while (*p++);
-}
-
 // Tokenize a given string and returns new tokens.
 static Token *tokenize(char *filename, char *p) {
   current_filename = filename;
   current_input = p;
-  Token head = {};
-  Token *cur = &head;
+  tokens = NULL;
+  ntokens = capacity = 0;
+  init_lines(p);
+  Token *cur;
 
   while (*p) {
     // Skip line comments.
     if (startswith(p, "//")) {
-      p += 2;
-      while (*p != '\n')
-        p++;
+      p = skip_line(p + 2);
       continue;
     }
 
     // Skip block comments.
     if (startswith(p, "/*")) {
-      char *q = strstr(p + 2, "*/");
-      if (!q)
-        error_at(p, "unclosed block comment");
-      p = q + 2;
+      char *q = p + 2;
+      for (;;) {
+        q = skip_comment(q);
+        if (*q == '\0')
+          error_at(p, "unclosed block comment");
+        if (*++q == '/')
+          break;
+      }
+      p = q + 1;
       continue;
     }
 
     // Skip whitespace characters.
     if (isspace(*p)) {
-      p++;
+      p = skip_space(p);
       continue;
     }
 
     // Numeric literal
     if (isdigit(*p)) {
-      cur = read_int_literal(cur, p);
+      cur = read_int_literal(p);
       p += cur->len;
       continue;
     }
 
     // String literal
     if (*p == '"') {
-      cur = read_string_literal(cur, p);
+      cur = read_string_literal(p);
       p += cur->len;
       continue;
     }
 
     // Character literal
     if (*p == '\'') {
-      cur = read_char_literal(cur, p);
+      cur = read_char_literal(p);
       p += cur->len;
       continue;
     }
@@ -326,15 +393,18 @@ static Token *tokenize(char *filename, char *p) {
     // Identifier or keyword
     if (is_ident1(*p)) {
       char *q = p++;
-      while (is_ident2(*p))
-        p++;
-      cur = new_token(TK_IDENT, cur, q, p - q);
+      p = skip_ident(p);
+      cur = new_token(TK_IDENT, q, p - q);
+      cur->sym = intern(q, p - q);
+      cur->kw = cur->sym->kw;
+      if (cur->kw)
+        cur->kind = TK_RESERVED;
       continue;
     }
 
     // Three-letter punctuators
     if (startswith(p, "<<=") || startswith(p, ">>=")) {
-      cur = new_token(TK_RESERVED, cur, p, 3);
+      cur = new_token(TK_RESERVED, p, 3);
       p += 3;
       continue;
     }
@@ -350,64 +420,113 @@ static Token *tokenize(char *filename, char *p) {
         startswith(p, "^=") || startswith(p, "&&") ||
         startswith(p, "||") || startswith(p, "<<") ||
         startswith(p, ">>")) {
-      cur = new_token(TK_RESERVED, cur, p, 2);
+      cur = new_token(TK_RESERVED, p, 2);
       p += 2;
       continue;
     }
 
     // Single-letter punctuators
     if (ispunct(*p)) {
-      cur = new_token(TK_RESERVED, cur, p++, 1);
+      cur = new_token(TK_RESERVED, p++, 1);
       continue;
     }
 
     error_at(p, "invalid token");
   }
 
-  new_token(TK_EOF, cur, p, 0);
-  add_line_numbers(head.next);
-  convert_keywords(head.next);
-  return head.next;
+  new_token(TK_EOF, p, 0);
+  input_end = p;
+  return tokens;
+}
+
+// Reads everything from `fd` into a malloc'ed buffer. This is the
+// fallback for stdin and other inputs that can't be mapped, e.g. pipes.
+static char *read_stream(int fd, char *path, size_t *len) {
+  size_t buflen = 4096;
+  size_t nread = 0;
+  char *buf = malloc(buflen);
+
+  for (;;) {
+    // extra 2 bytes for the trailing "\n\0"
+    if (buflen - nread < 2 + 4096) {
+      buflen *= 2;
+      buf = realloc(buf, buflen);
+    }
+    ssize_t n = read(fd, buf + nread, buflen - nread - 2);
+    if (n == 0)
+      break;
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      error("cannot read %s: %s", path, strerror(errno));
+    }
+    nread += n;
+  }
+  buf[nread] = buf[nread + 1] = '\0';
+  *len = nread;
+  return buf;
+}
+
+// Maps a regular file of `size` bytes into memory. The mapping is
+// rounded up so that at least two bytes follow the file contents, and
+// those bytes are zero-filled: pages beyond the last page of the file
+// come from an anonymous mapping and the tail of the last file page is
+// zeroed by the kernel. The file pages themselves are read-only.
+static char *map_file(int fd, char *path, size_t size) {
+  size_t pagesize = sysconf(_SC_PAGESIZE);
+  size_t maplen = (size + 2 + pagesize - 1) / pagesize * pagesize;
+
+  char *buf = mmap(NULL, maplen, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (buf == MAP_FAILED)
+    error("cannot map %s: %s", path, strerror(errno));
+
+  if (size > 0 && mmap(buf, size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED)
+    error("cannot map %s: %s", path, strerror(errno));
+  return buf;
 }
 
 // Returns the contents of a given file.
 static char *read_file(char *path) {
-  FILE *fp;
+  int fd;
 
   if (strcmp(path, "-") == 0) {
     // By convention, read from stdin if a given filename is "-".
-    fp = stdin;
+    fd = STDIN_FILENO;
   } else {
-    fp = fopen(path, "r");
-    if (!fp)
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
       error("cannot open %s: %s", path, strerror(errno));
   }
 
-  int buflen = 4096;
-  int nread = 0;
-  char *buf = calloc(1, buflen);
+  struct stat st;
+  if (fstat(fd, &st) < 0)
+    error("cannot stat %s: %s", path, strerror(errno));
 
-  // Read the entire file.
-  for (;;) {
-    int end = buflen - 2; // extra 2 bytes for the trailing "\n\0"
-    int n = fread(buf + nread, 1, end - nread, fp);
-    if (n == 0)
-      break;
-    nread += n;
-    if (nread == end) {
-      buflen *= 2;
-      buf = realloc(buf, buflen);
-    }
+  char *buf;
+  size_t len;
+  bool mapped = fd != STDIN_FILENO && S_ISREG(st.st_mode);
+  if (mapped) {
+    len = st.st_size;
+    buf = map_file(fd, path, len);
+  } else {
+    buf = read_stream(fd, path, &len);
   }
 
-  if (fp != stdin)
-    fclose(fp);
+  if (fd != STDIN_FILENO)
+    close(fd);
 
   // Make sure that the last line is properly terminated with '\n'.
-  if (nread == 0 || buf[nread - 1] != '\n')
-    buf[nread++] = '\n';
-
-  buf[nread] = '\0';
+  // Both readers leave two zero bytes after the contents, so the
+  // terminating '\0' is already in place. If the newline lands in the
+  // last page of a mapped file, that one page becomes a private copy.
+  if (len == 0 || buf[len - 1] != '\n') {
+    if (mapped) {
+      size_t pagesize = sysconf(_SC_PAGESIZE);
+      mprotect(buf + len / pagesize * pagesize, pagesize, PROT_READ | PROT_WRITE);
+    }
+    buf[len++] = '\n';
+  }
   return buf;
 }
 
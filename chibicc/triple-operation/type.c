@@ -8,8 +8,19 @@ Type *ty_short = &(Type){TY_SHORT, 2, 2};
 Type *ty_int = &(Type){TY_INT, 4, 4};
 Type *ty_long = &(Type){TY_LONG, 8, 8};
 
+// Pointer and array types are hash-consed: there is one pointer type
+// per base type and one array type per base type and length, kept in
+// an open-addressing table. Two such types are equal exactly when they
+// are the same object.
+static Type **derived;
+static int derived_capacity;
+static int derived_used;
+
+// Structs with at least this many members get a hash index.
+#define MEMBER_INDEX_MIN 8
+
 static Type *new_type(TypeKind kind, int size, int align) {
-  Type *ty = calloc(1, sizeof(Type));
+  Type *ty = arena_alloc(&ast_arena, sizeof(Type));
   ty->kind = kind;
   ty->size = size;
   ty->align = align;
@@ -23,29 +34,127 @@ bool is_integer(Type *ty) {
 }
 
 Type *copy_type(Type *ty) {
-  Type *ret = calloc(1, sizeof(Type));
+  Type *ret = arena_alloc(&ast_arena, sizeof(Type));
   *ret = *ty;
   return ret;
 }
 
-Type *pointer_to(Type *base) {
-  Type *ty = new_type(TY_PTR, 8, 8);
+static uint64_t hash_derived(TypeKind kind, Type *base, int len) {
+  uint64_t h = ((uintptr_t)base ^ (uint64_t)len << 32 ^ kind) * 0x9e3779b97f4a7c15;
+  return h ^ (h >> 32);
+}
+
+static void rehash_derived(void) {
+  Type **old = derived;
+  int old_capacity = derived_capacity;
+
+  derived_capacity = derived_capacity ? derived_capacity * 2 : 256;
+  derived = calloc(derived_capacity, sizeof(Type *));
+
+  for (int i = 0; i < old_capacity; i++) {
+    Type *ty = old[i];
+    if (!ty)
+      continue;
+    int j = hash_derived(ty->kind, ty->base, ty->array_len) & (derived_capacity - 1);
+    while (derived[j])
+      j = (j + 1) & (derived_capacity - 1);
+    derived[j] = ty;
+  }
+  free(old);
+}
+
+static Type *new_derived(TypeKind kind, Type *base, int len) {
+  Type *ty;
+  if (kind == TY_PTR)
+    ty = new_type(TY_PTR, 8, 8);
+  else
+    ty = new_type(TY_ARRAY, base->size * len, base->align);
   ty->base = base;
+  ty->array_len = len;
+  ty->is_probe = base->is_probe;
   return ty;
 }
 
+static Type *derived_type(TypeKind kind, Type *base, int len) {
+  // Keep the load factor under 3/4.
+  if ((derived_used + 1) * 4 > derived_capacity * 3)
+    rehash_derived();
+
+  uint64_t h = hash_derived(kind, base, len);
+  for (int i = h & (derived_capacity - 1);; i = (i + 1) & (derived_capacity - 1)) {
+    Type *ty = derived[i];
+    if (!ty) {
+      derived_used++;
+      return derived[i] = new_derived(kind, base, len);
+    }
+    if (ty->kind == kind && ty->base == base && ty->array_len == len)
+      return ty;
+  }
+}
+
+// A type derived from a probe, which may live on the stack, is made
+// anew, so the table never holds a pointer to a dead object.
+Type *pointer_to(Type *base) {
+  if (base->is_probe)
+    return new_derived(TY_PTR, base, 0);
+  return derived_type(TY_PTR, base, 0);
+}
+
 Type *func_type(Type *return_ty) {
-  Type *ty = calloc(1, sizeof(Type));
+  Type *ty = arena_alloc(&ast_arena, sizeof(Type));
   ty->kind = TY_FUNC;
   ty->return_ty = return_ty;
   return ty;
 }
 
 Type *array_of(Type *base, int len) {
-  Type *ty = new_type(TY_ARRAY, base->size * len, base->align);
-  ty->base = base;
-  ty->array_len = len;
-  return ty;
+  // The size of an array of an incomplete struct is computed from the
+  // struct's placeholder size, so such an array must not be shared
+  // with arrays made after the struct is completed.
+  if (base->size < 0 || base->is_probe)
+    return new_derived(TY_ARRAY, base, len);
+  return derived_type(TY_ARRAY, base, len);
+}
+
+// Builds the member index of a wide struct or union. The first member
+// with a given name wins, as it does in a linear scan.
+void index_members(Type *ty) {
+  int n = 0;
+  for (Member *mem = ty->members; mem; mem = mem->next)
+    n++;
+  if (n < MEMBER_INDEX_MIN)
+    return;
+
+  int capacity = 16;
+  while (capacity < n * 2)
+    capacity *= 2;
+  ty->member_index = arena_alloc(&ast_arena, sizeof(Member *) * capacity);
+  ty->member_mask = capacity - 1;
+
+  for (Member *mem = ty->members; mem; mem = mem->next) {
+    Symbol *name = mem->name->sym;
+    int i = name->hash & ty->member_mask;
+    while (ty->member_index[i] && ty->member_index[i]->name->sym != name)
+      i = (i + 1) & ty->member_mask;
+    if (!ty->member_index[i])
+      ty->member_index[i] = mem;
+  }
+}
+
+// Returns the member of `ty` called `name`, or NULL.
+Member *find_member(Type *ty, Symbol *name) {
+  if (!ty->member_index) {
+    for (Member *mem = ty->members; mem; mem = mem->next)
+      if (mem->name->sym == name)
+        return mem;
+    return NULL;
+  }
+
+  for (int i = name->hash & ty->member_mask;; i = (i + 1) & ty->member_mask) {
+    Member *mem = ty->member_index[i];
+    if (!mem || mem->name->sym == name)
+      return mem;
+  }
 }
 
 Type *enum_type(void) {
@@ -81,18 +190,50 @@ void add_type(Node *node) {
   if (!node || node->ty)
     return;
 
-  add_type(node->lhs);
-  add_type(node->rhs);
-  add_type(node->cond);
-  add_type(node->then);
-  add_type(node->els);
-  add_type(node->init);
-  add_type(node->inc);
-
-  for (Node *n = node->body; n; n = n->next)
-    add_type(n);
-  for (Node *n = node->args; n; n = n->next)
-    add_type(n);
+  // Only the fields of the node's own kind may be touched.
+  switch (node->kind) {
+  case ND_NUM:
+  case ND_VAR:
+  case ND_GOTO:
+    break;
+  case ND_IF:
+  case ND_COND:
+  case ND_FOR:
+  case ND_SWITCH:
+    add_type(node->cond);
+    add_type(node->then);
+    if (node->kind == ND_FOR) {
+      add_type(node->init);
+      add_type(node->inc);
+    } else if (node->kind != ND_SWITCH) {
+      add_type(node->els);
+    }
+    break;
+  case ND_BLOCK:
+  case ND_STMT_EXPR:
+    for (Node *n = node->body; n; n = n->next)
+      add_type(n);
+    break;
+  case ND_FUNCALL:
+    for (Node *n = node->args; n; n = n->next)
+      add_type(n);
+    break;
+  case ND_ADDR:
+  case ND_DEREF:
+  case ND_NOT:
+  case ND_BITNOT:
+  case ND_CAST:
+  case ND_RETURN:
+  case ND_EXPR_STMT:
+  case ND_MEMBER:
+  case ND_LABEL:
+  case ND_CASE:
+    add_type(node->lhs);
+    break;
+  default:
+    add_type(node->lhs);
+    add_type(node->rhs);
+  }
 
   switch (node->kind) {
   case ND_NUM:
@@ -0,0 +1,154 @@
+// This file implements region-based memory allocation.
+//
+// Objects that die together are allocated from the same arena by
+// bumping a pointer through large chunks, and the whole arena is
+// released at once by arena_reset(). There is no way to free a single
+// object, which matches how a compiler uses its data structures: they
+// are built up during one phase and dropped when the phase is done.
+//
+// Chunks are zero-filled when they are obtained, so arena_alloc()
+// returns zeroed memory like calloc().
+//
+// Besides the arenas for whole phases, there is one arena per function
+// being compiled, made by new_arena(). Many of those are small and
+// some are kept to the end, so chunks start small and double in size
+// up to CHUNK_SIZE.
+
+#include "manda.h"
+#include <pthread.h>
+
+#define CHUNK_SIZE (64 * 1024)
+#define MIN_CHUNK_SIZE 1024
+
+// Nothing the compiler allocates needs more than pointer alignment.
+#define ALIGN 8
+
+struct ArenaChunk {
+  ArenaChunk* next;
+  size_t size;
+  char data[];
+};
+
+Arena lex_arena = {"lex"};
+Arena sexp_arena = {"sexp"};
+Arena ast_arena = {"ast"};
+Arena env_arena = {"env"};
+
+// The statistics of the arenas made by new_arena() are added up here,
+// with one reset counted for each arena freed. Those arenas are made
+// on one thread and freed on another.
+static Arena fn_arenas = {"fn"};
+static pthread_mutex_t fn_arenas_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static Arena* arenas[] = {&lex_arena, &sexp_arena, &ast_arena, &env_arena, &fn_arenas};
+
+static void add_reserved(Arena* a, ptrdiff_t size) {
+  a->reserved += size;
+  if (a->reserved > a->peak)
+    a->peak = a->reserved;
+}
+
+static ArenaChunk* new_chunk(Arena* a, size_t size) {
+  ArenaChunk* c = calloc(1, sizeof(ArenaChunk) + size);
+  if (!c)
+    error("out of memory");
+  c->size = size;
+
+  add_reserved(a, size);
+  if (a->is_fn) {
+    pthread_mutex_lock(&fn_arenas_lock);
+    add_reserved(&fn_arenas, size);
+    pthread_mutex_unlock(&fn_arenas_lock);
+  }
+  return c;
+}
+
+// Returns the size of the next regular chunk of `a`.
+static size_t chunk_size(Arena* a) {
+  if (a->reserved >= CHUNK_SIZE)
+    return CHUNK_SIZE;
+  return a->reserved > MIN_CHUNK_SIZE ? a->reserved : MIN_CHUNK_SIZE;
+}
+
+void* arena_alloc(Arena* a, size_t size) {
+  size = (size + ALIGN - 1) & ~(size_t)(ALIGN - 1);
+  a->nallocs++;
+  a->used += size;
+
+  if (size <= a->end - a->cur) {
+    void* p = a->cur;
+    a->cur += size;
+    return p;
+  }
+
+  // A large object gets a chunk of its own, which is put behind the
+  // current chunk so that the rest of the current chunk is not wasted.
+  size_t csize = chunk_size(a);
+  if (size > csize / 4) {
+    ArenaChunk* c = new_chunk(a, size);
+    if (a->chunks) {
+      c->next = a->chunks->next;
+      a->chunks->next = c;
+    } else {
+      a->chunks = c;
+    }
+    return c->data;
+  }
+
+  ArenaChunk* c = new_chunk(a, csize);
+  c->next = a->chunks;
+  a->chunks = c;
+  a->cur = c->data + size;
+  a->end = c->data + csize;
+  return c->data;
+}
+
+static void free_chunks(Arena* a) {
+  for (ArenaChunk* c = a->chunks, *next; c; c = next) {
+    next = c->next;
+    free(c);
+  }
+  a->chunks = NULL;
+  a->cur = a->end = NULL;
+}
+
+// Frees everything allocated from `a`. The arena can be used again.
+void arena_reset(Arena* a) {
+  free_chunks(a);
+  a->reserved = 0;
+  a->nresets++;
+}
+
+// Returns an arena for the nodes and variables of one function.
+Arena* new_arena(void) {
+  Arena* a = calloc(1, sizeof(Arena));
+  if (!a)
+    error("out of memory");
+  a->name = fn_arenas.name;
+  a->is_fn = true;
+  return a;
+}
+
+// Frees `a`, which was made by new_arena(), and everything in it. This
+// may be called on any thread.
+void free_arena(Arena* a) {
+  pthread_mutex_lock(&fn_arenas_lock);
+  fn_arenas.nallocs += a->nallocs;
+  fn_arenas.used += a->used;
+  fn_arenas.reserved -= a->reserved;
+  fn_arenas.nresets++;
+  pthread_mutex_unlock(&fn_arenas_lock);
+
+  free_chunks(a);
+  free(a);
+}
+
+void print_arena_stats(FILE* out) {
+  fprintf(out, "%-8s %10s %12s %12s %12s %7s\n",
+          "arena", "allocs", "bytes", "reserved", "peak", "resets");
+  for (int i = 0; i < sizeof(arenas) / sizeof(*arenas); i++) {
+    Arena* a = arenas[i];
+    fprintf(out, "%-8s %10zu %12zu %12zu %12zu %7d\n",
+            a->name, a->nallocs, a->used, a->reserved, a->peak, a->nresets);
+  }
+}
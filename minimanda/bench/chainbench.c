@@ -0,0 +1,102 @@
+// Compiles expressions with very long operator chains.
+//
+//   bench/chainbench [ <terms> ]
+//
+// An n-ary form such as (+ a b c ...) becomes a chain of binary nodes
+// as long as the form, so the passes over the AST must not recurse
+// along it. A program is generated with one function for each kind of
+// chain, each of the given number of terms (a million by default):
+// arithmetic, a comparison, which becomes a chain of ands, a logical
+// or, and a constant sum that is folded at compile time. It is parsed
+// and compiled in a child process with the default stack size, and
+// the best of a few runs is reported for each phase.
+
+#include "../manda.h"
+#include <sys/wait.h>
+#include <time.h>
+
+typedef struct {
+  double parse;
+  double codegen;
+} Result;
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void chain(FILE *out, char *op, char *term, int n) {
+  fprintf(out, "(%s", op);
+  for (int i = 0; i < n; i++)
+    fprintf(out, " %s", term);
+  fprintf(out, ")");
+}
+
+static char *generate(int n) {
+  static char path[] = "/tmp/manda-chainbench-XXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0)
+    error("mkstemp: %s", strerror(errno));
+
+  FILE *out = fdopen(fd, "w");
+  fprintf(out, "(def sum (x int) -> int ");
+  chain(out, "+", "x", n);
+  fprintf(out, ")\n(def less (x int) -> int (if ");
+  chain(out, "<", "x", n);
+  fprintf(out, " 1 0))\n(def any (x int) -> int ");
+  chain(out, "or", "(= x 7)", n);
+  fprintf(out, ")\n(def main() -> int (let c :int ");
+  chain(out, "+", "1", n);
+  fprintf(out, ") c)\n");
+  fclose(out);
+  return path;
+}
+
+// Compiles `path` in a child process.
+static Result run_once(char *path) {
+  int fds[2];
+  if (pipe(fds) < 0)
+    error("pipe: %s", strerror(errno));
+
+  pid_t pid = fork();
+  if (pid == 0) {
+    FILE *out = fopen("/dev/null", "w");
+    Token *tok = tokenize_file(path);
+    double start = now();
+    Node *prog = parse(tok);
+    double mid = now();
+    codegen(prog, out);
+    Result r = {mid - start, now() - mid};
+    write(fds[1], &r, sizeof(r));
+    _exit(0);
+  }
+
+  Result r;
+  if (read(fds[0], &r, sizeof(r)) != sizeof(r))
+    error("benchmark child failed");
+  waitpid(pid, NULL, 0);
+  close(fds[0]);
+  close(fds[1]);
+  return r;
+}
+
+int main(int argc, char **argv) {
+  int n = argc > 1 ? atoi(argv[1]) : 1000000;
+
+  char *path = generate(n);
+  Result best = {1e9, 1e9};
+  for (int i = 0; i < 3; i++) {
+    Result r = run_once(path);
+    if (r.parse < best.parse)
+      best.parse = r.parse;
+    if (r.codegen < best.codegen)
+      best.codegen = r.codegen;
+  }
+  unlink(path);
+
+  printf("4 chains of %d terms\n", n);
+  printf("%-10s %9.3fs\n", "parse", best.parse);
+  printf("%-10s %9.3fs\n", "codegen", best.codegen);
+  return 0;
+}
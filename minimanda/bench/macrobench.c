@@ -0,0 +1,98 @@
+// Times macro expansion.
+//
+//   bench/macrobench [ <functions> ]
+//
+// A program of the given number of functions (200 by default, about
+// 100k AST nodes) is generated in which every function is built from
+// nested uses of a few macros, some of which mention a parameter more
+// than once. The best of a few runs of parse() is reported, each in a
+// fresh child process.
+
+#include "../manda.h"
+#include <sys/wait.h>
+#include <time.h>
+
+typedef struct {
+  double time;
+  size_t nodes;
+} Result;
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char *generate(int n) {
+  static char path[] = "/tmp/manda-macrobench-XXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0)
+    error("mkstemp: %s", strerror(errno));
+
+  FILE *out = fdopen(fd, "w");
+  fprintf(out,
+          "(defmacro SQ (q) (* q q))\n"
+          "(defmacro CLAMP (lo hi v) (if (< v lo) lo (if (> v hi) hi v)))\n"
+          "(defmacro POLY (pa pb pc px) (+ (* pa (SQ px)) (* pb px) pc))\n"
+          "(defmacro LERP (la lb lt) (+ la (/ (* (- lb la) lt) 256)))\n"
+          "(defmacro TAP (s k) (CLAMP 0 255 (LERP s k (SQ k))))\n"
+          "(defmacro SUM4 (w) (+ (TAP w 0) (TAP w 1) (TAP w 2) (TAP w 3)))\n");
+  for (int i = 0; i < n; i++) {
+    fprintf(out,
+            "(def f%d (x int y int) -> int\n"
+            "  (let r :int (POLY 3 %d 7 (CLAMP 0 100 x)))\n"
+            "  (set r (+ r (LERP x y (SQ %d))))\n"
+            "  (set r (+ r (SUM4 (CLAMP 0 r y))))\n"
+            "  (CLAMP 0 65535 r))\n",
+            i, i % 13, i % 17);
+  }
+  fclose(out);
+  return path;
+}
+
+// Parses `path` in a child process.
+static Result run_once(char *path) {
+  int fds[2];
+  if (pipe(fds) < 0)
+    error("pipe: %s", strerror(errno));
+
+  pid_t pid = fork();
+  if (pid == 0) {
+    Token *tok = tokenize_file(path);
+    double start = now();
+    parse(tok);
+    Result r = {now() - start, ast_arena.nallocs};
+    write(fds[1], &r, sizeof(r));
+    _exit(0);
+  }
+
+  Result r;
+  if (read(fds[0], &r, sizeof(r)) != sizeof(r))
+    error("benchmark child failed");
+  waitpid(pid, NULL, 0);
+  close(fds[0]);
+  close(fds[1]);
+  return r;
+}
+
+static Result run(char *path) {
+  Result best = {1e9};
+  for (int i = 0; i < 5; i++) {
+    Result r = run_once(path);
+    if (r.time < best.time)
+      best = r;
+  }
+  return best;
+}
+
+int main(int argc, char **argv) {
+  int n = argc > 1 ? atoi(argv[1]) : 200;
+
+  char *path = generate(n);
+  Result r = run(path);
+  unlink(path);
+
+  printf("%d functions, %zu AST allocations\n", n, r.nodes);
+  printf("parse %9.3fs\n", r.time);
+  return 0;
+}
@@ -0,0 +1,189 @@
+// Measures what the peephole optimizer does to the code of -O0.
+//
+//   bench/peepbench
+//
+// Each program below is compiled at -O0 with and without the peephole
+// optimizer, assembled and linked with cc, and run. The first table
+// shows how many instructions were emitted and how long the program
+// took; both builds must exit with the same status. The second shows
+// how often each rule fired in each program.
+
+#include "../manda.h"
+#include <sys/wait.h>
+#include <time.h>
+
+static char *programs[][2] = {
+  {"loops",
+   "(def main() -> int\n"
+   "  (let s :int 0) (let i :int 0)\n"
+   "  (while (< i 30000)\n"
+   "    (let j :int 0)\n"
+   "    (while (< j 1000)\n"
+   "      (set s (- (+ s (* (bitxor i j) 3)) (sra j 2)))\n"
+   "      (set j (+ j 1)))\n"
+   "    (set i (+ i 1)))\n"
+   "  (bitand s 127))\n"},
+  {"fib",
+   "(def fib (n int) -> int (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))\n"
+   "(def main() -> int (bitand (fib 35) 127))\n"},
+  {"collatz",
+   "(def steps (n long) -> long\n"
+   "  (let k :long 0)\n"
+   "  (while (> n 1)\n"
+   "    (if (= (mod n 2) 1) (set n (+ (* 3 n) 1)) (set n (/ n 2)))\n"
+   "    (set k (+ k 1)))\n"
+   "  k)\n"
+   "(def main() -> int\n"
+   "  (let best :long 0) (let i :long 1)\n"
+   "  (while (< i 1000000)\n"
+   "    (let s :long (steps i))\n"
+   "    (if (> s best) (set best s))\n"
+   "    (set i (+ i 1)))\n"
+   "  (cast (bitand best 127) int))\n"},
+};
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int wait_for(pid_t pid) {
+  int status;
+  waitpid(pid, &status, 0);
+  return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+// Compiles `src` in a child process and counts the instructions it
+// emitted. The child writes its rule counts to `stats`.
+static void compile(char *src, bool peephole, char *asm_path, int *insns, FILE *stats) {
+  char m_path[] = "/tmp/manda-peepbench-XXXXXX";
+  int fd = mkstemp(m_path);
+  if (fd < 0)
+    error("mkstemp: %s", strerror(errno));
+  write(fd, src, strlen(src));
+  close(fd);
+
+  pid_t pid = fork();
+  if (pid == 0) {
+    opt_peephole = peephole;
+    FILE *out = fopen(asm_path, "w");
+    fprintf(out, ".file 1 \"%s\"\n", m_path);
+    compile_file(m_path, out);
+    fclose(out);
+    print_peephole_stats(stats);
+    fflush(stats);
+    _exit(0);
+  }
+  if (wait_for(pid) != 0)
+    error("cannot compile the benchmark");
+  unlink(m_path);
+
+  *insns = 0;
+  FILE *in = fopen(asm_path, "r");
+  char line[256];
+  while (fgets(line, sizeof(line), in))
+    if (line[0] == ' ' && line[strspn(line, " ")] != '.')
+      (*insns)++;
+  fclose(in);
+}
+
+// Assembles `asm_path`, runs it and returns its exit status.
+static int run(char *asm_path, double *time) {
+  char exe_path[] = "/tmp/manda-peepbench-XXXXXX";
+  int fd = mkstemp(exe_path);
+  if (fd < 0)
+    error("mkstemp: %s", strerror(errno));
+  close(fd);
+
+  pid_t pid = fork();
+  if (pid == 0) {
+    execlp("cc", "cc", "-o", exe_path, asm_path, NULL);
+    _exit(127);
+  }
+  if (wait_for(pid) != 0)
+    error("cannot assemble the benchmark");
+
+  double start = now();
+  pid = fork();
+  if (pid == 0) {
+    execl(exe_path, exe_path, NULL);
+    _exit(127);
+  }
+  int status = wait_for(pid);
+  *time = now() - start;
+  unlink(exe_path);
+  return status;
+}
+
+#define NPROGRAMS (sizeof(programs) / sizeof(*programs))
+#define MAX_RULES 32
+
+// Reads back what print_peephole_stats() wrote: a header, then a name
+// and a count per line.
+static int read_stats(FILE *in, char names[][32], long *hits) {
+  char line[256];
+  int n = 0;
+  rewind(in);
+  fgets(line, sizeof(line), in);
+  while (n < MAX_RULES && fgets(line, sizeof(line), in)) {
+    char *p = strrchr(line, ' ');
+    hits[n] = atol(p + 1);
+    while (p > line && p[-1] == ' ')
+      p--;
+    *p = '\0';
+    snprintf(names[n++], 32, "%s", line);
+  }
+  return n;
+}
+
+int main(int argc, char **argv) {
+
+  char names[MAX_RULES][32];
+  long hits[NPROGRAMS][MAX_RULES];
+  int nrules = 0;
+
+  printf("%-8s %9s %9s %8s %8s %7s\n", "program", "insns off", "insns on",
+         "time off", "time on", "speedup");
+
+  for (int i = 0; i < NPROGRAMS; i++) {
+    int insns[2], status[2];
+    double time[2];
+    FILE *stats = tmpfile();
+
+    for (int on = 0; on < 2; on++) {
+      char asm_path[] = "/tmp/manda-peepbench-XXXXXX.s";
+      int fd = mkstemps(asm_path, 2);
+      if (fd < 0)
+        error("mkstemp: %s", strerror(errno));
+      close(fd);
+
+      rewind(stats);
+      compile(programs[i][1], on, asm_path, &insns[on], stats);
+      status[on] = run(asm_path, &time[on]);
+      unlink(asm_path);
+    }
+
+    if (status[0] != status[1])
+      error("%s: exit status %d without the optimizer but %d with it",
+            programs[i][0], status[0], status[1]);
+
+    nrules = read_stats(stats, names, hits[i]);
+    fclose(stats);
+
+    printf("%-8s %9d %9d %7.3fs %7.3fs %6.2fx\n", programs[i][0],
+           insns[0], insns[1], time[0], time[1], time[0] / time[1]);
+  }
+
+  printf("\n%-14s", "rule");
+  for (int i = 0; i < NPROGRAMS; i++)
+    printf(" %8s", programs[i][0]);
+  printf("\n");
+  for (int r = 0; r < nrules; r++) {
+    printf("%-14s", names[r]);
+    for (int i = 0; i < NPROGRAMS; i++)
+      printf(" %8ld", hits[i][r]);
+    printf("\n");
+  }
+  return 0;
+}
@@ -0,0 +1,150 @@
+// Compares the code generated at -O0 and -O1.
+//
+//   bench/regbench
+//
+// Each program below is compiled at both levels, assembled and linked
+// with cc, and run. The table shows how many instructions were emitted,
+// how many of them access the stack frame, and how long the program
+// took. The programs are dominated by loops over local variables, which
+// -O0 loads and stores on every use and -O1 keeps in registers. Both
+// builds must exit with the same status.
+
+#include "../manda.h"
+#include <sys/wait.h>
+#include <time.h>
+
+static char *programs[][2] = {
+  {"loops",
+   "(def main() -> int\n"
+   "  (let s :int 0) (let i :int 0)\n"
+   "  (while (< i 30000)\n"
+   "    (let j :int 0)\n"
+   "    (while (< j 1000)\n"
+   "      (set s (- (+ s (* (bitxor i j) 3)) (sra j 2)))\n"
+   "      (set j (+ j 1)))\n"
+   "    (set i (+ i 1)))\n"
+   "  (bitand s 127))\n"},
+  {"fib",
+   "(def fib (n int) -> int (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))\n"
+   "(def main() -> int (bitand (fib 35) 127))\n"},
+  {"collatz",
+   "(def steps (n long) -> long\n"
+   "  (let k :long 0)\n"
+   "  (while (> n 1)\n"
+   "    (if (= (mod n 2) 1) (set n (+ (* 3 n) 1)) (set n (/ n 2)))\n"
+   "    (set k (+ k 1)))\n"
+   "  k)\n"
+   "(def main() -> int\n"
+   "  (let best :long 0) (let i :long 1)\n"
+   "  (while (< i 1000000)\n"
+   "    (let s :long (steps i))\n"
+   "    (if (> s best) (set best s))\n"
+   "    (set i (+ i 1)))\n"
+   "  (cast (bitand best 127) int))\n"},
+};
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int wait_for(pid_t pid) {
+  int status;
+  waitpid(pid, &status, 0);
+  return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+// Compiles `src` at `level` in a child process and counts what it emitted.
+static void compile(char *src, int level, char *asm_path, int *insns, int *frame_refs) {
+  char m_path[] = "/tmp/manda-regbench-XXXXXX";
+  int fd = mkstemp(m_path);
+  if (fd < 0)
+    error("mkstemp: %s", strerror(errno));
+  write(fd, src, strlen(src));
+  close(fd);
+
+  pid_t pid = fork();
+  if (pid == 0) {
+    opt_level = level;
+    FILE *out = fopen(asm_path, "w");
+    fprintf(out, ".file 1 \"%s\"\n", m_path);
+    compile_file(m_path, out);
+    fclose(out);
+    _exit(0);
+  }
+  if (wait_for(pid) != 0)
+    error("cannot compile the benchmark");
+  unlink(m_path);
+
+  *insns = *frame_refs = 0;
+  FILE *in = fopen(asm_path, "r");
+  char line[256];
+  while (fgets(line, sizeof(line), in)) {
+    if (line[0] != ' ' || line[strspn(line, " ")] == '.')
+      continue;
+    (*insns)++;
+    if (strstr(line, "(%rbp)") || strstr(line, "push %rax") || strstr(line, "pop %r"))
+      (*frame_refs)++;
+  }
+  fclose(in);
+}
+
+// Assembles `asm_path`, runs it and returns its exit status.
+static int run(char *asm_path, double *time) {
+  char exe_path[] = "/tmp/manda-regbench-XXXXXX";
+  int fd = mkstemp(exe_path);
+  if (fd < 0)
+    error("mkstemp: %s", strerror(errno));
+  close(fd);
+
+  pid_t pid = fork();
+  if (pid == 0) {
+    execlp("cc", "cc", "-o", exe_path, asm_path, NULL);
+    _exit(127);
+  }
+  if (wait_for(pid) != 0)
+    error("cannot assemble the benchmark");
+
+  double start = now();
+  pid = fork();
+  if (pid == 0) {
+    execl(exe_path, exe_path, NULL);
+    _exit(127);
+  }
+  int status = wait_for(pid);
+  *time = now() - start;
+  unlink(exe_path);
+  return status;
+}
+
+int main(int argc, char **argv) {
+
+  printf("%-8s %9s %9s %9s %9s %8s %8s %7s\n", "program", "insns O0", "insns O1",
+         "frame O0", "frame O1", "time O0", "time O1", "speedup");
+
+  for (int i = 0; i < sizeof(programs) / sizeof(*programs); i++) {
+    int insns[2], frame_refs[2], status[2];
+    double time[2];
+
+    for (int level = 0; level < 2; level++) {
+      char asm_path[] = "/tmp/manda-regbench-XXXXXX.s";
+      int fd = mkstemps(asm_path, 2);
+      if (fd < 0)
+        error("mkstemp: %s", strerror(errno));
+      close(fd);
+
+      compile(programs[i][1], level, asm_path, &insns[level], &frame_refs[level]);
+      status[level] = run(asm_path, &time[level]);
+      unlink(asm_path);
+    }
+
+    if (status[0] != status[1])
+      error("%s: exit status %d at -O0 but %d at -O1", programs[i][0], status[0], status[1]);
+
+    printf("%-8s %9d %9d %9d %9d %7.3fs %7.3fs %6.2fx\n", programs[i][0],
+           insns[0], insns[1], frame_refs[0], frame_refs[1],
+           time[0], time[1], time[0] / time[1]);
+  }
+  return 0;
+}
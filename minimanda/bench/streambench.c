@@ -0,0 +1,109 @@
+// Compares compiling a whole program at once with the pipeline.
+//
+//   bench/streambench [ <functions> ]
+//
+// A program of the given number of functions (100k by default) is
+// generated, with the structs, globals, macros and strings that go with
+// them. Some functions are pure and are called at compile time by
+// later ones. It is compiled once by tokenizing, parsing and generating
+// code for the whole file, one phase after the other, and once by
+// compile_file(), which streams top-level forms through a pipeline of
+// threads. Each run happens in a fresh child process, and its wall
+// time and peak memory are reported.
+
+#include "../manda.h"
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+
+typedef struct {
+  double time;
+  long maxrss;
+} Result;
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char *generate(int n) {
+  static char path[] = "/tmp/manda-streambench-XXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0)
+    error("mkstemp: %s", strerror(errno));
+
+  FILE *out = fdopen(fd, "w");
+  fprintf(out, "(defmacro TWICE ((once x)) (+ x x))\n");
+  for (int i = 0; i < n; i++) {
+    switch (i % 4) {
+    case 0:
+      fprintf(out,
+              "(defstruct S%d a int b long)\n"
+              "(def f%d (x int) -> int\n"
+              "  (let s :S%d) (set s.a x) (set s.b %d) (+ s.a (cast s.b int)))\n",
+              i, i, i, i % 11);
+      break;
+    case 1:
+      fprintf(out,
+              "(def f%d (x int) -> int (TWICE (f%d x)))\n"
+              "(let g%d :int (f%d %d))\n",
+              i, i - 1, i, i, i % 7);
+      break;
+    case 2:
+      fprintf(out,
+              "(defmacro M%d (y) (* y %d))\n"
+              "(def f%d (x int) -> int (+ (M%d x) (comptime (f%d 3)) g%d))\n",
+              i, i % 13, i, i, i - 1, i - 1);
+      break;
+    case 3:
+      fprintf(out,
+              "(def f%d (x int) -> int\n"
+              "  (let t :[4 int]) (iset t 1 x)\n"
+              "  (+ (iget t 1) (iget (str f%d) (bitand x 3)) (f%d x)))\n",
+              i, i, i - 1);
+      break;
+    }
+  }
+  fprintf(out, "(def main() -> int 0)\n");
+  fclose(out);
+  return path;
+}
+
+static Result run(char *path, bool stream) {
+  double start = now();
+  pid_t pid = fork();
+  if (pid == 0) {
+    FILE *out = fopen("/dev/null", "w");
+    if (stream) {
+      compile_file(path, out);
+    } else {
+      Node *prog = parse(tokenize_file(path));
+      codegen(prog, out);
+    }
+    fclose(out);
+    _exit(0);
+  }
+
+  int status;
+  struct rusage ru;
+  if (wait4(pid, &status, 0, &ru) < 0 || !WIFEXITED(status) || WEXITSTATUS(status))
+    error("benchmark child failed");
+  return (Result){now() - start, ru.ru_maxrss};
+}
+
+int main(int argc, char **argv) {
+  int n = argc > 1 ? atoi(argv[1]) : 100000;
+
+  char *path = generate(n);
+  struct stat st;
+  stat(path, &st);
+  Result whole = run(path, false);
+  Result stream = run(path, true);
+  unlink(path);
+
+  printf("%d functions, %.1f MB of source\n", n, st.st_size / 1e6);
+  printf("%-10s %9.3fs %8.1f MB\n", "whole", whole.time, whole.maxrss / 1024.0);
+  printf("%-10s %9.3fs %8.1f MB\n", "stream", stream.time, stream.maxrss / 1024.0);
+  return 0;
+}
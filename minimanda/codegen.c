@@ -3,9 +3,14 @@
 
 static void gen_addr(Node* node);
 static void gen_expr(Node* node);
+static void gen_cond(Node* node, int t, int f);
 
 
 // codegen
+
+// Optimization level, 0 or 1. See regalloc.c for -O1.
+int opt_level;
+
 static FILE *output_file;
 static int depth;
 static char *argreg8[] = {"%dil", "%sil", "%dl", "%cl", "%r8b", "%r9b"};
@@ -14,11 +19,16 @@ static char *argreg32[] = {"%edi", "%esi", "%edx", "%ecx", "%r8d", "%r9d"};
 static char *argreg64[] = {"%rdi", "%rsi", "%rdx", "%rcx", "%r8", "%r9"};
 static Node* current_fn;
 
-static void println(char *fmt, ...) {
+// Prints a line of assembly. The lines of a function are held back
+// for the peephole optimizer, see peephole.c.
+void println(char *fmt, ...) {
   va_list ap;
   va_start(ap, fmt);
-  vfprintf(output_file, fmt, ap);
-  fprintf(output_file, "\n");
+  if (!buffer_line(fmt, ap)) {
+    vfprintf(output_file, fmt, ap);
+    fprintf(output_file, "\n");
+  }
+  va_end(ap);
 }
 
 static int count(void) {
@@ -123,16 +133,14 @@ static void gen_addr(Node *node) {
 }
 
 // Assign offsets to local variables.
-static void assign_lvar_offsets(Node* prog) {
-  for (Node* fn = prog; fn; fn = fn->next) {
-    int offset = 0;
-    for (Var *var = fn->locals; var; var = var->next) {
-      offset += var->ty->size;
-      offset = align_to(offset, var->ty->align);
-      var->offset = -offset;
-    }
-    fn->stack_size = align_to(offset, 16);
+static void assign_lvar_offsets(Node* fn) {
+  int offset = 0;
+  for (Var *var = fn->locals; var; var = var->next) {
+    offset += var->ty->size;
+    offset = align_to(offset, var->ty->align);
+    var->offset = -offset;
   }
+  fn->stack_size = align_to(offset, 16);
 }
 
 
@@ -170,8 +178,315 @@ static void cast(Type* from, Type* to) {
     println("  %s", cast_table[t1][t2]);
 }
 
+static void emit_loc(Node* node) {
+  println(" .loc 1 %d %d", node->tok->line_no, node->tok->col_no);
+}
+
+// Operators whose left operand may itself be a long chain of them, as
+// in the tree an n-ary (+ a b c ...) becomes. Such a chain is generated
+// by walking down and back up its left operands without recursing.
+bool is_chain(Node* node) {
+  switch (node->kind) {
+  case ND_ADD:
+  case ND_SUB:
+  case ND_MUL:
+  case ND_DIV:
+  case ND_MOD:
+  case ND_EQ:
+  case ND_LT:
+  case ND_LE:
+  case ND_GT:
+  case ND_GE:
+  case ND_AND:
+  case ND_OR:
+  case ND_BITAND:
+  case ND_BITOR:
+  case ND_BITXOR:
+  case ND_SRA:
+  case ND_SRL:
+  case ND_SLL:
+  case ND_IGET:
+    return true;
+  }
+  return false;
+}
+
+// Returns true if element `index` of an array of `ty` is at a constant
+// offset that fits in an immediate, and sets `*offset` to it.
+bool constant_offset(Node* index, Type* ty, int64_t* offset) {
+  if (index->kind != ND_NUM)
+    return false;
+  *offset = (uint64_t)index->val * ty->size;
+  return *offset == (int32_t)*offset;
+}
+
+// Generates the part of `node` that comes before its left operand.
+// Returns a label number for gen_after_lhs().
+static int gen_before_lhs(Node* node) {
+  emit_loc(node);
+  switch (node->kind) {
+  case ND_AND:
+  case ND_OR:
+    return count();
+  case ND_IGET:
+    return 0;
+  }
+
+  if (can_reduce(node))
+    return 0;
+  gen_expr(node->rhs);
+  push();
+  return 0;
+}
+
+// Generates the part of `node` that comes after its left operand.
+static void gen_after_lhs(Node* node, int c) {
+  switch (node->kind) {
+  case ND_AND:
+    println("  cmp $0, %%rax");
+    println("  je .L.%d", c);
+    gen_cond(node->rhs, -1, c);
+    println("  mov $1, %%rax");
+    println("  jmp .L.end.%d", c);
+    println(".L.%d:", c);
+    println("  mov $0, %%rax");
+    println(".L.end.%d:", c);
+    return;
+  case ND_OR:
+    println("  cmp $0, %%rax");
+    println("  jne .L.%d", c);
+    gen_cond(node->rhs, c, -1);
+    println("  mov $0, %%rax");
+    println("  jmp .L.end.%d", c);
+    println(".L.%d:", c);
+    println("  mov $1, %%rax");
+    println(".L.end.%d:", c);
+    return;
+  case ND_IGET: {
+    int64_t offset;
+    if (constant_offset(node->rhs, node->lhs->ty->base, &offset)) {
+      if (offset)
+        println("  add $%ld, %%rax", offset);
+      load(node->lhs->ty->base);
+      return;
+    }
+    push();
+    gen_expr(node->rhs);
+    gen_mul_imm(node->lhs->ty->base->size, 8, "%rax");
+    pop("%rdi");
+    println("  add %%rdi, %%rax");
+    load(node->lhs->ty->base);
+    return;
+  }
+  }
+
+  // Multiplication or division by a constant. See strength.c.
+  if (can_reduce(node)) {
+    bool wide = node->lhs->ty->kind == TY_LONG || node->lhs->ty->base;
+    if (node->kind == ND_MUL)
+      gen_mul_imm(node->rhs->val, wide ? 8 : 4, "%rax");
+    else
+      gen_div_imm(node->rhs->val, wide ? 8 : 4, node->kind == ND_MOD);
+    return;
+  }
+
+  pop("%rdi");
+
+  char *ax, *di;
+  if (node->lhs->ty->kind == TY_LONG || node->lhs->ty->base) {
+    ax = "%rax";
+    di = "%rdi";
+  } else {
+    ax = "%eax";
+    di = "%edi";
+  }
+  // for compare operation.
+  char* cc = NULL;
+
+  switch (node->kind) {
+  case ND_ADD:
+    println("  add %s, %s", di, ax);
+    return;
+  case ND_SUB:
+    println("  sub %s, %s", di, ax);
+    return;
+  case ND_MUL:
+    println("  imul %s, %s", di, ax);
+    return;
+  case ND_DIV:
+  case ND_MOD:
+    if (node->lhs->ty->size == 8) {
+      println("  cqo");
+    } else {
+      println("  cdq");
+    }
+    println("  idiv %s", di);
+    if (node->kind == ND_MOD) {
+      println("  mov %%rdx, %%rax");
+    }
+    return;
+  case ND_BITAND:
+    println("  and %s, %s", di, ax);
+    return;
+  case ND_BITOR:
+    println("  or %s, %s", di, ax);
+    return;
+  case ND_BITXOR:
+    println("  xor %s, %s", di, ax);
+    return;
+  case ND_SRA:
+    println("  mov %%rdi, %%rcx");
+    println("  sar %%cl, %%rax");
+    return;
+  case ND_SRL:
+    println("  mov %%rdi, %%rcx");
+    println("  shr %%cl, %%rax");
+    return;
+  case ND_SLL:
+    println("  mov %%rdi, %%rcx");
+    println("  shl %%cl, %%rax");
+    return;
+  case ND_EQ: cc = "e"; break;
+  case ND_LT: cc = "l"; break;
+  case ND_LE: cc = "le"; break;
+  case ND_GE: cc = "ge"; break;
+  case ND_GT: cc = "g"; break;
+ }
+  if (cc) {
+    println("  cmp %s, %s", di, ax);
+    println("  set%s %%al", cc);
+    println("  movzb %%al, %%rax");
+    return;
+  }
+
+  error("invalid expression");
+}
+
+// The links of the chains being generated, innermost last.
+typedef struct {
+  Node* node;
+  int label;
+} ChainLink;
+
+static ChainLink* links;
+static int links_len;
+static int links_capacity;
+
+static void push_link(Node* node, int label) {
+  if (links_len == links_capacity) {
+    links_capacity = links_capacity ? links_capacity * 2 : 64;
+    links = realloc(links, sizeof(ChainLink) * links_capacity);
+    if (!links)
+      error("out of memory");
+  }
+  links[links_len++] = (ChainLink){node, label};
+}
+
+static void gen_chain(Node* node) {
+  int base = links_len;
+  for (; is_chain(node); node = node->lhs) {
+    int label = gen_before_lhs(node);
+    push_link(node, label);
+  }
+  gen_expr(node);
+  while (links_len > base) {
+    ChainLink link = links[--links_len];
+    gen_after_lhs(link.node, link.label);
+  }
+}
+
+static char* negate_cc(char* cc) {
+  if (!strcmp(cc, "e"))
+    return "ne";
+  if (!strcmp(cc, "ne"))
+    return "e";
+  if (!strcmp(cc, "l"))
+    return "ge";
+  if (!strcmp(cc, "ge"))
+    return "l";
+  if (!strcmp(cc, "le"))
+    return "g";
+  return "le";
+}
+
+// Jumps on the flags to .L.<t> if `cc` holds and to .L.<f> if not,
+// where either label may be -1 to fall through instead.
+static void branch(char* cc, int t, int f) {
+  if (t < 0) {
+    println("  j%s .L.%d", negate_cc(cc), f);
+    return;
+  }
+  println("  j%s .L.%d", cc, t);
+  if (f >= 0)
+    println("  jmp .L.%d", f);
+}
+
+// Jumps to .L.<t> if `node` is true and to .L.<f> if it is false,
+// either of which may be -1 to fall through. A comparison jumps on the
+// flags of its cmp, and not, and and or become jumps, so a condition
+// never computes the 0 or 1 that gen_expr() would. A chain of ands or
+// ors is walked down its left operands without recursing, like
+// gen_chain().
+static void gen_cond(Node* node, int t, int f) {
+  switch (node->kind) {
+  case ND_NOT:
+    gen_cond(node->lhs, f, t);
+    return;
+  case ND_AND:
+  case ND_OR: {
+    // Every operand but the last one jumps to `out` when it decides
+    // the result, and otherwise falls through to the next one.
+    bool is_and = node->kind == ND_AND;
+    int out = is_and ? f : t;
+    int skip = (out >= 0) ? out : count();
+    int base = links_len;
+    Node* n = node;
+    for (; n->kind == node->kind; n = n->lhs)
+      push_link(n->rhs, 0);
+    for (;;) {
+      if (links_len == base) {
+        gen_cond(n, t, f);
+        break;
+      }
+      gen_cond(n, is_and ? -1 : skip, is_and ? skip : -1);
+      n = links[--links_len].node;
+    }
+    if (out < 0)
+      println(".L.%d:", skip);
+    return;
+  }
+  case ND_EQ:
+  case ND_LT:
+  case ND_LE:
+  case ND_GT:
+  case ND_GE: {
+    emit_loc(node);
+    gen_expr(node->rhs);
+    push();
+    gen_expr(node->lhs);
+    pop("%rdi");
+    if (node->lhs->ty->kind == TY_LONG || node->lhs->ty->base)
+      println("  cmp %%rdi, %%rax");
+    else
+      println("  cmp %%edi, %%eax");
+    branch((node->kind == ND_EQ) ? "e" : (node->kind == ND_LT) ? "l" :
+           (node->kind == ND_LE) ? "le" : (node->kind == ND_GT) ? "g" : "ge", t, f);
+    return;
+  }
+  }
+
+  gen_expr(node);
+  println("  cmp $0, %%rax");
+  branch("ne", t, f);
+}
+
 static void gen_expr(Node* node) {
-  println(" .loc 1 %d", node->tok->line_no);
+  if (is_chain(node)) {
+    gen_chain(node);
+    return;
+  }
+
+  emit_loc(node);
   switch(node->kind) {
   case ND_DEFSTRUCT:
   case ND_DEFUNION:
@@ -202,47 +517,18 @@ static void gen_expr(Node* node) {
     return;
   case ND_IF: {     // {} is needed here to declare `c`.
     int c = count();
-    gen_expr(node->cond);
-    println("  cmp $0, %%rax");
-    println("  je  .L.else.%d", c);
+    gen_cond(node->cond, -1, c);
     gen_expr(node->then);
     println("  jmp .L.end.%d", c);
-    println(".L.else.%d:", c);
+    println(".L.%d:", c);
     if (node->els)
       gen_expr(node->els);
+    else
+      println("  mov $0, %%rax");
     println(".L.end.%d:", c);
     return;
   }
-  case ND_AND: {
-    int c = count();
-    gen_expr(node->lhs);
-    println("  cmp $0, %%rax");
-    println("  je .L.false.%d", c);
-    gen_expr(node->rhs);
-    println("  cmp $0, %%rax");
-    println("  je .L.false.%d", c);
-    println("  mov $1, %%rax");
-    println("  jmp .L.end.%d", c);
-    println(".L.false.%d:", c);
-    println("  mov $0, %%rax");
-    println(".L.end.%d:", c);
-    return;
-  }
-  case ND_OR: {
-    int c = count();
-    gen_expr(node->lhs);
-    println("  cmp $0, %%rax");
-    println("  jne .L.true.%d", c);
-    gen_expr(node->rhs);
-    println("  cmp $0, %%rax");
-    println("  jne .L.true.%d", c);
-    println("  mov $0, %%rax");
-    println("  jmp .L.end.%d", c);
-    println(".L.true.%d:", c);
-    println("  mov $1, %%rax");
-    println(".L.end.%d:", c);
-    return;
-  }
+
   case ND_DO: 
     for (Node* n = node->body; n; n = n->next)
       gen_expr(n);
@@ -250,13 +536,14 @@ static void gen_expr(Node* node) {
   case ND_WHILE: {
     int c = count();
     println(".L.while.%d:", c);
-    gen_expr(node->cond);
-    println("  cmp $0, %%rax");
-    println("  je  .L.end.%d", c);
+    // A loop whose condition is a nonzero number never ends.
+    if (node->cond->kind != ND_NUM || node->cond->val == 0)
+      gen_cond(node->cond, -1, c);
     for (Node* n = node->then; n; n = n->next)
       gen_expr(n);
     println("  jmp .L.while.%d", c);
-    println(".L.end.%d:", c);
+    println(".L.%d:", c);
+    println("  mov $0, %%rax");
     return;
   }
   case ND_APP: {
@@ -300,100 +587,26 @@ static void gen_expr(Node* node) {
       return;
   } 
 
-  // iget iset
+  // iset
   switch (node->kind) {
-    case ND_ISET:
+    case ND_ISET: {
+      int64_t offset;
       gen_expr(node->lhs);
-      push();
-      gen_expr(node->mhs);
-      println("  imul $%d, %%rax", node->lhs->ty->base->size);
-      pop("%rdi");
-      println("  add %%rdi, %%rax");
+      if (constant_offset(node->mhs, node->lhs->ty->base, &offset)) {
+        if (offset)
+          println("  add $%ld, %%rax", offset);
+      } else {
+        push();
+        gen_expr(node->mhs);
+        gen_mul_imm(node->lhs->ty->base->size, 8, "%rax");
+        pop("%rdi");
+        println("  add %%rdi, %%rax");
+      }
       push();
       gen_expr(node->rhs);
       store(node->lhs->ty->base);
       return;
-    case ND_IGET:
-      gen_expr(node->lhs);
-      push();
-      gen_expr(node->rhs);
-      println("  imul $%d, %%rax", node->lhs->ty->base->size);
-      pop("%rdi");
-      println("  add %%rdi, %%rax");
-      load(node->lhs->ty->base);
-      return;
-  }
-
-  gen_expr(node->rhs);
-  push();
-  gen_expr(node->lhs);
-  pop("%rdi");
-  
-  char *ax, *di;
-  if (node->lhs->ty->kind == TY_LONG || node->lhs->ty->base) {
-    ax = "%rax";
-    di = "%rdi";
-  } else {
-    ax = "%eax";
-    di = "%edi";
-  }
-  // for compare operation.
-  char* cc = NULL;
-
-  switch (node->kind) {
-  case ND_ADD:
-    println("  add %s, %s", di, ax);
-    return;
-  case ND_SUB:
-    println("  sub %s, %s", di, ax);
-    return;
-  case ND_MUL:
-    println("  imul %s, %s", di, ax);
-    return;
-  case ND_DIV:
-  case ND_MOD:
-    if (node->lhs->ty->size == 8) {
-      println("  cqo");
-    } else {
-      println("  cdq");
     }
-    println("  idiv %s", di);
-    if (node->kind == ND_MOD) {
-      println("  mov %%rdx, %%rax");
-    }
-    return;
-  case ND_BITAND:
-    println("  and %s, %s", di, ax);
-    return;
-  case ND_BITOR:
-    println("  or %s, %s", di, ax);
-    return;
-  case ND_BITXOR:
-    println("  xor %s, %s", di, ax);
-    return;
-  case ND_SRA:
-    println("  mov %%rdi, %%rcx");
-    println("  sar %%cl, %%rax");
-    return;
-  case ND_SRL:
-    println("  mov %%rdi, %%rcx");
-    println("  shr %%cl, %%rax");
-    return;
-  case ND_SLL:
-    println("  mov %%rdi, %%rcx");
-    println("  shl %%cl, %%rax");
-    return;
-  case ND_EQ: cc = "e"; break;
-  case ND_LT: cc = "l"; break;
-  case ND_LE: cc = "le"; break;
-  case ND_GE: cc = "ge"; break;
-  case ND_GT: cc = "g"; break;
- }
-  if (cc) {
-    println("  cmp %s, %s", di, ax);
-    println("  set%s %%al", cc);
-    println("  movzb %%al, %%rax");
-    return;
   }
 
   error("invalid expression");
@@ -401,55 +614,72 @@ static void gen_expr(Node* node) {
 
 
 // emit global variable
-static void emit_data(Node* prog) {
-  for (Node* node = prog; node; node = node->next) {
-    if (node->kind != ND_LET)
-      continue;
-
-    println("  .data");
-    println("  .globl %s", node->lhs->var->name);
-    println("%s:", node->lhs->var->name);
-    if (node->rhs && node->rhs->ty->kind == TY_ARRAY) {
-      for (int i = 0; i < node->lhs->ty->size; i++)
-        println("  .byte %d", node->rhs->str[i]);
-    } else {
-      println("  .zero %d", node->lhs->var->ty->size);
-    }
+static void emit_data(Node* node) {
+  Var* var = node->lhs->var;
+  println("  .data");
+  println("  .globl %s", var->name);
+  println("%s:", var->name);
+  if (var->init_data) {
+    for (int i = 0; i < var->ty->size; i++)
+      println("  .byte %d", var->init_data[i]);
+  } else {
+    println("  .zero %d", var->ty->size);
   }
 }
 
+static void emit_text(Node* fn) {
+  assign_lvar_offsets(fn);
+  println("  .globl %s", fn->fn);
+  println("  .text");
+  println("%s:", fn->fn);
+  current_fn = fn;
+
+  // Prologue
+  println("  push %%rbp");
+  println("  mov %%rsp, %%rbp");
+  println("  sub $%d, %%rsp", fn->stack_size);
+
+  int i = 0;
+  for (Node* arg = fn->args; arg; arg = arg->next)
+    store_gp(i++, arg->var->offset, arg->var->ty->size);
+  // Emit code
+  for (Node* e = fn->body; e; e = e->next) {
+    gen_expr(e);
+  }
+  assert(depth == 0);
 
-void codegen(Node* prog, FILE* out) {
+  // Epilogue
+  println(".L.return.%s:", fn->fn);
+  println("  mov %%rbp, %%rsp");
+  println("  pop %%rbp");
+  println("  ret");
+}
+
+// Emits the global variables defined by the lets in `lets`.
+void codegen_data(Node* lets, FILE* out) {
   output_file = out;
+  for (Node* node = lets; node; node = node->next)
+    emit_data(node);
+}
 
-  emit_data(prog);
-  assign_lvar_offsets(prog);
-  for (Node* fn = prog; fn; fn = fn->next) {
-    if (fn->kind != ND_FUNC) 
-      continue;
-
-    println("  .globl %s", fn->fn);
-    println("%s:", fn->fn);
-    current_fn = fn;
-
-    // Prologue
-    println("  push %%rbp");
-    println("  mov %%rsp, %%rbp");
-    println("  sub $%d, %%rsp", fn->stack_size);
-
-    int i = 0;
-    for (Node* arg = fn->args; arg; arg = arg->next)
-      store_gp(i++, arg->var->offset, arg->var->ty->size);
-    // Emit code
-    for (Node* e = fn->body; e; e = e->next) {
-      gen_expr(e);
-    }
-    assert(depth == 0);
+// Emits one function. Functions may be emitted as soon as they are
+// evaluated, and the data after all of them.
+void codegen_function(Node* fn, FILE* out) {
+  output_file = out;
+  start_buffering();
+  if (opt_level > 0)
+    codegen_function_o1(fn);
+  else
+    emit_text(fn);
+  flush_lines(out);
+}
 
-    // Epilogue
-    println(".L.return.%s:", fn->fn);
-    println("  mov %%rbp, %%rsp");
-    println("  pop %%rbp");
-    println("  ret");
-  }
+void codegen(Node* prog, FILE* out) {
+  output_file = out;
+  for (Node* node = prog; node; node = node->next)
+    if (node->kind == ND_LET)
+      emit_data(node);
+  for (Node* node = prog; node; node = node->next)
+    if (node->kind == ND_FUNC)
+      codegen_function(node, out);
 }
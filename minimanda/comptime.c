@@ -0,0 +1,846 @@
+// This file evaluates expressions at compile time.
+//
+// (comptime e) is replaced by the value of e, which is computed while
+// the program is parsed, and a let whose initializer is a constant
+// expression gets the value instead of the expression. The evaluator
+// runs the typed AST that codegen would compile and computes what the
+// generated code would leave in %rax: arithmetic on ints is done in 32
+// bits and zero-extends, loads sign-extend, and so on. Evaluating an
+// expression early therefore never changes what it computes.
+//
+// The variables of each call live in a frame on the host heap and a
+// pointer is a host address. Every load and store is checked against
+// the live frames, so a stray pointer is reported as an error instead
+// of crashing the compiler. Global variables cannot be used.
+//
+// A function can be called once its definition has been read. A let
+// initializer is folded if it reads no variable and calls only pure
+// functions, those that read no global variable and call only pure
+// functions or themselves. If folding fails for any reason, such as a
+// division by zero, the initializer is left as it is.
+//
+// The same evaluator folds the operations on numbers left in each
+// function once its types are known, see fold_function().
+
+#include "manda.h"
+#include <setjmp.h>
+
+// Limits on the work done by one evaluation
+#define COMPTIME_STEPS (1 << 26)
+#define FOLD_STEPS (1 << 20)
+#define MAX_CALL_DEPTH 1000
+
+typedef struct Frame Frame;
+struct Frame {
+  Frame* caller;
+  Var** vars;
+  char** addrs;   // addrs[i] is where vars[i] lives
+  int nvars;
+  char* data;
+  int size;
+};
+
+static Frame* frame;
+static int call_depth;
+static long steps;
+static uint64_t rax;
+
+// Set while a let initializer is being folded. Errors jump back to
+// fold_init() instead of being reported.
+static jmp_buf* recover;
+
+static uint64_t eval(Node* node);
+
+static void fail(Node* node, char* fmt, ...) {
+  if (recover)
+    longjmp(*recover, 1);
+
+  char buf[256];
+  va_list ap;
+  va_start(ap, fmt);
+  vsnprintf(buf, sizeof(buf), fmt, ap);
+  va_end(ap);
+  error_tok(node->tok, "%s", buf);
+}
+
+static bool is_aggregate(Type* ty) {
+  return ty->kind == TY_ARRAY || ty->kind == TY_STRUCT || ty->kind == TY_UNION;
+}
+
+//
+// Frames
+//
+
+// Makes a frame for the variables `vars` up to, but not including,
+// `end`. They are laid out like assign_lvar_offsets() does.
+static void push_frame(Var* vars, Var* end) {
+  Frame* f = calloc(1, sizeof(Frame));
+  for (Var* var = vars; var != end; var = var->next) {
+    f->size = align_to(f->size, var->ty->align) + var->ty->size;
+    f->nvars++;
+  }
+
+  f->vars = calloc(f->nvars + 1, sizeof(Var*));
+  f->addrs = calloc(f->nvars + 1, sizeof(char*));
+  f->data = calloc(1, f->size + 1);
+  if (!f->vars || !f->addrs || !f->data)
+    error("out of memory");
+
+  int offset = 0;
+  int i = 0;
+  for (Var* var = vars; var != end; var = var->next) {
+    offset = align_to(offset, var->ty->align);
+    f->vars[i] = var;
+    f->addrs[i++] = f->data + offset;
+    offset += var->ty->size;
+  }
+
+  f->caller = frame;
+  frame = f;
+}
+
+static void pop_frame(void) {
+  Frame* f = frame;
+  frame = f->caller;
+  free(f->vars);
+  free(f->addrs);
+  free(f->data);
+  free(f);
+}
+
+static char* var_addr(Node* node) {
+  for (int i = 0; i < frame->nvars; i++)
+    if (frame->vars[i] == node->var)
+      return frame->addrs[i];
+  fail(node, "'%s' is not known at compile time", node->var->name);
+}
+
+// Reports an error unless `size` bytes at `p` are in a live frame.
+static void check(Node* node, uint64_t p, int size) {
+  for (Frame* f = frame; f; f = f->caller)
+    if ((uint64_t)f->data <= p && p + size <= (uint64_t)f->data + f->size)
+      return;
+  fail(node, "invalid memory access at compile time");
+}
+
+// Mirrors load() in codegen.c.
+static uint64_t load(Node* node, Type* ty, uint64_t p) {
+  if (is_aggregate(ty))
+    return p;
+
+  check(node, p, ty->size);
+  char* addr = (char*)p;
+  switch (ty->size) {
+  case 1: { int8_t v; memcpy(&v, addr, 1); return (int64_t)v; }
+  case 2: { int16_t v; memcpy(&v, addr, 2); return (int64_t)v; }
+  case 4: { int32_t v; memcpy(&v, addr, 4); return (int64_t)v; }
+  }
+  uint64_t v;
+  memcpy(&v, addr, 8);
+  return v;
+}
+
+// Mirrors store() in codegen.c.
+static void store(Node* node, Type* ty, uint64_t p, uint64_t v) {
+  if (ty->kind == TY_STRUCT || ty->kind == TY_UNION) {
+    check(node, p, ty->size);
+    check(node, v, ty->size);
+    memmove((char*)p, (char*)v, ty->size);
+    return;
+  }
+
+  int size = ty->size < 8 ? ty->size : 8;
+  check(node, p, size);
+  memcpy((char*)p, &v, size);
+}
+
+static uint64_t eval_addr(Node* node) {
+  switch (node->kind) {
+  case ND_VAR:
+    return (uint64_t)var_addr(node);
+  case ND_STRUCT_REF:
+    return eval_addr(node->lhs) + node->member->offset;
+  }
+  fail(node, "not an lvalue");
+}
+
+//
+// Evaluator
+//
+
+static uint64_t eval_call(Node* node) {
+  uint64_t args[6];
+  int nargs = 0;
+  for (Node* arg = node->args; arg; arg = arg->next) {
+    if (nargs == 6)
+      fail(node, "too many arguments");
+    args[nargs++] = eval(arg);
+  }
+
+  Node* fn = name_symbol(node->fn)->fn;
+  if (!fn)
+    fail(node, "'%s' cannot be called at compile time", node->fn);
+  if (call_depth == MAX_CALL_DEPTH)
+    fail(node, "too many nested calls at compile time");
+
+  push_frame(fn->locals, NULL);
+  call_depth++;
+
+  int i = 0;
+  for (Node* param = fn->args; param; param = param->next) {
+    if (i == nargs)
+      fail(node, "too few arguments");
+    store(node, param->var->ty, (uint64_t)var_addr(param), args[i++]);
+  }
+  if (i != nargs)
+    fail(node, "too many arguments");
+
+  rax = 0;
+  for (Node* e = fn->body; e; e = e->next)
+    eval(e);
+
+  call_depth--;
+  pop_frame();
+  return rax;
+}
+
+// Mirrors the binary operators in gen_after_lhs(), where `a` and `b`
+// are the values of the operands.
+static uint64_t eval_binary(Node* node, uint64_t a, uint64_t b) {
+  bool wide = node->lhs->ty->kind == TY_LONG || node->lhs->ty->base;
+
+  switch (node->kind) {
+  case ND_ADD:
+    return wide ? a + b : (uint32_t)(a + b);
+  case ND_SUB:
+    return wide ? a - b : (uint32_t)(a - b);
+  case ND_MUL:
+    return wide ? a * b : (uint32_t)(a * b);
+  case ND_DIV:
+  case ND_MOD:
+    if (wide != (node->lhs->ty->size == 8))
+      fail(node, "cannot divide this type at compile time");
+    if (wide) {
+      if (b == 0)
+        fail(node, "division by zero");
+      if ((int64_t)a == INT64_MIN && (int64_t)b == -1)
+        fail(node, "division overflow");
+      return node->kind == ND_DIV ? (int64_t)a / (int64_t)b : (int64_t)a % (int64_t)b;
+    }
+    if ((uint32_t)b == 0)
+      fail(node, "division by zero");
+    if ((int32_t)a == INT32_MIN && (int32_t)b == -1)
+      fail(node, "division overflow");
+    return (uint32_t)(node->kind == ND_DIV ? (int32_t)a / (int32_t)b : (int32_t)a % (int32_t)b);
+  case ND_BITAND:
+    return wide ? a & b : (uint32_t)(a & b);
+  case ND_BITOR:
+    return wide ? a | b : (uint32_t)(a | b);
+  case ND_BITXOR:
+    return wide ? a ^ b : (uint32_t)(a ^ b);
+  case ND_SRA:
+    return (int64_t)a >> (b & 63);
+  case ND_SRL:
+    return a >> (b & 63);
+  case ND_SLL:
+    return a << (b & 63);
+  }
+
+  int64_t x = wide ? (int64_t)a : (int32_t)a;
+  int64_t y = wide ? (int64_t)b : (int32_t)b;
+  switch (node->kind) {
+  case ND_EQ: return x == y;
+  case ND_LT: return x < y;
+  case ND_LE: return x <= y;
+  case ND_GT: return x > y;
+  case ND_GE: return x >= y;
+  }
+  fail(node, "cannot be evaluated at compile time");
+}
+
+// The links of the chains being evaluated, innermost last. See
+// gen_chain() in codegen.c.
+typedef struct {
+  Node* node;
+  uint64_t rhs;
+} ChainLink;
+
+static ChainLink* links;
+static int links_len;
+static int links_capacity;
+
+static void push_link(Node* node, uint64_t rhs) {
+  if (links_len == links_capacity) {
+    links_capacity = links_capacity ? links_capacity * 2 : 64;
+    links = realloc(links, sizeof(ChainLink) * links_capacity);
+    if (!links)
+      error("out of memory");
+  }
+  links[links_len++] = (ChainLink){node, rhs};
+}
+
+static void step(Node* node) {
+  if (--steps < 0)
+    fail(node, "compile-time evaluation takes too long");
+}
+
+// Returns the value of `link.node` given that of its left operand.
+static uint64_t eval_after_lhs(ChainLink link, uint64_t lhs) {
+  Node* node = link.node;
+  switch (node->kind) {
+  case ND_AND:
+    return lhs && eval(node->rhs);
+  case ND_OR:
+    return lhs || eval(node->rhs);
+  case ND_IGET: {
+    uint64_t p = lhs + eval(node->rhs) * node->lhs->ty->base->size;
+    return load(node, node->lhs->ty->base, p);
+  }
+  }
+  return eval_binary(node, lhs, link.rhs);
+}
+
+static uint64_t eval_chain(Node* node) {
+  int base = links_len;
+  for (; is_chain(node); node = node->lhs) {
+    if (links_len > base)
+      step(node);
+    bool rhs_first = node->kind != ND_AND && node->kind != ND_OR && node->kind != ND_IGET;
+    push_link(node, rhs_first ? eval(node->rhs) : 0);
+  }
+
+  uint64_t v = eval(node);
+  while (links_len > base) {
+    ChainLink link = links[--links_len];
+    v = rax = eval_after_lhs(link, v);
+  }
+  return v;
+}
+
+// Mirrors cast_table in codegen.c.
+static uint64_t eval_cast(Node* node) {
+  enum { I8, I16, I32, I64 };
+  uint64_t v = eval(node->lhs);
+  int from = node->lhs->ty->kind == TY_CHAR ? I8 : node->lhs->ty->kind == TY_SHORT ? I16 :
+             node->lhs->ty->kind == TY_INT ? I32 : I64;
+  int to = node->ty->kind == TY_CHAR ? I8 : node->ty->kind == TY_SHORT ? I16 :
+           node->ty->kind == TY_INT ? I32 : I64;
+
+  if (to == I8 && from > I8)
+    return (uint32_t)(int8_t)v;
+  if (to == I16 && from > I16)
+    return (uint32_t)(int16_t)v;
+  if (to == I64 && from < I64)
+    return (int64_t)(int32_t)v;
+  return v;
+}
+
+static uint64_t eval_node(Node* node) {
+  switch (node->kind) {
+  case ND_DEFSTRUCT:
+  case ND_DEFUNION:
+  case ND_DEFTYPE:
+  case ND_DEFMACRO:
+    return rax;
+  case ND_NUM:
+    return node->val;
+  case ND_VAR:
+  case ND_STRUCT_REF:
+    return load(node, node->ty, eval_addr(node));
+  case ND_LET:
+    if (!node->rhs)
+      return rax;
+    // fallthrough
+  case ND_SET: {
+    uint64_t p = eval_addr(node->lhs);
+    uint64_t v = eval(node->rhs);
+    store(node, node->lhs->ty, p, v);
+    return v;
+  }
+  case ND_IF:
+    if (eval(node->cond))
+      return eval(node->then);
+    return node->els ? eval(node->els) : rax;
+  case ND_DO:
+    for (Node* n = node->body; n; n = n->next)
+      eval(n);
+    return rax;
+  case ND_WHILE:
+    while (eval(node->cond))
+      for (Node* n = node->then; n; n = n->next)
+        eval(n);
+    return rax;
+  case ND_APP:
+    return eval_call(node);
+  case ND_DEREF:
+    return load(node, node->ty, eval(node->lhs));
+  case ND_ADDR:
+    return eval_addr(node->lhs);
+  case ND_CAST:
+    return eval_cast(node);
+  case ND_NOT:
+    return eval(node->lhs) == 0;
+  case ND_BITNOT:
+    return ~eval(node->lhs);
+  case ND_ISET: {
+    uint64_t base = eval(node->lhs);
+    uint64_t p = base + eval(node->mhs) * node->lhs->ty->base->size;
+    uint64_t v = eval(node->rhs);
+    store(node, node->lhs->ty->base, p, v);
+    return v;
+  }
+  case ND_STR:
+  case ND_BOOL:
+  case ND_FUNC:
+  case ND_ARRAY_LITERAL:
+    fail(node, "cannot be evaluated at compile time");
+  }
+  if (is_chain(node))
+    return eval_chain(node);
+  fail(node, "cannot be evaluated at compile time");
+}
+
+static uint64_t eval(Node* node) {
+  step(node);
+  return rax = eval_node(node);
+}
+
+//
+// Purity
+//
+
+typedef struct {
+  Node* fn;
+  bool ok;
+} ConstantCheck;
+
+static bool check_constant(Node* node, void* arg) {
+  ConstantCheck* c = arg;
+  if (!c->ok)
+    return false;
+
+  switch (node->kind) {
+  case ND_VAR:
+    c->ok = c->fn && node->var->is_local;
+    break;
+  case ND_STR:
+  case ND_BOOL:
+  case ND_FUNC:
+  case ND_ARRAY_LITERAL:
+    c->ok = false;
+    break;
+  case ND_APP: {
+    Node* callee = name_symbol(node->fn)->fn;
+    c->ok = (c->fn && !strcmp(node->fn, c->fn->fn)) || (callee && callee->pure);
+    break;
+  }
+  }
+  return c->ok;
+}
+
+// Returns true if `node` reads no variable but the locals of `fn`, if
+// any, and calls only pure functions or `fn` itself.
+static bool is_constant(Node* node, Node* fn) {
+  ConstantCheck c = {fn, true};
+  walk_tree(node, check_constant, NULL, &c);
+  return c.ok;
+}
+
+// Makes the typed function `fn` callable at compile time if it is pure.
+// Only then must it be kept after its code has been emitted.
+void define_function(Node* fn) {
+  fn->pure = true;
+  for (Node* e = fn->body; e && fn->pure; e = e->next)
+    fn->pure = is_constant(e, fn);
+  name_symbol(fn->fn)->fn = fn->pure ? fn : NULL;
+}
+
+//
+// Entry points
+//
+
+// A value holding a pointer cannot be copied out of the evaluator.
+static bool has_pointer(Type* ty) {
+  if (ty->kind == TY_PTR)
+    return true;
+  if (ty->kind == TY_ARRAY)
+    return has_pointer(ty->base);
+  if (ty->kind == TY_STRUCT || ty->kind == TY_UNION)
+    for (Member* mem = ty->members; mem; mem = mem->next)
+      if (has_pointer(mem->ty))
+        return true;
+  return false;
+}
+
+// Evaluates the typed expression `node`, whose local variables are
+// `vars` up to `end`. An int is returned as a number, an array or a
+// struct as a reference to static data holding it.
+Node* comptime_eval(Node* node, Var* vars, Var* end, Token* tok) {
+  Type* ty = node->ty;
+  if (ty->kind == TY_VOID)
+    error_tok(tok, "expression has no value");
+  if (has_pointer(ty))
+    error_tok(tok, "a pointer cannot be computed at compile time");
+
+  steps = COMPTIME_STEPS;
+  push_frame(vars, end);
+  uint64_t v = eval(node);
+
+  Node* val;
+  if (is_aggregate(ty)) {
+    check(node, v, ty->size);
+    char* data = arena_alloc(&ast_arena, ty->size);
+    memcpy(data, (char*)v, ty->size);
+    val = register_data(ty, data, tok);
+  } else {
+    val = new_num(v, tok);
+    val->ty = ty;
+  }
+  pop_frame();
+  return val;
+}
+
+// Returns the value of a let initializer if it is a constant
+// expression, or NULL.
+Node* fold_init(Node* node) {
+  if (node->kind == ND_NUM || !is_constant(node, NULL))
+    return NULL;
+
+  add_type(node);
+  if (is_aggregate(node->ty) || node->ty->kind == TY_PTR || node->ty->kind == TY_VOID)
+    return NULL;
+
+  Frame* base = frame;
+  jmp_buf buf;
+  if (setjmp(buf)) {
+    while (frame != base)
+      pop_frame();
+    call_depth = 0;
+    links_len = 0;
+    recover = NULL;
+    return NULL;
+  }
+
+  recover = &buf;
+  steps = FOLD_STEPS;
+  uint64_t v = eval(node);
+  recover = NULL;
+
+  Node* val = new_num(v, node->tok);
+  val->ty = node->ty;
+  return val;
+}
+
+//
+// Folding
+//
+
+// fold_function() replaces the operations of a typed function whose
+// operands are numbers by their values. It also simplifies x+0, x*1 and
+// the like, ifs with a constant condition and whiles that never run.
+//
+// Like the evaluator, it keeps what the generated code leaves in %rax.
+// A 32-bit operation zero-extends its result, so (+ x 0) only becomes x
+// if x is zero-extended already, and a node that replaces another takes
+// its type, since the width of an operation comes from the type of its
+// left operand.
+
+bool opt_fold = true;
+
+static bool is_num(Node* node) {
+  return node->kind == ND_NUM;
+}
+
+static bool is_wide(Type* ty) {
+  return ty->kind == TY_LONG || ty->base;
+}
+
+static Node* new_value(Node* node, uint64_t val) {
+  Node* num = new_num(val, node->tok);
+  num->ty = node->ty;
+  return num;
+}
+
+// Returns the value of `node`, whose operands are numbers, or `node`
+// itself if it cannot be computed, as on a division by zero.
+static Node* fold_constant(Node* node) {
+  jmp_buf buf;
+  if (setjmp(buf)) {
+    links_len = 0;
+    recover = NULL;
+    return node;
+  }
+
+  recover = &buf;
+  steps = FOLD_STEPS;
+  uint64_t v = eval_node(node);
+  recover = NULL;
+  return new_value(node, v);
+}
+
+// Returns true if the upper half of %rax is zero after `node`.
+static bool is_zero_extended(Node* node) {
+  switch (node->kind) {
+  case ND_NUM:
+    return node->val == (uint32_t)node->val;
+  case ND_ADD:
+  case ND_SUB:
+  case ND_MUL:
+  case ND_DIV:
+  case ND_MOD:
+  case ND_BITAND:
+  case ND_BITOR:
+  case ND_BITXOR:
+    return !is_wide(node->lhs->ty);
+  case ND_EQ:
+  case ND_LT:
+  case ND_LE:
+  case ND_GT:
+  case ND_GE:
+  case ND_NOT:
+  case ND_AND:
+  case ND_OR:
+    return true;
+  }
+  return false;
+}
+
+static bool is_shift(NodeKind kind) {
+  return kind == ND_SRA || kind == ND_SRL || kind == ND_SLL;
+}
+
+// Returns true if `node`, whose right operand is a number, gives the
+// low `wide ? 64 : 32` bits of its left operand.
+static bool is_identity(Node* node, bool wide) {
+  uint64_t c = wide ? node->rhs->val : (uint32_t)node->rhs->val;
+  switch (node->kind) {
+  case ND_ADD:
+  case ND_SUB:
+  case ND_BITOR:
+  case ND_BITXOR:
+    return c == 0;
+  case ND_MUL:
+    return c == 1;
+  case ND_BITAND:
+    return c == (wide ? UINT64_MAX : UINT32_MAX);
+  case ND_SRA:
+  case ND_SRL:
+  case ND_SLL:
+    return (c & 63) == 0;
+  }
+  return false;
+}
+
+static bool is_commutative(NodeKind kind) {
+  return kind == ND_ADD || kind == ND_MUL || kind == ND_BITAND || kind == ND_BITOR ||
+         kind == ND_BITXOR;
+}
+
+// Returns the constant of (+ x c) or (- x c) as an addend.
+static uint64_t addend(Node* node) {
+  return node->kind == ND_SUB ? -(uint64_t)node->rhs->val : node->rhs->val;
+}
+
+// Combines the constants of (op (op x c1) c2) into (op x c), which is
+// the same in either width.
+static Node* reassociate(Node* node, bool wide) {
+  Node* x = node->lhs;
+  bool sums = (node->kind == ND_ADD || node->kind == ND_SUB) &&
+              (x->kind == ND_ADD || x->kind == ND_SUB);
+  if (!sums && (x->kind != node->kind || !is_commutative(node->kind)))
+    return node;
+  if (!is_num(x->rhs) || is_wide(x->lhs->ty) != wide)
+    return node;
+
+  uint64_t c1 = x->rhs->val;
+  uint64_t c2 = node->rhs->val;
+  uint64_t c;
+  switch (node->kind) {
+  case ND_MUL:    c = c1 * c2; break;
+  case ND_BITAND: c = c1 & c2; break;
+  case ND_BITOR:  c = c1 | c2; break;
+  case ND_BITXOR: c = c1 ^ c2; break;
+  default:        c = addend(x) + addend(node);
+  }
+
+  Node* num = new_num(wide ? c : (int32_t)c, node->rhs->tok);
+  num->ty = node->rhs->ty;
+  Node* n = new_binary(sums ? ND_ADD : node->kind, x->lhs, num, node->tok);
+  n->ty = node->ty;
+  return n;
+}
+
+static Node* fold_binary(Node* node) {
+  // The constant of a commutative operation goes on the right, where
+  // it can be combined with others and used as an immediate.
+  if (is_num(node->lhs) && is_commutative(node->kind) &&
+      is_wide(node->lhs->ty) == is_wide(node->rhs->ty)) {
+    Node* n = new_binary(node->kind, node->rhs, node->lhs, node->tok);
+    n->ty = node->ty;
+    node = n;
+  }
+  if (!is_num(node->rhs))
+    return node;
+
+  bool wide = is_wide(node->lhs->ty);
+  if (!is_shift(node->kind))
+    node = reassociate(node, wide);
+
+  // A shift is done in 64 bits and anything else in the width of its
+  // left operand.
+  Node* x = node->lhs;
+  if (is_identity(node, wide) && x->ty == node->ty &&
+      (wide || is_shift(node->kind) || is_zero_extended(x)))
+    return x;
+  return node;
+}
+
+// Returns true if `node` always sets %rax, as the condition of an if
+// does before the chosen branch is evaluated.
+static bool sets_rax(Node* node) {
+  while (node->kind == ND_DO) {
+    Node* last = NULL;
+    for (Node* n = node->body; n; n = n->next)
+      last = n;
+    if (!last)
+      return false;
+    node = last;
+  }
+
+  switch (node->kind) {
+  case ND_DEFSTRUCT:
+  case ND_DEFUNION:
+  case ND_DEFTYPE:
+  case ND_DEFMACRO:
+    return false;
+  case ND_LET:
+    return node->rhs;
+  }
+  return true;
+}
+
+// Returns what `node`, whose operands have been folded, folds to.
+static Node* fold_node(Node* node) {
+  switch (node->kind) {
+  case ND_NOT:
+  case ND_BITNOT:
+  case ND_CAST:
+    return is_num(node->lhs) ? fold_constant(node) : node;
+  case ND_AND:
+  case ND_OR:
+    if (is_num(node->lhs) && !node->lhs->val == (node->kind == ND_AND))
+      return new_value(node, node->kind == ND_OR);
+    return is_num(node->lhs) && is_num(node->rhs) ? fold_constant(node) : node;
+  case ND_IF: {
+    if (!is_num(node->cond))
+      return node;
+    Node* branch = node->cond->val ? node->then : node->els;
+    if (!branch)
+      return new_value(node, 0);
+    return branch->ty == node->ty && sets_rax(branch) ? branch : node;
+  }
+  case ND_WHILE:
+    return is_num(node->cond) && node->cond->val == 0 ? new_value(node, 0) : node;
+  case ND_ADD:
+  case ND_SUB:
+  case ND_MUL:
+  case ND_DIV:
+  case ND_MOD:
+  case ND_EQ:
+  case ND_LT:
+  case ND_LE:
+  case ND_GT:
+  case ND_GE:
+  case ND_BITAND:
+  case ND_BITOR:
+  case ND_BITXOR:
+  case ND_SRA:
+  case ND_SRL:
+  case ND_SLL:
+    if (is_num(node->lhs) && is_num(node->rhs))
+      return fold_constant(node);
+    return fold_binary(node);
+  }
+  return node;
+}
+
+static void fold_list(Node** list) {
+  for (Node** p = list; *p; p = &(*p)->next) {
+    Node* n = fold_node(*p);
+    if (n != *p) {
+      n->next = (*p)->next;
+      *p = n;
+    }
+  }
+}
+
+// Folds the operands of `node`, which have had theirs folded. Only the
+// fields of the node's own kind may be touched, and an operand that is
+// used as an lvalue is left as it is.
+static void fold_operands(Node* node, void* arg) {
+  switch (node->kind) {
+  case ND_IF:
+    node->cond = fold_node(node->cond);
+    node->then = fold_node(node->then);
+    if (node->els)
+      node->els = fold_node(node->els);
+    return;
+  case ND_WHILE:
+    node->cond = fold_node(node->cond);
+    fold_list(&node->then);
+    return;
+  case ND_DO:
+  case ND_APP:
+  case ND_FUNC:
+    fold_list(&node->body);
+    if (node->kind == ND_APP)
+      fold_list(&node->args);
+    return;
+  case ND_NOT:
+  case ND_BITNOT:
+  case ND_CAST:
+  case ND_DEREF:
+    node->lhs = fold_node(node->lhs);
+    return;
+  case ND_LET:
+  case ND_SET:
+    if (node->rhs)
+      node->rhs = fold_node(node->rhs);
+    return;
+  case ND_ISET:
+    node->mhs = fold_node(node->mhs);
+    node->rhs = fold_node(node->rhs);
+    return;
+  case ND_IGET:
+    node->rhs = fold_node(node->rhs);
+    return;
+  case ND_ADD:
+  case ND_SUB:
+  case ND_MUL:
+  case ND_DIV:
+  case ND_MOD:
+  case ND_EQ:
+  case ND_LT:
+  case ND_LE:
+  case ND_GT:
+  case ND_GE:
+  case ND_AND:
+  case ND_OR:
+  case ND_BITAND:
+  case ND_BITOR:
+  case ND_BITXOR:
+  case ND_SRA:
+  case ND_SRL:
+  case ND_SLL:
+    node->lhs = fold_node(node->lhs);
+    node->rhs = fold_node(node->rhs);
+    return;
+  }
+}
+
+// Folds the constants of the typed function `fn` in place. New nodes
+// are allocated like those of the function.
+void fold_function(Node* fn) {
+  if (opt_fold)
+    walk_tree(fn, NULL, fold_operands, NULL);
+}
@@ -0,0 +1,139 @@
+// This file implements a persistent hash array mapped trie, which the
+// evaluator uses for its environments.
+//
+// A map is never modified. hamt_put() returns a new map that shares
+// every node with the old one except those on the path to the new
+// entry, so both maps stay valid. That is what lets `env` and
+// `newenv` be passed around as values.
+//
+// Keys are pointers compared by address, such as interned names. Each
+// level of the trie consumes 5 bits of the key's hash. A node stores
+// only its used slots, with a bitmap saying which of the 32 possible
+// slots they are. A slot holds either a key and its value, or, if its
+// key is NULL, a child node for the keys that share the bits so far.
+
+#include "manda.h"
+
+#define BITS 5
+#define MASK ((1 << BITS) - 1)
+
+typedef struct {
+  void* key;
+  void* val;
+} HamtSlot;
+
+struct Hamt {
+  uint32_t bitmap;
+  HamtSlot slots[];
+};
+
+// The hash is a bijection on 64-bit values, so two distinct keys always
+// end up in different slots by the last level and no collision lists
+// are needed.
+static uint64_t hash(void* key) {
+  uint64_t h = (uintptr_t)key * 0x9e3779b97f4a7c15;
+  return h ^ (h >> 32);
+}
+
+static int slot_index(uint64_t h, int shift) {
+  return (h >> shift) & MASK;
+}
+
+static Hamt* new_node(Arena* arena, uint32_t bitmap) {
+  Hamt* node = arena_alloc(arena, sizeof(Hamt) + sizeof(HamtSlot) * __builtin_popcount(bitmap));
+  node->bitmap = bitmap;
+  return node;
+}
+
+// Returns the position of the slot for `bit` in `node->slots`.
+static int slot_pos(Hamt* node, uint32_t bit) {
+  return __builtin_popcount(node->bitmap & (bit - 1));
+}
+
+void* hamt_get(Hamt* node, void* key) {
+  uint64_t h = hash(key);
+  for (int shift = 0; node; shift += BITS) {
+    uint32_t bit = 1u << slot_index(h, shift);
+    if (!(node->bitmap & bit))
+      return NULL;
+
+    HamtSlot* slot = &node->slots[slot_pos(node, bit)];
+    if (slot->key)
+      return slot->key == key ? slot->val : NULL;
+    node = slot->val;
+  }
+  return NULL;
+}
+
+// Returns a node holding two entries whose hashes agree below `shift`.
+static Hamt* new_pair(Arena* arena, HamtSlot s1, uint64_t h1, HamtSlot s2, uint64_t h2, int shift) {
+  int i1 = slot_index(h1, shift);
+  int i2 = slot_index(h2, shift);
+
+  if (i1 == i2) {
+    Hamt* node = new_node(arena, 1u << i1);
+    node->slots[0].val = new_pair(arena, s1, h1, s2, h2, shift + BITS);
+    return node;
+  }
+
+  Hamt* node = new_node(arena, (1u << i1) | (1u << i2));
+  node->slots[i1 > i2] = s1;
+  node->slots[i1 < i2] = s2;
+  return node;
+}
+
+static Hamt* put(Arena* arena, Hamt* node, void* key, void* val, uint64_t h, int shift) {
+  uint32_t bit = 1u << slot_index(h, shift);
+  if (!node) {
+    node = new_node(arena, bit);
+    node->slots[0] = (HamtSlot){key, val};
+    return node;
+  }
+
+  int n = __builtin_popcount(node->bitmap);
+  int pos = slot_pos(node, bit);
+
+  // The slot is free. Copy the node with the new entry inserted.
+  if (!(node->bitmap & bit)) {
+    Hamt* copy = new_node(arena, node->bitmap | bit);
+    memcpy(copy->slots, node->slots, sizeof(HamtSlot) * pos);
+    copy->slots[pos] = (HamtSlot){key, val};
+    memcpy(copy->slots + pos + 1, node->slots + pos, sizeof(HamtSlot) * (n - pos));
+    return copy;
+  }
+
+  // The slot is taken. Copy the node and replace the slot with the new
+  // entry, an updated child, or a child holding both entries.
+  Hamt* copy = new_node(arena, node->bitmap);
+  memcpy(copy->slots, node->slots, sizeof(HamtSlot) * n);
+  HamtSlot* slot = &copy->slots[pos];
+
+  if (!slot->key)
+    slot->val = put(arena, slot->val, key, val, h, shift + BITS);
+  else if (slot->key == key)
+    slot->val = val;
+  else
+    *slot = (HamtSlot){NULL, new_pair(arena, *slot, hash(slot->key), (HamtSlot){key, val}, h, shift + BITS)};
+  return copy;
+}
+
+// Returns a map that is `map` with `key` bound to `val`. `map` itself
+// is left unchanged. `key` must not be NULL. The nodes made for the
+// new map are allocated from `arena`, and it shares the rest with `map`.
+Hamt* hamt_put(Arena* arena, Hamt* map, void* key, void* val) {
+  return put(arena, map, key, val, hash(key), 0);
+}
+
+// Returns a copy of `map` allocated from `arena`.
+Hamt* hamt_copy(Arena* arena, Hamt* map) {
+  if (!map)
+    return NULL;
+  int n = __builtin_popcount(map->bitmap);
+  Hamt* copy = new_node(arena, map->bitmap);
+  for (int i = 0; i < n; i++) {
+    copy->slots[i] = map->slots[i];
+    if (!map->slots[i].key)
+      copy->slots[i].val = hamt_copy(arena, map->slots[i].val);
+  }
+  return copy;
+}
@@ -0,0 +1,189 @@
+// This file compiles macro bodies to bytecode and runs it.
+//
+// A macro body is a template: a use of the macro is expanded by
+// substituting the arguments for the parameters in the body, and the
+// result is evaluated like any other form. Instead of walking the body
+// and looking every symbol up in a parameter environment on each use,
+// defmacro compiles the body once into a short program for a stack
+// machine with three instructions:
+//
+//   OP_CONST k   push constant k, a subtree that mentions no parameter
+//   OP_ARG i     push the argument for the i-th parameter
+//   OP_LIST k    pop as many S-expressions as constant k, a list, has
+//                elements and push a new list of them
+//
+// Subtrees that mention no parameter are shared by every expansion, so
+// a use only allocates the lists on the paths from the root of the
+// body to the parameters. The arguments are passed as an array indexed
+// by parameter number.
+
+#include "manda.h"
+
+typedef enum {
+  OP_CONST,
+  OP_ARG,
+  OP_LIST,
+} MacroOp;
+
+bool is_once_param(Sexp* param) {
+  return param->kind == SE_LIST;
+}
+
+// Returns the name of a parameter `x` or (once x).
+static Sexp* param_name(Sexp* param) {
+  return is_once_param(param) ? param->elements[1] : param;
+}
+
+//
+// Compiler
+//
+
+// Code and constants of the macro being compiled. They are copied to
+// the macro when it is done.
+static int* code;
+static int code_len;
+static int code_capacity;
+
+static Sexp** consts;
+static int nconsts;
+static int consts_capacity;
+
+static int depth;
+static int max_depth;
+
+static void emit(int op, int operand) {
+  if (code_len + 2 > code_capacity) {
+    code_capacity = code_capacity ? code_capacity * 2 : 64;
+    code = realloc(code, sizeof(int) * code_capacity);
+    if (!code)
+      error("out of memory");
+  }
+  code[code_len++] = op;
+  code[code_len++] = operand;
+}
+
+static int add_const(Sexp* se) {
+  if (nconsts == consts_capacity) {
+    consts_capacity = consts_capacity ? consts_capacity * 2 : 16;
+    consts = realloc(consts, sizeof(Sexp*) * consts_capacity);
+    if (!consts)
+      error("out of memory");
+  }
+  consts[nconsts] = se;
+  return nconsts++;
+}
+
+static void push(void) {
+  if (++depth > max_depth)
+    max_depth = depth;
+}
+
+// Returns the number of the parameter named by `se`, or -1.
+static int find_param(Sexp* se, Sexp* params) {
+  if (se->kind != SE_SYMBOL || !se->tok->sym)
+    return -1;
+  for (int i = 0; i < params->len; i++)
+    if (param_name(params->elements[i])->tok->sym == se->tok->sym)
+      return i;
+  return -1;
+}
+
+// Emits code that pushes `se` with the parameters substituted.
+// Returns true if `se` mentions a parameter.
+static bool gen_template(Sexp* se, Sexp* params) {
+  int param = find_param(se, params);
+  if (param >= 0) {
+    emit(OP_ARG, param);
+    push();
+    return true;
+  }
+
+  if (se->kind == SE_LIST) {
+    int code_start = code_len;
+    int consts_start = nconsts;
+    int depth_start = depth;
+
+    bool has_param = false;
+    for (int i = 0; i < se->len; i++)
+      has_param |= gen_template(se->elements[i], params);
+
+    if (has_param) {
+      emit(OP_LIST, add_const(se));
+      depth = depth_start;
+      push();
+      return true;
+    }
+
+    // Nothing to substitute. Take the list as it is.
+    code_len = code_start;
+    nconsts = consts_start;
+    depth = depth_start;
+  }
+
+  emit(OP_CONST, add_const(se));
+  push();
+  return false;
+}
+
+void compile_macro(Macro* m) {
+  code_len = nconsts = depth = max_depth = 0;
+  gen_template(m->body, m->args);
+
+  m->code = arena_alloc(&ast_arena, sizeof(int) * code_len);
+  memcpy(m->code, code, sizeof(int) * code_len);
+  m->code_len = code_len;
+  m->consts = arena_alloc(&ast_arena, sizeof(Sexp*) * nconsts);
+  memcpy(m->consts, consts, sizeof(Sexp*) * nconsts);
+  m->max_depth = max_depth;
+
+  for (int i = 0; i < m->args->len; i++)
+    if (is_once_param(m->args->elements[i]))
+      m->has_once = true;
+}
+
+//
+// Interpreter
+//
+
+// The operand stack. Running a macro never runs another one, so a
+// single stack is enough.
+static Sexp** stack;
+static int stack_capacity;
+
+// Returns the body of `m` with args[i] substituted for the i-th
+// parameter.
+Sexp* run_macro(Macro* m, Sexp** args) {
+  if (m->max_depth > stack_capacity) {
+    stack_capacity = m->max_depth * 2;
+    stack = realloc(stack, sizeof(Sexp*) * stack_capacity);
+    if (!stack)
+      error("out of memory");
+  }
+
+  Sexp** sp = stack;
+  for (int* pc = m->code; pc < m->code + m->code_len; pc += 2) {
+    switch (pc[0]) {
+    case OP_CONST:
+      *sp++ = m->consts[pc[1]];
+      break;
+    case OP_ARG:
+      *sp++ = args[pc[1]];
+      break;
+    case OP_LIST: {
+      Sexp* proto = m->consts[pc[1]];
+      int n = proto->len;
+      Sexp* list = arena_alloc(&sexp_arena, sizeof(Sexp) + sizeof(Sexp*) * n);
+      list->kind = SE_LIST;
+      list->tok = proto->tok;
+      list->len = n;
+      sp -= n;
+      memcpy(list->elements, sp, sizeof(Sexp*) * n);
+      *sp++ = list;
+      break;
+    }
+    default:
+      unreachable();
+    }
+  }
+  return stack[0];
+}
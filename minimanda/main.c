@@ -1,11 +1,14 @@
 #include "manda.h"
 
 static char *opt_o;
+static bool opt_arena_stats;
+static bool opt_peephole_stats;
 
 static char *input_path;
 
 static void usage(int status) {
-  fprintf(stderr, "manda [ -o <path> ] <file>\n");
+  fprintf(stderr, "manda [ -o <path> ] [ -O0 | -O1 ] [ --no-fold ] [ --no-peephole ]\n"
+                  "      [ --arena-stats ] [ --peephole-stats ] <file>\n");
   exit(status);
 }
 
@@ -14,6 +17,31 @@ static void parse_args(int argc, char **argv) {
     if (!strcmp(argv[i], "--help"))
       usage(0);
 
+    if (!strcmp(argv[i], "--arena-stats")) {
+      opt_arena_stats = true;
+      continue;
+    }
+
+    if (!strcmp(argv[i], "--peephole-stats")) {
+      opt_peephole_stats = true;
+      continue;
+    }
+
+    if (!strcmp(argv[i], "--no-fold")) {
+      opt_fold = false;
+      continue;
+    }
+
+    if (!strcmp(argv[i], "--no-peephole")) {
+      opt_peephole = false;
+      continue;
+    }
+
+    if (!strcmp(argv[i], "-O0") || !strcmp(argv[i], "-O1")) {
+      opt_level = argv[i][2] - '0';
+      continue;
+    }
+
     if (!strcmp(argv[i], "-o")) {
       if (!argv[++i])
         usage(1);
@@ -36,26 +64,59 @@ static void parse_args(int argc, char **argv) {
     error("no input files");
 }
 
+// Code is emitted while the input is still being read, so an error may
+// come after some of the output. A file is written under a temporary
+// name, which is removed unless the compilation succeeds.
+static char *tmp_path;
+
+static void remove_tmp_file(void) {
+  if (tmp_path)
+    unlink(tmp_path);
+}
+
 static FILE *open_file(char *path) {
   if (!path || strcmp(path, "-") == 0)
     return stdout;
 
-  FILE *out = fopen(path, "w");
+  tmp_path = malloc(strlen(path) + 8);
+  sprintf(tmp_path, "%s.XXXXXX", path);
+  int fd = mkstemp(tmp_path);
+  if (fd < 0)
+    error("cannot open output file: %s: %s", path, strerror(errno));
+  atexit(remove_tmp_file);
+
+  // mkstemp() makes the file private. Give it the usual permissions.
+  mode_t mask = umask(0);
+  umask(mask);
+  fchmod(fd, 0666 & ~mask);
+
+  FILE *out = fdopen(fd, "w");
   if (!out)
     error("cannot open output file: %s: %s", path, strerror(errno));
   return out;
 }
 
+static void close_file(FILE *out, char *path) {
+  if (out == stdout)
+    return;
+  if (fclose(out) != 0 || rename(tmp_path, path) != 0)
+    error("cannot write output file: %s: %s", path, strerror(errno));
+  free(tmp_path);
+  tmp_path = NULL;
+}
+
 int main(int argc, char **argv) {
   parse_args(argc, argv);
 
-  // Tokenize and parse.
-  Token *tok = tokenize_file(input_path);
-  Node *prog = parse(tok);
-
-  // Traverse the AST to emit assembly.
+  // Tokenize, evaluate and emit assembly, a top-level form at a time.
   FILE *out = open_file(opt_o);
   fprintf(out, ".file 1 \"%s\"\n", input_path);
-  codegen(prog, out);
+  compile_file(input_path, out);
+  close_file(out, opt_o);
+
+  if (opt_arena_stats)
+    print_arena_stats(stderr);
+  if (opt_peephole_stats)
+    print_peephole_stats(stderr);
   return 0;
 }
\ No newline at end of file
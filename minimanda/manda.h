@@ -1,21 +1,29 @@
 #ifndef MANDA_H
 #define MANDA_H
 #define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE // MAP_ANONYMOUS
 #include <assert.h>
 #include <ctype.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <errno.h>
+#include <limits.h>
 #include <stdio.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 
 typedef struct Type Type;
 typedef struct Node Node;
 typedef struct Member Member;
+typedef struct Macro Macro;
 
 // 
 // tokenize.c
@@ -32,40 +40,140 @@ typedef enum {
   TK_STR,       // C String
 } TokenKind;
 
+// Keywords and primitives. The tokenizer classifies every identifier
+// once, so later passes can switch on `tok->kw` instead of comparing
+// strings. Keywords start at KW_LET and primitives at KW_ADD; the form
+// heads before KW_LET may still name variables.
+typedef enum {
+  KW_NONE,
+  // form heads
+  KW_MAKE_ARRAY, KW_STR,
+  // keywords
+  KW_LET, KW_CONST, KW_SET, KW_DO, KW_DEF, KW_LAMBDA, KW_IF, KW_WHILE,
+  KW_ASM, KW_DEFSTRUCT, KW_DEFENUM, KW_MATCH, KW_DEFTYPE, KW_DEFMODULE,
+  KW_IMPORT, KW_EXPORT, KW_ASYNC, KW_DEFASYNC, KW_AWAIT, KW_DEFMACRO,
+  KW_WITH, KW_DEFUNION, KW_TYPEOF, KW_TRUE, KW_FALSE, KW_POINTER,
+  KW_COMPTIME,
+  // primitives
+  KW_ADD, KW_SUB, KW_MUL, KW_DIV, KW_LT, KW_GT, KW_GE, KW_LE, KW_EQ,
+  KW_AND, KW_OR, KW_NOT, KW_XOR, KW_SRA, KW_SRL, KW_SLL, KW_BITAND,
+  KW_BITOR, KW_BITNOT, KW_BITXOR, KW_ADDR, KW_DEREF, KW_IGET, KW_ISET,
+  KW_SIZEOF, KW_CAST, KW_MOD, KW_REM, KW_STRUCT_REF,
+} Keyword;
+
+// Interned identifier. There is one Symbol per distinct spelling, see
+// symbol.c.
+typedef struct Symbol Symbol;
+struct Symbol {
+  char* name;     // NUL-terminated spelling
+  int len;
+  uint32_t hash;
+  Keyword kw;     // Keyword or primitive id, KW_NONE otherwise
+  Macro* macro;   // Macro named by this symbol, if any
+  Node* fn;       // Pure function named by this symbol, see define_function()
+};
+
 // Token type
+//
+// Tokens are stored contiguously in batches of whole top-level forms,
+// each ending with TK_EOF, so the token after `tok` is `tok + 1`.
 typedef struct Token Token;
 struct Token {
   TokenKind kind; // Token kind
-  Token* next;    // Next token
+  Keyword kw;     // Keyword or primitive id, KW_NONE otherwise
+  Symbol* sym;    // If kind is TK_IDENT or TK_RESERVED, its symbol
   int64_t val;        // If kind is TK_NUM, its value
   char* loc;      // Token location
   int len;        // Token length
   char* str;      // String literal content including terminating '\0'
   int line_no;    // line number
+  int col_no;     // column number
 };
 
 
 bool equal(Token*, char*);
+Keyword find_keyword(char* p, int len);
 bool is_primitive(Token*);
 bool stop_parse(Token* tok);
 bool is_list(Token* tok);
 char* get_pair(Token** rest, Token* tok);
 Token* skip(Token*, char*);
 Token* tokenize_file(char* filename);
+void tokenize_file_in_batches(char* filename, int batch_size, void (*emit)(Token* tokens, void* arg), void* arg);
 
 void error(char*, ...);
-void error_at(char* loc, char* fmt, ...);
 void error_tok(Token* tok, char* fmt, ...);
+void warn_tok(Token* tok, char* fmt, ...);
+
+//
+// scan.c
+//
+bool is_ident1(char c);
+bool is_ident2(char c);
+char *skip_space(char *p);
+char *skip_ident(char *p);
+char *skip_line(char *p);
+char *skip_str(char *p);
+
+//
+// arena.c
+//
+typedef struct ArenaChunk ArenaChunk;
+
+// A region of memory that is freed all at once.
+typedef struct {
+  char* name;
+  ArenaChunk* chunks;
+  char* cur;
+  char* end;
+
+  // statistics
+  size_t nallocs;
+  size_t used;
+  size_t reserved;
+  size_t peak;
+  int nresets;
+
+  bool is_fn;     // made by new_arena()
+} Arena;
+
+extern Arena lex_arena;   // symbols, string literals and made-up tokens
+extern Arena sexp_arena;  // S-expressions and environments of one form
+extern Arena ast_arena;   // what outlives a form: types, members, globals, macros
+extern Arena env_arena;   // the environment of the top-level forms
+
+void* arena_alloc(Arena* a, size_t size);
+void arena_reset(Arena* a);
+Arena* new_arena(void);
+void free_arena(Arena* a);
+void print_arena_stats(FILE* out);
+
+//
+// symbol.c
+//
+Symbol* intern(char* s, int len);
+Symbol* name_symbol(char* name);
+
+//
+// hamt.c
+//
+typedef struct Hamt Hamt;
+void* hamt_get(Hamt* map, void* key);
+Hamt* hamt_put(Arena* arena, Hamt* map, void* key, void* val);
+Hamt* hamt_copy(Arena* arena, Hamt* map);
 
 //
 // parse.c
 //
 typedef struct Var Var;
 typedef struct Env Env;
+
+// Variables and tags in scope. An Env is never modified; adding a
+// binding makes a new Env that shares its tables with the old one.
+// NULL is the empty environment.
 struct Env {
-  Var* var;
-  Env* next;
-  bool is_tag;
+  Hamt* vars;     // name -> Var
+  Hamt* tags;     // name -> Var holding the tag's type
 };
 
 typedef enum {
@@ -114,44 +222,52 @@ typedef enum {
 } NodeKind;
 
 
+// AST node
+//
+// A node is a small header followed by the fields of its kind, which
+// share storage. new_node() allocates only as much of the union as the
+// kind uses, so a node must only be accessed through the fields of its
+// own kind.
 struct Node {
   NodeKind kind;
   Token* tok;
   Node* next;
   Type* ty;
 
-  // number
-  int64_t val;
-
-  char* str;
-
-  // binary or triple
-  Node* lhs;  // left
-  Node* mhs;  // middle, only for triple
-  Node* rhs;  // right
-
-  // var
-  Var* var;
-
-  // struct member;
-  Member* member;
-
-  // array element
-  Node* elements;
-
-  // if
-  Node* cond;
-  Node* then;
-  Node* els;
-
-  // application // function
-  char* fn;
-  Node* args;
-  Node* body;
-  Var* locals;
-  Type* ret_ty; 
-  int stack_size;
-  
+  union {
+    int64_t val;      // number or boolean
+    char* str;        // string
+    Var* var;         // var
+    Node* elements;   // array literal
+
+    // operators, let and set
+    struct {
+      Node* lhs;      // left
+      union {
+        Node* rhs;    // right
+        Member* member; // struct member, only for struct-ref
+      };
+      Node* mhs;      // middle, only for triple
+    };
+
+    // if and while
+    struct {
+      Node* cond;
+      Node* then;
+      Node* els;
+    };
+
+    // do, application and function
+    struct {
+      Node* body;
+      Node* args;
+      char* fn;
+      Var* locals;
+      Type* ret_ty;
+      int stack_size;
+      bool pure;      // function only, see define_function()
+    };
+  };
 };
 
 struct Member {
@@ -163,16 +279,34 @@ struct Member {
 
 struct Var {
   Var* next;
-  char* name;
+  char* name;     // Interned if the variable is named in the source
   Type* ty;
   int offset;
+  int vreg;       // virtual register at -O1, -1 if it lives in memory
   bool is_local;
+  bool is_data;    // global only, made by register_data()
+  char* init_data; // global only, NULL if zero-initialized
 };
 
 extern Var* locals;
 
+Node* new_binary(NodeKind kind, Node* lhs, Node* rhs, Token* tok);
+Node* new_num(int64_t val, Token* tok);
+Node* register_data(Type* ty, char* data, Token* tok);
+void init_parser(void);
+Node* parse_form(Token** rest, Token* tok, Arena* fn_arena);
+Node* global_data(void);
 Node* parse(Token*);
 
+//
+// comptime.c
+//
+void define_function(Node* fn);
+Node* comptime_eval(Node* node, Var* vars, Var* end, Token* tok);
+Node* fold_init(Node* node);
+extern bool opt_fold;
+void fold_function(Node* fn);
+
 // type.c
 typedef enum {
   TY_CHAR,
@@ -198,7 +332,9 @@ struct Type {
 
   // struct members
   Member* members;
-  
+  Member** member_index;  // hash index of a wide struct, see find_member()
+  int member_mask;
+
   // pointer or array
   Type* base;
 };
@@ -213,10 +349,12 @@ extern Type* ty_long;
 extern Type* ty_short;
 
 void add_type(Node* node);
+void walk_tree(Node* node, bool (*enter)(Node*, void*), void (*leave)(Node*, void*), void* arg);
 Type* new_struct_type(int size, int align, Member* members);
 Type* new_union_type(int size, int align, Member* members);
 Type* pointer_to(Type* base);
 Type* array_of(Type *base, int len);
+Member* find_member(Type* ty, Symbol* name);
 
 //
 // codegen.c
@@ -224,40 +362,84 @@ Type* array_of(Type *base, int len);
 #define unreachable() \
   error("internal error at %s:%d", __FILE__, __LINE__)
 
+extern int opt_level;
+
+void println(char* fmt, ...);
 void codegen(Node* prog, FILE* out);
+void codegen_function(Node* fn, FILE* out);
+void codegen_data(Node* lets, FILE* out);
 int align_to(int n, int align);
+bool is_chain(Node* node);
+bool constant_offset(Node* index, Type* ty, int64_t* offset);
+
+//
+// strength.c
+//
+bool can_reduce(Node* node);
+void gen_mul_imm(int64_t c, int width, char* reg);
+void gen_div_imm(int64_t d, int width, bool is_mod);
+
+//
+// regalloc.c
+//
+void codegen_function_o1(Node* fn);
+
+//
+// peephole.c
+//
+extern bool opt_peephole;
+
+void start_buffering(void);
+bool buffer_line(char* fmt, va_list ap);
+void flush_lines(FILE* out);
+void print_peephole_stats(FILE* out);
+
+//
+// pipeline.c
+//
+void compile_file(char* path, FILE* out);
 
 
 //
 // macro.c
 //
 typedef struct Sexp Sexp;
-typedef struct Macro Macro;
-typedef struct MEnv MEnv;
 typedef enum {
   SE_SYMBOL,
   SE_LIST,
+  SE_VAR,     // variable holding a once-only macro argument
 } SexpKind;
 
 
+// A list stores its elements inline, so the i-th element of a form is
+// `se->elements[i]` and its arity is known without walking it.
+//
+// An SE_VAR stands for the variable a (once x) macro argument was
+// stored in. `tok` names the variable and `elements[0]` is the
+// argument, which is what (str x) prints.
 struct Sexp {
   SexpKind kind; 
   Token* tok;
-  Sexp* next;         // the chain
-  Sexp* elements;     // elements of a list node
+  int len;            // number of elements of a list node
+  Sexp* elements[];   // elements of a list node
 };
 
 struct Macro {
   Token* name;
-  Sexp* args;
+  Sexp* args;         // parameter list, each `x` or (once x)
   Sexp* body;
-  Macro* next;
+  int stamp;          // last expansion that counted its body
+  bool has_once;      // some parameter is (once x)
+
+  // the body compiled by compile_macro()
+  int* code;
+  int code_len;
+  Sexp** consts;
+  int max_depth;      // operand stack slots needed to run `code`
 };
 
-struct MEnv {
-  Sexp* symbol;
-  Sexp* value;
-  MEnv* next;
-};
+bool is_once_param(Sexp* param);
+void compile_macro(Macro* m);
+Sexp* run_macro(Macro* m, Sexp** args);
 
 #endif
\ No newline at end of file
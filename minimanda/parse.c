@@ -33,63 +33,97 @@ void unset_binding_ctx() {
 }
 
 // programs
-// prog is a linked list of AST nodes
-Node* prog = &(Node){};
+// global_lets is a linked list of lets of global variables, newest first
+static Node* global_lets;
+// True while the initializer of a global is evaluated. It has no
+// locals to hold (once x) arguments, but it must be constant, so an
+// argument is substituted as it is.
+static bool in_global_init;
 // locals is a linked list of local variables
 Var* locals;
 // globals is a linked list of globals variables
 Var* globals;
 
+// The program is evaluated one top-level form at a time, see
+// parse_form(). The nodes and variables of a function are allocated
+// from `node_arena`, which is the function's own arena while it is
+// evaluated, and anything that outlives its form from ast_arena. The
+// environments of a form are allocated from `scope_arena`, which is
+// env_arena for the forms that add to the global environment.
+static Arena* node_arena = &ast_arena;
+static Arena* scope_arena = &sexp_arena;
+
+// The environment of the top-level forms. The old versions of it that
+// each form leaves behind in env_arena are dropped by copying it out
+// once env_arena has grown to twice its size, see compact_global_env().
+static Env* global_env;
+static size_t global_env_size;
+
 // main program environment
-Env* new_env() {
-  Env* env = calloc(1, sizeof(Env));
+Env* new_env(Env* oldenv) {
+  Env* env = arena_alloc(scope_arena, sizeof(Env));
+  if (oldenv)
+    *env = *oldenv;
   return env;
 }
 
+// Names are interned, so the tables are keyed by their address.
 Env* add_var(Env* oldenv, Var* var) {
-  Env* env = new_env();
-  env->var = var;
-  env->next = oldenv;
-  env->is_tag = false;
+  Env* env = new_env(oldenv);
+  env->vars = hamt_put(scope_arena, env->vars, var->name, var);
   return env;
 }
 
 Env* add_tag(Env* oldenv, Var* var) {
-  Env* env = new_env();
-  env->var = var;
-  env->next = oldenv;
-  env->is_tag = true;
+  Env* env = new_env(oldenv);
+  env->tags = hamt_put(scope_arena, env->tags, var->name, var);
   return env;
 }
 
+// Only identifiers and punctuators have a symbol.
 Var* lookup_var(Env* env, Token* tok) {
-  while (env!=NULL) {
-    if (!env->is_tag && equal(tok, env->var->name))
-      return env->var;
-    else 
-      env = env->next;
-  }
-  return NULL;
+  if (!env || !tok->sym)
+    return NULL;
+  return hamt_get(env->vars, tok->sym->name);
+}
+
+static Env* copy_env(Arena* arena, Env* env) {
+  if (!env)
+    return NULL;
+  Env* copy = arena_alloc(arena, sizeof(Env));
+  copy->vars = hamt_copy(arena, env->vars);
+  copy->tags = hamt_copy(arena, env->tags);
+  return copy;
+}
+
+static void compact_global_env(void) {
+  if (env_arena.reserved < 2 * global_env_size + 64 * 1024)
+    return;
+  Env* env = copy_env(&sexp_arena, global_env);
+  arena_reset(&env_arena);
+  global_env = copy_env(&env_arena, env);
+  global_env_size = env_arena.reserved;
 }
 
 Type* lookup_tag(Env* env, Token* tok) {
-  while (env!=NULL) {
-    if (env->is_tag && equal(tok, env->var->name))
-      return env->var->ty;
-    else 
-      env = env->next;
-  }
-  return NULL;
+  if (!env || !tok->sym)
+    return NULL;
+  Var* tag = hamt_get(env->tags, tok->sym->name);
+  return tag ? tag->ty : NULL;
 }
 
 
-Var* new_var(char* name, Type* ty) {
-  Var* var = calloc(1, sizeof(Var));
+static Var* alloc_var(Arena* arena, char* name, Type* ty) {
+  Var* var = arena_alloc(arena, sizeof(Var));
   var->name = name;
   var->ty = ty;
   return var;
 }
 
+Var* new_var(char* name, Type* ty) {
+  return alloc_var(node_arena, name, ty);
+}
+
 Var* new_lvar(char* name, Type *ty) {
   Var* var = new_var(name, ty);
   var->next = locals;
@@ -99,23 +133,33 @@ Var* new_lvar(char* name, Type *ty) {
 }
 
 Var* new_gvar(char* name, Type *ty) {
-  Var* var = new_var(name, ty);
+  Var* var = alloc_var(&ast_arena, name, ty);
   var->next = globals;
   var->is_local = false;
   globals = var;
   return var;
 }
 
+// Returns a copy of `tok` for something that outlives the form, and so
+// the batch of tokens, that `tok` is in.
+static Token* keep_token(Token* tok) {
+  Token* copy = arena_alloc(&ast_arena, sizeof(Token));
+  *copy = *tok;
+  return copy;
+}
+
 Member* new_member(Token* tok, Type* ty) {
-  Member* mem = calloc(1, sizeof(Member));
-  mem->tok = tok;
+  if (!tok->sym)
+    error_tok(tok, "expected a member name");
+  Member* mem = arena_alloc(&ast_arena, sizeof(Member));
+  mem->tok = keep_token(tok);
   mem->ty = ty;
   return mem;
 }
 
 static char* new_unique_name(void) {
   static int id = 0;
-  char *buf = calloc(1, 20);
+  char *buf = arena_alloc(&ast_arena, 20);
   sprintf(buf, ".L..%d", id++);
   return buf;
 }
@@ -125,8 +169,53 @@ static Var* new_anon_gvar(Type* ty) {
 }
 
 // ----- nodes
+#define SIZE_UPTO(field) (offsetof(Node, field) + sizeof(((Node*)0)->field))
+
+// Returns the number of bytes a node of `kind` occupies.
+static size_t node_size(NodeKind kind) {
+  switch (kind) {
+  case ND_DEFSTRUCT:
+  case ND_DEFUNION:
+  case ND_DEFTYPE:
+  case ND_DEFMACRO:
+    return offsetof(Node, val);
+  case ND_NUM:
+  case ND_BOOL:
+    return SIZE_UPTO(val);
+  case ND_STR:
+    return SIZE_UPTO(str);
+  case ND_VAR:
+    return SIZE_UPTO(var);
+  case ND_ARRAY_LITERAL:
+    return SIZE_UPTO(elements);
+  case ND_ADDR:
+  case ND_DEREF:
+  case ND_NOT:
+  case ND_BITNOT:
+  case ND_CAST:
+    return SIZE_UPTO(lhs);
+  case ND_ISET:
+    return SIZE_UPTO(mhs);
+  case ND_IF:
+  case ND_WHILE:
+    return SIZE_UPTO(els);
+  case ND_DO:
+    return SIZE_UPTO(body);
+  case ND_APP:
+    return SIZE_UPTO(fn);
+  case ND_FUNC:
+    return sizeof(Node);
+  }
+  // Binary operators, let, set and struct-ref.
+  return SIZE_UPTO(rhs);
+}
+
+// The number of nodes made so far.
+static int nnodes;
+
 Node* new_node(NodeKind kind, Token* tok) {
-  Node* node = calloc(1, sizeof(Node));
+  nnodes++;
+  Node* node = arena_alloc(node_arena, node_size(kind));
   node->kind = kind;
   node->tok = tok;
   node->next = NULL;
@@ -245,22 +334,45 @@ static int get_number(Node* node) {
   return node->val;
 }
 
-Node* register_str(Node* str_node) {
-  Var* var = new_anon_gvar(str_node->ty);
-  Node* var_node = new_var_node(var, str_node->tok);
-  var_node->ty = str_node->ty;
-  Node* let = new_let(var_node, str_node, str_node->tok);
-  let->next = prog;
-  prog = let;
+// Adds the global `var` to the data of the program, and returns a
+// reference to it.
+static Node* add_global(Var* var, Token* tok) {
+  Arena* saved = node_arena;
+  node_arena = &ast_arena;
+  tok = keep_token(tok);
+  Node* var_node = new_var_node(var, tok);
+  var_node->ty = var->ty;
+  Node* let = new_let(var_node, NULL, tok);
+  node_arena = saved;
+
+  let->next = global_lets;
+  global_lets = let;
   return var_node;
 }
 
+// Returns the global variables made so far, each as a let.
+Node* global_data(void) {
+  return global_lets;
+}
+
+Node* register_str(Node* str_node) {
+  return register_data(str_node->ty, str_node->str, str_node->tok);
+}
+
+// Returns a reference to an anonymous global variable of type `ty`
+// initialized with `data`.
+Node* register_data(Type* ty, char* data, Token* tok) {
+  Var* var = new_anon_gvar(ty);
+  var->is_data = true;
+  var->init_data = data;
+  return add_global(var, tok);
+}
+
 static Member* get_struct_member(Type* ty, Token* tok) {
-  for (Member* mem = ty->members; mem; mem = mem->next)
-    if (mem->tok->len == tok->len &&
-        !strncmp(mem->tok->loc, tok->loc, tok->len))
-      return mem;
-  error_tok(tok, "no such member");
+  Member* mem = tok->sym ? find_member(ty, tok->sym) : NULL;
+  if (!mem)
+    error_tok(tok, "no such member");
+  return mem;
 }
 
 static Node* struct_ref(Node* lhs, Token* tok) {
@@ -305,36 +417,40 @@ static Node* literal_expand(Node* lhs, Node* rhs, Token* tok) {
 
 // Sexp Parser
 static Sexp* parse_sexp(Token** rest, Token* tok);
-static Sexp* parse_sexp_list(Token** rest, Token* tok);
-static Sexp* parse_sexp_symbol(Token** rest, Token* tok);
+
+// Forms are evaluated recursively, so they are only accepted up to this
+// depth, counting the forms that macros expand to. Long operator
+// chains such as (+ a b c ...) are not nested and are not limited.
+#define MAX_NESTING 10000
+static int nesting;
 
 // Sexp Evaluator
-static Node* eval_sexp(Sexp* se, MEnv* menv, Env** newenv, Env* env);
-static Node* eval_list(Sexp* se, MEnv* menv, Env** newenv, Env* env);
-static Node* eval_application(Sexp* se, MEnv* menv, Env* env);
-static Node* eval_def(Sexp* se, MEnv* menv, Env** newenv, Env* env);
-static Node* eval_defstruct(Sexp* se, MEnv* menv, Env** newenv, Env* env);
-static Node* eval_defunion(Sexp* se, MEnv* menv, Env** newenv, Env* env);
-static Node* eval_struct_ref(Sexp* se, MEnv* menv, Env* env);
-static Node* eval_array_shortcut(Sexp* se, MEnv* menv, Env* env);
-static Node* eval_let(Sexp* se, MEnv* menv, Env** newenv, Env* env, Var* (*alloc_var)(char* name, Type* ty));
-static Node* eval_set(Sexp* se, MEnv* menv, Env* env);
-static Node* eval_while(Sexp* se, MEnv* menv, Env* env);
-static Node* eval_if(Sexp* se, MEnv* menv, Env* env);
-static Node* eval_do(Sexp* se, MEnv* menv, Env* env);
-static Node* eval_macro_primitive(Sexp* se, MEnv* menv, Env* env);
-static Node* eval_primitive(Sexp* se, MEnv* menv, Env* env);
-static Node* eval_triple(Sexp* se, MEnv* menv, Env* env, NodeKind kind);
-static Node* eval_binary(Sexp* se, MEnv* menv, Env* env, NodeKind kind, bool left_compose, bool near_compose);
-static Node* eval_unary(Sexp* se, MEnv* menv, Env* env, NodeKind kind);
-static Node* eval_sizeof(Sexp* se, MEnv* menv, Env* env);
+static Node* eval_sexp(Sexp* se, Env** newenv, Env* env);
+static Node* eval_list(Sexp* se, Env** newenv, Env* env);
+static Node* eval_application(Sexp* se, Env* env);
+static Node* eval_def(Sexp* se, Env** newenv, Env* env);
+static Node* eval_defstruct(Sexp* se, Env** newenv, Env* env);
+static Node* eval_defunion(Sexp* se, Env** newenv, Env* env);
+static Node* eval_struct_ref(Sexp* se, Env* env);
+static Node* eval_array_shortcut(Sexp* se, Env* env);
+static Node* eval_let(Sexp* se, Env** newenv, Env* env, Var* (*alloc_var)(char* name, Type* ty));
+static Node* eval_set(Sexp* se, Env* env);
+static Node* eval_while(Sexp* se, Env* env);
+static Node* eval_if(Sexp* se, Env* env);
+static Node* eval_do(Sexp* se, Env* env);
+static Node* eval_primitive(Sexp* se, Env* env);
+static Node* eval_triple(Sexp* se, Env* env, NodeKind kind);
+static Node* eval_binary(Sexp* se, Env* env, NodeKind kind, bool left_compose, bool near_compose);
+static Node* eval_unary(Sexp* se, Env* env, NodeKind kind);
+static Node* eval_sizeof(Sexp* se, Env* env);
 static Node* eval_num(Sexp* se);
-static Node* eval_str(Sexp* se, MEnv* menv, Env* env);
-static Node* eval_cast(Sexp* se, MEnv* menv, Env* env);
-static Node* eval_deftype(Sexp* se, MEnv* menv, Env** newenv, Env* env);
-static Type* eval_base_type(Sexp* se, MEnv* menv, Env* env);
-static Type* eval_type(Sexp* se, MEnv* menv, Env* env);
-static Type* eval_typeof(Sexp* se, MEnv* menv, Env* env);
+static Node* eval_str(Sexp* se, Env* env);
+static Node* eval_cast(Sexp* se, Env* env);
+static Node* eval_comptime(Sexp* se, Env* env);
+static Node* eval_deftype(Sexp* se, Env** newenv, Env* env);
+static Type* eval_base_type(Sexp* se, Env* env);
+static Type* eval_type(Sexp* se, Env* env);
+static Type* eval_typeof(Sexp* se, Env* env);
 
 /* Macro Interpreter
 
@@ -348,83 +464,73 @@ THere are also primitives in such an interpreter. When an application is met, th
 interpreter must apply transform when it is a macro primitives.
 
 */
-static Macro* macros = NULL;
-static Node* macro_expand(Sexp* se, MEnv* menv, Env* env);
-
-static MEnv* new_menv() {
-  MEnv* menv = calloc(1, sizeof(MEnv));
-  return menv; 
-}
-
-static MEnv* add_symbol(MEnv* oldmenv, Sexp* symbol, Sexp* value) {
-  MEnv* menv = new_menv();
-  menv->symbol = symbol;
-  menv->value = value;
-  menv->next = oldmenv;
-  return menv;
-}
-
-static bool is_same_symbol(Sexp* s1, Sexp* s2) {
-  return (s1->tok->len == s2->tok->len) && 
-    !strncmp(s1->tok->loc, s2->tok->loc, s1->tok->len);
-}
-
-static Sexp* lookup_symbol(MEnv* menv, Sexp* symbol) {
-  MEnv* cur = menv;
-  while (cur) {
-    if (is_same_symbol(cur->symbol, symbol)) {
-      return cur->value;
-    }
-    cur = cur->next;
-  }
-  return NULL;
-}
+static Node* macro_expand(Sexp* se, Macro* m, Env* env);
 
 static Macro* new_macro(Token* name, Sexp* args, Sexp* body) {
-  Macro* t = calloc(1, sizeof(Macro));
+  Macro* t = arena_alloc(&ast_arena, sizeof(Macro));
   t->name = name;
   t->args = args;
   t->body = body;
-  t->next = NULL;
   return t;
 }
 
-static Sexp* new_sexp(SexpKind kind, Token* tok) {
-  Sexp* s = calloc(1, sizeof(Sexp));
-  s->kind = kind;
+static Sexp* new_symbol(Token* tok) {
+  Sexp* s = arena_alloc(&sexp_arena, sizeof(Sexp));
+  s->kind = SE_SYMBOL;
   s->tok = tok;
-  s->next = NULL;
-  s->elements = NULL;
+  return s;
 }
 
-static Macro* lookup_macro(Token* t) {
-  Macro* cur = macros;
-  while (cur != NULL) {
-    if (t->len == cur->name->len && !strncmp(t->loc, cur->name->loc, t->len))
-      return cur;
-    cur = cur->next;
-  }
-  return NULL;
+static Sexp* new_list(Token* tok, int len) {
+  Sexp* s = arena_alloc(&sexp_arena, sizeof(Sexp) + sizeof(Sexp*) * len);
+  s->kind = SE_LIST;
+  s->tok = tok;
+  s->len = len;
+  return s;
 }
 
-static void register_macro(Macro* t) {
-  t->next = macros;
-  macros = t;
+// Returns a copy of `se` and its tokens allocated from ast_arena.
+static Sexp* keep_sexp(Sexp* se) {
+  int len = se->kind == SE_LIST ? se->len : 0;
+  Sexp* copy = arena_alloc(&ast_arena, sizeof(Sexp) + sizeof(Sexp*) * len);
+  copy->kind = se->kind;
+  copy->tok = keep_token(se->tok);
+  copy->len = se->len;
+  for (int i = 0; i < len; i++)
+    copy->elements[i] = keep_sexp(se->elements[i]);
+  return copy;
+}
+
+// Returns a list of the `len` Sexps that follow.
+static Sexp* new_form(Token* tok, int len, ...) {
+  Sexp* list = new_list(tok, len);
+  va_list ap;
+  va_start(ap, len);
+  for (int i = 0; i < len; i++)
+    list->elements[i] = va_arg(ap, Sexp*);
+  va_end(ap);
+  return list;
 }
 
-static bool is_macro(Token* t) {
-  if (lookup_macro(t)) {
-    return true;
-  }
-  return false;
+// Reports an error unless the form has between `min` and `max`
+// arguments, not counting its head.
+static void expect_args(Sexp* se, int min, int max) {
+  int n = se->len - 1;
+  if (n < min || n > max)
+    error_tok(se->elements[0]->tok, "wrong number of arguments");
 }
 
-static bool is_macro_primitive(Token* tok) {
-  static char *kw[] = {"str"};
-  for (int i = 0; i < sizeof(kw) / sizeof(*kw); i++)
-    if (equal(tok, kw[i]))
-      return true;
-  return false;
+// A macro is stored on the symbol it is named by, so finding the macro
+// for a form head costs nothing beyond the interning done by the
+// tokenizer. A later definition replaces an earlier one.
+static Macro* lookup_macro(Token* t) {
+  return t->sym ? t->sym->macro : NULL;
+}
+
+static void register_macro(Macro* t) {
+  if (!t->name->sym)
+    error_tok(t->name, "expected an identifier");
+  t->name->sym->macro = t;
 }
 
 bool is_type(Token* tok) {
@@ -436,67 +542,124 @@ bool is_type(Token* tok) {
 }
 
 bool is_array(Token* tok) {
-  return (is_list(tok)) && (tok->next->kind == TK_NUM);
+  return (is_list(tok)) && (tok[1].kind == TK_NUM);
 }
 
-static Sexp* skip_sexp(Sexp* se, char* s) {
+// Returns the interned name of an identifier.
+static char* get_ident(Token* tok) {
+  if (!tok->sym)
+    error_tok(tok, "expected an identifier");
+  return tok->sym->name;
+}
+
+static void expect_sexp(Sexp* se, char* s) {
   if (!equal(se->tok, s)) {
     error_tok(se->tok, "expected '%s'", s);
   }
-  return se->next;
 }
 
-static Sexp* new_symbol_with_token(char* str) {
-  Token* tok = calloc(1, sizeof(Token));
+// Heads of the forms the reader makes up for shorthand syntax, e.g.
+// (deref a) for a.*. Each is made once and shared by all such forms.
+static Sexp* se_addr;
+static Sexp* se_deref;
+static Sexp* se_struct_ref;
+static Sexp* se_pointer;
+static Sexp* se_make_array;
+
+// The heads outlive the S-expressions, so they live in lex_arena. They
+// are made before the tokenizer starts, as it is the only user of
+// lex_arena and intern() while it runs.
+static Sexp* new_head(char* str) {
+  Token* tok = arena_alloc(&lex_arena, sizeof(Token));
   tok->kind = TK_RESERVED;
   tok->loc = str;
   tok->len = strlen(str);
-  Sexp* se = new_sexp(SE_SYMBOL, tok); 
+  tok->sym = intern(str, tok->len);
+  tok->kw = tok->sym->kw;
+  Sexp* se = arena_alloc(&lex_arena, sizeof(Sexp));
+  se->kind = SE_SYMBOL;
+  se->tok = tok;
   return se;
 }
 
-static int sexp_to_str(Sexp* se, char** str) {
+void init_parser(void) {
+  if (se_addr)
+    return;
+  se_addr = new_head("addr");
+  se_deref = new_head("deref");
+  se_struct_ref = new_head("struct-ref");
+  se_pointer = new_head("pointer");
+  se_make_array = new_head("make-array");
+}
+
+// A growable buffer that a string is built up in. One buffer is reused
+// by every (str ...), and the finished string is copied out once, so
+// building a string is linear in its length.
+typedef struct {
+  char* buf;
+  int len;
+  int capacity;
+} StrBuilder;
+
+static StrBuilder str_builder;
+
+static void sb_append(StrBuilder* sb, char* s, int len) {
+  if (sb->len + len > sb->capacity) {
+    int capacity = sb->capacity ? sb->capacity : 128;
+    while (capacity < sb->len + len)
+      capacity *= 2;
+    sb->buf = realloc(sb->buf, capacity);
+    if (!sb->buf)
+      error("out of memory");
+    sb->capacity = capacity;
+  }
+  memcpy(sb->buf + sb->len, s, len);
+  sb->len += len;
+}
+
+// Returns a NUL-terminated copy of the string built so far, and empties
+// the builder. The copy is allocated from ast_arena, since the string
+// outlives the form; lex_arena belongs to the tokenizer while it runs.
+static char* sb_finish(StrBuilder* sb) {
+  char* str = arena_alloc(&ast_arena, sb->len + 1);
+  memcpy(str, sb->buf, sb->len);
+  sb->len = 0;
+  return str;
+}
+
+// Appends the source text of `se`, with list elements separated by a
+// single space.
+static void sexp_to_str(StrBuilder* sb, Sexp* se) {
+  if (se->kind == SE_VAR) {
+    sexp_to_str(sb, se->elements[0]);
+    return;
+  }
   if (se->kind == SE_SYMBOL) {
-    *str = strndup(se->tok->loc, se->tok->len);
-    return se->tok->len;
-  } 
-  int size = 128;
-  int len = 0;
-  char* s;
-  char* buffer = calloc(1, size);
-  buffer[len++] = '(';
-  for (Sexp* cur = se->elements; cur; cur = cur->next) {
-    int len0 = sexp_to_str(cur, &s);
-    len += len0;
-    if (len > size) {
-      size = size * 2;
-      buffer = realloc(buffer, size);
-    }
-    strncat(buffer, s, len0);
-    if (cur->next) buffer[len++] = ' ';
+    sb_append(sb, se->tok->loc, se->tok->len);
+    return;
+  }
+  sb_append(sb, "(", 1);
+  for (int i = 0; i < se->len; i++) {
+    if (i > 0)
+      sb_append(sb, " ", 1);
+    sexp_to_str(sb, se->elements[i]);
   }
-  buffer[len++] = ')';
-  *str = buffer;
-  return len;
+  sb_append(sb, ")", 1);
 }
 
-static Node* eval_macro_str(Sexp* se, MEnv* menv, Env* env) {
-  char* str; 
-  Sexp* val;
-  if (se->elements->next->tok->kind == TK_IDENT) {
-    val = lookup_symbol(menv, se->elements->next);
-  } else {
-    val = se->elements->next;
-  }
-  int len = sexp_to_str(val, &str);
+static Node* eval_macro_str(Sexp* se, Env* env) {
+  expect_args(se, 1, 1);
+  sexp_to_str(&str_builder, se->elements[1]);
+  int len = str_builder.len;
+  char* str = sb_finish(&str_builder);
   Type* ty = array_of(ty_char, len + 1);
-  Node* str_node = new_str_node(str, se->elements->tok);
+  Node* str_node = new_str_node(str, se->elements[0]->tok);
   str_node->ty = ty;
   Node* var_node = register_str(str_node);
   return var_node;
 }
 
-static Node* eval_str(Sexp* se, MEnv* menv, Env* env) {
+static Node* eval_str(Sexp* se, Env* env) {
   Type* ty = array_of(ty_char, strlen(se->tok->str) + 1);
   Node* str_node = new_str_node(se->tok->str, se->tok);
   str_node->ty = ty;
@@ -508,37 +671,33 @@ static Node* eval_str(Sexp* se, MEnv* menv, Env* env) {
   return var_node;
 }
 
-static Node* eval_do(Sexp* se, MEnv* menv, Env* env) {
-  Token* tok = se->elements->tok;
+static Node* eval_do(Sexp* se, Env* env) {
+  Token* tok = se->elements[0]->tok;
   Node head = {};
   Node* cur = &head;
-  Sexp* secur = se->elements->next;
-  while (secur) {
-    cur = merge_nodes(cur, eval_sexp(secur, menv, &env, env));
-    secur = secur->next;
-  }
+  for (int i = 1; i < se->len; i++)
+    cur = merge_nodes(cur, eval_sexp(se->elements[i], &env, env));
   Node* node = new_do(head.next, tok);
   return node;
 }
 
-static Node* eval_while(Sexp* se, MEnv* menv, Env* env) {
-  Token* tok = se->elements->tok;
-  Node* cond = eval_sexp(se->elements->next, menv, &env, env);
+static Node* eval_while(Sexp* se, Env* env) {
+  Token* tok = se->elements[0]->tok;
+  expect_args(se, 1, INT_MAX);
+  Node* cond = eval_sexp(se->elements[1], &env, env);
   Node head = {};
   Node* cur = &head;
-  Sexp* rest = se->elements->next->next;
-  while (rest) {
-    cur = merge_nodes(cur, eval_sexp(rest, menv, &env, env));
-    rest = rest->next;
-  }
+  for (int i = 2; i < se->len; i++)
+    cur = merge_nodes(cur, eval_sexp(se->elements[i], &env, env));
   Node* node = new_while(cond, head.next, tok);
   return node;
 }
 
-static Node* eval_set(Sexp* se, MEnv* menv, Env* env) {
-  Token* tok = se->elements->tok;
-  Node* lhs = eval_sexp(se->elements->next, menv, &env, env);
-  Node* rhs = eval_sexp(se->elements->next->next, menv, &env, env);
+static Node* eval_set(Sexp* se, Env* env) {
+  Token* tok = se->elements[0]->tok;
+  expect_args(se, 2, 2);
+  Node* lhs = eval_sexp(se->elements[1], &env, env);
+  Node* rhs = eval_sexp(se->elements[2], &env, env);
   if (rhs->kind == ND_ARRAY_LITERAL) {
     Node* node = new_let(lhs, NULL, tok);
     node->next = literal_expand(lhs, rhs, tok);
@@ -549,54 +708,68 @@ static Node* eval_set(Sexp* se, MEnv* menv, Env* env) {
 }
 
 // (let var :type val)
-static Node* eval_let(Sexp* se, MEnv* menv,  Env** newenv, Env* env, Var* (*alloc_var)(char* name, Type* ty)) {
-  Token* tok = se->elements->tok;
-  Sexp* se_var = se->elements->next;
-  Sexp* se_type = skip_sexp(se_var->next, ":");
-  Sexp* se_val = se_type->next;
+static Node* eval_let(Sexp* se,  Env** newenv, Env* env, Var* (*alloc_var)(char* name, Type* ty)) {
+  Token* tok = se->elements[0]->tok;
+  expect_args(se, 3, 4);
+  Sexp* se_var = se->elements[1];
+  expect_sexp(se->elements[2], ":");
+  Sexp* se_type = se->elements[3];
+  Sexp* se_val = se->len > 4 ? se->elements[4] : NULL;
   if (se_var->tok->kind != TK_IDENT) {
     error_tok(se_var->tok, "bad identifier");
   }
-  Type* ty = eval_type(se_type, menv, env);
-  Var* var = alloc_var(strndup(se_var->tok->loc, se_var->tok->len), ty);
+  Type* ty = eval_type(se_type, env);
+  Var* var = alloc_var(get_ident(se_var->tok), ty);
   *newenv = add_var(env, var);
   Node* lhs = new_var_node(var, se_var->tok);
   set_binding_ctx();
 
   Node* rhs = NULL;
   if (se_val) {
-    rhs = eval_sexp(se_val, menv, &env, env);
+    rhs = eval_sexp(se_val, &env, env);
     if (rhs->kind == ND_ARRAY_LITERAL || rhs->kind == ND_STR) {
       Node* node = new_let(lhs, NULL, tok);
       node->next = literal_expand(lhs, rhs, tok);
       return node;
     }
+    Node* val = fold_init(rhs);
+    if (val)
+      rhs = val;
   }
 
   Node* node = new_let(lhs, rhs, tok);
   return node;
 }
 
-static Node* eval_if(Sexp* se, MEnv* menv, Env* env) {
-  Token* tok = se->elements->tok;
-  Node* cond = eval_sexp(se->elements->next, menv, &env, env);
-  Node* then = eval_sexp(se->elements->next->next, menv, &env, env);
+// (comptime expr)
+static Node* eval_comptime(Sexp* se, Env* env) {
+  expect_args(se, 1, 1);
+  // Variables made by the expression only exist while it is evaluated.
+  Var* saved = locals;
+  bool saved_init = in_global_init;
+  in_global_init = false;
+  Node* node = eval_sexp(se->elements[1], &env, env);
+  in_global_init = saved_init;
+  add_type(node);
+  Node* val = comptime_eval(node, locals, saved, se->elements[0]->tok);
+  locals = saved;
+  return val;
+}
+
+static Node* eval_if(Sexp* se, Env* env) {
+  Token* tok = se->elements[0]->tok;
+  expect_args(se, 2, 3);
+  Node* cond = eval_sexp(se->elements[1], &env, env);
+  Node* then = eval_sexp(se->elements[2], &env, env);
   Node* els = NULL;
-  if (se->elements->next->next->next) {
-    els = eval_sexp(se->elements->next->next->next, menv, &env, env);
+  if (se->len > 3) {
+    els = eval_sexp(se->elements[3], &env, env);
   }
   Node* node = new_if(cond, then, els, tok);
   return node;
 }
 
-static Node* eval_macro_primitive(Sexp* se, MEnv* menv, Env* env) {
-  if (equal(se->elements->tok, "str")) {
-    return eval_macro_str(se, menv, env); 
-  }
-  error_tok(se->tok, "unsupported yet!");
-}
-
-static Node* eval_array_shortcut(Sexp* se, MEnv* menv, Env* env) {
+static Node* eval_array_shortcut(Sexp* se, Env* env) {
   Token* tok = se->tok;  
   Node head = {}; 
   Node* cur = &head;
@@ -605,9 +778,8 @@ static Node* eval_array_shortcut(Sexp* se, MEnv* menv, Env* env) {
 
   set_array_ctx();
 
-  Sexp* se_cur = se->elements->next;
-  while (se_cur) {
-    cur->next = eval_sexp(se_cur, menv, &env, env);
+  for (int i = 1; i < se->len; i++) {
+    cur->next = eval_sexp(se->elements[i], &env, env);
     cur = cur->next;
     add_type(cur);
     if (!base) {
@@ -615,7 +787,6 @@ static Node* eval_array_shortcut(Sexp* se, MEnv* menv, Env* env) {
     } else if (base->kind != cur->ty->kind ) {
       error_tok(tok, "type mismatch!");
     }
-    se_cur = se_cur->next;
     len++;
   }
 
@@ -627,23 +798,25 @@ static Node* eval_array_shortcut(Sexp* se, MEnv* menv, Env* env) {
   return node;
 }
 
-static Node* eval_struct_ref(Sexp* se, MEnv* menv, Env* env) {
-  Node* lhs = eval_sexp(se->elements->next, menv, &env, env);
+static Node* eval_struct_ref(Sexp* se, Env* env) {
+  expect_args(se, 2, 2);
+  Node* lhs = eval_sexp(se->elements[1], &env, env);
   add_type(lhs);
   if (lhs->ty->kind != TY_STRUCT && lhs->ty->kind != TY_UNION) {
     error_tok(lhs->tok, "not a struct");
   }
   Node* node = new_unary(ND_STRUCT_REF, lhs, se->tok);
-  node->member = get_struct_member(lhs->ty, se->elements->next->next->tok);
+  node->member = get_struct_member(lhs->ty, se->elements[2]->tok);
   return node;
 }
 
-static Node* eval_defunion(Sexp* se, MEnv* menv, Env** newenv, Env* env) {
+static Node* eval_defunion(Sexp* se, Env** newenv, Env* env) {
   Token* tok = se->tok;
-  Sexp* se_tag = se->elements->next;
-  Sexp* members = se_tag->next;
+  if (se->len < 2 || se->len % 2)
+    error_tok(tok, "expected a tag and member-type pairs");
+  Sexp* se_tag = se->elements[1];
 
-  char* name = strndup(se_tag->tok->loc, se_tag->tok->len);
+  char* name = get_ident(se_tag->tok);
 
   // members
   Member head = {};
@@ -651,13 +824,12 @@ static Node* eval_defunion(Sexp* se, MEnv* menv, Env** newenv, Env* env) {
   int max_align = 1;
   int max_size = 0;
 
-  while (members) {
-    Token* mem_tok = members->tok;
-    Type* ty = eval_type(members->next, menv, env);
+  for (int i = 2; i < se->len; i += 2) {
+    Token* mem_tok = se->elements[i]->tok;
+    Type* ty = eval_type(se->elements[i + 1], env);
     Member* mem = new_member(mem_tok, ty);
     mem->offset = 0;
 
-    members = members->next->next;
     cur->next = mem;
     cur = cur->next;
     max_align = ty->align < max_align? max_align : ty->align;
@@ -669,27 +841,27 @@ static Node* eval_defunion(Sexp* se, MEnv* menv, Env** newenv, Env* env) {
   return new_node(ND_DEFUNION, tok);
 }
 
-static Node* eval_defstruct(Sexp* se, MEnv* menv, Env** newenv, Env* env) {
+static Node* eval_defstruct(Sexp* se, Env** newenv, Env* env) {
   Token* tok = se->tok;
-  Sexp* se_tag = se->elements->next;
-  Sexp* members = se_tag->next;
+  if (se->len < 2 || se->len % 2)
+    error_tok(tok, "expected a tag and member-type pairs");
+  Sexp* se_tag = se->elements[1];
 
-  char* name = strndup(se_tag->tok->loc, se_tag->tok->len);
+  char* name = get_ident(se_tag->tok);
 
   // members
   Member head = {};
   Member* cur = &head;
   int offset = 0;
   int max_align = 1;
-  while (members) {
-    Token* mem_tok = members->tok;
-    Type* ty = eval_type(members->next, menv, env);
+  for (int i = 2; i < se->len; i += 2) {
+    Token* mem_tok = se->elements[i]->tok;
+    Type* ty = eval_type(se->elements[i + 1], env);
     Member* mem = new_member(mem_tok, ty);
     offset = align_to(offset, ty->align);
     mem->offset = offset;
     offset += ty->size;
 
-    members = members->next->next;
     cur->next = mem;
     cur = cur->next;
     max_align = ty->align < max_align? max_align : ty->align;
@@ -701,131 +873,134 @@ static Node* eval_defstruct(Sexp* se, MEnv* menv, Env** newenv, Env* env) {
   return new_node(ND_DEFSTRUCT, tok);
 }
 
-static Node* eval_def(Sexp* se, MEnv* menv, Env** newenv, Env* env) {
+static Node* eval_def(Sexp* se, Env** newenv, Env* env) {
   Token* tok = se->tok;  
-  Sexp* se_fn = skip_sexp(se->elements, "def");
-  Sexp* se_args = se_fn->next->elements;
-  Sexp* se_type = skip_sexp(se_fn->next->next, "->");
-  Sexp* se_body = se_type->next;  
-  char* fn = strndup(se_fn->tok->loc, se_fn->tok->len);  
+  expect_args(se, 4, INT_MAX);
+  expect_sexp(se->elements[0], "def");
+  Sexp* se_fn = se->elements[1];
+  Sexp* se_args = se->elements[2];
+  expect_sexp(se->elements[3], "->");
+  Sexp* se_type = se->elements[4];
+  char* fn = get_ident(se_fn->tok);  
+  if (se_args->kind != SE_LIST || se_args->len % 2)
+    error_tok(se_args->tok, "expected parameter-type pairs");
   // args parsing
   locals = NULL;
   Node head_args = {};
   Node* cur = &head_args;
-  while (se_args) {
-    Token* tok_arg = se_args->tok;
-    Type* ty = eval_type(se_args->next, menv, env);
-    Var* var = new_lvar(strndup(tok_arg->loc, tok_arg->len), ty);
+  for (int i = 0; i < se_args->len; i += 2) {
+    Token* tok_arg = se_args->elements[i]->tok;
+    Type* ty = eval_type(se_args->elements[i + 1], env);
+    Var* var = new_lvar(get_ident(tok_arg), ty);
     cur->next = new_var_node(var, tok_arg);
     cur = cur->next;
-    se_args = se_args->next->next;
     env = add_var(env, var);
   }
 
-  Type* ret_ty = eval_type(se_type, menv, env);
+  Type* ret_ty = eval_type(se_type, env);
 
   // body
   Node head_body = {};
   cur = &head_body;
-  while (se_body) {
-    cur = merge_nodes(cur, eval_sexp(se_body, menv, &env, env));
-    se_body = se_body->next;
-  }
+  for (int i = 5; i < se->len; i++)
+    cur = merge_nodes(cur, eval_sexp(se->elements[i], &env, env));
   return new_function(fn, ret_ty, head_args.next, head_body.next, tok);
 }
 
-static Node* eval_application(Sexp* se, MEnv* menv, Env* env) {
+static Node* eval_application(Sexp* se, Env* env) {
   Token* tok = se->tok;
   // function
-  Sexp* secur = se->elements;
-  char* fn = strndup(secur->tok->loc, secur->tok->len);
-  secur = secur->next;
+  char* fn = get_ident(se->elements[0]->tok);
   // args
   Node head = {};
   Node* cur = &head;
-  while (secur) {
-    cur->next = eval_sexp(secur, menv, &env, env);
+  for (int i = 1; i < se->len; i++) {
+    cur->next = eval_sexp(se->elements[i], &env, env);
     cur = cur->next;
-    secur = secur->next;
   }
   return new_app(fn, head.next, tok);
 }
 
-static Node* eval_primitive(Sexp* se, MEnv* menv, Env* env) {
-  Token* tok = se->elements->tok;
-#define Match(t, handle)    if (equal(tok, t)) return handle;
-  Match("+", eval_binary(se, menv, env, ND_ADD, true, false))
-  Match("-", eval_binary(se, menv, env, ND_SUB, true, false))
-  Match("*", eval_binary(se, menv, env, ND_MUL, true, false))
-  Match("/", eval_binary(se, menv, env, ND_DIV, true, false))
-  Match("mod", eval_binary(se, menv, env, ND_MOD, false, false))
-  Match("=", eval_binary(se, menv, env, ND_EQ, false, true))
-  Match(">", eval_binary(se, menv, env, ND_GT, false, true))
-  Match("<", eval_binary(se, menv, env, ND_LT, false, true))
-  Match(">=", eval_binary(se, menv, env, ND_GE, false, true))
-  Match("<=", eval_binary(se, menv, env, ND_LE, false, true))
-  Match("iget", eval_binary(se, menv, env, ND_IGET, true, false))
-  Match("iset", eval_triple(se, menv, env, ND_ISET))
-  Match("addr", eval_unary(se, menv, env, ND_ADDR))
-  Match("deref", eval_unary(se, menv, env, ND_DEREF))
-  Match("not", eval_unary(se, menv, env, ND_NOT))
-  Match("and", eval_binary(se, menv, env, ND_AND, true, false))
-  Match("or", eval_binary(se, menv, env, ND_OR, true, false))
-  Match("bitnot", eval_unary(se, menv, env, ND_BITNOT))
-  Match("bitand", eval_binary(se, menv, env, ND_BITAND, true, false))
-  Match("bitor", eval_binary(se, menv, env, ND_BITOR, true, false))
-  Match("bitxor", eval_binary(se, menv, env, ND_BITXOR, false, false))
-  Match("sra", eval_binary(se, menv, env, ND_SRA, false, false))
-  Match("srl", eval_binary(se, menv, env, ND_SRL, false, false))
-  Match("sll", eval_binary(se, menv, env, ND_SLL, false, false))
-  Match("sizeof", eval_sizeof(se, menv, env))
-  Match("cast", eval_cast(se, menv, env))
-#undef Match
-}
-
-static Node* eval_sizeof(Sexp* se, MEnv* menv, Env* env) {
-  Type* ty = eval_type(se->elements->next, menv, env);
-  return new_num(ty->size, se->elements->next->tok);
-}
-
-static Node* eval_cast(Sexp* se, MEnv* menv, Env* env) {
+static Node* eval_primitive(Sexp* se, Env* env) {
+  Token* tok = se->elements[0]->tok;
+  switch (tok->kw) {
+  case KW_ADD:    return eval_binary(se, env, ND_ADD, true, false);
+  case KW_SUB:    return eval_binary(se, env, ND_SUB, true, false);
+  case KW_MUL:    return eval_binary(se, env, ND_MUL, true, false);
+  case KW_DIV:    return eval_binary(se, env, ND_DIV, true, false);
+  case KW_MOD:    return eval_binary(se, env, ND_MOD, false, false);
+  case KW_EQ:     return eval_binary(se, env, ND_EQ, false, true);
+  case KW_GT:     return eval_binary(se, env, ND_GT, false, true);
+  case KW_LT:     return eval_binary(se, env, ND_LT, false, true);
+  case KW_GE:     return eval_binary(se, env, ND_GE, false, true);
+  case KW_LE:     return eval_binary(se, env, ND_LE, false, true);
+  case KW_IGET:   return eval_binary(se, env, ND_IGET, true, false);
+  case KW_ISET:   return eval_triple(se, env, ND_ISET);
+  case KW_ADDR:   return eval_unary(se, env, ND_ADDR);
+  case KW_DEREF:  return eval_unary(se, env, ND_DEREF);
+  case KW_NOT:    return eval_unary(se, env, ND_NOT);
+  case KW_AND:    return eval_binary(se, env, ND_AND, true, false);
+  case KW_OR:     return eval_binary(se, env, ND_OR, true, false);
+  case KW_BITNOT: return eval_unary(se, env, ND_BITNOT);
+  case KW_BITAND: return eval_binary(se, env, ND_BITAND, true, false);
+  case KW_BITOR:  return eval_binary(se, env, ND_BITOR, true, false);
+  case KW_BITXOR: return eval_binary(se, env, ND_BITXOR, false, false);
+  case KW_SRA:    return eval_binary(se, env, ND_SRA, false, false);
+  case KW_SRL:    return eval_binary(se, env, ND_SRL, false, false);
+  case KW_SLL:    return eval_binary(se, env, ND_SLL, false, false);
+  case KW_SIZEOF: return eval_sizeof(se, env);
+  case KW_CAST:   return eval_cast(se, env);
+  case KW_STRUCT_REF: return eval_struct_ref(se, env);
+  }
+  error_tok(tok, "unsupported primitive");
+}
+
+static Node* eval_sizeof(Sexp* se, Env* env) {
+  expect_args(se, 1, 1);
+  Type* ty = eval_type(se->elements[1], env);
+  return new_num(ty->size, se->elements[1]->tok);
+}
+
+static Node* eval_cast(Sexp* se, Env* env) {
   Token* tok = se->tok;
-  Node* lhs = eval_sexp(se->elements->next, menv, &env, env);
+  expect_args(se, 2, 2);
+  Node* lhs = eval_sexp(se->elements[1], &env, env);
   add_type(lhs);
-  Type* ty = eval_type(se->elements->next->next, menv, env);
+  Type* ty = eval_type(se->elements[2], env);
   Node* node = new_unary(ND_CAST, lhs, tok);
   node->ty = ty;
   return node;
 }
 
-static Node* eval_unary(Sexp* se, MEnv* menv, Env* env, NodeKind kind) {
+static Node* eval_unary(Sexp* se, Env* env, NodeKind kind) {
   Token* tok = se->tok;
-  Node* lhs = eval_sexp(se->elements->next, menv, &env, env);
+  expect_args(se, 1, 1);
+  Node* lhs = eval_sexp(se->elements[1], &env, env);
   Node* node = new_unary(kind, lhs, tok);
   return node;
 }
 
-static Node* eval_binary(Sexp* se, MEnv* menv, Env* env, NodeKind kind, bool left_compose, bool near_compose) {
-  Token* op_tok = se->elements->tok;
-  Node* lhs = eval_sexp(se->elements->next, menv, &env, env);
-  Node* rhs = eval_sexp(se->elements->next->next, menv, &env, env);
+static Node* eval_binary(Sexp* se, Env* env, NodeKind kind, bool left_compose, bool near_compose) {
+  Token* op_tok = se->elements[0]->tok;
+  expect_args(se, 2, left_compose || near_compose ? INT_MAX : 2);
+  Node* lhs = eval_sexp(se->elements[1], &env, env);
+  Node* rhs = eval_sexp(se->elements[2], &env, env);
   Node* node = new_binary(kind, lhs, rhs, op_tok);
-  Sexp* rest = se->elements->next->next->next;
 
-  while (left_compose && rest) {
+  for (int i = 3; left_compose && i < se->len; i++) {
     lhs = node;
-    rhs = eval_sexp(rest, menv, &env, env);
+    rhs = eval_sexp(se->elements[i], &env, env);
     node = new_binary(kind, lhs, rhs, op_tok);
-    rest = rest->next;
   }
   return node;
 }
 
-static Node* eval_triple(Sexp* se, MEnv* menv, Env* env, NodeKind kind) {
-  Token* op_tok = se->elements->tok;
-  Node* lhs = eval_sexp(se->elements->next, menv, &env, env);
-  Node* mhs = eval_sexp(se->elements->next->next, menv, &env, env);
-  Node* rhs = eval_sexp(se->elements->next->next->next, menv, &env, env);
+static Node* eval_triple(Sexp* se, Env* env, NodeKind kind) {
+  Token* op_tok = se->elements[0]->tok;
+  expect_args(se, 3, 3);
+  Node* lhs = eval_sexp(se->elements[1], &env, env);
+  Node* mhs = eval_sexp(se->elements[2], &env, env);
+  Node* rhs = eval_sexp(se->elements[3], &env, env);
   Node* node = new_triple(kind, lhs, mhs, rhs, op_tok);
   return node;
 }
@@ -840,55 +1015,51 @@ static Node* eval_bool(Sexp* se) {
   return node;
 }
 
-static Node* eval_list(Sexp* se, MEnv* menv, Env** newenv, Env* env) {
-  if (equal(se->elements->tok, "do")) {
-    return eval_do(se, menv, env); 
-  } else if (equal(se->elements->tok, "if")) {
-    return eval_if(se, menv, env); 
-  } else if (equal(se->elements->tok, "let")) {
-    return eval_let(se, menv, newenv, env, new_lvar); 
-  } else if (equal(se->elements->tok, "set")) {
-    return eval_set(se, menv, env); 
-  } else if (equal(se->elements->tok, "while")) {
-    return eval_while(se, menv, env); 
-  } else if (equal(se->elements->tok, "def")) {
-    return eval_def(se, menv, newenv, env); 
-  } else if (equal(se->elements->tok, "defstruct")) {
-    return eval_defstruct(se, menv, newenv, env); 
-  } else if (equal(se->elements->tok, "defunion")) {
-    return eval_defunion(se, menv, newenv, env); 
-  } else if (equal(se->elements->tok, "struct-ref")) {
-    return eval_struct_ref(se, menv, env); 
-  } else if (equal(se->elements->tok, "make-array")) {
-    return eval_array_shortcut(se, menv, env); 
-  } else if (equal(se->elements->tok, "deftype")) {
-    return eval_deftype(se, menv, newenv, env); 
-  } else if (equal(se->elements->tok, "deftype")) {
-    return eval_deftype(se, menv, newenv, env); 
-  } else if (is_macro_primitive(se->elements->tok)) {
-    return eval_macro_primitive(se, menv, env);
-  } else if (is_primitive(se->elements->tok)) {
-    return eval_primitive(se, menv, env);
-  } else if (is_macro(se->elements->tok)) {
-    return macro_expand(se, menv, env);
-  } else {
-    return eval_application(se, menv, env);
+// The head of a form is classified once by the tokenizer, so a form is
+// dispatched with a single switch on its keyword id. Anything else is a
+// macro use or a function call.
+static Node* eval_list(Sexp* se, Env** newenv, Env* env) {
+  if (se->len == 0)
+    error_tok(se->tok, "empty form");
+  Token* tok = se->elements[0]->tok;
+  switch (tok->kw) {
+  case KW_DO:         return eval_do(se, env);
+  case KW_IF:         return eval_if(se, env);
+  case KW_LET:        return eval_let(se, newenv, env, new_lvar);
+  case KW_SET:        return eval_set(se, env);
+  case KW_WHILE:      return eval_while(se, env);
+  case KW_DEF:        return eval_def(se, newenv, env);
+  case KW_DEFSTRUCT:  return eval_defstruct(se, newenv, env);
+  case KW_DEFUNION:   return eval_defunion(se, newenv, env);
+  case KW_DEFTYPE:    return eval_deftype(se, newenv, env);
+  case KW_MAKE_ARRAY: return eval_array_shortcut(se, env);
+  case KW_STR:        return eval_macro_str(se, env);
+  case KW_COMPTIME:   return eval_comptime(se, env);
   }
+
+  if (is_primitive(tok))
+    return eval_primitive(se, env);
+
+  Macro* m = lookup_macro(tok);
+  if (m)
+    return macro_expand(se, m, env);
+  return eval_application(se, env);
 }
 
 
-static Node* eval_deftype(Sexp* se, MEnv* menv, Env** newenv, Env* env) {
-  Token* tok = se->elements->tok;
-  Sexp* se_tag = se->elements->next;
-  Sexp* se_ty = se_tag->next;
-  char* name = strndup(se_tag->tok->loc, se_tag->tok->len);
-  Type* ty = eval_type(se_ty, menv, env);
+static Node* eval_deftype(Sexp* se, Env** newenv, Env* env) {
+  Token* tok = se->elements[0]->tok;
+  expect_args(se, 2, 2);
+  Sexp* se_tag = se->elements[1];
+  Sexp* se_ty = se->elements[2];
+  char* name = get_ident(se_tag->tok);
+  Type* ty = eval_type(se_ty, env);
   Var* tag = new_var(name, ty);
   *newenv = add_tag(env, tag);
   return new_node(ND_DEFTYPE, tok);
 }
 
-static Type* eval_base_type(Sexp* se, MEnv* menv, Env* env) {
+static Type* eval_base_type(Sexp* se, Env* env) {
   if (equal(se->tok, "long")) {
     return ty_long;
   }
@@ -911,52 +1082,69 @@ static Type* eval_base_type(Sexp* se, MEnv* menv, Env* env) {
   error_tok(se->tok, "invalid base type!");
 }
 
-static Type* eval_pointer_type(Sexp* se, MEnv* menv, Env* env) {
-  Type* base = eval_type(se->elements->next, menv, env);
+static Type* eval_pointer_type(Sexp* se, Env* env) {
+  expect_args(se, 1, 1);
+  Type* base = eval_type(se->elements[1], env);
   return pointer_to(base);
 }
 
-static Type* eval_array_type_helper(Sexp* se, MEnv* menv, Env* env) {
-  int len = se->tok->val;
-  Sexp* se_base = se->next;
+// [n m ... type] is an array of n arrays of m ... elements of type.
+static Type* eval_array_type_helper(Sexp* se, int i, Env* env) {
+  if (i + 1 >= se->len)
+    error_tok(se->elements[i]->tok, "expected a type");
+  int len = se->elements[i]->tok->val;
+  Sexp* se_base = se->elements[i + 1];
   Type* ty_base;
   if (se_base->tok->kind == TK_NUM) {
-    ty_base = eval_array_type_helper(se_base, menv, env); 
+    ty_base = eval_array_type_helper(se, i + 1, env); 
   } else {
-    ty_base = eval_type(se_base, menv, env);
+    ty_base = eval_type(se_base, env);
   }
   return array_of(ty_base, len);
 }
 
-static Type* eval_array_type(Sexp* se, MEnv* menv, Env* env) {
-  return eval_array_type_helper(se->elements, menv, env);
+static Type* eval_array_type(Sexp* se, Env* env) {
+  return eval_array_type_helper(se, 0, env);
 }
 
-static Type* eval_typeof(Sexp* se, MEnv* menv, Env* env) {
-  Node* node = eval_sexp(se->elements->next, menv, &env, env);
+static Type* eval_typeof(Sexp* se, Env* env) {
+  expect_args(se, 1, 1);
+  Node* node = eval_sexp(se->elements[1], &env, env);
   add_type(node);
   return node->ty;
 }
 
-static Type* eval_type(Sexp* se, MEnv* menv, Env* env) {
+static Type* eval_type(Sexp* se, Env* env) {
   if (se->kind == SE_LIST) {
-    if (equal(se->elements->tok, "pointer")) {
-      return eval_pointer_type(se, menv, env);
+    if (se->len == 0) {
+      error_tok(se->tok, "expected a type");
     }
-    if (equal(se->elements->tok, "typeof")) {
-      return eval_typeof(se, menv, env);
+    if (equal(se->elements[0]->tok, "pointer")) {
+      return eval_pointer_type(se, env);
     }
-    if (se->elements->tok->kind == TK_NUM) {
-      return eval_array_type(se, menv, env);
+    if (equal(se->elements[0]->tok, "typeof")) {
+      return eval_typeof(se, env);
+    }
+    if (se->elements[0]->tok->kind == TK_NUM) {
+      return eval_array_type(se, env);
     }
   }
-  return eval_base_type(se, menv, env);
+  return eval_base_type(se, env);
 }
 
 
-static Node* eval_sexp(Sexp* se, MEnv* menv, Env** newenv, Env* env) {
+static Node* eval_sexp(Sexp* se, Env** newenv, Env* env) {
   if (se->kind == SE_LIST) {
-    return eval_list(se, menv, newenv, env);
+    if (nesting == MAX_NESTING)
+      error_tok(se->tok, "expression nested too deeply");
+    nesting++;
+    Node* node = eval_list(se, newenv, env);
+    nesting--;
+    return node;
+  }
+
+  if (se->kind == SE_VAR) {
+    return new_var_node(lookup_var(env, se->tok), se->elements[0]->tok);
   }
   
   Token* tok = se->tok;
@@ -964,21 +1152,17 @@ static Node* eval_sexp(Sexp* se, MEnv* menv, Env** newenv, Env* env) {
     return eval_num(se);
   }
 
-  if (equal(tok, "true")) {
+  if (tok->kw == KW_TRUE) {
     tok->val = TRUE;
     return eval_bool(se);
   }
 
-  if (equal(tok, "false")) {
+  if (tok->kw == KW_FALSE) {
     tok->val = FALSE;
     return eval_bool(se);
   }
 
   if (tok->kind == TK_IDENT) {
-    Sexp* val = lookup_symbol(menv, se); 
-    if (val) {
-      return eval_sexp(val, menv, newenv, env);
-    }
     Var* var = lookup_var(env, tok);
     if (var) {
       return new_var_node(var, tok);
@@ -987,207 +1171,396 @@ static Node* eval_sexp(Sexp* se, MEnv* menv, Env** newenv, Env* env) {
   }
 
   if (tok->kind == TK_STR) {
-    return eval_str(se, menv, env);
+    return eval_str(se, env);
   }
   error("invalid symbol expression");
 }
 
 
-Node* macro_expand(Sexp* se, MEnv* menv, Env* env) {
-  Macro* m = lookup_macro(se->elements->tok);
-  Sexp* args = se->elements->next;
+// A use of a macro is reported if it expands to more than this many
+// times as many nodes as there are S-expressions in the use and in the
+// bodies of the macros it expands. That happens when arguments are
+// duplicated, typically by nested macros that mention a parameter
+// more than once.
+#define EXPANSION_GROWTH_LIMIT 8
 
-  // prepare the macro environment
-  Sexp* symbol;
-  for (symbol = m->args; symbol && args; symbol = symbol->next, args = args->next) {
-    menv = add_symbol(menv, symbol, args);
-  }
-  if (symbol || args) {
+static int expansion_depth;
+static int expansion_stamp;
+static int expansion_input;
+
+// Returns the number of S-expressions in `se`.
+static int sexp_size(Sexp* se) {
+  if (se->kind != SE_LIST)
+    return 1;
+  int n = 1;
+  for (int i = 0; i < se->len; i++)
+    n += sexp_size(se->elements[i]);
+  return n;
+}
+
+// Evaluates the argument of a (once x) parameter into a new local
+// variable, whose initialization is appended to `cur`, and returns an
+// S-expression that refers to the variable. The argument is evaluated
+// in the environment of the macro use.
+static Sexp* bind_once(Sexp* arg, Env** env, Node** cur) {
+  static int id = 0;
+  Node* val = eval_sexp(arg, env, *env);
+  if (val->kind == ND_ARRAY_LITERAL)
+    error_tok(arg->tok, "array literal cannot be a once argument");
+  if (val->kind == ND_STR)
+    val = register_str(val);
+  add_type(val);
+  Type* ty = val->ty;
+  if (ty->kind == TY_VOID)
+    error_tok(arg->tok, "argument has no value");
+  if (ty->kind == TY_ARRAY)
+    ty = pointer_to(ty->base);
+
+  // The name contains a '.', so it cannot clash with a name in the
+  // source. It is not interned, since only the tokenizer may intern
+  // while it runs, and its Symbol only serves to look the variable up.
+  char buf[20];
+  int len = sprintf(buf, "once.%d", id++);
+  Symbol* sym = arena_alloc(node_arena, sizeof(Symbol) + len + 1);
+  sym->name = memcpy(sym + 1, buf, len + 1);
+  sym->len = len;
+
+  Token* tok = arena_alloc(node_arena, sizeof(Token));
+  tok->kind = TK_IDENT;
+  tok->loc = arg->tok->loc;
+  tok->len = arg->tok->len;
+  tok->line_no = arg->tok->line_no;
+  tok->col_no = arg->tok->col_no;
+  tok->sym = sym;
+
+  Var* var = new_lvar(tok->sym->name, ty);
+  *env = add_var(*env, var);
+  *cur = merge_nodes(*cur, new_let(new_var_node(var, arg->tok), val, arg->tok));
+
+  Sexp* se = new_list(tok, 1);
+  se->kind = SE_VAR;
+  se->elements[0] = arg;
+  return se;
+}
+
+static Node* macro_expand(Sexp* se, Macro* m, Env* env) {
+  if (se->len - 1 != m->args->len) {
     error_tok(se->tok, "args number mismatch!");
   }
+
+  int start = nnodes;
+  if (expansion_depth++ == 0) {
+    expansion_stamp++;
+    expansion_input = sexp_size(se);
+  }
+  if (m->stamp != expansion_stamp) {
+    m->stamp = expansion_stamp;
+    expansion_input += sexp_size(m->body);
+  }
+
+  // (once x) arguments are evaluated first, into variables
+  Sexp** args = se->elements + 1;
+  Node head = {};
+  Node* cur = &head;
+  if (m->has_once && !in_global_init) {
+    args = arena_alloc(&sexp_arena, sizeof(Sexp*) * m->args->len);
+    for (int i = 0; i < m->args->len; i++) {
+      args[i] = se->elements[i + 1];
+      if (is_once_param(m->args->elements[i]))
+        args[i] = bind_once(args[i], &env, &cur);
+    }
+  }
+
   // perform transformation
-  Node* node = eval_sexp(m->body, menv, &env, env);
+  Node* node = eval_sexp(run_macro(m, args), &env, env);
+  if (head.next) {
+    merge_nodes(cur, node);
+    node = new_do(head.next, se->tok);
+  }
+
+  if (--expansion_depth == 0) {
+    int output = nnodes - start;
+    if (output > EXPANSION_GROWTH_LIMIT * expansion_input)
+      warn_tok(se->tok, "macro expands to %d nodes from %d S-expressions; "
+               "consider (once x) for parameters used more than once",
+               output, expansion_input);
+  }
   return node;
 }
 
 
-Sexp* parse_sexp(Token** rest, Token* tok) {
-  if (is_list(tok)) {
-    return parse_sexp_list(rest, tok);
-  } else {
-    return parse_sexp_symbol(rest, tok);
+// Elements of the lists being read, innermost list last. A list's
+// elements are pushed as they are read and copied out when the list is
+// closed, so each list is allocated once at its final length.
+static Sexp** stack;
+static int stack_len;
+static int stack_capacity;
+
+static void push_sexp(Sexp* se) {
+  if (stack_len == stack_capacity) {
+    stack_capacity = stack_capacity ? stack_capacity * 2 : 64;
+    stack = realloc(stack, sizeof(Sexp*) * stack_capacity);
+    if (!stack)
+      error("out of memory");
   }
+  stack[stack_len++] = se;
 }
 
-Sexp* parse_sexp_array_literal(Token** rest, Token* tok) {
-  Sexp* list = new_sexp(SE_LIST, tok);
-  Sexp* cur = new_symbol_with_token("make-array");
-  list->elements = cur;
-  char* pair = get_pair(&tok, tok->next->next);
-  while (!stop_parse(tok)) {
-    cur->next = parse_sexp(&tok, tok);
-    cur = cur->next; 
-  }
-  *rest = skip(tok, pair);
+// Makes a list of the elements pushed since the stack was `base` long.
+static Sexp* pop_list(Token* tok, int base) {
+  int len = stack_len - base;
+  Sexp* list = new_list(tok, len);
+  memcpy(list->elements, stack + base, sizeof(Sexp*) * len);
+  stack_len = base;
   return list;
 }
 
-Sexp* parse_sexp_hash_literal(Token** rest, Token* tok) {
-  if (equal(tok->next, "a")) {
-    return parse_sexp_array_literal(rest, tok);
+// Forms whose elements are still being read, innermost last. They are
+// kept here rather than on the C stack, and their depth is limited like
+// that of evaluation so that later walks over a form can recurse.
+typedef struct {
+  Token* start;
+  Sexp* head;     // se_addr or se_pointer for a prefix, NULL for a list
+  char* pair;     // the closing bracket of a list
+  int base;       // where the list's elements start on `stack`
+} OpenForm;
+
+static OpenForm* open_forms;
+static int open_len;
+static int open_capacity;
+
+static void open_form(Token* start, Sexp* head, char* pair) {
+  if (open_len == open_capacity) {
+    open_capacity = open_capacity ? open_capacity * 2 : 64;
+    open_forms = realloc(open_forms, sizeof(OpenForm) * open_capacity);
+    if (!open_forms)
+      error("out of memory");
   }
-  error_tok(tok, "unsupported hash literal");
+  if (open_len == MAX_NESTING)
+    error_tok(start, "expression nested too deeply");
+  open_forms[open_len++] = (OpenForm){start, head, pair, stack_len};
 }
 
-Sexp* parse_sexp_symbol(Token** rest, Token* tok) {
-  if (equal(tok, "&")) {
-    Sexp* list = new_sexp(SE_LIST, tok);
-    list->elements = new_symbol_with_token("addr");
-    list->elements->next = parse_sexp(&tok, tok->next);
-    *rest = tok;
-    return list;
-  }
-
-  if (equal(tok, "#")) {
-    return parse_sexp_hash_literal(rest, tok);
-  }
-
+// Reads a symbol, with any member references and dereferences that
+// follow it.
+static Sexp* parse_sexp_symbol(Token** rest, Token* tok) {
   if (tok->kind == TK_IDENT) {
-    Sexp* se = new_sexp(SE_SYMBOL, tok);
-    tok = tok->next;
+    Sexp* se = new_symbol(tok);
+    tok++;
     while (equal(tok, ".")) {
-      if (equal(tok->next, "*")) {
-        Sexp* list = new_sexp(SE_LIST, tok->next);
-        list->elements = new_symbol_with_token("deref");
-        list->elements->next = se;
-        se = list;
-        tok = tok->next->next;
+      if (equal(tok + 1, "*")) {
+        se = new_form(tok + 1, 2, se_deref, se);
+        tok += 2;
       } else {
         // a.v -> (struct-ref a v)
-        Sexp* list = new_sexp(SE_LIST, tok);
-        list->elements = new_symbol_with_token("struct-ref");
-        se->next = new_sexp(SE_SYMBOL, tok->next);
-        list->elements->next = se;
-        se = list;
-        tok = tok->next->next;
+        se = new_form(tok, 3, se_struct_ref, se, new_symbol(tok + 1));
+        tok += 2;
       }
     }
     *rest = tok;
     return se;
   }
 
-  // pointer type, there may be another better way to do this
-  if (equal(tok, "*") && (equal(tok->next, "*") || is_type(tok->next) || is_array(tok->next))) {
-    Sexp* list = new_sexp(SE_LIST, tok);
-    list->elements = new_symbol_with_token("pointer");
-    list->elements->next = parse_sexp(&tok, tok->next);
-    *rest = tok;
-    return list;
-  }
-  
-  Sexp* s = new_sexp(SE_SYMBOL, tok);
-  *rest = tok->next;
+  Sexp* s = new_symbol(tok);
+  *rest = tok + 1;
   return s;
 }
 
-Sexp* parse_sexp_list(Token** rest, Token* tok) {
-  Sexp* list = new_sexp(SE_LIST, tok);
-  char* pair = get_pair(&tok, tok);
-  // parse elements
-  Sexp head = {};
-  Sexp* cur = &head;
-  while (!stop_parse(tok)) {
-    cur->next = parse_sexp(&tok, tok);
-    cur = cur->next;
-  }
-  list->elements = head.next;
+static Sexp* parse_sexp(Token** rest, Token* tok) {
+  int bottom = open_len;
+
+  for (;;) {
+    Sexp* se;
+    OpenForm* form = open_len > bottom ? &open_forms[open_len - 1] : NULL;
+
+    if (form && !form->head && stop_parse(tok)) {
+      // End of a list
+      tok = skip(tok, form->pair);
+      open_len--;
+      se = pop_list(form->start, form->base);
+    } else if (is_list(tok)) {
+      Token* start = tok;
+      char* pair = get_pair(&tok, tok);
+      open_form(start, NULL, pair);
+      continue;
+    } else if (equal(tok, "&")) {
+      open_form(tok, se_addr, NULL);
+      tok++;
+      continue;
+    } else if (equal(tok, "#")) {
+      // #a(...) -> (make-array ...)
+      if (!equal(tok + 1, "a"))
+        error_tok(tok, "unsupported hash literal");
+      Token* start = tok;
+      char* pair = get_pair(&tok, tok + 2);
+      open_form(start, NULL, pair);
+      push_sexp(se_make_array);
+      continue;
+    } else if (equal(tok, "*") && (equal(tok + 1, "*") || is_type(tok + 1) || is_array(tok + 1))) {
+      // pointer type, there may be another better way to do this
+      open_form(tok, se_pointer, NULL);
+      tok++;
+      continue;
+    } else {
+      se = parse_sexp_symbol(&tok, tok);
+    }
 
-  tok = skip(tok, pair);
-  *rest = tok;
-  return list;
+    // `se` is complete. Wrap it in the prefixes waiting for it and
+    // add it to the innermost list, unless it is what was asked for.
+    while (open_len > bottom && open_forms[open_len - 1].head) {
+      OpenForm* prefix = &open_forms[--open_len];
+      se = new_form(prefix->start, 2, prefix->head, se);
+    }
+    if (open_len == bottom) {
+      *rest = tok;
+      return se;
+    }
+    push_sexp(se);
+  }
 }
-static Node* eval_defmacro(Sexp* se, MEnv* menv, Env** newenv, Env* env) {
+
+static Node* eval_defmacro(Sexp* se, Env** newenv, Env* env) {
   Token* tok = se->tok;
-  Sexp* se_name = se->elements->next;
-  Sexp* se_args = se_name->next;
-  Sexp* se_body = se_args->next;
+  expect_args(se, 3, 3);
+  Sexp* se_name = se->elements[1];
+  Sexp* se_args = se->elements[2];
+  Sexp* se_body = se->elements[3];
+  if (se_args->kind != SE_LIST)
+    error_tok(se_args->tok, "expected a parameter list");
+  for (int i = 0; i < se_args->len; i++) {
+    Sexp* param = se_args->elements[i];
+    if (is_once_param(param) &&
+        (param->len != 2 || !equal(param->elements[0]->tok, "once") ||
+         param->elements[1]->kind != SE_SYMBOL))
+      error_tok(param->tok, "expected a parameter or (once parameter)");
+  }
 
-  // macro
-  Token* name = se_name->tok;
+  // The macro outlives the form, so it is made of copies.
+  Token* name = keep_token(se_name->tok);
 
-  Macro* t = new_macro(name, se_args->elements, se_body);
+  Macro* t = new_macro(name, keep_sexp(se_args), keep_sexp(se_body));
+  compile_macro(t);
   register_macro(t);
 
   return new_node(ND_DEFMACRO, tok);
 }
 
-static bool is_certain_expr(Sexp* se, char* form) {
-  return se->kind == SE_LIST && equal(se->elements->tok, form);
+static bool is_certain_expr(Sexp* se, Keyword form) {
+  return se->kind == SE_LIST && se->len > 0 && se->elements[0]->tok->kw == form;
 }
 
 static bool is_function(Sexp* se) {
-  return is_certain_expr(se, "def");
+  return is_certain_expr(se, KW_DEF);
 }
 
 static bool is_global_var(Sexp* se) {
-  return is_certain_expr(se, "let");
+  return is_certain_expr(se, KW_LET);
 }
 
 static bool is_defstruct(Sexp* se) {
-  return is_certain_expr(se, "defstruct");
+  return is_certain_expr(se, KW_DEFSTRUCT);
 }
 
 static bool is_defunion(Sexp* se) {
-  return is_certain_expr(se, "defunion");
+  return is_certain_expr(se, KW_DEFUNION);
 }
 
 
 static bool is_defmacro(Sexp* se) {
-  return is_certain_expr(se, "defmacro");
+  return is_certain_expr(se, KW_DEFMACRO);
 }
 
 
-static Node* eval_global_var(Sexp* se, MEnv* menv, Env** newenv, Env* env) {
-  Node* node = eval_let(se, menv, &env, env, new_gvar);
+// Gives a global the value of its initializer, which must be constant.
+// A global initialized by (comptime ...) takes over the data made for
+// it.
+static void set_init_data(Var* var, Node* rhs) {
+  if (!rhs)
+    return;
+
+  add_type(rhs);
+  Type* ty = var->ty;
+  if (rhs->kind == ND_NUM && ty->kind != TY_ARRAY && ty->kind != TY_STRUCT && ty->kind != TY_UNION) {
+    var->init_data = arena_alloc(&ast_arena, ty->size);
+    memcpy(var->init_data, &rhs->val, ty->size);
+    return;
+  }
+
+  if (rhs->kind == ND_VAR && rhs->var->is_data && rhs->ty->size == ty->size) {
+    var->init_data = rhs->var->init_data;
+    if (global_lets && global_lets->lhs->var == rhs->var)
+      global_lets = global_lets->next;
+    return;
+  }
+
+  error_tok(rhs->tok, "global initializer is not a constant");
+}
+
+static Node* eval_global_var(Sexp* se, Env** newenv, Env* env) {
+  in_global_init = true;
+  Node* node = eval_let(se, &env, env, new_gvar);
+  in_global_init = false;
+  Var* var = node->lhs->var;
+  set_init_data(var, node->rhs);
+  add_global(var, node->tok);
   *newenv = env;
   return node;
 }
 
+// Reads and evaluates the top-level form at `tok`. A function is
+// returned, with its nodes and local variables allocated from
+// `fn_arena`. Any other form returns NULL; what it defines is kept for
+// the forms that follow, and the globals it makes are added to
+// global_data(). Nothing refers to the form's tokens afterwards, except
+// for the function.
+Node* parse_form(Token** rest, Token* tok, Arena* fn_arena) {
+  Sexp* se = parse_sexp(rest, tok);
+  Env* env = global_env;
+  Node* node = NULL;
+  locals = NULL;
 
-static Sexp* program_as_sexp(Token* tok) {
-  Sexp prog = {};
-  Sexp* se_cur = &prog;
-  while (tok->kind != TK_EOF) {
-    se_cur->next = parse_sexp(&tok, tok);
-    se_cur = se_cur->next;
+  if (is_function(se)) {
+    node_arena = fn_arena;
+    node = eval_sexp(se, &env, env);
+    add_type(node);
+    fold_function(node);
+    define_function(node);
+    node_arena = &ast_arena;
+  } else {
+    scope_arena = &env_arena;
+    if (is_global_var(se))
+      eval_global_var(se, &global_env, env);
+    else if (is_defstruct(se))
+      eval_defstruct(se, &global_env, env);
+    else if (is_defunion(se))
+      eval_defunion(se, &global_env, env);
+    else if (is_defmacro(se))
+      eval_defmacro(se, &global_env, env);
+    else
+      error_tok(se->tok, "invalid expression");
+    scope_arena = &sexp_arena;
+    compact_global_env();
   }
-  return prog.next;
+
+  // The S-expressions and environments are only needed while the form
+  // is evaluated.
+  arena_reset(&sexp_arena);
+  return node;
 }
 
+// Evaluates a whole program, whose nodes are all allocated from
+// ast_arena, and returns its globals followed by its functions.
 Node* parse(Token* tok) {
-  Node* cur = prog;
-  Env* env = NULL;
-  
-  Sexp* se = program_as_sexp(tok);
-  MEnv* menv = NULL;
-
-  while (se) {
-    if (is_function(se)) {
-      Node* node = eval_sexp(se, menv, &env, env);
-      add_type(node);
-      cur = merge_nodes(cur, node);
-    } else if (is_global_var(se)) {
-      cur = merge_nodes(cur, eval_global_var(se, menv, &env, env));
-    } else if (is_defstruct(se)) {
-      cur = merge_nodes(cur, eval_defstruct(se, menv, &env, env));
-    } else if (is_defunion(se)) {
-      cur = merge_nodes(cur, eval_defunion(se, menv, &env, env));
-    } else if (is_defmacro(se)) {
-      cur = merge_nodes(cur, eval_defmacro(se, menv, &env, env));
-    } else {
-      error_tok(se->tok, "invalid expression");
-    }
-    se = se->next;
+  init_parser();
+  Node head = {};
+  Node* cur = &head;
+  while (tok->kind != TK_EOF) {
+    Node* fn = parse_form(&tok, tok, &ast_arena);
+    if (fn)
+      cur = cur->next = fn;
   }
-  return prog;
+
+  Node prog = {};
+  merge_nodes(&prog, global_data())->next = head.next;
+  return prog.next;
 }
@@ -0,0 +1,255 @@
+// This file runs the compiler as a pipeline of three threads connected
+// by bounded queues: the tokenizer, the evaluator and the code
+// generator.
+//
+// The tokenizer cuts the tokens into batches of whole top-level forms.
+// The evaluator, which runs on the calling thread, reads and evaluates
+// the forms one at a time, each function into an arena of its own.
+// When it is done with a batch, it passes the batch on with the
+// functions read from it, and the code generator emits them and frees
+// them along with the batch. So only the batches in flight are held in
+// memory, besides what the forms leave behind for later ones: types,
+// macros, global variables, and the functions that can be called at
+// compile time. The data is emitted last.
+
+#include "manda.h"
+#include <pthread.h>
+
+// A batch is cut at the end of the first top-level form that makes it
+// this many tokens long.
+#define BATCH_SIZE 4096
+
+// How many batches may wait in each queue.
+#define MAX_BATCHES 4
+
+// The code generator recurses into nested expressions, so it is given
+// as much stack as the main thread usually has.
+#define CODEGEN_STACK_SIZE (8 * 1024 * 1024)
+
+//
+// Queues
+//
+
+typedef struct {
+  void** items;
+  int capacity;
+  int head;
+  int len;
+  bool closed;
+  pthread_mutex_t lock;
+  pthread_cond_t not_empty;
+  pthread_cond_t not_full;
+} Queue;
+
+static void init_queue(Queue* q, int capacity) {
+  *q = (Queue){0};
+  q->items = calloc(capacity, sizeof(void*));
+  if (!q->items)
+    error("out of memory");
+  q->capacity = capacity;
+  pthread_mutex_init(&q->lock, NULL);
+  pthread_cond_init(&q->not_empty, NULL);
+  pthread_cond_init(&q->not_full, NULL);
+}
+
+// Adds `item` to the queue, waiting while it is full.
+static void put(Queue* q, void* item) {
+  pthread_mutex_lock(&q->lock);
+  while (q->len == q->capacity)
+    pthread_cond_wait(&q->not_full, &q->lock);
+  q->items[(q->head + q->len++) % q->capacity] = item;
+  pthread_cond_signal(&q->not_empty);
+  pthread_mutex_unlock(&q->lock);
+}
+
+// Removes the oldest item from the queue, waiting while it is empty.
+// Returns NULL once the queue is closed and empty.
+static void* take(Queue* q) {
+  pthread_mutex_lock(&q->lock);
+  while (q->len == 0 && !q->closed)
+    pthread_cond_wait(&q->not_empty, &q->lock);
+  void* item = NULL;
+  if (q->len > 0) {
+    item = q->items[q->head];
+    q->head = (q->head + 1) % q->capacity;
+    q->len--;
+    pthread_cond_signal(&q->not_full);
+  }
+  pthread_mutex_unlock(&q->lock);
+  return item;
+}
+
+// Tells the taker that nothing more will be put.
+static void close_queue(Queue* q) {
+  pthread_mutex_lock(&q->lock);
+  q->closed = true;
+  pthread_cond_broadcast(&q->not_empty);
+  pthread_mutex_unlock(&q->lock);
+}
+
+//
+// Work items
+//
+
+typedef struct Function Function;
+struct Function {
+  Function* next;
+  Node* fn;
+  Arena* arena;       // the function's nodes, NULL if it is kept
+};
+
+typedef struct {
+  Token* tokens;
+  Function* fns;      // the functions read from `tokens`
+} Batch;
+
+static Queue tokenized;
+static Queue evaluated;
+
+//
+// Threads
+//
+
+static void put_batch(Token* tokens, void* arg) {
+  Batch* batch = calloc(1, sizeof(Batch));
+  if (!batch)
+    error("out of memory");
+  batch->tokens = tokens;
+  put(&tokenized, batch);
+}
+
+static void* tokenizer(void* path) {
+  tokenize_file_in_batches(path, BATCH_SIZE, put_batch, NULL);
+  close_queue(&tokenized);
+  return NULL;
+}
+
+static void* code_generator(void* out) {
+  Batch* batch;
+  while ((batch = take(&evaluated))) {
+    for (Function* f = batch->fns, *next; f; f = next) {
+      next = f->next;
+      codegen_function(f->fn, out);
+      if (f->arena)
+        free_arena(f->arena);
+      free(f);
+    }
+    free(batch->tokens);
+    free(batch);
+  }
+  return NULL;
+}
+
+//
+// Evaluator
+//
+
+// The functions that can be called at compile time, with their arenas.
+// They are kept until the whole program has been evaluated.
+static Function* kept;
+static int nkept;
+static int kept_capacity;
+
+static void keep(Node* fn, Arena* arena) {
+  if (nkept == kept_capacity) {
+    kept_capacity = kept_capacity ? kept_capacity * 2 : 64;
+    kept = realloc(kept, sizeof(Function) * kept_capacity);
+    if (!kept)
+      error("out of memory");
+  }
+  kept[nkept++] = (Function){NULL, fn, arena};
+}
+
+typedef struct {
+  Token* start;
+  Token* end;
+  Token** copies;   // copies[i] is the copy of start[i], if made
+  Arena* arena;
+} TokenCopy;
+
+static bool use_copy(Node* node, void* arg) {
+  TokenCopy* c = arg;
+  Token* tok = node->tok;
+  if (tok < c->start || tok >= c->end)
+    return true;
+
+  Token** copy = &c->copies[tok - c->start];
+  if (!*copy) {
+    *copy = arena_alloc(c->arena, sizeof(Token));
+    **copy = *tok;
+  }
+  node->tok = *copy;
+  return true;
+}
+
+// Makes the nodes of `fn`, which was read from the tokens from `start`
+// up to `end`, refer to copies of their tokens in `arena`, so that it
+// outlives its batch.
+static void copy_tokens(Node* fn, Token* start, Token* end, Arena* arena) {
+  TokenCopy c = {start, end, calloc(end - start, sizeof(Token*)), arena};
+  if (!c.copies)
+    error("out of memory");
+  walk_tree(fn, use_copy, NULL, &c);
+  free(c.copies);
+}
+
+static void evaluate(Batch* batch) {
+  Function** cur = &batch->fns;
+  Token* tok = batch->tokens;
+  while (tok->kind != TK_EOF) {
+    Token* start = tok;
+    Arena* arena = new_arena();
+    Node* fn = parse_form(&tok, tok, arena);
+    if (!fn) {
+      free_arena(arena);
+      continue;
+    }
+
+    if (fn->pure) {
+      copy_tokens(fn, start, tok, arena);
+      keep(fn, arena);
+      arena = NULL;
+    }
+    Function* f = calloc(1, sizeof(Function));
+    if (!f)
+      error("out of memory");
+    *f = (Function){NULL, fn, arena};
+    *cur = f;
+    cur = &f->next;
+  }
+  put(&evaluated, batch);
+}
+
+// Compiles the file at `path` to assembly written to `out`.
+void compile_file(char* path, FILE* out) {
+  // The parser interns the names it needs before the tokenizer starts.
+  init_parser();
+  init_queue(&tokenized, MAX_BATCHES);
+  init_queue(&evaluated, MAX_BATCHES);
+
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setstacksize(&attr, CODEGEN_STACK_SIZE);
+  pthread_t tokenizer_thread, codegen_thread;
+  if (pthread_create(&tokenizer_thread, NULL, tokenizer, path) ||
+      pthread_create(&codegen_thread, &attr, code_generator, out))
+    error("cannot start a thread");
+  pthread_attr_destroy(&attr);
+
+  Batch* batch;
+  while ((batch = take(&tokenized)))
+    evaluate(batch);
+  close_queue(&evaluated);
+  pthread_join(tokenizer_thread, NULL);
+  pthread_join(codegen_thread, NULL);
+
+  codegen_data(global_data(), out);
+
+  for (int i = 0; i < nkept; i++) {
+    Symbol* sym = name_symbol(kept[i].fn->fn);
+    if (sym->fn == kept[i].fn)
+      sym->fn = NULL;
+    free_arena(kept[i].arena);
+  }
+  nkept = 0;
+}
@@ -0,0 +1,1464 @@
+// This file generates code for -O1.
+//
+// Instead of evaluating expressions on the stack like codegen.c, a
+// function is first lowered to a list of instructions over an unbounded
+// set of virtual registers, where every intermediate value has a name.
+// Local scalars whose address is never taken become virtual registers
+// too, so reading and setting them costs no memory access.
+//
+// Virtual registers are then mapped to machine registers by linear-scan
+// allocation. The live interval of a virtual register runs from its
+// first to its last mention in the instruction list, widened to cover
+// the loops it is live around. Intervals are visited in order of their
+// start; each takes a free register and gives it back when it ends. If
+// no register is free, whichever of the competing intervals ends last
+// is spilled to a stack slot for its whole life.
+//
+// An interval that spans a call gets a callee-saved register, which the
+// prologue saves, so nothing is saved around calls; the others prefer
+// caller-saved registers. %rax, %rcx, %rdx and %r11 are never
+// allocated: they are the scratch registers of spilled operands and of
+// the instructions that need particular registers, such as division,
+// shifts and calls.
+//
+// Every operation has the width and sign extension that codegen.c gives
+// it, so a program behaves the same at either level. Like codegen.c,
+// this runs on the code generator thread of the pipeline, one function
+// at a time.
+
+#include "manda.h"
+
+typedef enum {
+  IR_NOP,
+  IR_IMM,        // dst = imm
+  IR_MOV,        // dst = a
+  IR_LEA_LOCAL,  // dst = %rbp + imm
+  IR_LEA_GLOBAL, // dst = address of name
+  IR_LOAD,       // dst = *a, imm bytes sign-extended to 64 bits
+  IR_STORE,      // *a = b, imm bytes
+  IR_COPY,       // copy imm bytes from *b to *a
+  IR_ADD,        // dst = a + b, and so on
+  IR_SUB,
+  IR_MUL,
+  IR_DIV,
+  IR_MOD,
+  IR_AND,
+  IR_OR,
+  IR_XOR,
+  IR_SHL,
+  IR_SAR,
+  IR_SHR,
+  IR_CMP,        // dst = a cc b ? 1 : 0
+  IR_ADD_IMM,    // dst = a + imm, 64 bits
+  IR_MUL_IMM,    // dst = a * imm, see strength.c
+  IR_DIV_IMM,
+  IR_MOD_IMM,
+  IR_SEXT,       // dst = a, imm bytes sign-extended to width
+  IR_NOT,        // dst = a == 0
+  IR_BITNOT,     // dst = ~a
+  IR_LABEL,      // label imm
+  IR_JMP,        // jump to label imm
+  IR_JZ,         // jump to label imm if a == 0
+  IR_JNZ,        // jump to label imm if a != 0
+  IR_JCC,        // jump to label imm if a cc b
+  IR_CALL,       // dst = name(args)
+  IR_RET,        // return a
+  IR_ENTRY,      // parameters arrive
+} IrOp;
+
+typedef struct {
+  IrOp op;
+  int dst;       // Virtual register written, -1 if none
+  int a, b;      // Virtual registers read, -1 if unused
+  int width;     // Operand width in bytes, 4 or 8
+  int64_t imm;
+  char* cc;      // IR_CMP and IR_JCC: condition code
+  char* name;    // IR_LEA_GLOBAL and IR_CALL: symbol
+  int args;      // IR_CALL: the arguments are call_args[args..args+nargs)
+  int nargs;
+  Token* tok;    // For .loc
+} Insn;
+
+typedef struct {
+  int start, end;    // Live interval, -1 if never mentioned
+  bool is_var;       // Holds a local variable
+  bool crosses_call;
+  int ndefs;
+  int nuses;
+  int def;           // Where it is written, if ndefs is 1
+  int reg;           // Machine register, or -1 if spilled
+  int offset;        // Stack slot if spilled
+} VReg;
+
+// Machine registers
+enum { RAX, RCX, RDX, RBX, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+
+static char* regs8[] = {"%al", "%cl", "%dl", "%bl", "%sil", "%dil", "%r8b",
+                        "%r9b", "%r10b", "%r11b", "%r12b", "%r13b", "%r14b", "%r15b"};
+static char* regs16[] = {"%ax", "%cx", "%dx", "%bx", "%si", "%di", "%r8w",
+                         "%r9w", "%r10w", "%r11w", "%r12w", "%r13w", "%r14w", "%r15w"};
+static char* regs32[] = {"%eax", "%ecx", "%edx", "%ebx", "%esi", "%edi", "%r8d",
+                         "%r9d", "%r10d", "%r11d", "%r12d", "%r13d", "%r14d", "%r15d"};
+static char* regs64[] = {"%rax", "%rcx", "%rdx", "%rbx", "%rsi", "%rdi", "%r8",
+                         "%r9", "%r10", "%r11", "%r12", "%r13", "%r14", "%r15"};
+
+// Allocatable registers, caller-saved first.
+static int alloc_regs[] = {RSI, RDI, R8, R9, R10, RBX, R12, R13, R14, R15};
+#define NUM_ALLOC_REGS (sizeof(alloc_regs) / sizeof(*alloc_regs))
+
+static int arg_regs[] = {RDI, RSI, RDX, RCX, R8, R9};
+
+static bool is_callee_saved(int r) {
+  return r == RBX || r >= R12;
+}
+
+// The function being compiled. Its buffers are reused by the next one.
+static Node* current_fn;
+static Insn* insns;
+static int ninsns;
+static int insns_capacity;
+static VReg* vregs;
+static int nvregs;
+static int vregs_capacity;
+static int* call_args;
+static int ncall_args;
+static int call_args_capacity;
+static int* label_pos;
+static int nlabels;
+static int labels_capacity;
+
+// Labels are numbered per function from here.
+static int label_base;
+
+static Token* cur_tok;
+
+static void* grow(void* buf, int* capacity, int n, size_t size) {
+  if (n < *capacity)
+    return buf;
+  *capacity = *capacity ? *capacity * 2 : 256;
+  buf = realloc(buf, size * *capacity);
+  if (!buf)
+    error("out of memory");
+  return buf;
+}
+
+//
+// Lowering
+//
+
+static Insn* emit(IrOp op, int dst, int a, int b) {
+  insns = grow(insns, &insns_capacity, ninsns, sizeof(Insn));
+  Insn* in = &insns[ninsns++];
+  *in = (Insn){op, dst, a, b, 8};
+  in->tok = cur_tok;
+  return in;
+}
+
+static int new_vreg(bool is_var) {
+  vregs = grow(vregs, &vregs_capacity, nvregs, sizeof(VReg));
+  vregs[nvregs] = (VReg){.is_var = is_var};
+  return nvregs++;
+}
+
+static int new_label(void) {
+  label_pos = grow(label_pos, &labels_capacity, nlabels, sizeof(int));
+  label_pos[nlabels] = -1;
+  return nlabels++;
+}
+
+static void label(int l) {
+  emit(IR_LABEL, -1, -1, -1)->imm = l;
+}
+
+static void jump(IrOp op, int a, int l) {
+  emit(op, -1, a, -1)->imm = l;
+}
+
+static int imm(int64_t val) {
+  int d = new_vreg(false);
+  emit(IR_IMM, d, -1, -1)->imm = val;
+  return d;
+}
+
+static int unary(IrOp op, int a, int width) {
+  int d = new_vreg(false);
+  emit(op, d, a, -1)->width = width;
+  return d;
+}
+
+static int binary(IrOp op, int a, int b, int width) {
+  int d = new_vreg(false);
+  emit(op, d, a, b)->width = width;
+  return d;
+}
+
+// dst = a op imm, for the operations of strength.c.
+static int binary_imm(IrOp op, int a, int64_t val, int width) {
+  int d = unary(op, a, width);
+  insns[ninsns - 1].imm = val;
+  return d;
+}
+
+static void move(int d, int a) {
+  emit(IR_MOV, d, a, -1);
+}
+
+// Sign-extends the low `size` bytes of `v` to `width` bytes.
+static int extend(int v, int size, int width) {
+  if (size == 8)
+    return v;
+  int d = new_vreg(false);
+  Insn* in = emit(IR_SEXT, d, v, -1);
+  in->imm = size;
+  in->width = width;
+  return d;
+}
+
+static int load(int addr, Type* ty) {
+  if (ty->kind == TY_ARRAY || ty->kind == TY_UNION || ty->kind == TY_STRUCT)
+    return addr;
+
+  int d = new_vreg(false);
+  emit(IR_LOAD, d, addr, -1)->imm = ty->size;
+  return d;
+}
+
+static void store(int addr, int v, Type* ty) {
+  IrOp op = (ty->kind == TY_STRUCT || ty->kind == TY_UNION) ? IR_COPY : IR_STORE;
+  emit(op, -1, addr, v)->imm = ty->size;
+}
+
+// A local variable lives in a virtual register if it is a scalar whose
+// address is never taken.
+static bool in_vreg(Node* node) {
+  return node->kind == ND_VAR && node->var->is_local && node->var->vreg >= 0;
+}
+
+// A variable holds its value as load() in codegen.c would read it.
+static void assign_var(Var* var, int v) {
+  move(var->vreg, extend(v, var->ty->size, 8));
+}
+
+static int gen_expr(Node* node);
+
+static int gen_addr(Node* node) {
+  cur_tok = node->tok;
+
+  switch (node->kind) {
+  case ND_VAR: {
+    int d = new_vreg(false);
+    if (node->var->is_local)
+      emit(IR_LEA_LOCAL, d, -1, -1)->imm = node->var->offset;
+    else
+      emit(IR_LEA_GLOBAL, d, -1, -1)->name = node->var->name;
+    return d;
+  }
+  case ND_STRUCT_REF: {
+    int d = new_vreg(false);
+    emit(IR_ADD_IMM, d, gen_addr(node->lhs), -1)->imm = node->member->offset;
+    return d;
+  }
+  }
+
+  error_tok(node->tok, "not an lvalue");
+}
+
+static int cast(int v, Type* from, Type* to) {
+  // The conversions of the cast table in codegen.c
+  int t1 = (from->kind == TY_CHAR) ? 1 : (from->kind == TY_SHORT) ? 2 :
+           (from->kind == TY_INT) ? 4 : 8;
+  int t2 = (to->kind == TY_CHAR) ? 1 : (to->kind == TY_SHORT) ? 2 :
+           (to->kind == TY_INT) ? 4 : 8;
+  if (t2 < t1 && t2 < 4)
+    return extend(v, t2, 4);
+  if (t1 < 8 && t2 == 8)
+    return extend(v, 4, 8);
+  return v;
+}
+
+// Sets the variable `lhs`, which is at `addr` unless it lives in a
+// register, to `v`. Returns `v`.
+static int assign(Node* lhs, int v, int addr) {
+  if (in_vreg(lhs))
+    assign_var(lhs->var, v);
+  else
+    store(addr, v, lhs->ty);
+  return v;
+}
+
+// Returns the address of element `index` of the array at `base`.
+static int element(int base, Node* index, Type* ty) {
+  int64_t offset;
+  if (constant_offset(index, ty, &offset)) {
+    int d = new_vreg(false);
+    emit(IR_ADD_IMM, d, base, -1)->imm = offset;
+    return d;
+  }
+  int scaled = binary_imm(IR_MUL_IMM, gen_expr(index), ty->size, 8);
+  return binary(IR_ADD, base, scaled, 8);
+}
+
+// A link of a chain being lowered, see gen_chain().
+typedef struct {
+  Node* node;
+  int rhs;        // the right operand, if evaluated before the left
+} ChainLink;
+
+static ChainLink* links;
+static int links_len;
+static int links_capacity;
+
+static void push_link(Node* node, int rhs) {
+  if (links_len == links_capacity) {
+    links_capacity = links_capacity ? links_capacity * 2 : 64;
+    links = realloc(links, sizeof(ChainLink) * links_capacity);
+    if (!links)
+      error("out of memory");
+  }
+  links[links_len++] = (ChainLink){node, rhs};
+}
+
+static char* negate_cc(char* cc) {
+  if (!strcmp(cc, "e"))
+    return "ne";
+  if (!strcmp(cc, "ne"))
+    return "e";
+  if (!strcmp(cc, "l"))
+    return "ge";
+  if (!strcmp(cc, "ge"))
+    return "l";
+  if (!strcmp(cc, "le"))
+    return "g";
+  return "le";
+}
+
+// Jumps to label `t` if `node` is true and to `f` if it is false,
+// either of which may be -1 to fall through, like gen_cond() in
+// codegen.c. A comparison becomes a compare and a conditional jump.
+static void gen_cond(Node* node, int t, int f) {
+  switch (node->kind) {
+  case ND_NOT:
+    gen_cond(node->lhs, f, t);
+    return;
+  case ND_AND:
+  case ND_OR: {
+    bool is_and = node->kind == ND_AND;
+    int out = is_and ? f : t;
+    int skip = (out >= 0) ? out : new_label();
+    int base = links_len;
+    Node* n = node;
+    for (; n->kind == node->kind; n = n->lhs)
+      push_link(n->rhs, -1);
+    for (;;) {
+      if (links_len == base) {
+        gen_cond(n, t, f);
+        break;
+      }
+      gen_cond(n, is_and ? -1 : skip, is_and ? skip : -1);
+      n = links[--links_len].node;
+    }
+    if (out < 0)
+      label(skip);
+    return;
+  }
+  case ND_EQ:
+  case ND_LT:
+  case ND_LE:
+  case ND_GT:
+  case ND_GE: {
+    int rhs = gen_expr(node->rhs);
+    int lhs = gen_expr(node->lhs);
+    cur_tok = node->tok;
+    char* cc = (node->kind == ND_EQ) ? "e" : (node->kind == ND_LT) ? "l" :
+               (node->kind == ND_LE) ? "le" : (node->kind == ND_GT) ? "g" : "ge";
+    Insn* in = emit(IR_JCC, -1, lhs, rhs);
+    in->imm = (t >= 0) ? t : f;
+    in->cc = (t >= 0) ? cc : negate_cc(cc);
+    in->width = (node->lhs->ty->kind == TY_LONG || node->lhs->ty->base) ? 8 : 4;
+    if (t >= 0 && f >= 0)
+      jump(IR_JMP, -1, f);
+    return;
+  }
+  }
+
+  int v = gen_expr(node);
+  if (t < 0) {
+    jump(IR_JZ, v, f);
+    return;
+  }
+  jump(IR_JNZ, v, t);
+  if (f >= 0)
+    jump(IR_JMP, -1, f);
+}
+
+static int gen_after_lhs(Node* node, int lhs, int rhs) {
+  cur_tok = node->tok;
+
+  switch (node->kind) {
+  case ND_AND:
+  case ND_OR: {
+    // (and a b) is 0 as soon as an operand is 0, (or a b) is 1 as soon
+    // as one is not.
+    bool is_and = node->kind == ND_AND;
+    int d = new_vreg(false);
+    int other = new_label();
+    int end = new_label();
+    int skip = new_label();
+    jump(IR_JZ, lhs, is_and ? other : skip);
+    if (!is_and) {
+      move(d, imm(1));
+      jump(IR_JMP, -1, end);
+      label(skip);
+    }
+    gen_cond(node->rhs, -1, other);
+    move(d, imm(1));
+    jump(IR_JMP, -1, end);
+    label(other);
+    move(d, imm(0));
+    label(end);
+    return d;
+  }
+  case ND_IGET:
+    return load(element(lhs, node->rhs, node->lhs->ty->base), node->lhs->ty->base);
+  }
+
+  int width = (node->lhs->ty->kind == TY_LONG || node->lhs->ty->base) ? 8 : 4;
+  char* cc = NULL;
+
+  if (can_reduce(node)) {
+    IrOp op = (node->kind == ND_MUL) ? IR_MUL_IMM : (node->kind == ND_DIV) ? IR_DIV_IMM : IR_MOD_IMM;
+    return binary_imm(op, lhs, node->rhs->val, width);
+  }
+
+  switch (node->kind) {
+  case ND_ADD:
+    return binary(IR_ADD, lhs, rhs, width);
+  case ND_SUB:
+    return binary(IR_SUB, lhs, rhs, width);
+  case ND_MUL:
+    return binary(IR_MUL, lhs, rhs, width);
+  case ND_DIV:
+    return binary(IR_DIV, lhs, rhs, node->lhs->ty->size == 8 ? 8 : 4);
+  case ND_MOD:
+    return binary(IR_MOD, lhs, rhs, node->lhs->ty->size == 8 ? 8 : 4);
+  case ND_BITAND:
+    return binary(IR_AND, lhs, rhs, width);
+  case ND_BITOR:
+    return binary(IR_OR, lhs, rhs, width);
+  case ND_BITXOR:
+    return binary(IR_XOR, lhs, rhs, width);
+  case ND_SRA:
+    return binary(IR_SAR, lhs, rhs, 8);
+  case ND_SRL:
+    return binary(IR_SHR, lhs, rhs, 8);
+  case ND_SLL:
+    return binary(IR_SHL, lhs, rhs, 8);
+  case ND_EQ: cc = "e"; break;
+  case ND_LT: cc = "l"; break;
+  case ND_LE: cc = "le"; break;
+  case ND_GE: cc = "ge"; break;
+  case ND_GT: cc = "g"; break;
+  }
+
+  if (cc) {
+    int d = binary(IR_CMP, lhs, rhs, width);
+    insns[ninsns - 1].cc = cc;
+    return d;
+  }
+
+  error("invalid expression");
+}
+
+// Lowers a chain of operators down its left operands without recursing,
+// like gen_chain() in codegen.c. The right operands are evaluated first,
+// except those of `and`, `or` and `iget`.
+static int gen_chain(Node* node) {
+  int base = links_len;
+  for (; is_chain(node); node = node->lhs) {
+    int rhs = -1;
+    if (node->kind != ND_AND && node->kind != ND_OR && node->kind != ND_IGET &&
+        !can_reduce(node))
+      rhs = gen_expr(node->rhs);
+    push_link(node, rhs);
+  }
+
+  int v = gen_expr(node);
+  while (links_len > base) {
+    ChainLink link = links[--links_len];
+    v = gen_after_lhs(link.node, v, link.rhs);
+  }
+  return v;
+}
+
+static int gen_body(Node* body) {
+  int v = -1;
+  for (Node* n = body; n; n = n->next)
+    v = gen_expr(n);
+  return v >= 0 ? v : imm(0);
+}
+
+static int gen_expr(Node* node) {
+  if (is_chain(node))
+    return gen_chain(node);
+
+  cur_tok = node->tok;
+
+  switch (node->kind) {
+  case ND_DEFSTRUCT:
+  case ND_DEFUNION:
+  case ND_DEFTYPE:
+  case ND_DEFMACRO:
+    return imm(0);
+  case ND_LET:
+    if (!node->rhs)
+      return imm(0);
+    // fallthrough
+  case ND_SET: {
+    int addr = in_vreg(node->lhs) ? -1 : gen_addr(node->lhs);
+    return assign(node->lhs, gen_expr(node->rhs), addr);
+  }
+  case ND_NUM:
+    return imm(node->val);
+  case ND_VAR:
+    if (in_vreg(node)) {
+      int d = new_vreg(false);
+      move(d, node->var->vreg);
+      return d;
+    }
+    return load(gen_addr(node), node->ty);
+  case ND_STRUCT_REF:
+    return load(gen_addr(node), node->ty);
+  case ND_IF: {
+    int d = new_vreg(false);
+    int els = new_label();
+    int end = new_label();
+    gen_cond(node->cond, -1, els);
+    move(d, gen_expr(node->then));
+    jump(IR_JMP, -1, end);
+    label(els);
+    move(d, node->els ? gen_expr(node->els) : imm(0));
+    label(end);
+    return d;
+  }
+  case ND_DO:
+    return gen_body(node->body);
+  case ND_WHILE: {
+    int begin = new_label();
+    int end = new_label();
+    label(begin);
+    if (node->cond->kind != ND_NUM || node->cond->val == 0)
+      gen_cond(node->cond, -1, end);
+    for (Node* n = node->then; n; n = n->next)
+      gen_expr(n);
+    jump(IR_JMP, -1, begin);
+    label(end);
+    return imm(0);
+  }
+  case ND_APP: {
+    int nargs = 0;
+    for (Node* arg = node->args; arg; arg = arg->next)
+      nargs++;
+
+    int args[6];
+    int i = 0;
+    for (Node* arg = node->args; arg; arg = arg->next)
+      args[i++] = gen_expr(arg);
+
+    call_args = grow(call_args, &call_args_capacity, ncall_args + nargs, sizeof(int));
+    int d = new_vreg(false);
+    cur_tok = node->tok;
+    Insn* in = emit(IR_CALL, d, -1, -1);
+    in->name = node->fn;
+    in->args = ncall_args;
+    in->nargs = nargs;
+    for (i = 0; i < nargs; i++)
+      call_args[ncall_args++] = args[i];
+    return d;
+  }
+  case ND_DEREF:
+    return load(gen_expr(node->lhs), node->ty);
+  case ND_ADDR:
+    return gen_addr(node->lhs);
+  case ND_CAST:
+    return cast(gen_expr(node->lhs), node->lhs->ty, node->ty);
+  case ND_NOT:
+    return unary(IR_NOT, gen_expr(node->lhs), 8);
+  case ND_BITNOT:
+    return unary(IR_BITNOT, gen_expr(node->lhs), 8);
+  case ND_ISET: {
+    int base = gen_expr(node->lhs);
+    int addr = element(base, node->mhs, node->lhs->ty->base);
+    int v = gen_expr(node->rhs);
+    store(addr, v, node->lhs->ty->base);
+    return v;
+  }
+  }
+
+  error("invalid expression");
+}
+
+//
+// Finding the variables that can live in registers
+//
+
+// Marks the variables whose address is taken in `node`.
+static void mark_addr_taken(Node* node) {
+  for (; node && is_chain(node); node = node->lhs)
+    mark_addr_taken(node->rhs);
+  if (!node)
+    return;
+
+  switch (node->kind) {
+  case ND_NUM:
+  case ND_BOOL:
+  case ND_STR:
+  case ND_VAR:
+  case ND_ARRAY_LITERAL:
+  case ND_DEFSTRUCT:
+  case ND_DEFUNION:
+  case ND_DEFTYPE:
+  case ND_DEFMACRO:
+    return;
+  case ND_ADDR: {
+    Node* n = node->lhs;
+    while (n->kind == ND_STRUCT_REF)
+      n = n->lhs;
+    if (n->kind == ND_VAR)
+      n->var->vreg = -1;
+    mark_addr_taken(node->lhs);
+    return;
+  }
+  case ND_IF:
+    mark_addr_taken(node->cond);
+    mark_addr_taken(node->then);
+    mark_addr_taken(node->els);
+    return;
+  case ND_WHILE:
+    mark_addr_taken(node->cond);
+    for (Node* n = node->then; n; n = n->next)
+      mark_addr_taken(n);
+    return;
+  case ND_DO:
+    for (Node* n = node->body; n; n = n->next)
+      mark_addr_taken(n);
+    return;
+  case ND_APP:
+    for (Node* n = node->args; n; n = n->next)
+      mark_addr_taken(n);
+    return;
+  case ND_DEREF:
+  case ND_NOT:
+  case ND_BITNOT:
+  case ND_CAST:
+  case ND_STRUCT_REF:
+    mark_addr_taken(node->lhs);
+    return;
+  case ND_ISET:
+    mark_addr_taken(node->mhs);
+    // fallthrough
+  default:
+    mark_addr_taken(node->lhs);
+    mark_addr_taken(node->rhs);
+  }
+}
+
+// Gives the local scalars whose address is not taken virtual registers
+// and the others stack slots. Returns the size of the slots.
+static int assign_vars(Node* fn) {
+  for (Var* var = fn->locals; var; var = var->next)
+    var->vreg = 0;
+  for (Node* n = fn->body; n; n = n->next)
+    mark_addr_taken(n);
+
+  int offset = 0;
+  for (Var* var = fn->locals; var; var = var->next) {
+    TypeKind k = var->ty->kind;
+    if (var->vreg == 0 && k != TY_ARRAY && k != TY_STRUCT && k != TY_UNION) {
+      var->vreg = new_vreg(true);
+      continue;
+    }
+
+    var->vreg = -1;
+    offset += var->ty->size;
+    offset = align_to(offset, var->ty->align);
+    var->offset = -offset;
+  }
+  return offset;
+}
+
+//
+// Cleaning up
+//
+
+// Calls `f` on each virtual register read by `in`.
+#define FOR_EACH_USE(in, v, body)                            \
+  do {                                                       \
+    int* uses_[2] = {&(in)->a, &(in)->b};                    \
+    for (int i_ = 0; i_ < 2; i_++)                           \
+      if (*uses_[i_] >= 0) { int* v = uses_[i_]; body; }     \
+    if ((in)->op == IR_CALL)                                 \
+      for (int i_ = 0; i_ < (in)->nargs; i_++) {             \
+        int* v = &call_args[(in)->args + i_]; body;          \
+      }                                                      \
+  } while (0)
+
+static void count_uses(void) {
+  for (int i = 0; i < nvregs; i++) {
+    vregs[i].ndefs = vregs[i].nuses = 0;
+    vregs[i].def = -1;
+  }
+
+  for (int i = 0; i < ninsns; i++) {
+    Insn* in = &insns[i];
+    if (in->dst >= 0) {
+      vregs[in->dst].ndefs++;
+      vregs[in->dst].def = i;
+    }
+    FOR_EACH_USE(in, v, vregs[*v].nuses++);
+  }
+}
+
+// Position of the first element of `pos[0..n)`, which is sorted, that
+// is greater than `x`, or n.
+static int upper_bound(int* pos, int n, int x) {
+  int lo = 0, hi = n;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (pos[mid] <= x)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+// Removes the copies that reading and writing variables leave behind.
+//
+// `t = op ...; x = t` becomes `x = op ...` when t is used nowhere else,
+// and `t = x` is dropped in favor of x itself when x is not written
+// before t's last use.
+static void coalesce(void) {
+  count_uses();
+
+  for (int i = 1; i < ninsns; i++) {
+    Insn* in = &insns[i];
+    if (in->op != IR_MOV || !vregs[in->dst].is_var)
+      continue;
+    VReg* t = &vregs[in->a];
+    if (t->is_var || t->ndefs != 1 || t->nuses != 1 || t->def != i - 1)
+      continue;
+    insns[i - 1].dst = in->dst;
+    in->op = IR_NOP;
+    in->dst = in->a = -1;
+  }
+
+  // Where each variable is written, in order
+  int* start = calloc(nvregs + 1, sizeof(int));
+  int* last_use = malloc(nvregs * sizeof(int));
+  for (int i = 0; i < ninsns; i++) {
+    Insn* in = &insns[i];
+    if (in->dst >= 0 && vregs[in->dst].is_var)
+      start[in->dst + 1]++;
+    FOR_EACH_USE(in, v, last_use[*v] = i);
+  }
+  for (int i = 0; i < nvregs; i++)
+    start[i + 1] += start[i];
+  int* defs = malloc((start[nvregs] + 1) * sizeof(int));
+  int* fill = malloc(nvregs * sizeof(int));
+  memcpy(fill, start, nvregs * sizeof(int));
+  for (int i = 0; i < ninsns; i++) {
+    int d = insns[i].dst;
+    if (d >= 0 && vregs[d].is_var)
+      defs[fill[d]++] = i;
+  }
+
+  count_uses();
+  int* alias = malloc(nvregs * sizeof(int));
+  for (int i = 0; i < nvregs; i++)
+    alias[i] = i;
+
+  for (int i = 0; i < ninsns; i++) {
+    Insn* in = &insns[i];
+    if (in->op != IR_MOV || vregs[in->dst].is_var || !vregs[in->a].is_var)
+      continue;
+    int t = in->dst, x = in->a;
+    if (vregs[t].ndefs != 1 || vregs[t].nuses == 0)
+      continue;
+
+    // x must not change before t is last read. The instruction that
+    // reads t last may write x, as it reads before it writes.
+    int n = start[x + 1] - start[x];
+    int j = upper_bound(defs + start[x], n, i);
+    if (j < n && defs[start[x] + j] < last_use[t])
+      continue;
+
+    alias[t] = x;
+    in->op = IR_NOP;
+    in->dst = in->a = -1;
+  }
+
+  for (int i = 0; i < ninsns; i++)
+    FOR_EACH_USE(&insns[i], v, *v = alias[*v]);
+
+  free(start);
+  free(last_use);
+  free(defs);
+  free(fill);
+  free(alias);
+}
+
+static bool has_side_effect(Insn* in) {
+  switch (in->op) {
+  case IR_IMM:
+  case IR_MOV:
+  case IR_LEA_LOCAL:
+  case IR_LEA_GLOBAL:
+  case IR_LOAD:
+  case IR_ADD:
+  case IR_SUB:
+  case IR_MUL:
+  case IR_AND:
+  case IR_OR:
+  case IR_XOR:
+  case IR_SHL:
+  case IR_SAR:
+  case IR_SHR:
+  case IR_CMP:
+  case IR_ADD_IMM:
+  case IR_MUL_IMM:
+  case IR_DIV_IMM:
+  case IR_MOD_IMM:
+  case IR_SEXT:
+  case IR_NOT:
+  case IR_BITNOT:
+    return false;
+  }
+  return true;
+}
+
+// Removes the instructions whose results are never read, such as the
+// values of expression statements.
+static void remove_dead_code(void) {
+  count_uses();
+  for (int i = ninsns - 1; i >= 0; i--) {
+    Insn* in = &insns[i];
+    if (in->op == IR_NOP || has_side_effect(in) || vregs[in->dst].nuses > 0)
+      continue;
+    FOR_EACH_USE(in, v, vregs[*v].nuses--);
+    in->op = IR_NOP;
+    in->dst = in->a = in->b = -1;
+  }
+}
+
+//
+// Register allocation
+//
+
+static bool is_jump(Insn* in) {
+  return in->op == IR_JMP || in->op == IR_JZ || in->op == IR_JNZ || in->op == IR_JCC;
+}
+
+static void touch(int v, int i) {
+  if (vregs[v].start < 0)
+    vregs[v].start = i;
+  vregs[v].end = i;
+}
+
+static void compute_intervals(void) {
+  for (int i = 0; i < nvregs; i++) {
+    vregs[i].start = vregs[i].end = -1;
+    vregs[i].crosses_call = false;
+  }
+
+  for (int i = 0; i < ninsns; i++) {
+    Insn* in = &insns[i];
+    if (in->op == IR_LABEL)
+      label_pos[in->imm] = i;
+    if (in->op == IR_ENTRY)
+      for (Node* arg = current_fn->args; arg; arg = arg->next)
+        if (arg->var->vreg >= 0)
+          touch(arg->var->vreg, i);
+    if (in->dst >= 0)
+      touch(in->dst, i);
+    FOR_EACH_USE(in, v, touch(*v, i));
+  }
+
+  // A backward jump closes a loop. A variable mentioned in a loop may
+  // carry its value around it, so it is live throughout the loop. A
+  // value made before a loop and used in it lives to the loop's end.
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (int t = 0; t < ninsns; t++) {
+      if (!is_jump(&insns[t]))
+        continue;
+      int h = label_pos[insns[t].imm];
+      if (h < 0 || h > t)
+        continue;
+
+      for (int i = 0; i < nvregs; i++) {
+        VReg* vr = &vregs[i];
+        if (vr->start < 0 || vr->end < h || vr->start > t)
+          continue;
+        if (vr->is_var && (vr->start > h || vr->end < t)) {
+          if (vr->start > h)
+            vr->start = h;
+          if (vr->end < t)
+            vr->end = t;
+          changed = true;
+        } else if (vr->start < h && vr->end < t) {
+          vr->end = t;
+          changed = true;
+        }
+      }
+    }
+  }
+
+  // Mark the intervals that a call falls strictly inside of.
+  int* calls = malloc((ninsns + 1) * sizeof(int));
+  int ncalls = 0;
+  for (int i = 0; i < ninsns; i++)
+    if (insns[i].op == IR_CALL)
+      calls[ncalls++] = i;
+  for (int i = 0; i < nvregs; i++) {
+    VReg* vr = &vregs[i];
+    if (vr->start < 0)
+      continue;
+    int j = upper_bound(calls, ncalls, vr->start);
+    vr->crosses_call = j < ncalls && calls[j] < vr->end;
+  }
+  free(calls);
+}
+
+static int by_start(const void* x, const void* y) {
+  int a = *(int *)x, b = *(int *)y;
+  if (vregs[a].start != vregs[b].start)
+    return vregs[a].start - vregs[b].start;
+  return a - b;
+}
+
+static void linear_scan(void) {
+  int* order = malloc(nvregs * sizeof(int));
+  int n = 0;
+  for (int i = 0; i < nvregs; i++) {
+    vregs[i].reg = -1;
+    if (vregs[i].start >= 0)
+      order[n++] = i;
+  }
+  qsort(order, n, sizeof(int), by_start);
+
+  int active[NUM_ALLOC_REGS];
+  int nactive = 0;
+  bool used[R15 + 1] = {};
+
+  for (int k = 0; k < n; k++) {
+    VReg* cur = &vregs[order[k]];
+
+    // Free the registers of the intervals that have ended.
+    for (int j = 0; j < nactive; j++) {
+      if (vregs[active[j]].end < cur->start) {
+        used[vregs[active[j]].reg] = false;
+        active[j--] = active[--nactive];
+      }
+    }
+
+    for (int j = 0; j < NUM_ALLOC_REGS; j++) {
+      int r = alloc_regs[j];
+      if (!used[r] && (!cur->crosses_call || is_callee_saved(r))) {
+        cur->reg = r;
+        break;
+      }
+    }
+
+    if (cur->reg < 0) {
+      // Spill the interval that ends last, either the current one or
+      // an active one whose register it can take.
+      int victim = -1;
+      for (int j = 0; j < nactive; j++) {
+        VReg* vr = &vregs[active[j]];
+        if (cur->crosses_call && !is_callee_saved(vr->reg))
+          continue;
+        if (vr->end > cur->end && (victim < 0 || vr->end > vregs[active[victim]].end))
+          victim = j;
+      }
+      if (victim < 0)
+        continue;
+      cur->reg = vregs[active[victim]].reg;
+      vregs[active[victim]].reg = -1;
+      active[victim] = active[--nactive];
+    }
+
+    used[cur->reg] = true;
+    active[nactive++] = cur - vregs;
+  }
+  free(order);
+}
+
+//
+// Emission
+//
+
+static char* reg(int r, int size) {
+  switch (size) {
+  case 1: return regs8[r];
+  case 2: return regs16[r];
+  case 4: return regs32[r];
+  }
+  return regs64[r];
+}
+
+// Returns `v` as an operand: its register or its stack slot.
+static char* operand(int v, int size) {
+  if (vregs[v].reg >= 0)
+    return reg(vregs[v].reg, size);
+
+  static char buf[4][32];
+  static int i;
+  char* p = buf[i++ % 4];
+  sprintf(p, "%d(%%rbp)", vregs[v].offset);
+  return p;
+}
+
+// Returns a register holding `v`, loading it into `scratch` if `v` is
+// spilled.
+static int use_reg(int v, int scratch) {
+  if (vregs[v].reg >= 0)
+    return vregs[v].reg;
+  println("  mov %d(%%rbp), %s", vregs[v].offset, regs64[scratch]);
+  return scratch;
+}
+
+// Returns the register to compute `v` into.
+static int def_reg(int v, int scratch) {
+  return vregs[v].reg >= 0 ? vregs[v].reg : scratch;
+}
+
+// Stores `v`, computed into `r`, if it is spilled.
+static void write_back(int v, int r) {
+  if (vregs[v].reg < 0)
+    println("  mov %s, %d(%%rbp)", regs64[r], vregs[v].offset);
+}
+
+static void emit_label(int l) {
+  println(".L.%d:", label_base + l);
+}
+
+typedef struct {
+  int reg;      // -1 if in memory
+  int offset;
+} Loc;
+
+static Loc loc_of(int v) {
+  return (Loc){vregs[v].reg, vregs[v].offset};
+}
+
+static void move_loc(Loc from, Loc to) {
+  if (from.reg >= 0 && to.reg >= 0) {
+    if (from.reg != to.reg)
+      println("  mov %s, %s", regs64[from.reg], regs64[to.reg]);
+  } else if (from.reg >= 0) {
+    println("  mov %s, %d(%%rbp)", regs64[from.reg], to.offset);
+  } else if (to.reg >= 0) {
+    println("  mov %d(%%rbp), %s", from.offset, regs64[to.reg]);
+  } else if (from.offset != to.offset) {
+    println("  mov %d(%%rbp), %%r11", from.offset);
+    println("  mov %%r11, %d(%%rbp)", to.offset);
+  }
+}
+
+// Performs the moves `from[i]` to `to[i]` as if all at once. The
+// destinations are distinct.
+static void parallel_move(Loc* from, Loc* to, int n) {
+  bool done[8] = {};
+
+  // Stores first, while every source register still holds its value.
+  for (int i = 0; i < n; i++) {
+    if (to[i].reg < 0) {
+      move_loc(from[i], to[i]);
+      done[i] = true;
+    }
+  }
+
+  // Then register moves, in an order that reads each register before
+  // it is overwritten. A cycle is broken by moving one of its
+  // registers aside to %r11.
+  for (;;) {
+    int pending = 0;
+    bool progress = false;
+    for (int i = 0; i < n; i++) {
+      if (done[i] || from[i].reg < 0)
+        continue;
+      pending++;
+
+      bool blocked = false;
+      for (int j = 0; j < n; j++)
+        if (j != i && !done[j] && from[j].reg == to[i].reg)
+          blocked = true;
+      if (blocked && from[i].reg != to[i].reg)
+        continue;
+
+      move_loc(from[i], to[i]);
+      done[i] = true;
+      progress = true;
+    }
+    if (!pending)
+      break;
+    if (progress)
+      continue;
+
+    for (int i = 0; i < n; i++) {
+      if (!done[i] && from[i].reg >= 0) {
+        int r = to[i].reg;
+        println("  mov %s, %%r11", regs64[r]);
+        for (int j = 0; j < n; j++)
+          if (!done[j] && from[j].reg == r)
+            from[j].reg = R11;
+        break;
+      }
+    }
+  }
+
+  // Loads last, as their destinations may have been sources.
+  for (int i = 0; i < n; i++)
+    if (!done[i])
+      move_loc(from[i], to[i]);
+}
+
+static void emit_entry(void) {
+  Loc from[6], to[6];
+  int n = 0;
+  int i = 0;
+
+  for (Node* arg = current_fn->args; arg; arg = arg->next, i++) {
+    Var* var = arg->var;
+    if (var->vreg < 0) {
+      int size = var->ty->size;
+      println("  mov %s, %d(%%rbp)", reg(arg_regs[i], size), var->offset);
+      continue;
+    }
+    if (vregs[var->vreg].start < 0)
+      continue;
+    from[n] = (Loc){arg_regs[i]};
+    to[n] = loc_of(var->vreg);
+    n++;
+  }
+  parallel_move(from, to, n);
+}
+
+static void emit_call(Insn* in) {
+  Loc from[6], to[6];
+  for (int i = 0; i < in->nargs; i++) {
+    from[i] = loc_of(call_args[in->args + i]);
+    to[i] = (Loc){arg_regs[i]};
+  }
+  parallel_move(from, to, in->nargs);
+
+  println("  mov $0, %%rax");
+  println("  call %s", in->name);
+  if (vregs[in->dst].start >= 0)
+    move_loc((Loc){RAX}, loc_of(in->dst));
+}
+
+// dst = a op b. The operation reads its destination, so it is computed
+// in %rax if the destination is b's register or memory.
+static void emit_binary(Insn* in, char* op, bool commutative) {
+  int w = in->width;
+  int d = vregs[in->dst].reg;
+  int b = vregs[in->b].reg;
+
+  if (d >= 0 && d == b && commutative) {
+    println("  %s %s, %s", op, operand(in->a, w), reg(d, w));
+    return;
+  }
+
+  if (d >= 0 && (d != b || in->a == in->b)) {
+    if (vregs[in->a].reg != d)
+      println("  mov %s, %s", operand(in->a, w), reg(d, w));
+    println("  %s %s, %s", op, operand(in->b, w), reg(d, w));
+    return;
+  }
+
+  println("  mov %s, %s", operand(in->a, w), reg(RAX, w));
+  println("  %s %s, %s", op, operand(in->b, w), reg(RAX, w));
+  move_loc((Loc){RAX}, loc_of(in->dst));
+}
+
+static char* sext_op(int from, int to) {
+  if (from == 1)
+    return to == 4 ? "movsbl" : "movsbq";
+  if (from == 2)
+    return to == 4 ? "movswl" : "movswq";
+  return "movslq";
+}
+
+static void emit_insn(Insn* in) {
+  int w = in->width;
+
+  switch (in->op) {
+  case IR_NOP:
+  case IR_ENTRY:
+    return;
+  case IR_IMM: {
+    int d = def_reg(in->dst, RAX);
+    println("  mov $%ld, %s", in->imm, regs64[d]);
+    write_back(in->dst, d);
+    return;
+  }
+  case IR_MOV:
+    move_loc(loc_of(in->a), loc_of(in->dst));
+    return;
+  case IR_LEA_LOCAL: {
+    int d = def_reg(in->dst, RAX);
+    println("  lea %ld(%%rbp), %s", in->imm, regs64[d]);
+    write_back(in->dst, d);
+    return;
+  }
+  case IR_LEA_GLOBAL: {
+    int d = def_reg(in->dst, RAX);
+    println("  lea %s(%%rip), %s", in->name, regs64[d]);
+    write_back(in->dst, d);
+    return;
+  }
+  case IR_LOAD: {
+    int a = use_reg(in->a, R11);
+    int d = def_reg(in->dst, RAX);
+    if (in->imm == 8)
+      println("  mov (%s), %s", regs64[a], regs64[d]);
+    else
+      println("  %s (%s), %s", sext_op(in->imm, w), regs64[a], reg(d, w));
+    write_back(in->dst, d);
+    return;
+  }
+  case IR_STORE: {
+    int a = use_reg(in->a, R11);
+    int b = use_reg(in->b, RAX);
+    println("  mov %s, (%s)", reg(b, in->imm), regs64[a]);
+    return;
+  }
+  case IR_COPY: {
+    int a = use_reg(in->a, R11);
+    int b = use_reg(in->b, RAX);
+    int i = 0;
+    for (; i + 8 <= in->imm; i += 8) {
+      println("  mov %d(%s), %%rdx", i, regs64[b]);
+      println("  mov %%rdx, %d(%s)", i, regs64[a]);
+    }
+    for (; i < in->imm; i++) {
+      println("  mov %d(%s), %%dl", i, regs64[b]);
+      println("  mov %%dl, %d(%s)", i, regs64[a]);
+    }
+    return;
+  }
+  case IR_ADD:
+    emit_binary(in, "add", true);
+    return;
+  case IR_SUB:
+    emit_binary(in, "sub", false);
+    return;
+  case IR_MUL:
+    emit_binary(in, "imul", true);
+    return;
+  case IR_AND:
+    emit_binary(in, "and", true);
+    return;
+  case IR_OR:
+    emit_binary(in, "or", true);
+    return;
+  case IR_XOR:
+    emit_binary(in, "xor", true);
+    return;
+  case IR_DIV:
+  case IR_MOD: {
+    println("  mov %s, %s", operand(in->a, w), reg(RAX, w));
+    int b = use_reg(in->b, R11);
+    println(w == 8 ? "  cqo" : "  cdq");
+    println("  idiv %s", reg(b, w));
+    move_loc((Loc){in->op == IR_DIV ? RAX : RDX}, loc_of(in->dst));
+    return;
+  }
+  case IR_MUL_IMM: {
+    int d = def_reg(in->dst, RAX);
+    if (vregs[in->a].reg != d)
+      println("  mov %s, %s", operand(in->a, 8), regs64[d]);
+    gen_mul_imm(in->imm, w, regs64[d]);
+    write_back(in->dst, d);
+    return;
+  }
+  case IR_DIV_IMM:
+  case IR_MOD_IMM:
+    println("  mov %s, %s", operand(in->a, w), reg(RAX, w));
+    gen_div_imm(in->imm, w, in->op == IR_MOD_IMM);
+    move_loc((Loc){RAX}, loc_of(in->dst));
+    return;
+  case IR_SHL:
+  case IR_SAR:
+  case IR_SHR: {
+    char* op = (in->op == IR_SHL) ? "shl" : (in->op == IR_SAR) ? "sar" : "shr";
+    println("  mov %s, %%rcx", operand(in->b, 8));
+    int d = def_reg(in->dst, RAX);
+    if (vregs[in->a].reg != d)
+      println("  mov %s, %s", operand(in->a, 8), regs64[d]);
+    println("  %s %%cl, %s", op, reg(d, w));
+    write_back(in->dst, d);
+    return;
+  }
+  case IR_CMP: {
+    int a = use_reg(in->a, RAX);
+    println("  cmp %s, %s", operand(in->b, w), reg(a, w));
+    int d = def_reg(in->dst, RAX);
+    println("  set%s %s", in->cc, reg(d, 1));
+    println("  movzb %s, %s", reg(d, 1), regs64[d]);
+    write_back(in->dst, d);
+    return;
+  }
+  case IR_ADD_IMM: {
+    int a = use_reg(in->a, RAX);
+    int d = def_reg(in->dst, RAX);
+    println("  lea %ld(%s), %s", in->imm, regs64[a], regs64[d]);
+    write_back(in->dst, d);
+    return;
+  }
+  case IR_SEXT: {
+    int a = use_reg(in->a, RAX);
+    int d = def_reg(in->dst, RAX);
+    println("  %s %s, %s", sext_op(in->imm, w), reg(a, in->imm), reg(d, w));
+    write_back(in->dst, d);
+    return;
+  }
+  case IR_NOT: {
+    int a = use_reg(in->a, RAX);
+    println("  cmp $0, %s", reg(a, w));
+    println("  sete %%al");
+    int d = def_reg(in->dst, RAX);
+    println("  movzb %%al, %s", regs64[d]);
+    write_back(in->dst, d);
+    return;
+  }
+  case IR_BITNOT: {
+    int d = def_reg(in->dst, RAX);
+    if (vregs[in->a].reg != d)
+      println("  mov %s, %s", operand(in->a, 8), regs64[d]);
+    println("  not %s", regs64[d]);
+    write_back(in->dst, d);
+    return;
+  }
+  case IR_LABEL:
+    emit_label(in->imm);
+    return;
+  case IR_JMP:
+    println("  jmp .L.%ld", label_base + in->imm);
+    return;
+  case IR_JZ:
+  case IR_JNZ: {
+    int a = use_reg(in->a, RAX);
+    println("  cmp $0, %s", regs64[a]);
+    println("  j%s .L.%ld", in->op == IR_JZ ? "e" : "ne", label_base + in->imm);
+    return;
+  }
+  case IR_JCC: {
+    int a = use_reg(in->a, RAX);
+    println("  cmp %s, %s", operand(in->b, w), reg(a, w));
+    println("  j%s .L.%ld", in->cc, label_base + in->imm);
+    return;
+  }
+  case IR_CALL:
+    emit_call(in);
+    return;
+  case IR_RET:
+    println("  mov %s, %%rax", operand(in->a, 8));
+    println("  jmp .L.return.%s", current_fn->fn);
+    return;
+  }
+  unreachable();
+}
+
+// The token of the last .loc directive
+static Token* last_loc;
+
+static void emit_loc(Token* tok) {
+  if (!tok || tok == last_loc)
+    return;
+  last_loc = tok;
+  println(" .loc 1 %d %d", tok->line_no, tok->col_no);
+}
+
+void codegen_function_o1(Node* fn) {
+  current_fn = fn;
+  ninsns = nvregs = ncall_args = nlabels = 0;
+
+  int locals_size = assign_vars(fn);
+
+  cur_tok = last_loc = NULL;
+
+  // The parameters held in registers arrive at IR_ENTRY. Like those
+  // stored and reloaded at -O0, they are then sign-extended from their
+  // size.
+  emit(IR_ENTRY, -1, -1, -1);
+  for (Node* arg = fn->args; arg; arg = arg->next) {
+    Var* var = arg->var;
+    if (var->vreg < 0)
+      continue;
+    int v = extend(var->vreg, var->ty->size, 8);
+    if (v != var->vreg)
+      move(var->vreg, v);
+  }
+  emit(IR_RET, -1, gen_body(fn->body), -1);
+
+  coalesce();
+  remove_dead_code();
+  compute_intervals();
+  linear_scan();
+
+  // Frame: locals in memory, then spill slots, then the callee-saved
+  // registers in use.
+  int offset = locals_size;
+  for (int i = 0; i < nvregs; i++) {
+    if (vregs[i].start >= 0 && vregs[i].reg < 0) {
+      offset = align_to(offset + 8, 8);
+      vregs[i].offset = -offset;
+    }
+  }
+
+  bool saved[R15 + 1] = {0};
+  int save_offset[R15 + 1];
+  for (int i = 0; i < nvregs; i++) {
+    int r = vregs[i].reg;
+    if (vregs[i].start >= 0 && r >= 0 && is_callee_saved(r) && !saved[r]) {
+      saved[r] = true;
+      offset = align_to(offset + 8, 8);
+      save_offset[r] = -offset;
+    }
+  }
+  fn->stack_size = align_to(offset, 16);
+
+  println("  .globl %s", fn->fn);
+  println("  .text");
+  println("%s:", fn->fn);
+
+  // Prologue
+  println("  push %%rbp");
+  println("  mov %%rsp, %%rbp");
+  println("  sub $%d, %%rsp", fn->stack_size);
+  for (int r = 0; r <= R15; r++)
+    if (saved[r])
+      println("  mov %s, %d(%%rbp)", regs64[r], save_offset[r]);
+  emit_entry();
+
+  for (int i = 0; i < ninsns; i++) {
+    if (insns[i].op == IR_NOP)
+      continue;
+    emit_loc(insns[i].tok);
+    emit_insn(&insns[i]);
+  }
+
+  // Epilogue
+  println(".L.return.%s:", fn->fn);
+  for (int r = 0; r <= R15; r++)
+    if (saved[r])
+      println("  mov %d(%%rbp), %s", save_offset[r], regs64[r]);
+  println("  mov %%rbp, %%rsp");
+  println("  pop %%rbp");
+  println("  ret");
+
+  label_base += nlabels;
+}
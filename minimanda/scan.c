@@ -0,0 +1,49 @@
+// This file contains the scanners the tokenizer uses to skip over long
+// runs of bytes: whitespace, identifier bodies, comments and the bodies
+// of string literals.
+//
+// Each scanner returns a pointer to the first byte that is not part of
+// the run. '\0' never belongs to a run, so a scanner always stops at the
+// end of the input.
+
+#include "manda.h"
+
+// Returns true if c is valid as the first character of an identifier.
+bool is_ident1(char c) {
+  return ('a' <= c && c <= 'z') || ('A' <= c && c <= 'Z') || c == '_' || c == '-'
+      || c == '+' || c == '<' || c == '>' || c == '%' || c == '$';
+}
+
+// Returns true if c is valid as a non-first character of an identifier.
+bool is_ident2(char c) {
+  return is_ident1(c) || ('0' <= c && c <= '9') || c == '/' || c == '?'
+      || c == '!' || c == '^' || c == '=';
+}
+
+// Skips whitespace characters.
+char *skip_space(char *p) {
+  while (isspace(*p))
+    p++;
+  return p;
+}
+
+// Skips the rest of an identifier.
+char *skip_ident(char *p) {
+  while (is_ident2(*p))
+    p++;
+  return p;
+}
+
+// Skips to the end of the line, i.e. to the next '\n'.
+char *skip_line(char *p) {
+  while (*p && *p != '\n')
+    p++;
+  return p;
+}
+
+// Skips to the next '"' or '\\' in a string literal.
+char *skip_str(char *p) {
+  while (*p && *p != '"' && *p != '\\')
+    p++;
+  return p;
+}
@@ -0,0 +1,227 @@
+// This file generates multiplications, divisions and remainders by a
+// constant without imul and idiv where cheaper instructions will do.
+// Both code generators use it, for (* x c), (/ x d) and (mod x d) and
+// to scale the index of iget and iset.
+//
+// x*c becomes a shift if c is a power of two, and an lea and a shift
+// if c is 3, 5 or 9 times one; a negative c negates the result. Other
+// constants are multiplied as immediates.
+//
+// Division truncates toward zero but an arithmetic shift rounds down,
+// so x/2^k adds 2^k-1 to a negative x before shifting. x/d for any
+// other d multiplies x by a magic number close to 2^(w+s)/d, shifts
+// the high half of the product right by s and adds one if the result
+// is negative (Hacker's Delight, chapter 10). x%d is x - x/d*d, or for
+// a power of two, x minus x rounded toward zero to a multiple of it.
+//
+// The results are those of imul and idiv, down to the upper half of a
+// 32-bit result being zero. Division by 0 and by -1 is left to idiv,
+// so that x/0 and the most negative x divided by -1 still trap.
+
+#include "manda.h"
+
+static bool is_wide(Type* ty) {
+  return ty->kind == TY_LONG || ty->base;
+}
+
+// Returns `val` as an operand of `width` bytes sees it.
+static int64_t to_width(int64_t val, int width) {
+  return (width == 8) ? val : (int32_t)val;
+}
+
+static uint64_t abs_value(int64_t val, int width) {
+  uint64_t v = (val < 0) ? -(uint64_t)val : val;
+  return (width == 8) ? v : (uint32_t)v;
+}
+
+static bool is_power_of_two(uint64_t v) {
+  return v && !(v & (v - 1));
+}
+
+static int trailing_zeros(uint64_t v) {
+  int k = 0;
+  while (!(v & 1)) {
+    v >>= 1;
+    k++;
+  }
+  return k;
+}
+
+// Returns the 32-bit name of a 64-bit register, %eax for %rax or %r8d
+// for %r8.
+static char* low_half(char* reg) {
+  static char buf[4][8];
+  static int i;
+  char* p = buf[i++ % 4];
+  if (isdigit(reg[2]))
+    sprintf(p, "%sd", reg);
+  else
+    sprintf(p, "%%e%s", reg + 2);
+  return p;
+}
+
+// Returns true if `node` multiplies, divides or takes the remainder by
+// a constant in a way gen_mul_imm() or gen_div_imm() can generate.
+bool can_reduce(Node* node) {
+  if (node->kind != ND_MUL && node->kind != ND_DIV && node->kind != ND_MOD)
+    return false;
+  if (node->rhs->kind != ND_NUM)
+    return false;
+  if (node->kind == ND_MUL)
+    return true;
+
+  // idiv takes the width of its dividend and of its divisor from
+  // different places; they agree for every type there is.
+  int width = (node->lhs->ty->size == 8) ? 8 : 4;
+  if (is_wide(node->lhs->ty) != (width == 8))
+    return false;
+  int64_t d = to_width(node->rhs->val, width);
+  return d != 0 && d != -1;
+}
+
+// reg = reg * c in `width` bytes. Clobbers %rdx.
+void gen_mul_imm(int64_t c, int width, char* reg) {
+  char* r = (width == 8) ? reg : low_half(reg);
+  c = to_width(c, width);
+
+  if (c == 0) {
+    println("  xor %s, %s", low_half(reg), low_half(reg));
+    return;
+  }
+
+  uint64_t m = abs_value(c, width);
+  int k = trailing_zeros(m);
+  uint64_t odd = m >> k;
+
+  if (odd == 1 || odd == 3 || odd == 5 || odd == 9) {
+    if (odd > 1)
+      println("  lea (%s,%s,%d), %s", reg, reg, (int)odd - 1, r);
+    if (k)
+      println("  shl $%d, %s", k, r);
+    if (c == 1 && width == 4)
+      println("  mov %s, %s", r, r);
+    if (c < 0)
+      println("  neg %s", r);
+    return;
+  }
+
+  if (c == (int32_t)c) {
+    println("  imul $%ld, %s, %s", c, r, r);
+    return;
+  }
+  println("  mov $%ld, %%rdx", c);
+  println("  imul %%rdx, %s", reg);
+}
+
+// Computes the magic number `m` and the shift `s` that divide a signed
+// integer of `bits` bits by `d`, where |d| is at least 2 and not a
+// power of two. This is Figure 10-1 of Hacker's Delight, with the
+// arithmetic done in `bits` bits.
+static void magic(int64_t d, int bits, int64_t* m, int* s) {
+  uint64_t mask = (bits == 64) ? UINT64_MAX : ((uint64_t)1 << bits) - 1;
+  uint64_t two = (uint64_t)1 << (bits - 1);
+  uint64_t ad = abs_value(d, bits / 8);
+  uint64_t t = two + (d < 0);
+  uint64_t anc = t - 1 - t % ad;
+  int p = bits - 1;
+  uint64_t q1 = two / anc;
+  uint64_t r1 = two - q1 * anc;
+  uint64_t q2 = two / ad;
+  uint64_t r2 = two - q2 * ad;
+  uint64_t delta;
+
+  do {
+    p++;
+    q1 = (q1 * 2) & mask;
+    r1 = (r1 * 2) & mask;
+    if (r1 >= anc) {
+      q1 = (q1 + 1) & mask;
+      r1 = (r1 - anc) & mask;
+    }
+    q2 = (q2 * 2) & mask;
+    r2 = (r2 * 2) & mask;
+    if (r2 >= ad) {
+      q2 = (q2 + 1) & mask;
+      r2 = (r2 - ad) & mask;
+    }
+    delta = (ad - r2) & mask;
+  } while (q1 < delta || (q1 == delta && r1 == 0));
+
+  uint64_t mag = (q2 + 1) & mask;
+  if (d < 0)
+    mag = -mag & mask;
+  *m = (bits == 64) ? (int64_t)mag : (int32_t)mag;
+  *s = p - bits;
+}
+
+// %rax = %rax / d, or %rax % d if `is_mod`, in `width` bytes.
+// Clobbers %rcx and %rdx.
+void gen_div_imm(int64_t d, int width, bool is_mod) {
+  char* ax = (width == 8) ? "%rax" : "%eax";
+  char* cx = (width == 8) ? "%rcx" : "%ecx";
+  char* dx = (width == 8) ? "%rdx" : "%edx";
+  int bits = width * 8;
+  d = to_width(d, width);
+  uint64_t ad = abs_value(d, width);
+
+  if (ad == 1) {
+    if (is_mod)
+      println("  xor %%eax, %%eax");
+    else if (width == 4)
+      println("  mov %%eax, %%eax");
+    return;
+  }
+
+  if (is_power_of_two(ad)) {
+    // %rdx = x < 0 ? 2^k-1 : 0
+    int k = trailing_zeros(ad);
+    println("  mov %s, %s", ax, dx);
+    if (k > 1)
+      println("  sar $%d, %s", bits - 1, dx);
+    println("  shr $%d, %s", bits - k, dx);
+
+    if (!is_mod) {
+      println("  add %s, %s", dx, ax);
+      println("  sar $%d, %s", k, ax);
+      if (d < 0)
+        println("  neg %s", ax);
+      return;
+    }
+
+    println("  add %s, %s", ax, dx);
+    if (k < 32) {
+      println("  and $%ld, %s", -((int64_t)1 << k), dx);
+    } else {
+      println("  shr $%d, %s", k, dx);
+      println("  shl $%d, %s", k, dx);
+    }
+    println("  sub %s, %s", dx, ax);
+    return;
+  }
+
+  int64_t m;
+  int s;
+  magic(d, bits, &m, &s);
+
+  // %rdx = the high half of x * m
+  println("  mov %s, %s", ax, cx);
+  println("  mov $%ld, %s", m, dx);
+  println("  imul %s", dx);
+  if (d > 0 && m < 0)
+    println("  add %s, %s", cx, dx);
+  if (d < 0 && m > 0)
+    println("  sub %s, %s", cx, dx);
+  if (s)
+    println("  sar $%d, %s", s, dx);
+
+  // Round toward zero.
+  println("  mov %s, %s", dx, ax);
+  println("  shr $%d, %s", bits - 1, ax);
+  println("  add %s, %s", dx, ax);
+
+  if (is_mod) {
+    gen_mul_imm(d, width, "%rax");
+    println("  sub %s, %s", ax, cx);
+    println("  mov %s, %s", cx, ax);
+  }
+}
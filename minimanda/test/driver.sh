@@ -22,4 +22,146 @@ check -o
 ./manda --help 2>&1 | grep -q manda
 check --help
 
+# arity
+echo '(def main() -> int (if 1))' > $tmp/arity.manda
+./manda -o $tmp/out $tmp/arity.manda 2>&1 | grep -q 'wrong number of arguments'
+check arity
+
+# macro expansion growth
+echo '(defmacro TWICE (x) (+ x x))' > $tmp/grow.manda
+echo '(def main() -> int (TWICE (TWICE (TWICE (TWICE (TWICE (TWICE (TWICE (TWICE 1)))))))))' >> $tmp/grow.manda
+./manda -o $tmp/out $tmp/grow.manda 2>&1 | grep -q 'macro expands to'
+check 'expansion warning'
+
+sed -i 's/(x)/((once x))/' $tmp/grow.manda
+! ./manda -o $tmp/out $tmp/grow.manda 2>&1 | grep -q 'macro expands to'
+check 'expansion warning with once'
+
+# compile-time evaluation
+echo '(def main() -> int (let n :int 3) (comptime (+ n 1)))' > $tmp/comptime.manda
+./manda -o $tmp/out $tmp/comptime.manda 2>&1 | grep -q "'n' is not known at compile time"
+check 'comptime of a runtime variable'
+
+echo '(def sq (x int) -> int (* x x)) (def main() -> int (let y :int (sq 9)) y)' > $tmp/fold.manda
+./manda -o $tmp/out $tmp/fold.manda && ! grep -q 'call sq' $tmp/out
+check 'folded let initializer'
+
+echo '(let g :int 2) (def get() -> int g) (def main() -> int (let y :int (get)) y)' > $tmp/fold.manda
+./manda -o $tmp/out $tmp/fold.manda && grep -q 'call get' $tmp/out
+check 'impure call left alone'
+
+for init in a '(do (let t :int 3) t)' '(get)'; do
+    echo "(let a :int 4) (def get() -> int a) (let g :int $init) (def main() -> int g)" > $tmp/init.manda
+    ./manda -o $tmp/out $tmp/init.manda 2>&1 | grep -q 'global initializer is not a constant'
+    check "non-constant global initializer $init"
+done
+
+echo '(let a :[2 int] (comptime (do (let t :[2 int]) (iset t 1 5) t))) (let g :[2 int] a)' > $tmp/init.manda
+./manda -o $tmp/out $tmp/init.manda 2>&1 | grep -q 'global initializer is not a constant'
+check 'global initialized from an array global'
+
+# long chains and deep nesting
+(echo '(def main() -> int (let x :int 1) (- (+'; yes x | head -n 200000; echo ') 200000))') > $tmp/chain.manda
+./manda -o $tmp/out $tmp/chain.manda
+check 'long chain'
+
+(echo '(def main() -> int'; yes '(+ 1' | head -n 20000; yes ')' | head -n 20001) > $tmp/deep.manda
+./manda -o $tmp/out $tmp/deep.manda 2>&1 | grep -q 'nested too deeply'
+check 'deep nesting'
+
+# forms spread over many batches of tokens
+(echo '(defstruct P a int b int) (defmacro ADD (x y) (+ x y))'
+ for i in `seq 3000`; do
+     echo "(def f$i (x int) -> int (let p :P) (set p.a x) (set p.b $i) (ADD p.a p.b))"
+ done
+ echo '(let total :int (f3000 1))'
+ echo '(def main() -> int (assert 3001 total (str total)) (assert 11 (f10 1) (str f10)) 0)') > $tmp/stream.manda
+./manda -o $tmp/stream.s $tmp/stream.manda && cc -o $tmp/stream $tmp/stream.s -xc test/common 2>/dev/null && $tmp/stream > /dev/null
+check 'streaming'
+
+echo '(def main() -> int (undefined-form))) (def f() -> int 0)' > $tmp/fail.manda
+rm -f $tmp/out
+! ./manda -o $tmp/out $tmp/fail.manda 2>/dev/null && [ ! -e $tmp/out ]
+check 'no output on error'
+
+# -O1 keeps locals and temporaries in registers
+echo '(def sum (n int) -> int (let s :int 0) (let i :int 0) (while (< i n) (set s (+ s (* i n))) (set i (+ i 1))) s)' > $tmp/loop.manda
+./manda -O1 -o $tmp/out $tmp/loop.manda && ! grep -q 'push %rax\|(%rbp)' $tmp/out
+check -O1
+
+./manda -O1 -o $tmp/out $tmp/chain.manda
+check '-O1 long chain'
+
+(echo '(def main() -> int (let x :int 1) (if (and'; yes x | head -n 200000; echo ') 1 2))') > $tmp/cond-chain.manda
+./manda -o $tmp/out $tmp/cond-chain.manda && ./manda -O1 -o $tmp/out $tmp/cond-chain.manda
+check 'long condition chain'
+
+# conditions jump on the flags of their comparisons
+echo '(def f (n int) -> int (let i :int 0) (while (and (< i n) (not (= i 7))) (set i (+ i 1))) i)' > $tmp/cond.manda
+./manda --no-peephole -o $tmp/out $tmp/cond.manda && ! grep -q 'set\|movz' $tmp/out && grep -q jge $tmp/out
+check 'compare and branch'
+
+./manda -O1 -o $tmp/out $tmp/cond.manda && ! grep -q 'set\|movz' $tmp/out && grep -q jge $tmp/out
+check 'compare and branch -O1'
+
+# the peephole optimizer cleans up the stack machine's output
+echo '(def f (x int) -> int (+ x 2))' > $tmp/peep.manda
+./manda -o $tmp/out $tmp/peep.manda && ! grep -q 'push %rax\|pop %rdi' $tmp/out && grep -q 'add $2, %eax' $tmp/out
+check peephole
+
+./manda --no-peephole -o $tmp/out $tmp/peep.manda && grep -q 'push %rax' $tmp/out
+check --no-peephole
+
+./manda --peephole-stats -o $tmp/out $tmp/peep.manda 2>&1 | grep -q 'push-pop *1$'
+check --peephole-stats
+
+# constant folding
+echo '(def f () -> int (* 6 7))' > $tmp/const.manda
+./manda -o $tmp/out $tmp/const.manda && grep -q 'mov $42, %rax' $tmp/out && ! grep -q imul $tmp/out
+check 'constant folding'
+
+./manda --no-fold -o $tmp/out $tmp/const.manda && grep -q imul $tmp/out
+check --no-fold
+
+# multiplication and division by constants compute what cc does
+int_consts='1 2 3 5 6 7 8 9 10 12 24 25 36 40 100 641 1000 4096 65536 1000000007 1073741824 2147483647 2147483648'
+long_consts="$int_consts 4294967296 4294967297 1099511627777 6148914691236517205 4611686018427387904 9223372036854775807"
+n=0
+for ty in int long; do
+    [ $ty = int ] && consts=$int_consts || consts=$long_consts
+    for m in 0 $consts; do
+        for sign in + -; do
+            [ $m = 0 ] && [ $sign = - ] && continue
+            if [ $sign = + ]; then
+                c=$m; cc="($ty)${m}UL"
+            elif [ $ty = int ]; then
+                c="(- 0 $m)"; cc="(int)(0-${m}UL)"
+            else
+                c="(- (cast 0 long) $m)"; cc="(long)(0-${m}UL)"
+            fi
+            n=$((n+1))
+            echo "mul$n $ty (* x $c) x * $cc"
+            [ $m = 0 ] || [ "$m$sign" = 1- ] && continue
+            echo "div$n $ty (/ x $c) x / $cc"
+            echo "mod$n $ty (mod x $c) x % $cc"
+        done
+    done
+done > $tmp/ops
+sed 's/^\([a-z0-9]*\) \([a-z]*\) \(.*) \)x .*/(def \1 (x \2) -> \2 \3)/' $tmp/ops > $tmp/arith.manda
+(echo '#include <stdio.h>'
+ sed 's/^\([a-z0-9]*\) \([a-z]*\) .*) \(x .*\)/\2 \1(\2 x); \2 ref_\1(\2 x) { return \3; }/' $tmp/ops
+ echo 'int main() {'
+ echo '  long xs[] = {0, 1, -1, 2, -2, 3, 7, -7, 100, -100, 2147483647, -2147483647-1, 4294967295, 1L<<40, -(1L<<40), 9223372036854775807, -9223372036854775807-1};'
+ echo '  unsigned long r = 1;'
+ echo '  for (int i = 0; i < 2000; i++) {'
+ echo '    long x = i < sizeof(xs) / sizeof(*xs) ? xs[i] : (long)(r = r * 6364136223846793005 + 1442695040888963407) >> (i % 64);'
+ sed 's/^\([a-z0-9]*\) .*/    if (\1(x) != ref_\1(x)) { printf("\1(%ld) is %ld, not %ld\\n", x, (long)\1(x), (long)ref_\1(x)); return 1; }/' $tmp/ops
+ echo '  }'
+ echo '  return 0;'
+ echo '}') > $tmp/ref.c
+for opt in -O0 -O1; do
+    ./manda $opt -o $tmp/arith.s $tmp/arith.manda && cc -fwrapv -o $tmp/arith $tmp/arith.s $tmp/ref.c 2>/dev/null && $tmp/arith
+    check "constant operands $opt"
+done
+
 echo OK
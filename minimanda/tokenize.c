@@ -1,7 +1,5 @@
 #include "manda.h"
 
-// Input string
-static char* current_input;
 static char *current_filename;
 
 // Reports an error and exit.
@@ -13,15 +11,44 @@ void error(char* fmt, ...) {
   exit(1);
 }
 
-// Reports an error location and exit.
-static void verror_at(int line_no, char *loc, char *fmt, va_list ap) {
-  // Find a line containing `loc`.
-  char *line = loc;
-  while (current_input < line && line[-1] != '\n')
-    line--;
+// The line the tokenizer has got to. Every token records its own line
+// and column, so only the current line needs to be known, and the
+// tokens can be used on another thread while the tokenizer goes on.
+static int line_no;
+static char* line_start;
+static char* scanned;
+
+static void init_lines(char* p) {
+  line_no = 1;
+  line_start = scanned = p;
+}
+
+// Advances the current line to the one `end` is on.
+static void scan_lines(char* end) {
+  if (end <= scanned)
+    return;
+  for (char* p = scanned; (p = memchr(p, '\n', end - p)); p++) {
+    line_no++;
+    line_start = p + 1;
+  }
+  scanned = end;
+}
+
+// Reports a message at an error location, which is on line `line_no`
+// at column `col_no`, or 0 for both if it is not in the input. Such a
+// location has no source line, so only the file name is printed.
+static void verror_at(char* loc, int line_no, int col_no, char* fmt, va_list ap) {
+  if (col_no == 0) {
+    fprintf(stderr, "%s: ", current_filename);
+    vfprintf(stderr, fmt, ap);
+    fprintf(stderr, "\n");
+    return;
+  }
 
-  char *end = loc;
-  while (*end != '\n')
+  // Find a line containing `loc`.
+  char* line = loc - col_no + 1;
+  char* end = loc;
+  while (*end && *end != '\n')
     end++;
 
   // Print out the line.
@@ -34,38 +61,43 @@ static void verror_at(int line_no, char *loc, char *fmt, va_list ap) {
   fprintf(stderr, "^ ");
   vfprintf(stderr, fmt, ap);
   fprintf(stderr, "\n");
-  exit(1);
 }
 
-void error_at(char* loc, char* fmt, ...) {
-  int line_no = 1;
-  for (char *p = current_input; p < loc; p++)
-    if (*p == '\n')
-      line_no++;
-
+// Reports an error at a location the tokenizer has not gone past. Only
+// the current line is known, so this is for the tokenizer alone; the
+// passes after it report through error_tok().
+static void error_at(char* loc, char* fmt, ...) {
   va_list ap;
   va_start(ap, fmt);
-  verror_at(line_no, loc, fmt, ap);
+  scan_lines(loc);
+  verror_at(loc, line_no, loc - line_start + 1, fmt, ap);
+  exit(1);
 }
 
 void error_tok(Token* tok, char* fmt, ...) {
   va_list ap;
   va_start(ap, fmt);
-  verror_at(tok->line_no, tok->loc, fmt, ap);
+  verror_at(tok->loc, tok->line_no, tok->col_no, fmt, ap);
+  exit(1);
+}
+
+void warn_tok(Token* tok, char* fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  verror_at(tok->loc, tok->line_no, tok->col_no, fmt, ap);
 }
 
 
 // Ensure that the current token is `s`.
 bool equal(Token* tok, char* s) {
-  return strlen(s) == tok->len &&
-         !strncmp(tok->loc, s, tok->len);
+  return strlen(s) == tok->len && !memcmp(tok->loc, s, tok->len);
 }
 
 // ensure the current token is a list and get a pair of it.
 char* get_pair(Token** rest, Token* tok) {
   if (is_list(tok)) {
     char* pair = tok->kind == TK_LPAREN ? ")" : "]";
-    *rest = tok->next;
+    *rest = tok + 1;
     return pair;
   }
   error_tok(tok, "expected a list");
@@ -75,7 +107,7 @@ char* get_pair(Token** rest, Token* tok) {
 Token* skip(Token* tok, char* s) {
   if (!equal(tok, s))
     error_tok(tok, "expected '%s'", s);
-  return tok->next;
+  return tok + 1;
 }
 
 bool stop_parse(Token* tok) {
@@ -87,39 +119,72 @@ bool is_list(Token* tok) {
 }
 
 
-static bool is_ident1(char c) {
-  return ('a' <= c && c <= 'z') || ('A' <= c && c <= 'Z') || c == '_' || c == '-' 
-      || c == '+' || c == '<' || c == '>' || c == '%' || c == '$';
-}
-
-// Returns true if c is valid as a non-first character of an identifier.
-static bool is_ident2(char c) {
-  return is_ident1(c) || ('0' <= c && c <= '9') || c == '/' || c == '?' 
-      || c == '!' || c == '^' || c == '=';
-}
-
-static bool is_keyword(Token* tok) {
-  static char *kw[] = {"let", "const", "set", "do", "def", "lambda", "if", "iset", "iget", 
-    "while", "asm", "defstruct", "defenum", "match", "deftype", "defmodule", "import", 
-    "export", "async", "defasync", "await", "defmacro", "with", "defunion", "typeof",
-    "true", "false", "pointer",
-  };
-
-  for (int i = 0; i < sizeof(kw) / sizeof(*kw); i++)
-    if (equal(tok, kw[i]))
-      return true;
-  return false;
+// Returns the keyword or primitive spelled by `p`, or KW_NONE.
+//
+// This is a perfect hash done by hand: the length and the first
+// character of a word select at most four candidates, so any token is
+// classified with one jump and a couple of memcmp calls.
+Keyword find_keyword(char* p, int len) {
+#define KEY(n, c) ((n) << 8 | (unsigned char)(c))
+#define K(s, kw) if (!memcmp(p, s, len)) return kw;
+
+  if (len > 10)
+    return KW_NONE;
+
+  switch (KEY(len, *p)) {
+  case KEY(1, '+'): return KW_ADD;
+  case KEY(1, '-'): return KW_SUB;
+  case KEY(1, '*'): return KW_MUL;
+  case KEY(1, '/'): return KW_DIV;
+  case KEY(1, '<'): return KW_LT;
+  case KEY(1, '>'): return KW_GT;
+  case KEY(1, '='): return KW_EQ;
+  case KEY(2, '>'): K(">=", KW_GE) break;
+  case KEY(2, '<'): K("<=", KW_LE) break;
+  case KEY(2, 'd'): K("do", KW_DO) break;
+  case KEY(2, 'i'): K("if", KW_IF) break;
+  case KEY(2, 'o'): K("or", KW_OR) break;
+  case KEY(3, 'a'): K("asm", KW_ASM) K("and", KW_AND) break;
+  case KEY(3, 'd'): K("def", KW_DEF) break;
+  case KEY(3, 'l'): K("let", KW_LET) break;
+  case KEY(3, 'm'): K("mod", KW_MOD) break;
+  case KEY(3, 'n'): K("not", KW_NOT) break;
+  case KEY(3, 'r'): K("rem", KW_REM) break;
+  case KEY(3, 's'): K("set", KW_SET) K("sra", KW_SRA) K("srl", KW_SRL) K("sll", KW_SLL) K("str", KW_STR) break;
+  case KEY(3, 'x'): K("xor", KW_XOR) break;
+  case KEY(4, 'a'): K("addr", KW_ADDR) break;
+  case KEY(4, 'c'): K("cast", KW_CAST) break;
+  case KEY(4, 'i'): K("iget", KW_IGET) K("iset", KW_ISET) break;
+  case KEY(4, 't'): K("true", KW_TRUE) break;
+  case KEY(4, 'w'): K("with", KW_WITH) break;
+  case KEY(5, 'a'): K("async", KW_ASYNC) K("await", KW_AWAIT) break;
+  case KEY(5, 'b'): K("bitor", KW_BITOR) break;
+  case KEY(5, 'c'): K("const", KW_CONST) break;
+  case KEY(5, 'd'): K("deref", KW_DEREF) break;
+  case KEY(5, 'f'): K("false", KW_FALSE) break;
+  case KEY(5, 'm'): K("match", KW_MATCH) break;
+  case KEY(5, 'w'): K("while", KW_WHILE) break;
+  case KEY(6, 'b'): K("bitand", KW_BITAND) K("bitnot", KW_BITNOT) K("bitxor", KW_BITXOR) break;
+  case KEY(6, 'e'): K("export", KW_EXPORT) break;
+  case KEY(6, 'i'): K("import", KW_IMPORT) break;
+  case KEY(6, 'l'): K("lambda", KW_LAMBDA) break;
+  case KEY(6, 's'): K("sizeof", KW_SIZEOF) break;
+  case KEY(6, 't'): K("typeof", KW_TYPEOF) break;
+  case KEY(7, 'd'): K("defenum", KW_DEFENUM) K("deftype", KW_DEFTYPE) break;
+  case KEY(7, 'p'): K("pointer", KW_POINTER) break;
+  case KEY(8, 'c'): K("comptime", KW_COMPTIME) break;
+  case KEY(8, 'd'): K("defasync", KW_DEFASYNC) K("defmacro", KW_DEFMACRO) K("defunion", KW_DEFUNION) break;
+  case KEY(9, 'd'): K("defstruct", KW_DEFSTRUCT) K("defmodule", KW_DEFMODULE) break;
+  case KEY(10, 'm'): K("make-array", KW_MAKE_ARRAY) break;
+  case KEY(10, 's'): K("struct-ref", KW_STRUCT_REF) break;
+  }
+  return KW_NONE;
+#undef K
+#undef KEY
 }
 
 bool is_primitive(Token* tok) {
-  static char *kw[] = {"+", "-", "*", "/", "<", ">", ">=", "<=", "=", "and", "or", 
-    "not", "xor", "sra", "srl", "sll", "bitand", "bitor", "bitnot", "bitxor",
-    "addr", "deref", "iget", "iset", "sizeof", "cast", "mod", "rem", "struct-ref",
-  };
-  for (int i = 0; i < sizeof(kw) / sizeof(*kw); i++)
-    if (equal(tok, kw[i]))
-      return true;
-  return false;
+  return tok->kw >= KW_ADD;
 }
 
 
@@ -130,22 +195,39 @@ static int get_number(Token* tok) {
   return tok->val;
 }
 
-// Create a new token and add it as the next token of `cur`.
-static Token* new_token(TokenKind kind, Token* cur, char* str, int len) {
-  Token* tok = calloc(1, sizeof(Token));
+// Tokens of the batch being tokenized. They are kept in one array, so
+// the token after `tok` is `tok + 1`.
+static Token* tokens;
+static int ntokens;
+static int capacity;
+
+// Appends a new token to `tokens`. The returned pointer is only valid
+// until the next call, since growing the array may move it.
+// The current line is brought up to `str` to get the token's position.
+// Identifiers and punctuators are interned, and those that spell a
+// keyword or a primitive become TK_RESERVED.
+static Token* new_token(TokenKind kind, char* str, int len) {
+  if (ntokens == capacity) {
+    capacity = capacity ? capacity * 2 : 1024;
+    tokens = realloc(tokens, sizeof(Token) * capacity);
+  }
+  Token* tok = &tokens[ntokens++];
+  *tok = (Token){0};
+  scan_lines(str);
   tok->kind = kind;
+  tok->line_no = line_no;
+  tok->col_no = str - line_start + 1;
   tok->loc = str;
   tok->len = len;
-  cur->next = tok;
+  if (kind == TK_IDENT || kind == TK_RESERVED) {
+    tok->sym = intern(str, len);
+    tok->kw = tok->sym->kw;
+    if (tok->kw >= KW_LET)
+      tok->kind = TK_RESERVED;
+  }
   return tok;
 }
 
-static void correct_tokens(Token* tok) {
-  for (Token *t = tok; t->kind != TK_EOF; t = t->next)
-    if (is_keyword(t) || is_primitive(t))
-      t->kind = TK_RESERVED;
-}
-
 
 static int read_escaped_char(char *p) {
   switch (*p) {
@@ -165,18 +247,19 @@ static int read_escaped_char(char *p) {
 // Find a closing double-quote.
 static char *string_literal_end(char *p) {
   char *start = p;
-  for (; *p != '"'; p++) {
-    if (*p == '\0')
+  for (;;) {
+    p = skip_str(p);
+    if (*p == '"')
+      return p;
+    if (*p == '\0' || *++p == '\0')
       error_at(start, "unclosed string literal");
-    if (*p == '\\')
-      p++;
+    p++;
   }
-  return p;
 }
 
-static Token* read_string_literal(Token* cur, char* start) {
+static Token* read_string_literal(char* start) {
   char* end = string_literal_end(start + 1);
-  char* buf = calloc(1, end - start);
+  char* buf = arena_alloc(&lex_arena, end - start);
   int len = 0;
 
   for (char *p = start + 1; p < end;) {
@@ -184,16 +267,19 @@ static Token* read_string_literal(Token* cur, char* start) {
       buf[len++] = read_escaped_char(p + 1);
       p += 2;
     } else {
-      buf[len++] = *p++;
+      char *q = skip_str(p);
+      memcpy(buf + len, p, q - p);
+      len += q - p;
+      p = q;
     }
   }
   buf[len] = '\0';
-  Token* tok = new_token(TK_STR, cur, start, end - start + 1);
+  Token* tok = new_token(TK_STR, start, end - start + 1);
   tok->str = buf;
   return tok;
 }
 
-static Token *read_char_literal(Token *cur, char *start) {
+static Token *read_char_literal(char *start) {
   char* p = start + 1;
   if (*p == '\0')
     error_at(start, "unclosed char literal");
@@ -208,28 +294,12 @@ static Token *read_char_literal(Token *cur, char *start) {
   if (!end)
     error_at(p, "unclosed char literal");
 
-  Token *tok = new_token(TK_NUM, cur, start, end - start + 1);
+  Token *tok = new_token(TK_NUM, start, end - start + 1);
   tok->val = c;
   return tok;
 }
 
-// Initialize line info for all tokens.
-static void add_line_numbers(Token *tok) {
-  char *p = current_input;
-  int n = 1;
-
-  do {
-    if (p == tok->loc) {
-      tok->line_no = n;
-      tok = tok->next;
-    }
-    if (*p == '\n')
-      n++;
-  } while (*p++);
-}
-
-
-static Token* read_int_literal(Token* cur, char* start) {
+static Token* read_int_literal(char* start) {
   char *p = start;
 
   int base = 10;
@@ -248,149 +318,217 @@ static Token* read_int_literal(Token* cur, char* start) {
   if (isalnum(*p))
     error_at(p, "invalid digit");
 
-  Token *tok = new_token(TK_NUM, cur, start, p - start);
+  Token *tok = new_token(TK_NUM, start, p - start);
   tok->val = val;
   return tok;
 }
 
 
-// Tokenize `p` and returns new tokens.
-Token* tokenize(char* filename, char* p) {
+// Ends the current batch with a TK_EOF token at `p` and passes it on.
+static void end_batch(char* p, void (*emit)(Token*, void*), void* arg) {
+  new_token(TK_EOF, p, 0);
+  emit(tokens, arg);
+  tokens = NULL;
+  ntokens = capacity = 0;
+}
+
+// Tokenizes `p` and passes the tokens to `emit` in batches, whose
+// arrays it takes over. Each batch ends with TK_EOF and holds whole
+// top-level forms, at least `batch_size` tokens of them except for the
+// last batch.
+static void tokenize(char* filename, char* p, int batch_size, void (*emit)(Token*, void*), void* arg) {
   current_filename = filename;
-  current_input = p;
-  Token head = {};
-  Token* cur = &head;
+  tokens = NULL;
+  ntokens = capacity = 0;
+  init_lines(p);
+  Token* cur;
+  int depth = 0;
 
   while (*p) {
     // Skip whitespace characters.
     if (isspace(*p)) {
-      p++;
+      p = skip_space(p);
       continue;
     }
 
     // Numeric literal
     if (isdigit(*p)) {
-      cur = read_int_literal(cur, p);
+      cur = read_int_literal(p);
       p += cur->len;
       continue;
     }
 
     // hash literal
     if (*p == '#' && ((*(p+1) == 'b') || *(p+1) == 'x' || *(p+1) == 'o')) {
-      cur = read_int_literal(cur, p);
+      cur = read_int_literal(p);
       p += cur->len;
       continue;
     }
     
     // comment
     if (*p == ';') {
-      while (*p && *p != '\n') p++;
+      p = skip_line(p);
       continue;
     }
 
     // List expression
-    if (*p == '(') {
-      cur = new_token(TK_LPAREN, cur, p++, 1);
-      continue;
-    }
-    
-    if (*p == ')') {
-      cur = new_token(TK_RPAREN, cur, p++, 1);
+    if (*p == '(' || *p == '[') {
+      cur = new_token(*p == '(' ? TK_LPAREN : TK_LBRACKET, p, 1);
+      p++;
+      depth++;
       continue;
     }
 
-    if (*p == '[') {
-      cur = new_token(TK_LBRACKET, cur, p++, 1);
-      continue;
-    }
-    
-    if (*p == ']') {
-      cur = new_token(TK_RBRACKET, cur, p++, 1);
+    if (*p == ')' || *p == ']') {
+      cur = new_token(*p == ')' ? TK_RPAREN : TK_RBRACKET, p, 1);
+      p++;
+      if (depth > 0)
+        depth--;
+      if (depth == 0 && ntokens >= batch_size)
+        end_batch(p, emit, arg);
       continue;
     }
 
     // string
     if (*p == '"') {
-      cur = read_string_literal(cur, p);
+      cur = read_string_literal(p);
       p += cur->len;
       continue;
     }
 
     if (*p == '\'') {
-      cur = read_char_literal(cur, p);
+      cur = read_char_literal(p);
       p += cur->len;
       continue;
     }
 
     // Identifier, some multi-character operators and keywords may be collected as identifier.
-    // function `correct_token` corrects this.
+    // `new_token` reclassifies them.
     if (is_ident1(*p)) {
       char *q = p++;
-      while (is_ident2(*p))
-        p++;
+      p = skip_ident(p);
       if (*p == '*')                                        // need `a *i8`   not `a* i8`
         error("Invalid identifier symbol '*'");
-      cur = new_token(TK_IDENT, cur, q, p - q);
+      cur = new_token(TK_IDENT, q, p - q);
       continue;
     }
 
     // Punctuator, handles single character operation
     if (ispunct(*p)) {
-      cur = new_token(TK_RESERVED, cur, p++, 1);
+      cur = new_token(TK_RESERVED, p++, 1);
       continue;
     }
 
     error("invalid token");
   }
 
-  new_token(TK_EOF, cur, p, 0);
-  correct_tokens(head.next);
-  add_line_numbers(head.next);
-  return head.next;
+  end_batch(p, emit, arg);
 }
 
 
+// Reads everything from `fd` into a malloc'ed buffer. This is the
+// fallback for stdin and other inputs that can't be mapped, e.g. pipes.
+static char *read_stream(int fd, char *path, size_t *len) {
+  size_t buflen = 4096;
+  size_t nread = 0;
+  char *buf = malloc(buflen);
+
+  for (;;) {
+    // extra 2 bytes for the trailing "\n\0"
+    if (buflen - nread < 2 + 4096) {
+      buflen *= 2;
+      buf = realloc(buf, buflen);
+    }
+    ssize_t n = read(fd, buf + nread, buflen - nread - 2);
+    if (n == 0)
+      break;
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      error("cannot read %s: %s", path, strerror(errno));
+    }
+    nread += n;
+  }
+  buf[nread] = buf[nread + 1] = '\0';
+  *len = nread;
+  return buf;
+}
+
+// Maps a regular file of `size` bytes into memory. The mapping is
+// rounded up so that at least two bytes follow the file contents, and
+// those bytes are zero-filled: pages beyond the last page of the file
+// come from an anonymous mapping and the tail of the last file page is
+// zeroed by the kernel. The file pages themselves are read-only.
+static char *map_file(int fd, char *path, size_t size) {
+  size_t pagesize = sysconf(_SC_PAGESIZE);
+  size_t maplen = (size + 2 + pagesize - 1) / pagesize * pagesize;
+
+  char *buf = mmap(NULL, maplen, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (buf == MAP_FAILED)
+    error("cannot map %s: %s", path, strerror(errno));
+
+  if (size > 0 && mmap(buf, size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED)
+    error("cannot map %s: %s", path, strerror(errno));
+  return buf;
+}
+
 // Returns the contents of a given file.
 static char *read_file(char *path) {
-  FILE *fp;
+  int fd;
 
   if (strcmp(path, "-") == 0) {
     // By convention, read from stdin if a given filename is "-".
-    fp = stdin;
+    fd = STDIN_FILENO;
   } else {
-    fp = fopen(path, "r");
-    if (!fp)
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
       error("cannot open %s: %s", path, strerror(errno));
   }
 
-  int buflen = 4096;
-  int nread = 0;
-  char *buf = calloc(1, buflen);
+  struct stat st;
+  if (fstat(fd, &st) < 0)
+    error("cannot stat %s: %s", path, strerror(errno));
 
-  // Read the entire file.
-  for (;;) {
-    int end = buflen - 2; // extra 2 bytes for the trailing "\n\0"
-    int n = fread(buf + nread, 1, end - nread, fp);
-    if (n == 0)
-      break;
-    nread += n;
-    if (nread == end) {
-      buflen *= 2;
-      buf = realloc(buf, buflen);
-    }
+  char *buf;
+  size_t len;
+  bool mapped = fd != STDIN_FILENO && S_ISREG(st.st_mode);
+  if (mapped) {
+    len = st.st_size;
+    buf = map_file(fd, path, len);
+  } else {
+    buf = read_stream(fd, path, &len);
   }
 
-  if (fp != stdin)
-    fclose(fp);
+  if (fd != STDIN_FILENO)
+    close(fd);
 
   // Make sure that the last line is properly terminated with '\n'.
-  if (nread == 0 || buf[nread - 1] != '\n')
-    buf[nread++] = '\n';
-
-  buf[nread] = '\0';
+  // Both readers leave two zero bytes after the contents, so the
+  // terminating '\0' is already in place. If the newline lands in the
+  // last page of a mapped file, that one page becomes a private copy.
+  if (len == 0 || buf[len - 1] != '\n') {
+    if (mapped) {
+      size_t pagesize = sysconf(_SC_PAGESIZE);
+      mprotect(buf + len / pagesize * pagesize, pagesize, PROT_READ | PROT_WRITE);
+    }
+    buf[len++] = '\n';
+  }
   return buf;
 }
 
+static void keep_tokens(Token* tokens, void* arg) {
+  *(Token**)arg = tokens;
+}
+
+// Returns the tokens of a file as a single batch.
 Token *tokenize_file(char *path) {
-  return tokenize(path, read_file(path));
+  Token* tokens;
+  tokenize(path, read_file(path), INT_MAX, keep_tokens, &tokens);
+  return tokens;
+}
+
+// Tokenizes a file in batches, see tokenize().
+void tokenize_file_in_batches(char* path, int batch_size, void (*emit)(Token*, void*), void* arg) {
+  tokenize(path, read_file(path), batch_size, emit, arg);
 }
\ No newline at end of file
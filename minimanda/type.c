@@ -8,37 +8,137 @@ Type* ty_char = &(Type){.kind = TY_CHAR, .size = 1, .align = 1};
 Type* ty_void = &(Type){.kind = TY_VOID, .size = 0, .align = 0};
 
 
+// Pointer and array types are hash-consed: there is one pointer type
+// per base type and one array type per base type and length, kept in
+// an open-addressing table. Two such types are equal exactly when they
+// are the same object.
+static Type** derived;
+static int derived_capacity;
+static int derived_used;
+
+// Structs with at least this many members get a hash index.
+#define MEMBER_INDEX_MIN 8
+
 static Type* new_type(TypeKind kind, int size, int align) {
-  Type* ty = calloc(1, sizeof(Type));
+  Type* ty = arena_alloc(&ast_arena, sizeof(Type));
   ty->kind = kind;
   ty->size = size;
   ty->align = align;
   return ty;
 }
 
+static uint64_t hash_derived(TypeKind kind, Type* base, int len) {
+  uint64_t h = ((uintptr_t)base ^ (uint64_t)len << 32 ^ kind) * 0x9e3779b97f4a7c15;
+  return h ^ (h >> 32);
+}
 
-Type* pointer_to(Type* base) {
-  Type* ty = new_type(TY_PTR, 8, 8);
-  ty->base = base;
-  return ty;
+static void rehash_derived(void) {
+  Type** old = derived;
+  int old_capacity = derived_capacity;
+
+  derived_capacity = derived_capacity ? derived_capacity * 2 : 256;
+  derived = calloc(derived_capacity, sizeof(Type*));
+
+  for (int i = 0; i < old_capacity; i++) {
+    Type* ty = old[i];
+    if (!ty)
+      continue;
+    int j = hash_derived(ty->kind, ty->base, ty->array_len) & (derived_capacity - 1);
+    while (derived[j])
+      j = (j + 1) & (derived_capacity - 1);
+    derived[j] = ty;
+  }
+  free(old);
 }
 
-Type* array_of(Type* base, int len) {
-  Type* ty = new_type(TY_ARRAY, base->size * len, base->align);
+static Type* new_derived(TypeKind kind, Type* base, int len) {
+  Type* ty;
+  if (kind == TY_PTR)
+    ty = new_type(TY_PTR, 8, 8);
+  else
+    ty = new_type(TY_ARRAY, base->size * len, base->align);
   ty->base = base;
   ty->array_len = len;
   return ty;
 }
 
+static Type* derived_type(TypeKind kind, Type* base, int len) {
+  // Keep the load factor under 3/4.
+  if ((derived_used + 1) * 4 > derived_capacity * 3)
+    rehash_derived();
+
+  uint64_t h = hash_derived(kind, base, len);
+  for (int i = h & (derived_capacity - 1);; i = (i + 1) & (derived_capacity - 1)) {
+    Type* ty = derived[i];
+    if (!ty) {
+      derived_used++;
+      return derived[i] = new_derived(kind, base, len);
+    }
+    if (ty->kind == kind && ty->base == base && ty->array_len == len)
+      return ty;
+  }
+}
+
+Type* pointer_to(Type* base) {
+  return derived_type(TY_PTR, base, 0);
+}
+
+Type* array_of(Type* base, int len) {
+  return derived_type(TY_ARRAY, base, len);
+}
+
+// Builds the member index of a wide struct or union. The first member
+// with a given name wins, as it does in a linear scan.
+static void index_members(Type* ty) {
+  int n = 0;
+  for (Member* mem = ty->members; mem; mem = mem->next)
+    n++;
+  if (n < MEMBER_INDEX_MIN)
+    return;
+
+  int capacity = 16;
+  while (capacity < n * 2)
+    capacity *= 2;
+  ty->member_index = arena_alloc(&ast_arena, sizeof(Member*) * capacity);
+  ty->member_mask = capacity - 1;
+
+  for (Member* mem = ty->members; mem; mem = mem->next) {
+    Symbol* name = mem->tok->sym;
+    int i = name->hash & ty->member_mask;
+    while (ty->member_index[i] && ty->member_index[i]->tok->sym != name)
+      i = (i + 1) & ty->member_mask;
+    if (!ty->member_index[i])
+      ty->member_index[i] = mem;
+  }
+}
+
+// Returns the member of `ty` called `name`, or NULL.
+Member* find_member(Type* ty, Symbol* name) {
+  if (!ty->member_index) {
+    for (Member* mem = ty->members; mem; mem = mem->next)
+      if (mem->tok->sym == name)
+        return mem;
+    return NULL;
+  }
+
+  for (int i = name->hash & ty->member_mask;; i = (i + 1) & ty->member_mask) {
+    Member* mem = ty->member_index[i];
+    if (!mem || mem->tok->sym == name)
+      return mem;
+  }
+}
+
 Type* new_struct_type(int size, int align, Member* members) {
   Type* ty = new_type(TY_STRUCT, size, align);
   ty->members = members;
+  index_members(ty);
   return ty;
 }
 
 Type* new_union_type(int size, int align, Member* members) {
   Type* ty = new_type(TY_UNION, size, align);
   ty->members = members;
+  index_members(ty);
   return ty;
 }
 
@@ -51,23 +151,117 @@ static Node* last_expr(Node* node) {
   return cur;
 }
 
-void add_type(Node* node) {
-  if (!node || node->ty)
+// The nodes left to visit by walk_tree(), last first. A node is pushed
+// once to visit its children and again to be left.
+typedef struct {
+  Node* node;
+  bool leave;
+} WalkItem;
+
+static WalkItem* walk_stack;
+static int walk_len;
+static int walk_capacity;
+
+static void walk_push(Node* node, bool leave) {
+  if (!node)
     return;
+  if (walk_len == walk_capacity) {
+    walk_capacity = walk_capacity ? walk_capacity * 2 : 256;
+    walk_stack = realloc(walk_stack, sizeof(WalkItem) * walk_capacity);
+    if (!walk_stack)
+      error("out of memory");
+  }
+  walk_stack[walk_len++] = (WalkItem){node, leave};
+}
 
-  add_type(node->lhs);
-  add_type(node->mhs);
-  add_type(node->rhs);
-  add_type(node->cond);
-  add_type(node->then);
-  add_type(node->els);
+// Pushes the children of `node` so that they are visited in order.
+// Only the fields of the node's own kind may be touched.
+static void push_children(Node* node) {
+  int start = walk_len;
 
-  for (Node* n = node->body; n; n = n->next)
-    add_type(n);
-  for (Node *n = node->args; n; n = n->next)
-    add_type(n);
+  switch (node->kind) {
+  case ND_NUM:
+  case ND_BOOL:
+  case ND_STR:
+  case ND_VAR:
+  case ND_ARRAY_LITERAL:
+  case ND_DEFSTRUCT:
+  case ND_DEFUNION:
+  case ND_DEFTYPE:
+  case ND_DEFMACRO:
+    break;
+  case ND_IF:
+    walk_push(node->cond, false);
+    walk_push(node->then, false);
+    walk_push(node->els, false);
+    break;
+  case ND_WHILE:
+    walk_push(node->cond, false);
+    for (Node* n = node->then; n; n = n->next)
+      walk_push(n, false);
+    break;
+  case ND_DO:
+  case ND_APP:
+  case ND_FUNC:
+    for (Node* n = node->body; n; n = n->next)
+      walk_push(n, false);
+    if (node->kind != ND_DO)
+      for (Node* n = node->args; n; n = n->next)
+        walk_push(n, false);
+    break;
+  case ND_ADDR:
+  case ND_DEREF:
+  case ND_NOT:
+  case ND_BITNOT:
+  case ND_CAST:
+  case ND_STRUCT_REF:
+    walk_push(node->lhs, false);
+    break;
+  case ND_ISET:
+    walk_push(node->mhs, false);
+    // fallthrough
+  default:
+    walk_push(node->lhs, false);
+    walk_push(node->rhs, false);
+  }
+
+  for (int i = start, j = walk_len - 1; i < j; i++, j--) {
+    WalkItem tmp = walk_stack[i];
+    walk_stack[i] = walk_stack[j];
+    walk_stack[j] = tmp;
+  }
+}
+
+// Walks the tree at `node` depth first. enter() is called on a node
+// before its children and leave() after them; if enter() returns false
+// the node's children and leave() are skipped. Either may be NULL.
+//
+// The walk keeps its own stack, so it works on trees of any depth such
+// as the chain of nodes made from an n-ary (+ a b c ...).
+void walk_tree(Node* node, bool (*enter)(Node*, void*), void (*leave)(Node*, void*), void* arg) {
+  int base = walk_len;
+  walk_push(node, false);
+
+  while (walk_len > base) {
+    WalkItem item = walk_stack[--walk_len];
+    if (item.leave) {
+      leave(item.node, arg);
+      continue;
+    }
+    if (enter && !enter(item.node, arg))
+      continue;
+    if (leave)
+      walk_push(item.node, true);
+    push_children(item.node);
+  }
+}
 
+static bool needs_type(Node* node, void* arg) {
+  return !node->ty;
+}
 
+// Sets the type of `node`, whose children have their types.
+static void set_type(Node* node, void* arg) {
   switch (node->kind) {
   case ND_ADD:
   case ND_SUB:
@@ -100,9 +294,6 @@ void add_type(Node* node) {
   case ND_VAR:
     node->ty = node->var->ty;
     return;
-  case ND_STR:
-    node->ty = node->var->ty;
-    return;
   case ND_IGET:
     if (node->lhs->ty->kind != TY_ARRAY) {
       error_tok(node->tok, "not an array\n");
@@ -152,4 +343,8 @@ void add_type(Node* node) {
     return;
   }
   error_tok(node->tok, "can't assign type of kind %d\n", node->kind);
-}
\ No newline at end of file
+}
+
+void add_type(Node* node) {
+  walk_tree(node, needs_type, set_type, NULL);
+}